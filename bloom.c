@@ -0,0 +1,221 @@
+#include "cache.h"
+#include "bloom.h"
+#include "commit.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "string-list.h"
+
+static uint32_t rotate_left(uint32_t value, int32_t count)
+{
+	uint32_t mask = 8 * sizeof(uint32_t) - 1;
+	count &= mask;
+	return ((value << count) | (value >> ((-count) & mask)));
+}
+
+static inline unsigned char get_bitmask(uint32_t pos)
+{
+	return ((unsigned char)1) << (pos & (BITS_PER_WORD - 1));
+}
+
+/*
+ * Calculate the murmur3 32-bit hash value for the given data
+ * using the given seed.
+ * Produces a uniformly distributed hash value.
+ * Not considered to be cryptographically secure.
+ * Implemented as described in https://en.wikipedia.org/wiki/MurmurHash#Algorithm
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	const unsigned char *bytes = (const unsigned char *)data;
+	int i;
+	uint32_t k1 = 0;
+	uint32_t h = seed;
+
+	int len4 = len / sizeof(uint32_t);
+
+	uint32_t k;
+	for (i = 0; i < len4; i++) {
+		uint32_t byte1 = (uint32_t)bytes[4*i];
+		uint32_t byte2 = ((uint32_t)bytes[4*i + 1]) << 8;
+		uint32_t byte3 = ((uint32_t)bytes[4*i + 2]) << 16;
+		uint32_t byte4 = ((uint32_t)bytes[4*i + 3]) << 24;
+		k = byte1 | byte2 | byte3 | byte4;
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		h ^= k;
+		h = rotate_left(h, r2) * m + n;
+	}
+
+	bytes += len4 * sizeof(uint32_t);
+
+	switch (len & (sizeof(uint32_t) - 1)) {
+	case 3:
+		k1 ^= ((uint32_t)bytes[2]) << 16;
+		/*-fallthrough*/
+	case 2:
+		k1 ^= ((uint32_t)bytes[1]) << 8;
+		/*-fallthrough*/
+	case 1:
+		k1 ^= ((uint32_t)bytes[0]);
+		k1 *= c1;
+		k1 = rotate_left(k1, r1);
+		k1 *= c2;
+		h ^= k1;
+		break;
+	}
+
+	h ^= len;
+	h ^= (h >> 16);
+	h *= 0x85ebca6b;
+	h ^= (h >> 13);
+	h *= 0xc2b2ae35;
+	h ^= (h >> 16);
+
+	return h;
+}
+
+void fill_bloom_key(const char *data, size_t len,
+		    struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	int i;
+	const uint32_t seed0 = 0x293ae76f;
+	const uint32_t seed1 = 0x7e646e2c;
+	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
+	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
+
+	ALLOC_ARRAY(key->hashes, settings->num_hashes);
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	free(key->hashes);
+	key->hashes = NULL;
+}
+
+void add_key_to_filter(const struct bloom_key *key,
+		       struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		filter->data[block_pos] |= get_bitmask(hash_mod);
+	}
+}
+
+/*
+ * Add "path" and all of its leading directories to "paths".
+ */
+static void add_path_and_leading_dirs(struct string_list *paths,
+				      const char *path)
+{
+	const char *slash;
+
+	string_list_append(paths, path);
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/'))
+		string_list_append_nodup(paths, xmemdupz(path, slash - path));
+}
+
+int compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+			 const struct bloom_filter_settings *settings)
+{
+	struct diff_options diffopt;
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	int i, ret;
+
+	if (parse_commit(c) || !c->tree)
+		return error("unable to parse commit %s",
+			     oid_to_hex(&c->object.oid));
+	if (c->parents && parse_commit(c->parents->item))
+		return error("unable to parse commit %s",
+			     oid_to_hex(&c->parents->item->object.oid));
+
+	diff_setup(&diffopt);
+	DIFF_OPT_SET(&diffopt, RECURSIVE);
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diffopt);
+
+	if (c->parents)
+		ret = diff_tree_sha1(c->parents->item->tree->object.oid.hash,
+				     c->tree->object.oid.hash, "", &diffopt);
+	else
+		ret = diff_root_tree_sha1(c->tree->object.oid.hash, "",
+					  &diffopt);
+	if (ret < 0) {
+		diff_flush(&diffopt);
+		return error("unable to diff the trees of %s",
+			     oid_to_hex(&c->object.oid));
+	}
+
+	if (diff_queued_diff.nr <= BLOOM_FILTER_MAX_CHANGED_PATHS) {
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			add_path_and_leading_dirs(&paths,
+				diff_queued_diff.queue[i]->two->path);
+		string_list_sort(&paths);
+		string_list_remove_duplicates(&paths, 0);
+
+		filter->len = (paths.nr * settings->bits_per_entry +
+			       BITS_PER_WORD - 1) / BITS_PER_WORD;
+		/*
+		 * A commit that changes nothing still gets a (one-word)
+		 * filter, so that it says "definitely not" for any path.
+		 */
+		if (!filter->len)
+			filter->len = 1;
+		filter->data = xcalloc(filter->len, 1);
+
+		for (i = 0; i < paths.nr; i++) {
+			struct bloom_key key;
+
+			fill_bloom_key(paths.items[i].string,
+				       strlen(paths.items[i].string),
+				       &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	} else {
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xff;
+	}
+
+	diff_flush(&diffopt);
+	string_list_clear(&paths, 0);
+	return 0;
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	if (!mod)
+		return 1;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		if (!(filter->data[block_pos] & get_bitmask(hash_mod)))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,97 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+struct commit;
+
+/*
+ * Changed-path Bloom filters: for each commit, a Bloom filter of the
+ * paths (and their leading directories) that differ between the
+ * commit and its first parent.  They are stored in the commit-graph
+ * file, and let a path-limited revision walk skip the tree diff of
+ * commits that certainly did not touch the path.  See
+ * Documentation/technical/commit-graph-format.txt.
+ */
+struct bloom_filter_settings {
+	/*
+	 * The version of the hashing technique being used.  We
+	 * currently only support version = 1, which is the seeded
+	 * murmur3 hashing technique implemented in bloom.c.
+	 */
+	uint32_t hash_version;
+
+	/*
+	 * The number of times a path is hashed, i.e. the number of
+	 * bit positions that cumulatively determine whether a path is
+	 * present in the Bloom filter.
+	 */
+	uint32_t num_hashes;
+
+	/*
+	 * The minimum number of bits per entry in the Bloom filter.
+	 * If the filter contains 'n' entries, then the filter size is
+	 * the minimum number of 8-bit words that contain n*b bits.
+	 */
+	uint32_t bits_per_entry;
+};
+
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10 }
+#define BITS_PER_WORD 8
+#define BLOOMDATA_CHUNK_HEADER_SIZE (3 * sizeof(uint32_t))
+
+/*
+ * Commits with more changed paths than this get a filter that has all
+ * its bits set, which says "maybe" for any path.
+ */
+#define BLOOM_FILTER_MAX_CHANGED_PATHS 512
+
+/*
+ * A Bloom filter is an array of bits, stored as 8-bit words.  The
+ * data of a filter read from a commit-graph points into the mmapped
+ * file.
+ */
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/*
+ * A path is hashed "num_hashes" times; a key holds these hashes so
+ * that it can be looked up in many filters.
+ */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+/*
+ * Calculate the murmur3 32-bit hash value for the given data using
+ * the given seed.  Produces a uniformly distributed hash value.  Not
+ * considered to be cryptographically secure.
+ */
+extern uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+extern void fill_bloom_key(const char *data, size_t len,
+			   struct bloom_key *key,
+			   const struct bloom_filter_settings *settings);
+extern void clear_bloom_key(struct bloom_key *key);
+
+extern void add_key_to_filter(const struct bloom_key *key,
+			      struct bloom_filter *filter,
+			      const struct bloom_filter_settings *settings);
+
+/*
+ * Compute the filter of the paths changed by "c" with respect to its
+ * first parent (or to the empty tree for a root commit) into a newly
+ * allocated filter->data.  Returns -1 if the trees cannot be read.
+ */
+extern int compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+				const struct bloom_filter_settings *settings);
+
+/*
+ * Returns 0 if the key is definitely not in the filter, and 1 if it
+ * may be (or if the filter is empty, and tells us nothing).
+ */
+extern int bloom_filter_contains(const struct bloom_filter *filter,
+				 const struct bloom_key *key,
+				 const struct bloom_filter_settings *settings);
+
+#endif
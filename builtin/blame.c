@@ -29,6 +29,8 @@
 #include "line-log.h"
 #include "dir.h"
 #include "progress.h"
+#include "tempfile.h"
+#include "thread-utils.h"
 
 static char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
 
@@ -52,6 +54,9 @@ static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
 static int show_progress;
+static int blame_cache;
+static unsigned long blame_cache_limit = 64 * 1024 * 1024;
+static int num_threads;
 
 static struct date_mode blame_date_mode = { DATE_ISO8601 };
 static size_t blame_date_width;
@@ -205,20 +210,58 @@ static void fill_origin_blob(struct diff_options *opt,
 		*file = o->file;
 }
 
+#ifndef NO_PTHREADS
+/*
+ * Looking for lines moved or copied from other blobs is done on
+ * several threads (see for_each_blame_work()).  The work they do is
+ * limited to comparing blobs that are already in memory against the
+ * final image, but they still take and drop references to origins.
+ * Those can only drop to zero in the main thread, as the callers hold
+ * on to all the origins involved for the duration.
+ */
+static int threads_active;
+static pthread_mutex_t blame_mutex;
+
+static inline void blame_lock(void)
+{
+	if (threads_active)
+		pthread_mutex_lock(&blame_mutex);
+}
+
+static inline void blame_unlock(void)
+{
+	if (threads_active)
+		pthread_mutex_unlock(&blame_mutex);
+}
+#else
+#define blame_lock()
+#define blame_unlock()
+#endif
+
 /*
  * Origin is refcounted and usually we keep the blob contents to be
  * reused.
  */
 static inline struct origin *origin_incref(struct origin *o)
 {
-	if (o)
+	if (o) {
+		blame_lock();
 		o->refcnt++;
+		blame_unlock();
+	}
 	return o;
 }
 
 static void origin_decref(struct origin *o)
 {
-	if (o && --o->refcnt <= 0) {
+	int refcnt;
+
+	if (!o)
+		return;
+	blame_lock();
+	refcnt = --o->refcnt;
+	blame_unlock();
+	if (refcnt <= 0) {
 		struct origin *p, *l = NULL;
 		if (o->previous)
 			origin_decref(o->previous);
@@ -1155,6 +1198,116 @@ static struct blame_entry **filter_small(struct scoreboard *sb,
 	return small;
 }
 
+/*
+ * Call fn(data, i) for all i in [0, nr), on several threads if that is
+ * allowed.  The calls must be independent of each other; callers make
+ * the result deterministic by storing it per item, and combining the
+ * items in order afterwards.
+ */
+typedef void (*blame_work_fn)(void *data, int i);
+
+struct blame_work {
+	blame_work_fn fn;
+	void *data;
+	int nr;
+	int next;
+};
+
+#ifndef NO_PTHREADS
+static void *run_blame_work(void *arg)
+{
+	struct blame_work *work = arg;
+
+	for (;;) {
+		int i;
+
+		blame_lock();
+		i = work->next++;
+		blame_unlock();
+		if (i >= work->nr)
+			break;
+		work->fn(work->data, i);
+	}
+	return NULL;
+}
+#endif
+
+static void for_each_blame_work(int nr, blame_work_fn fn, void *data)
+{
+	int i;
+#ifndef NO_PTHREADS
+	struct blame_work work;
+	pthread_t *threads;
+	int nr_threads = num_threads < nr ? num_threads : nr;
+
+	if (nr_threads > 1) {
+		work.fn = fn;
+		work.data = data;
+		work.nr = nr;
+		work.next = 0;
+
+		threads_active = 1;
+		ALLOC_ARRAY(threads, nr_threads - 1);
+		for (i = 0; i < nr_threads - 1; i++) {
+			int err = pthread_create(&threads[i], NULL,
+						 run_blame_work, &work);
+			if (err)
+				die(_("unable to create thread: %s"), strerror(err));
+		}
+		run_blame_work(&work);
+		for (i = 0; i < nr_threads - 1; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+		threads_active = 0;
+		return;
+	}
+#endif
+	for (i = 0; i < nr; i++)
+		fn(data, i);
+}
+
+struct blame_list {
+	struct blame_entry *ent;
+	struct blame_entry split[3];
+};
+
+/*
+ * Count the number of entries the target is suspected for,
+ * and prepare a list of entry and the best split.
+ */
+static struct blame_list *setup_blame_list(struct blame_entry *unblamed,
+					   int *num_ents_p)
+{
+	struct blame_entry *e;
+	int num_ents, i;
+	struct blame_list *blame_list = NULL;
+
+	for (e = unblamed, num_ents = 0; e; e = e->next)
+		num_ents++;
+	if (num_ents) {
+		blame_list = xcalloc(num_ents, sizeof(struct blame_list));
+		for (e = unblamed, i = 0; e; e = e->next)
+			blame_list[i++].ent = e;
+	}
+	*num_ents_p = num_ents;
+	return blame_list;
+}
+
+struct find_move_data {
+	struct scoreboard *sb;
+	struct blame_list *blame_list;
+	struct origin *parent;
+	mmfile_t *file_p;
+};
+
+static void find_move_in_entry(void *data, int i)
+{
+	struct find_move_data *d = data;
+
+	find_copy_in_blob(d->sb, d->blame_list[i].ent, d->parent,
+			  d->blame_list[i].split, d->file_p);
+}
+
 /*
  * See if lines currently target is suspected for can be attributed to
  * parent.
@@ -1165,9 +1318,9 @@ static void find_move_in_parent(struct scoreboard *sb,
 				struct origin *target,
 				struct origin *parent)
 {
-	struct blame_entry *e, split[3];
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	struct find_move_data d;
 	mmfile_t file_p;
 
 	if (!unblamed)
@@ -1177,6 +1330,10 @@ static void find_move_in_parent(struct scoreboard *sb,
 	if (!file_p.ptr)
 		return;
 
+	d.sb = sb;
+	d.parent = parent;
+	d.file_p = &file_p;
+
 	/* At each iteration, unblamed has a NULL-terminated list of
 	 * entries that have not yet been tested for blame.  leftover
 	 * contains the reversed list of entries that have been tested
@@ -1184,10 +1341,15 @@ static void find_move_in_parent(struct scoreboard *sb,
 	 */
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
-		struct blame_entry *next;
-		for (e = unblamed; e; e = next) {
-			next = e->next;
-			find_copy_in_blob(sb, e, parent, split, &file_p);
+		int i, num_ents;
+
+		d.blame_list = setup_blame_list(unblamed, &num_ents);
+		for_each_blame_work(num_ents, find_move_in_entry, &d);
+
+		for (i = 0; i < num_ents; i++) {
+			struct blame_entry *e = d.blame_list[i].ent;
+			struct blame_entry *split = d.blame_list[i].split;
+
 			if (split[1].suspect &&
 			    blame_move_score < ent_score(sb, &split[1])) {
 				split_blame(blamed, &unblamedtail, split, e);
@@ -1197,37 +1359,58 @@ static void find_move_in_parent(struct scoreboard *sb,
 			}
 			decref_split(split);
 		}
+		free(d.blame_list);
 		*unblamedtail = NULL;
 		toosmall = filter_small(sb, toosmall, &unblamed, blame_move_score);
 	} while (unblamed);
 	target->suspects = reverse_blame(leftover, NULL);
 }
 
-struct blame_list {
-	struct blame_entry *ent;
-	struct blame_entry split[3];
-};
-
 /*
- * Count the number of entries the target is suspected for,
- * and prepare a list of entry and the best split.
+ * The candidate paths of find_copy_in_parent() are looked at in
+ * batches; each entry is compared against each candidate of the batch
+ * independently, and the splits are then considered in the order of
+ * the candidates, like they would be if they were compared one by one.
  */
-static struct blame_list *setup_blame_list(struct blame_entry *unblamed,
-					   int *num_ents_p)
+#define COPY_BATCH_SPLITS 16384
+#define COPY_BATCH_BLOBS 16 /* per thread */
+
+struct copy_candidate {
+	struct origin *origin;
+	mmfile_t file;
+};
+
+struct find_copy_data {
+	struct scoreboard *sb;
+	struct blame_list *blame_list;
+	int num_ents;
+	struct copy_candidate *candidates;
+	struct blame_entry (*splits)[3];
+};
+
+static void find_copy_in_candidate(void *data, int i)
 {
-	struct blame_entry *e;
-	int num_ents, i;
-	struct blame_list *blame_list = NULL;
+	struct find_copy_data *d = data;
+	struct copy_candidate *c = &d->candidates[i / d->num_ents];
 
-	for (e = unblamed, num_ents = 0; e; e = e->next)
-		num_ents++;
-	if (num_ents) {
-		blame_list = xcalloc(num_ents, sizeof(struct blame_list));
-		for (e = unblamed, i = 0; e; e = e->next)
-			blame_list[i++].ent = e;
+	find_copy_in_blob(d->sb, d->blame_list[i % d->num_ents].ent,
+			  c->origin, d->splits[i], &c->file);
+}
+
+static void find_copy_in_batch(struct find_copy_data *d, int nr)
+{
+	int i, j;
+
+	for_each_blame_work(nr * d->num_ents, find_copy_in_candidate, d);
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < d->num_ents; j++) {
+			struct blame_entry *this = d->splits[i * d->num_ents + j];
+
+			copy_split_if_better(d->sb, d->blame_list[j].split, this);
+			decref_split(this);
+		}
+		origin_decref(d->candidates[i].origin);
 	}
-	*num_ents_p = num_ents;
-	return blame_list;
 }
 
 /*
@@ -1245,10 +1428,9 @@ static void find_copy_in_parent(struct scoreboard *sb,
 {
 	struct diff_options diff_opts;
 	int i, j;
-	struct blame_list *blame_list;
-	int num_ents;
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	struct find_copy_data d;
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -1281,15 +1463,28 @@ static void find_copy_in_parent(struct scoreboard *sb,
 	if (!DIFF_OPT_TST(&diff_opts, FIND_COPIES_HARDER))
 		diffcore_std(&diff_opts);
 
+	d.sb = sb;
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
-		blame_list = setup_blame_list(unblamed, &num_ents);
+		int batch, nr = 0;
+
+		d.blame_list = setup_blame_list(unblamed, &d.num_ents);
+
+		/* one candidate at a time unless it is worth it */
+		batch = 1;
+		if (num_threads > 1) {
+			batch = COPY_BATCH_SPLITS / d.num_ents;
+			if (batch > COPY_BATCH_BLOBS * num_threads)
+				batch = COPY_BATCH_BLOBS * num_threads;
+			if (batch < 1)
+				batch = 1;
+		}
+		ALLOC_ARRAY(d.candidates, batch);
+		ALLOC_ARRAY(d.splits, batch * d.num_ents);
 
 		for (i = 0; i < diff_queued_diff.nr; i++) {
 			struct diff_filepair *p = diff_queued_diff.queue[i];
-			struct origin *norigin;
-			mmfile_t file_p;
-			struct blame_entry this[3];
+			struct copy_candidate *c = &d.candidates[nr];
 
 			if (!DIFF_FILE_VALID(p->one))
 				continue; /* does not exist in parent */
@@ -1299,36 +1494,35 @@ static void find_copy_in_parent(struct scoreboard *sb,
 				/* find_move already dealt with this path */
 				continue;
 
-			norigin = get_origin(sb, parent, p->one->path);
-			oidcpy(&norigin->blob_oid, &p->one->oid);
-			norigin->mode = p->one->mode;
-			fill_origin_blob(&sb->revs->diffopt, norigin, &file_p);
-			if (!file_p.ptr)
+			c->origin = get_origin(sb, parent, p->one->path);
+			oidcpy(&c->origin->blob_oid, &p->one->oid);
+			c->origin->mode = p->one->mode;
+			fill_origin_blob(&sb->revs->diffopt, c->origin, &c->file);
+			if (!c->file.ptr)
 				continue;
 
-			for (j = 0; j < num_ents; j++) {
-				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, this, &file_p);
-				copy_split_if_better(sb, blame_list[j].split,
-						     this);
-				decref_split(this);
+			if (++nr == batch) {
+				find_copy_in_batch(&d, nr);
+				nr = 0;
 			}
-			origin_decref(norigin);
 		}
+		find_copy_in_batch(&d, nr);
+		free(d.candidates);
+		free(d.splits);
 
-		for (j = 0; j < num_ents; j++) {
-			struct blame_entry *split = blame_list[j].split;
+		for (j = 0; j < d.num_ents; j++) {
+			struct blame_entry *split = d.blame_list[j].split;
 			if (split[1].suspect &&
 			    blame_copy_score < ent_score(sb, &split[1])) {
 				split_blame(blamed, &unblamedtail, split,
-					    blame_list[j].ent);
+					    d.blame_list[j].ent);
 			} else {
-				blame_list[j].ent->next = leftover;
-				leftover = blame_list[j].ent;
+				d.blame_list[j].ent->next = leftover;
+				leftover = d.blame_list[j].ent;
 			}
 			decref_split(split);
 		}
-		free(blame_list);
+		free(d.blame_list);
 		*unblamedtail = NULL;
 		toosmall = filter_small(sb, toosmall, &unblamed, blame_copy_score);
 	} while (unblamed);
@@ -1763,6 +1957,497 @@ static void found_guilty_entry(struct blame_entry *ent,
 	display_progress(pi->progress, pi->blamed_lines);
 }
 
+/*
+ * The blame cache (blame.cache) keeps the final result of blaming a
+ * <commit, path> pair in $GIT_DIR/blame-cache.  When digging down the
+ * history reaches an origin that is in the cache, all the lines that
+ * are still suspected on it are blamed according to the cached result,
+ * and the commits behind it do not have to be looked at again.
+ *
+ * This relies on the lines of an origin being blamed independently of
+ * each other, so that blaming some of them gives the same result as
+ * blaming the whole file; that is not true of -M and -C, which are
+ * therefore never used with the cache.
+ *
+ * A cache file is made of a header (signature, version, number of lines
+ * in the file, number of suspects and of ranges), the suspects (their
+ * commit and previous commit, the latter null if there is none, then
+ * their path and previous path, NUL terminated), the ranges of lines
+ * blamed on the same suspect in file order (number of lines, suspect
+ * and line number in the suspect), and a SHA-1 of all of the above.
+ * Numbers are 32-bit in network byte order.
+ *
+ * Using a cache file touches it, and once the files take more than
+ * blame.cacheLimit bytes, writing a new one removes the least recently
+ * used ones.
+ */
+#define BLAME_CACHE_SIGNATURE 0x424c4d43 /* "BLMC" */
+#define BLAME_CACHE_VERSION 1
+
+/* options that affect the result, part of the name of cache files */
+static struct strbuf blame_cache_opts = STRBUF_INIT;
+
+struct blame_cache_suspect {
+	const unsigned char *commit;
+	const unsigned char *previous;
+	const char *path;
+	const char *previous_path;
+	struct origin *origin;
+};
+
+struct blame_cache_range {
+	int start;
+	int num_lines;
+	int s_lno;
+	struct blame_cache_suspect *suspect;
+};
+
+struct blame_cache {
+	struct strbuf buf;
+	int num_lines;
+	int nr_suspects;
+	struct blame_cache_suspect *suspects;
+	int nr_ranges;
+	struct blame_cache_range *ranges;
+};
+
+static void blame_cache_path(struct strbuf *path,
+			     struct commit *commit, const char *file)
+{
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	const char *hex;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, blame_cache_opts.buf, blame_cache_opts.len + 1);
+	git_SHA1_Update(&ctx, commit->object.oid.hash, GIT_SHA1_RAWSZ);
+	git_SHA1_Update(&ctx, file, strlen(file) + 1);
+	git_SHA1_Final(sha1, &ctx);
+
+	hex = sha1_to_hex(sha1);
+	strbuf_reset(path);
+	strbuf_git_common_path(path, "blame-cache/%.2s/%s", hex, hex + 2);
+}
+
+static int has_replace_ref(const char *refname, const struct object_id *oid,
+			   int flags, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * Can results be taken from and put into the cache for this blame?
+ * Anything that changes which commits are dug through (or how) does
+ * not go together with it.
+ */
+static int blame_cache_usable(struct rev_info *revs, const char *path,
+			      int opt, const char *revs_file)
+{
+	struct userdiff_driver *driver;
+	int i;
+
+	if (reverse || opt || revs_file || revs->max_age != -1)
+		return 0;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 0;
+	if (is_repository_shallow() || file_exists(get_graft_file()))
+		return 0;
+	if (check_replace_refs && for_each_replace_ref(has_replace_ref, NULL))
+		return 0;
+	if (DIFF_OPT_TST(&revs->diffopt, ALLOW_TEXTCONV) &&
+	    (driver = userdiff_find_by_path(path)) && driver->textconv)
+		return 0;
+
+	strbuf_addf(&blame_cache_opts,
+		    "blame-cache %d xdl=%d first-parent=%d no-follow=%d",
+		    BLAME_CACHE_VERSION, xdl_opts,
+		    revs->first_parent_only, no_whole_file_rename);
+	return 1;
+}
+
+static const char *parse_blame_cache_string(const char **p, const char *end)
+{
+	const char *str = *p;
+	const char *nul = memchr(str, '\0', end - str);
+
+	if (!nul)
+		return NULL;
+	*p = nul + 1;
+	return str;
+}
+
+static void release_blame_cache(struct blame_cache *bc)
+{
+	int i;
+
+	for (i = 0; bc->suspects && i < bc->nr_suspects; i++)
+		origin_decref(bc->suspects[i].origin);
+	free(bc->suspects);
+	free(bc->ranges);
+	strbuf_release(&bc->buf);
+}
+
+/*
+ * Read the cached result for "origin", if there is one.  Anything that
+ * does not look right is silently taken as a miss.
+ */
+static int read_blame_cache(struct blame_cache *bc, struct origin *origin)
+{
+	struct strbuf path = STRBUF_INIT;
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	const unsigned char *header;
+	const char *p, *end;
+	int i, lno;
+
+	memset(bc, 0, sizeof(*bc));
+	strbuf_init(&bc->buf, 0);
+	blame_cache_path(&path, origin->commit, origin->path);
+	if (strbuf_read_file(&bc->buf, path.buf, 0) < 0)
+		goto fail;
+	if (bc->buf.len < 5 * 4 + GIT_SHA1_RAWSZ)
+		goto fail;
+	end = bc->buf.buf + bc->buf.len - GIT_SHA1_RAWSZ;
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, bc->buf.buf, end - bc->buf.buf);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, (const unsigned char *)end))
+		goto fail;
+
+	header = (const unsigned char *)bc->buf.buf;
+	if (get_be32(header) != BLAME_CACHE_SIGNATURE ||
+	    get_be32(header + 4) != BLAME_CACHE_VERSION)
+		goto fail;
+	bc->num_lines = get_be32(header + 8);
+	bc->nr_suspects = get_be32(header + 12);
+	bc->nr_ranges = get_be32(header + 16);
+	if (bc->num_lines < 0 || bc->nr_suspects < 0 || bc->nr_ranges < 0)
+		goto fail;
+
+	p = bc->buf.buf + 5 * 4;
+	if (bc->nr_suspects > (end - p) / (2 * GIT_SHA1_RAWSZ + 2))
+		goto fail;
+	bc->suspects = xcalloc(bc->nr_suspects, sizeof(*bc->suspects));
+	for (i = 0; i < bc->nr_suspects; i++) {
+		struct blame_cache_suspect *s = &bc->suspects[i];
+
+		if (end - p < 2 * GIT_SHA1_RAWSZ)
+			goto fail;
+		s->commit = (const unsigned char *)p;
+		s->previous = (const unsigned char *)p + GIT_SHA1_RAWSZ;
+		p += 2 * GIT_SHA1_RAWSZ;
+		if (!(s->path = parse_blame_cache_string(&p, end)) ||
+		    !(s->previous_path = parse_blame_cache_string(&p, end)))
+			goto fail;
+	}
+
+	if ((end - p) / 12 != bc->nr_ranges || (end - p) % 12)
+		goto fail;
+	bc->ranges = xcalloc(bc->nr_ranges, sizeof(*bc->ranges));
+	for (i = lno = 0; i < bc->nr_ranges; i++, p += 12) {
+		struct blame_cache_range *r = &bc->ranges[i];
+		uint32_t suspect = get_be32(p + 4);
+
+		r->start = lno;
+		r->num_lines = get_be32(p);
+		r->s_lno = get_be32(p + 8);
+		if (r->num_lines <= 0 || r->num_lines > bc->num_lines - lno ||
+		    r->s_lno < 0 || suspect >= bc->nr_suspects)
+			goto fail;
+		r->suspect = &bc->suspects[suspect];
+		lno += r->num_lines;
+	}
+	if (lno != bc->num_lines)
+		goto fail;
+
+	/* mark it as recently used */
+	utime(path.buf, NULL);
+	strbuf_release(&path);
+	return 0;
+
+fail:
+	strbuf_release(&path);
+	release_blame_cache(bc);
+	return -1;
+}
+
+/* The origin blamed for "s", made the first time it is needed. */
+static struct origin *blame_cache_origin(struct scoreboard *sb,
+					 struct blame_cache_suspect *s)
+{
+	struct commit *commit;
+
+	if (s->origin)
+		return s->origin;
+
+	commit = lookup_commit(s->commit);
+	if (!commit || parse_commit(commit))
+		die(_("blame cache refers to a bad commit %s"),
+		    sha1_to_hex(s->commit));
+	s->origin = get_origin(sb, commit, s->path);
+	if (fill_blob_sha1_and_mode(s->origin))
+		die(_("blame cache refers to a bad path %s in %s"),
+		    s->path, sha1_to_hex(s->commit));
+	if (!is_null_sha1(s->previous) && !s->origin->previous) {
+		struct commit *previous = lookup_commit(s->previous);
+
+		if (!previous)
+			die(_("blame cache refers to a bad commit %s"),
+			    sha1_to_hex(s->previous));
+		s->origin->previous = get_origin(sb, previous,
+						 s->previous_path);
+		if (parse_commit(previous) ||
+		    fill_blob_sha1_and_mode(s->origin->previous))
+			die(_("blame cache refers to a bad path %s in %s"),
+			    s->previous_path, sha1_to_hex(s->previous));
+	}
+	/* as if the commit had been dug through; see assign_blame() */
+	if (!commit->parents && !show_root)
+		commit->object.flags |= UNINTERESTING;
+	return s->origin;
+}
+
+static struct blame_cache_range *find_blame_cache_range(struct blame_cache *bc,
+							int lno)
+{
+	int lo = 0, hi = bc->nr_ranges;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		struct blame_cache_range *r = &bc->ranges[mi];
+
+		if (lno < r->start)
+			hi = mi;
+		else if (lno >= r->start + r->num_lines)
+			lo = mi + 1;
+		else
+			return r;
+	}
+	return NULL;
+}
+
+/*
+ * If the result for "origin" is in the cache, blame all the lines it
+ * is suspected for accordingly, and return 1.
+ */
+static int blame_from_cache(struct scoreboard *sb, struct origin *origin,
+			    struct progress_info *pi)
+{
+	struct blame_cache bc;
+	struct blame_entry *e, *next;
+
+	if (is_null_oid(&origin->commit->object.oid) ||
+	    read_blame_cache(&bc, origin))
+		return 0;
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > bc.num_lines) {
+			release_blame_cache(&bc);
+			return 0;
+		}
+
+	for (e = origin->suspects; e; e = next) {
+		struct blame_cache_range *r = find_blame_cache_range(&bc, e->s_lno);
+		int lno = e->lno, s_lno = e->s_lno, left = e->num_lines;
+
+		while (left) {
+			struct blame_entry *ent = xcalloc(1, sizeof(*ent));
+			int skip = s_lno - r->start;
+
+			ent->lno = lno;
+			ent->num_lines = r->num_lines - skip;
+			if (ent->num_lines > left)
+				ent->num_lines = left;
+			ent->suspect = origin_incref(blame_cache_origin(sb, r->suspect));
+			ent->s_lno = r->s_lno + skip;
+			ent->suspect->guilty = 1;
+			found_guilty_entry(ent, pi);
+			ent->next = sb->ent;
+			sb->ent = ent;
+
+			lno += ent->num_lines;
+			s_lno += ent->num_lines;
+			left -= ent->num_lines;
+			r++;
+		}
+		next = e->next;
+		origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+
+	release_blame_cache(&bc);
+	return 1;
+}
+
+struct blame_cache_entry {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+struct blame_cache_entries {
+	struct blame_cache_entry *entry;
+	int nr, alloc;
+	off_t total;
+};
+
+static int collect_blame_cache_entry(const struct object_id *oid,
+				     const char *path, void *data)
+{
+	struct blame_cache_entries *entries = data;
+	struct blame_cache_entry *e;
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return 0;
+	ALLOC_GROW(entries->entry, entries->nr + 1, entries->alloc);
+	e = &entries->entry[entries->nr++];
+	e->path = xstrdup(path);
+	e->mtime = st.st_mtime;
+	e->size = st.st_size;
+	entries->total += st.st_size;
+	return 0;
+}
+
+static int blame_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct blame_cache_entry *a = va, *b = vb;
+
+	if (a->mtime < b->mtime)
+		return -1;
+	return a->mtime > b->mtime;
+}
+
+/* Remove the least recently used files until the cache fits. */
+static void prune_blame_cache(void)
+{
+	struct blame_cache_entries entries = { NULL, 0, 0, 0 };
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+	if (!blame_cache_limit)
+		return;
+
+	/* cache files are named like loose objects */
+	strbuf_git_common_path(&path, "blame-cache");
+	for_each_loose_file_in_objdir_buf(&path, collect_blame_cache_entry,
+					  NULL, NULL, &entries);
+
+	QSORT(entries.entry, entries.nr, blame_cache_entry_cmp);
+	for (i = 0; i < entries.nr; i++) {
+		if (entries.total > blame_cache_limit &&
+		    !unlink(entries.entry[i].path))
+			entries.total -= entries.entry[i].size;
+		free(entries.entry[i].path);
+	}
+	free(entries.entry);
+	strbuf_release(&path);
+}
+
+/*
+ * Store the result of blaming the whole of the final image, found in
+ * sb->ent once sorted and coalesced.  Failures are not worth telling
+ * the user about.
+ */
+static void write_blame_cache(struct scoreboard *sb)
+{
+	static struct tempfile blame_cache_tempfile;
+	struct strbuf path = STRBUF_INIT, buf = STRBUF_INIT;
+	struct origin **suspects = NULL;
+	int nr_suspects = 0, alloc_suspects = 0;
+	int *suspect_of_range;
+	struct blame_entry *ent;
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	char *slash;
+	int i, n, lno = 0, nr_ranges = 0;
+
+	for (ent = sb->ent; ent; ent = ent->next) {
+		if (ent->lno != lno)
+			return; /* only some lines were blamed */
+		lno += ent->num_lines;
+		nr_ranges++;
+	}
+	if (lno != sb->num_lines)
+		return;
+
+	blame_cache_path(&path, sb->final, sb->path);
+	if (file_exists(path.buf))
+		goto out;
+
+	strbuf_grow(&buf, 5 * 4 + 12 * nr_ranges);
+	strbuf_setlen(&buf, 5 * 4);
+	put_be32(buf.buf, BLAME_CACHE_SIGNATURE);
+	put_be32(buf.buf + 4, BLAME_CACHE_VERSION);
+	put_be32(buf.buf + 8, sb->num_lines);
+	put_be32(buf.buf + 16, nr_ranges);
+
+	/* number the suspects in the order they first appear in */
+	ALLOC_ARRAY(suspect_of_range, nr_ranges);
+	for (ent = sb->ent, n = 0; ent; ent = ent->next, n++) {
+		struct origin *o = ent->suspect;
+
+		for (i = nr_suspects - 1; i >= 0; i--)
+			if (suspects[i] == o)
+				break;
+		if (i < 0) {
+			ALLOC_GROW(suspects, nr_suspects + 1, alloc_suspects);
+			i = nr_suspects++;
+			suspects[i] = o;
+			strbuf_add(&buf, o->commit->object.oid.hash, GIT_SHA1_RAWSZ);
+			if (o->previous)
+				strbuf_add(&buf, o->previous->commit->object.oid.hash,
+					   GIT_SHA1_RAWSZ);
+			else
+				strbuf_add(&buf, null_sha1, GIT_SHA1_RAWSZ);
+			strbuf_add(&buf, o->path, strlen(o->path) + 1);
+			if (o->previous)
+				strbuf_add(&buf, o->previous->path,
+					   strlen(o->previous->path) + 1);
+			else
+				strbuf_addch(&buf, '\0');
+		}
+		suspect_of_range[n] = i;
+	}
+	put_be32(buf.buf + 12, nr_suspects);
+
+	for (ent = sb->ent, n = 0; ent; ent = ent->next, n++) {
+		unsigned char range[12];
+
+		put_be32(range, ent->num_lines);
+		put_be32(range + 4, suspect_of_range[n]);
+		put_be32(range + 8, ent->s_lno);
+		strbuf_add(&buf, range, sizeof(range));
+	}
+	free(suspect_of_range);
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, buf.buf, buf.len);
+	git_SHA1_Final(sha1, &ctx);
+	strbuf_add(&buf, sha1, sizeof(sha1));
+
+	if (safe_create_leading_directories(path.buf) < 0)
+		goto out;
+	slash = strrchr(path.buf, '/');
+	strbuf_setlen(&path, slash - path.buf);
+	strbuf_addstr(&path, "/tmp_XXXXXX");
+	if (mks_tempfile_m(&blame_cache_tempfile, path.buf, 0444) < 0)
+		goto out;
+	if (write_in_full(blame_cache_tempfile.fd, buf.buf, buf.len) < 0) {
+		delete_tempfile(&blame_cache_tempfile);
+		goto out;
+	}
+	blame_cache_path(&path, sb->final, sb->path);
+	if (!rename_tempfile(&blame_cache_tempfile, path.buf))
+		prune_blame_cache();
+
+out:
+	free(suspects);
+	strbuf_release(&buf);
+	strbuf_release(&path);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -1798,7 +2483,9 @@ static void assign_blame(struct scoreboard *sb, int opt)
 		 */
 		origin_incref(suspect);
 		parse_commit(commit);
-		if (reverse ||
+		if (blame_cache && blame_from_cache(sb, suspect, &pi))
+			; /* nothing left to dig for */
+		else if (reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
 		     !(revs->max_age != -1 && commit->date < revs->max_age)))
 			pass_blame(sb, suspect, opt);
@@ -2209,6 +2896,21 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 			*output_option &= ~OUTPUT_SHOW_EMAIL;
 		return 0;
 	}
+	if (!strcmp(var, "blame.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+		return 0;
+	}
+	if (!strcmp(var, "blame.cache")) {
+		blame_cache = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "blame.cachelimit")) {
+		blame_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.date")) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -2601,6 +3303,8 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 		{ OPTION_CALLBACK, 'M', NULL, &opt, N_("score"), N_("Find line movements within and across files"), PARSE_OPT_OPTARG, blame_move_callback },
 		OPT_STRING_LIST('L', NULL, &range_list, N_("n,m"), N_("Process only line range n,m, counting from 1")),
 		OPT__ABBREV(&abbrev),
+		OPT_INTEGER(0, "threads", &num_threads,
+			N_("use <n> threads to find moved and copied lines")),
 		OPT_END()
 	};
 
@@ -2709,6 +3413,17 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 		opt |= (PICKAXE_BLAME_COPY | PICKAXE_BLAME_MOVE |
 			PICKAXE_BLAME_COPY_HARDER);
 
+#ifndef NO_PTHREADS
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
+	else if (!num_threads)
+		num_threads = online_cpus();
+	if (num_threads > 1)
+		pthread_mutex_init(&blame_mutex, NULL);
+#else
+	num_threads = 1;
+#endif
+
 	if (!blame_move_score)
 		blame_move_score = BLAME_DEFAULT_MOVE_SCORE;
 	if (!blame_copy_score)
@@ -2796,6 +3511,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	else if (contents_from)
 		die(_("cannot use --contents with final commit object name"));
 
+	if (blame_cache && !blame_cache_usable(&revs, path, opt, revs_file))
+		blame_cache = 0;
+
 	if (reverse && revs.first_parent_only) {
 		final_commit = find_single_final(sb.revs, NULL);
 		if (!final_commit)
@@ -2921,6 +3639,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	coalesce(&sb);
 
+	if (blame_cache && !is_null_oid(&sb.final->object.oid))
+		write_blame_cache(&sb);
+
 	if (!(output_option & OUTPUT_PORCELAIN))
 		find_alignment(&sb, &output_option);
 
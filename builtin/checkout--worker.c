@@ -0,0 +1,190 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "parse-options.h"
+#include "pkt-line.h"
+#include "streaming.h"
+
+static const char * const checkout_worker_usage[] = {
+	N_("git checkout--worker"),
+	NULL
+};
+
+struct worker_item {
+	struct pc_item_fixed_portion fixed;
+	char *name;
+};
+
+static int open_item(struct worker_item *item)
+{
+	return open(item->name, O_WRONLY | O_CREAT | O_EXCL,
+		    (item->fixed.ce_mode & 0100) ? 0777 : 0666);
+}
+
+static int close_and_stat(struct worker_item *item, int fd, struct stat *st)
+{
+	int ret;
+
+	if (fstat_is_reliable())
+		fstat(fd, st);
+	ret = close(fd);
+	if (!fstat_is_reliable())
+		lstat(item->name, st);
+	return ret;
+}
+
+static enum pc_item_status open_failed(struct worker_item *item)
+{
+	/*
+	 * Somebody else (most likely another worker, writing a path that
+	 * is the same as ours on a case-insensitive file system) got there
+	 * first; let the main process sort it out.
+	 */
+	if (errno == EEXIST)
+		return PC_ITEM_COLLIDED;
+	error_errno("unable to create file %s", item->name);
+	return PC_ITEM_FAILED;
+}
+
+/*
+ * Like streaming_write_entry().  Returns -1 if the item cannot be
+ * streamed and has to be written from memory, or the status to report.
+ */
+static int stream_item(struct worker_item *item, const struct conv_attrs *ca,
+		       struct stat *st)
+{
+	struct stream_filter *filter;
+	struct object_id oid;
+	int fd, result;
+
+	filter = get_stream_filter_ca(ca, item->fixed.sha1);
+	if (!filter)
+		return -1;
+
+	fd = open_item(item);
+	if (fd < 0) {
+		free_stream_filter(filter);
+		return open_failed(item);
+	}
+	hashcpy(oid.hash, item->fixed.sha1);
+	result = stream_blob_to_fd(fd, &oid, filter, 1);
+	result |= close_and_stat(item, fd, st);
+	if (result) {
+		unlink(item->name);
+		return -1;
+	}
+	return PC_ITEM_WRITTEN;
+}
+
+static enum pc_item_status write_item(struct worker_item *item, struct stat *st)
+{
+	struct conv_attrs ca;
+	enum object_type type;
+	unsigned long size;
+	size_t newsize;
+	struct strbuf buf = STRBUF_INIT;
+	const char *path = item->name;
+	char *new;
+	int fd, ret;
+	size_t wrote;
+
+	memset(&ca, 0, sizeof(ca));
+	ca.attr_action = ca.crlf_action = item->fixed.crlf_action;
+	ca.ident = item->fixed.ident;
+
+	ret = stream_item(item, &ca, st);
+	if (ret >= 0)
+		return ret;
+
+	new = read_sha1_file(item->fixed.sha1, &type, &size);
+	if (!new || type != OBJ_BLOB) {
+		free(new);
+		error("unable to read sha1 file of %s (%s)",
+		      path, sha1_to_hex(item->fixed.sha1));
+		return PC_ITEM_FAILED;
+	}
+
+	if (convert_to_working_tree_ca(&ca, path, new, size, &buf)) {
+		free(new);
+		new = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	fd = open_item(item);
+	if (fd < 0) {
+		free(new);
+		return open_failed(item);
+	}
+
+	wrote = write_in_full(fd, new, size);
+	close_and_stat(item, fd, st);
+	free(new);
+	if (wrote != size) {
+		error("unable to write file %s", path);
+		return PC_ITEM_FAILED;
+	}
+	return PC_ITEM_WRITTEN;
+}
+
+/*
+ * Read the next batch of items.  Returns 0 when the main process has
+ * closed our input and there is nothing more to do.
+ */
+static size_t read_batch(struct worker_item **items, size_t *alloc)
+{
+	static char buf[LARGE_PACKET_MAX];
+	size_t nr = 0;
+	int len;
+
+	while ((len = packet_read(0, NULL, NULL, buf, sizeof(buf),
+				  PACKET_READ_GENTLE_ON_EOF)) > 0) {
+		struct worker_item *item;
+
+		ALLOC_GROW(*items, nr + 1, *alloc);
+		item = &(*items)[nr++];
+		if (len < sizeof(item->fixed))
+			die("BUG: checkout worker got a truncated item");
+		memcpy(&item->fixed, buf, sizeof(item->fixed));
+		if (len != sizeof(item->fixed) + item->fixed.name_len)
+			die("BUG: checkout worker got a malformed item");
+		item->name = xmemdupz(buf + sizeof(item->fixed),
+				      item->fixed.name_len);
+	}
+	if (len < 0 && nr)
+		die("checkout worker: unexpected end of input");
+	return nr;
+}
+
+int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
+{
+	struct worker_item *items = NULL;
+	size_t nr, alloc = 0, i;
+	struct option options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(checkout_worker_usage, options);
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     checkout_worker_usage, 0);
+	if (argc)
+		usage_with_options(checkout_worker_usage, options);
+
+	while ((nr = read_batch(&items, &alloc))) {
+		for (i = 0; i < nr; i++) {
+			struct pc_item_result res;
+
+			memset(&res, 0, sizeof(res));
+			res.id = items[i].fixed.id;
+			res.status = write_item(&items[i], &res.st);
+			packet_write(1, (const char *)&res, sizeof(res));
+			free(items[i].name);
+		}
+		packet_flush(1);
+	}
+
+	free(items);
+	return 0;
+}
@@ -22,6 +22,7 @@
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
 static const char *init_db_template_dir;
+static const char *init_ref_storage;
 
 static void copy_templates_1(struct strbuf *path, struct strbuf *template,
 			     DIR *dir)
@@ -222,6 +223,30 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
+	/*
+	 * The ref storage of a new repository can be chosen; that of an
+	 * existing one is what its config says.
+	 */
+	if (!reinit) {
+		const char *ref_storage = init_ref_storage;
+
+		if (!ref_storage)
+			ref_storage = getenv("GIT_TEST_REF_STORAGE");
+		if (ref_storage) {
+			if (!ref_storage_backend_exists(ref_storage))
+				die(_("unknown ref storage '%s'"), ref_storage);
+			free(repository_format_ref_storage);
+			repository_format_ref_storage = xstrdup(ref_storage);
+		}
+	} else if (init_ref_storage &&
+		   strcmp(init_ref_storage, repository_format_ref_storage ?
+			  repository_format_ref_storage : "files"))
+		die(_("cannot change the ref storage of an existing repository"));
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -229,18 +254,27 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
 	}
 
-	/* This forces creation of new config file */
-	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
-	git_config_set("core.repositoryformatversion", repo_version_string);
+	/*
+	 * This forces creation of new config file.  A ref storage
+	 * other than "files" is an extension that older versions of
+	 * Git must not ignore.
+	 */
+	if (repository_format_ref_storage &&
+	    strcmp(repository_format_ref_storage, "files")) {
+		git_config_set("core.repositoryformatversion", "1");
+		git_config_set("extensions.refstorage",
+			       repository_format_ref_storage);
+	} else {
+		xsnprintf(repo_version_string, sizeof(repo_version_string),
+			  "%d", GIT_REPO_VERSION);
+		git_config_set("core.repositoryformatversion",
+			       repo_version_string);
+	}
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -454,7 +488,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-storage=<format>] [<directory>]"),
 	NULL
 };
 
@@ -483,6 +517,8 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-storage", &init_ref_storage, N_("format"),
+			   N_("how to store the references (files or reftable)")),
 		OPT_END()
 	};
 
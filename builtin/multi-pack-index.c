@@ -0,0 +1,80 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static char const * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index [--object-dir <dir>] (write|read)"),
+	NULL
+};
+
+static struct opts_multi_pack_index {
+	const char *object_dir;
+} opts;
+
+static int midx_read(void)
+{
+	struct multi_pack_index *m;
+	uint32_t i;
+
+	m = load_multi_pack_index(opts.object_dir);
+	if (!m)
+		die(_("could not read multi-pack-index in '%s'"), opts.object_dir);
+
+	printf("header: %08x %d %d %d %d\n",
+	       get_be32(m->data),
+	       m->data[4],
+	       m->data[5],
+	       m->num_chunks,
+	       m->data[7]);
+	printf("num_packs: %u\n", m->num_packs);
+	printf("num_objects: %u\n", m->num_objects);
+	printf("chunks:");
+	if (m->chunk_pack_names)
+		printf(" pack_names");
+	if (m->chunk_oid_fanout)
+		printf(" oid_fanout");
+	if (m->chunk_oid_lookup)
+		printf(" oid_lookup");
+	if (m->chunk_object_offsets)
+		printf(" object_offsets");
+	if (m->chunk_large_offsets)
+		printf(" large_offsets");
+	printf("\n");
+
+	printf("packs:\n");
+	for (i = 0; i < m->num_packs; i++)
+		printf("%s\n", m->pack_names[i]);
+
+	close_midx(m);
+	return 0;
+}
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	static struct option builtin_multi_pack_index_options[] = {
+		OPT_FILENAME(0, "object-dir", &opts.object_dir,
+		  N_("object directory containing set of packfile and pack-index pairs")),
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_multi_pack_index_options,
+			     builtin_multi_pack_index_usage, 0);
+
+	if (!opts.object_dir)
+		opts.object_dir = get_object_directory();
+
+	if (argc != 1)
+		usage_with_options(builtin_multi_pack_index_usage,
+				   builtin_multi_pack_index_options);
+
+	if (!strcmp(argv[0], "write"))
+		return !!write_midx_file(opts.object_dir);
+	if (!strcmp(argv[0], "read"))
+		return midx_read();
+
+	die(_("unrecognized verb: %s"), argv[0]);
+}
@@ -9,6 +9,7 @@
 #include "delta.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "delta-islands.h"
 #include "csum-file.h"
 #include "tree-walk.h"
 #include "diff.h"
@@ -50,6 +51,8 @@ static int local;
 static int have_non_local_packs;
 static int incremental;
 static int ignore_packed_keep;
+static int ignore_packed_keep_in_core;
+static int use_delta_islands;
 static int allow_ofs_delta;
 static struct pack_idx_option pack_idx_opts;
 static const char *base_name;
@@ -64,7 +67,8 @@ static struct progress *progress_state;
 
 static struct packed_git *reuse_packfile;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
+static int allow_pack_reuse = 1;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
@@ -366,6 +370,8 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 
 	offset = entry->in_pack_offset;
 	revidx = find_pack_revindex(p, offset);
+	if (!revidx)
+		return write_no_reuse_object(f, entry, limit, usable_delta);
 	datalen = revidx[1].offset - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
 	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
@@ -713,57 +719,155 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct sha1file *f)
+/*
+ * Objects of the reused pack are copied with their offsets shifted by
+ * the objects we leave out.  Each chunk records where in the reused
+ * pack such a run of objects starts, and how much earlier they are
+ * found in the pack we write, so that OFS_DELTA bases can be patched.
+ */
+static struct reused_chunk {
+	off_t original;
+	off_t difference;
+} *reused_chunks;
+static int reused_chunks_nr;
+static int reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t difference)
 {
-	unsigned char buffer[8192];
-	off_t to_write, total;
-	int fd;
+	if (reused_chunks_nr &&
+	    reused_chunks[reused_chunks_nr - 1].difference == difference)
+		return;
 
-	if (!is_pack_valid(reuse_packfile))
-		die("packfile is invalid: %s", reuse_packfile->pack_name);
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1, reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = difference;
+	reused_chunks_nr++;
+}
+
+/* How much earlier is the object at "where" in the reused pack written? */
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
 
-	fd = git_open(reuse_packfile->pack_name);
-	if (fd < 0)
-		die_errno("unable to open packfile for reuse: %s",
-			  reuse_packfile->pack_name);
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
 
-	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
-		die_errno("unable to seek in reused packfile");
+	/* the first chunk starts at the first reused object */
+	assert(lo);
+	return reused_chunks[lo - 1].difference;
+}
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - 20;
+static void write_reused_pack_one(struct sha1file *f, size_t pos,
+				  struct pack_window **w_curs)
+{
+	off_t offset, next, cur;
+	enum object_type type;
+	unsigned long size;
 
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+	offset = reuse_packfile->revindex[pos].offset;
+	next = reuse_packfile->revindex[pos + 1].offset;
 
-	while (to_write) {
-		int read_pack = xread(fd, buffer, sizeof(buffer));
+	record_reused_object(offset, offset - (f->total + f->offset));
 
-		if (read_pack <= 0)
-			die_errno("unable to read from reused packfile");
+	cur = offset;
+	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
+	if (type < 0)
+		die("unable to read object header at %"PRIuMAX" in %s",
+		    (uintmax_t)offset, reuse_packfile->pack_name);
 
-		if (read_pack > to_write)
-			read_pack = to_write;
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset, fixup;
 
-		sha1write(f, buffer, read_pack);
-		to_write -= read_pack;
+		base_offset = get_delta_base(reuse_packfile, w_curs, &cur,
+					     type, offset);
+		if (!base_offset)
+			die("bad delta base at %"PRIuMAX" in %s",
+			    (uintmax_t)offset, reuse_packfile->pack_name);
 
 		/*
-		 * We don't know the actual number of objects written,
-		 * only how many bytes written, how many bytes total, and
-		 * how many objects total. So we can fake it by pretending all
-		 * objects we are writing are the same size. This gives us a
-		 * smooth progress meter, and at the end it matches the true
-		 * answer.
+		 * If objects were left out between the base and the delta,
+		 * the relative offset has to be written afresh.
 		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
+		fixup = find_reused_offset(offset) -
+			find_reused_offset(base_offset);
+		if (fixup) {
+			unsigned char header[MAX_PACK_OBJECT_HEADER];
+			unsigned char dheader[MAX_PACK_OBJECT_HEADER];
+			unsigned hdrlen, dpos = sizeof(dheader) - 1;
+			off_t ofs = offset - base_offset - fixup;
+
+			hdrlen = encode_in_pack_object_header(header,
+							      sizeof(header),
+							      type, size);
+			dheader[dpos] = ofs & 127;
+			while (ofs >>= 7)
+				dheader[--dpos] = 128 | (--ofs & 127);
+
+			sha1write(f, header, hdrlen);
+			sha1write(f, dheader + dpos, sizeof(dheader) - dpos);
+			copy_pack_data(f, reuse_packfile, w_curs, cur, next - cur);
+			return;
+		}
+	}
+
+	copy_pack_data(f, reuse_packfile, w_curs, offset, next - offset);
+}
+
+/*
+ * Write the objects marked in reuse_packfile_bitmap as they are in the
+ * reused pack.  Leading runs of whole words are copied in one go, the
+ * rest object by object.  Either way the data is handed to sha1write()
+ * straight from the mmapped pack windows.
+ */
+static void write_reused_pack(struct sha1file *f)
+{
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
+	uint32_t offset;
+
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile is invalid: %s", reuse_packfile->pack_name);
+
+	while (i < reuse_packfile_bitmap->word_alloc &&
+	       reuse_packfile_bitmap->words[i] == (eword_t)~0)
+		i++;
+	if (i) {
+		off_t to_write;
+
+		written = i * BITS_IN_EWORD;
+		to_write = reuse_packfile->revindex[written].offset -
+			   sizeof(struct pack_header);
+
+		/* this is one chunk, not one object */
+		record_reused_object(sizeof(struct pack_header), 0);
+		copy_pack_data(f, reuse_packfile, &w_curs,
+			       sizeof(struct pack_header), to_write);
 		display_progress(progress_state, written);
 	}
 
-	close(fd);
-	written = reuse_packfile_objects;
-	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+	for (; i < reuse_packfile_bitmap->word_alloc; i++) {
+		eword_t word = reuse_packfile_bitmap->words[i];
+		size_t pos = i * BITS_IN_EWORD;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			write_reused_pack_one(f, pos + offset, &w_curs);
+			display_progress(progress_state, ++written);
+		}
+	}
+
+	unuse_pack(&w_curs);
 }
 
 static const char no_split_warning[] = N_(
@@ -796,11 +900,9 @@ static void write_pack_file(void)
 		offset = write_pack_header(f, nr_remaining);
 
 		if (reuse_packfile) {
-			off_t packfile_size;
 			assert(pack_to_stdout);
-
-			packfile_size = write_reused_pack(f);
-			offset += packfile_size;
+			write_reused_pack(f);
+			offset = f->total + f->offset;
 		}
 
 		nr_written = 0;
@@ -961,7 +1063,7 @@ static int want_found_object(int exclude, struct packed_git *p)
 	 * Otherwise, we signal "-1" at the end to tell the caller that we do
 	 * not know either way, and it needs to check more packs.
 	 */
-	if (!ignore_packed_keep &&
+	if (!ignore_packed_keep && !ignore_packed_keep_in_core &&
 	    (!local || !have_non_local_packs))
 		return 1;
 
@@ -969,6 +1071,8 @@ static int want_found_object(int exclude, struct packed_git *p)
 		return 0;
 	if (ignore_packed_keep && p->pack_local && p->pack_keep)
 		return 0;
+	if (ignore_packed_keep_in_core && p->pack_keep_in_core)
+		return 0;
 
 	/* we don't know yet; keep looking for more packs */
 	return -1;
@@ -1455,7 +1559,8 @@ static void check_object(struct object_entry *entry)
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL)) &&
+		    in_same_island(entry->idx.sha1, base_entry->idx.sha1)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1810,6 +1915,11 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (trg_entry->type != src_entry->type)
 		return -1;
 
+	/* Nor against a base that some island of the target cannot see */
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return 0;
+
 	/*
 	 * We do not bother to try a delta that we discarded on an
 	 * earlier try, but only when reusing delta data.  Note that
@@ -2466,6 +2576,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.allowpackreuse")) {
+		allow_pack_reuse = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		delta_search_threads = git_config_int(k, v);
 		if (delta_search_threads < 0)
@@ -2518,6 +2632,92 @@ static void read_object_list_from_stdin(void)
 	}
 }
 
+static int pack_mtime_cmp(const void *_a, const void *_b)
+{
+	struct packed_git *a = ((const struct string_list_item *)_a)->util;
+	struct packed_git *b = ((const struct string_list_item *)_b)->util;
+
+	/* newest packs first */
+	if (a->mtime < b->mtime)
+		return 1;
+	if (a->mtime > b->mtime)
+		return -1;
+	return 0;
+}
+
+static void add_objects_in_pack(struct packed_git *p)
+{
+	uint32_t i;
+
+	if (open_pack_index(p))
+		die("cannot open pack index for '%s'", p->pack_name);
+	load_pack_revindex(p);
+
+	/* in pack order, to keep the objects of each pack together */
+	for (i = 0; i < p->num_objects; i++) {
+		const unsigned char *sha1;
+
+		sha1 = nth_packed_object_sha1(p, p->revindex[i].nr);
+		add_object_entry(sha1, 0, "", 0);
+	}
+}
+
+/*
+ * Read the names of packs ("pack-<sha1>.pack") from the standard
+ * input, and add all objects in them, except for the objects that are
+ * also in the packs whose names are prefixed with "^".
+ */
+static void read_packs_list_from_stdin(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list include_packs = STRING_LIST_INIT_DUP;
+	struct string_list exclude_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (buf.buf[0] == '^')
+			string_list_append(&exclude_packs, buf.buf + 1);
+		else
+			string_list_append(&include_packs, buf.buf);
+	}
+	string_list_sort(&include_packs);
+	string_list_sort(&exclude_packs);
+
+	for (p = packed_git; p; p = p->next) {
+		const char *name = strrchr(p->pack_name, '/');
+
+		name = name ? name + 1 : p->pack_name;
+		item = string_list_lookup(&include_packs, name);
+		if (!item)
+			item = string_list_lookup(&exclude_packs, name);
+		if (item)
+			item->util = p;
+	}
+
+	for_each_string_list_item(item, &exclude_packs) {
+		p = item->util;
+		if (!p)
+			die("could not find pack '%s'", item->string);
+		p->pack_keep_in_core = 1;
+	}
+	ignore_packed_keep_in_core = 1;
+
+	for_each_string_list_item(item, &include_packs) {
+		if (!item->util)
+			die("could not find pack '%s'", item->string);
+	}
+	QSORT(include_packs.items, include_packs.nr, pack_mtime_cmp);
+	for_each_string_list_item(item, &include_packs)
+		add_objects_in_pack(item->util);
+
+	strbuf_release(&buf);
+	string_list_clear(&include_packs, 0);
+	string_list_clear(&exclude_packs, 0);
+}
+
 #define OBJECT_ADDED (1u<<20)
 
 static void show_commit(struct commit *commit, void *data)
@@ -2527,6 +2727,9 @@ static void show_commit(struct commit *commit, void *data)
 
 	if (write_bitmap_index)
 		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj, const char *name, void *data)
@@ -2534,6 +2737,9 @@ static void show_object(struct object *obj, const char *name, void *data)
 	add_preferred_base_object(name);
 	add_object_entry(obj->oid.hash, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
+
+	if (use_delta_islands && obj->type == OBJ_TREE)
+		record_tree_depth(obj, name);
 }
 
 static void show_edge(struct commit *commit)
@@ -2717,7 +2923,7 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
  */
 static int pack_options_allow_reuse(void)
 {
-	return pack_to_stdout && allow_ofs_delta;
+	return allow_pack_reuse && pack_to_stdout && allow_ofs_delta;
 }
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
@@ -2729,7 +2935,7 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	    !reuse_partial_packfile_from_bitmap(
 			&reuse_packfile,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
@@ -2793,11 +2999,20 @@ static void get_object_list(int ac, const char **av)
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
+	if (use_delta_islands) {
+		/* children must pass their islands on before parents are shown */
+		load_delta_islands();
+		revs.topo_order = 1;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress, &to_pack);
+
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
 		if (add_unseen_recent_objects_to_traversal(&revs,
@@ -2858,6 +3073,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	struct argv_array rp = ARGV_ARRAY_INIT;
 	int rev_list_unpacked = 0, rev_list_all = 0, rev_list_reflog = 0;
 	int rev_list_index = 0;
+	int stdin_packs = 0;
 	struct option pack_objects_options[] = {
 		OPT_SET_INT('q', "quiet", &progress,
 			    N_("do not show progress meter"), 0),
@@ -2895,6 +3111,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from standard input")),
 		{ OPTION_SET_INT, 0, "unpacked", &rev_list_unpacked, NULL,
 		  N_("limit the objects to those that are not yet packed"),
 		  PARSE_OPT_NOARG | PARSE_OPT_NONEG, NULL, 1 },
@@ -2930,6 +3148,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			    N_("do not hide commits by grafts"), 0),
 		OPT_BOOL(0, "use-bitmap-index", &use_bitmap_index,
 			 N_("use a bitmap index if available to speed up counting objects")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
 		OPT_END(),
@@ -2951,6 +3171,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (pack_to_stdout != !base_name || argc)
 		usage_with_options(pack_usage, pack_objects_options);
 
+	if (stdin_packs && (use_internal_rev_list || thin || rev_list_all ||
+			    rev_list_reflog || rev_list_index))
+		die("--stdin-packs cannot be used with --revs");
+
 	argv_array_push(&rp, "pack-objects");
 	if (thin) {
 		use_internal_rev_list = 1;
@@ -2972,7 +3196,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--indexed-objects");
 	}
-	if (rev_list_unpacked) {
+	if (rev_list_unpacked && !stdin_packs) {
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--unpacked");
 	}
@@ -3027,6 +3251,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!use_internal_rev_list || (!pack_to_stdout && write_bitmap_index) || is_repository_shallow())
 		use_bitmap_index = 0;
 
+	/* islands are marked during the traversal that bitmaps would skip */
+	if (use_delta_islands)
+		use_bitmap_index = 0;
+
 	if (pack_to_stdout || !rev_list_all)
 		write_bitmap_index = 0;
 
@@ -3059,7 +3287,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Counting objects"), 0);
-	if (!use_internal_rev_list)
+	if (stdin_packs) {
+		read_packs_list_from_stdin();
+		if (rev_list_unpacked)
+			add_unreachable_loose_objects();
+	} else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.argc, rp.argv);
@@ -3075,7 +3307,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (nr_result)
 		prepare_pack(window, depth);
 	write_pack_file();
-	if (progress)
+	if (progress && reuse_packfile)
+		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
+			" reused %"PRIu32" (delta %"PRIu32"),"
+			" pack-reused %"PRIu32"\n",
+			written, written_delta, reused, reused_delta,
+			reuse_packfile_objects);
+	else if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
 			" reused %"PRIu32" (delta %"PRIu32")\n",
 			written, written_delta, reused, reused_delta);
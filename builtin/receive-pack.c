@@ -307,7 +307,8 @@ struct command {
 	struct command *next;
 	const char *error_string;
 	unsigned int skip_update:1,
-		     did_not_exist:1;
+		     did_not_exist:1,
+		     skip_old_check:1;
 	int index;
 	struct object_id old_oid;
 	struct object_id new_oid;
@@ -1126,6 +1127,7 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 		struct strbuf err = STRBUF_INIT;
 		if (!parse_object(old_oid->hash)) {
 			old_oid = NULL;
+			cmd->skip_old_check = 1;
 			if (ref_exists(name)) {
 				rp_warning("Allowing deletion of corrupt ref.");
 			} else {
@@ -1358,6 +1360,17 @@ static int should_process_cmd(struct command *cmd)
 	return !cmd->error_string && !cmd->skip_update;
 }
 
+static int count_commands_to_process(struct command *commands)
+{
+	struct command *cmd;
+	int nr = 0;
+
+	for (cmd = commands; cmd; cmd = cmd->next)
+		if (should_process_cmd(cmd))
+			nr++;
+	return nr;
+}
+
 static void warn_if_skipped_connectivity_check(struct command *commands,
 					       struct shallow_info *si)
 {
@@ -1406,6 +1419,110 @@ static void execute_commands_non_atomic(struct command *commands,
 	strbuf_release(&err);
 }
 
+/*
+ * Queue the ref update that update() queued for cmd again, in the
+ * current transaction.
+ */
+static int requeue_command(struct command *cmd, struct strbuf *err)
+{
+	struct strbuf namespaced_name = STRBUF_INIT;
+	const unsigned char *old_sha1 =
+		cmd->skip_old_check ? NULL : cmd->old_oid.hash;
+	int ret;
+
+	strbuf_addf(&namespaced_name, "%s%s", get_git_namespace(), cmd->ref_name);
+	if (is_null_oid(&cmd->new_oid))
+		ret = ref_transaction_delete(transaction, namespaced_name.buf,
+					     old_sha1, 0, "push", err);
+	else
+		ret = ref_transaction_update(transaction, namespaced_name.buf,
+					     cmd->new_oid.hash, old_sha1,
+					     0, "push", err);
+	strbuf_release(&namespaced_name);
+	return ret;
+}
+
+/*
+ * Return true if the ref of cmd has the value the command asked for.
+ */
+static int command_applied(struct command *cmd)
+{
+	struct strbuf namespaced_name = STRBUF_INIT;
+	unsigned char sha1[20];
+	int ret;
+
+	strbuf_addf(&namespaced_name, "%s%s", get_git_namespace(), cmd->ref_name);
+	if (read_ref(namespaced_name.buf, sha1))
+		ret = is_null_oid(&cmd->new_oid);
+	else
+		ret = !hashcmp(sha1, cmd->new_oid.hash);
+	strbuf_release(&namespaced_name);
+	return ret;
+}
+
+/*
+ * Like execute_commands_non_atomic(), but try to apply all the
+ * updates in a single transaction first, so that the ref backend can
+ * batch them (see core.batchRefUpdates). If that transaction fails,
+ * apply the updates one at a time to find out which of them fail.
+ */
+static void execute_commands_batched(struct command *commands,
+				     struct shallow_info *si)
+{
+	struct command *cmd;
+	struct strbuf err = STRBUF_INIT;
+
+	transaction = ref_transaction_begin(&err);
+	if (!transaction) {
+		rp_error("%s", err.buf);
+		strbuf_release(&err);
+		execute_commands_non_atomic(commands, si);
+		return;
+	}
+
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (!should_process_cmd(cmd))
+			continue;
+
+		cmd->error_string = update(cmd, si);
+	}
+
+	if (!ref_transaction_commit(transaction, &err)) {
+		ref_transaction_free(transaction);
+		strbuf_release(&err);
+		return;
+	}
+	ref_transaction_free(transaction);
+	strbuf_reset(&err);
+
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (!should_process_cmd(cmd))
+			continue;
+
+		transaction = ref_transaction_begin(&err);
+		if (!transaction) {
+			rp_error("%s", err.buf);
+			strbuf_reset(&err);
+			cmd->error_string = "transaction failed to start";
+			continue;
+		}
+
+		/*
+		 * The batch may have failed after some of its updates
+		 * were already done; do not report those as failures.
+		 */
+		if ((requeue_command(cmd, &err) ||
+		     ref_transaction_commit(transaction, &err)) &&
+		    !command_applied(cmd)) {
+			rp_error("%s", err.buf);
+			cmd->error_string = "failed to update ref";
+		}
+		strbuf_reset(&err);
+		ref_transaction_free(transaction);
+	}
+	strbuf_release(&err);
+}
+
 static void execute_commands_atomic(struct command *commands,
 					struct shallow_info *si)
 {
@@ -1516,6 +1633,9 @@ static void execute_commands(struct command *commands,
 
 	if (use_atomic)
 		execute_commands_atomic(commands, si);
+	else if (batch_ref_updates > 0 &&
+		 count_commands_to_process(commands) >= batch_ref_updates)
+		execute_commands_batched(commands, si);
 	else
 		execute_commands_non_atomic(commands, si);
 
@@ -7,10 +7,12 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps;
+static int use_delta_islands;
 static char *packdir, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -39,6 +41,10 @@ static int repack_config(const char *var, const char *value, void *cb)
 		write_bitmaps = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.usedeltaislands")) {
+		use_delta_islands = git_config_bool(var, value);
+		return 0;
+	}
 	return git_default_config(var, value, cb);
 }
 
@@ -126,6 +132,88 @@ static void remove_redundant_pack(const char *dir_name, const char *base_name)
 	strbuf_release(&buf);
 }
 
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	/* packs before this one are rolled up, the others are left alone */
+	uint32_t split;
+};
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	uint32_t a = (*(struct packed_git **)va)->num_objects;
+	uint32_t b = (*(struct packed_git **)vb)->num_objects;
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+/*
+ * Collect the local packs that are not marked with .keep, from the
+ * smallest to the largest.
+ */
+static void init_pack_geometry(struct pack_geometry *geometry)
+{
+	struct packed_git *p;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local || p->pack_keep)
+			continue;
+		if (open_pack_index(p))
+			die(_("cannot open index for %s"), p->pack_name);
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+/*
+ * Find the packs to roll up so that, once they are combined into one,
+ * each pack has at least "factor" times as many objects as the next
+ * smaller one.
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint64_t rolled_up = 0;
+	uint32_t i, split = 0;
+
+	/* Find the largest pack that is out of progression... */
+	for (i = geometry->pack_nr; i > 1; i--) {
+		uint64_t ours = geometry->pack[i - 1]->num_objects;
+		uint64_t prev = geometry->pack[i - 2]->num_objects;
+
+		if (ours < factor * prev) {
+			split = i;
+			break;
+		}
+	}
+
+	/*
+	 * ...and roll it up along with all the smaller ones, then with
+	 * any larger pack that is not large enough compared to the
+	 * result.
+	 */
+	for (i = 0; i < split; i++)
+		rolled_up += geometry->pack[i]->num_objects;
+	while (split < geometry->pack_nr &&
+	       geometry->pack[split]->num_objects < factor * rolled_up)
+		rolled_up += geometry->pack[split++]->num_objects;
+
+	geometry->split = split;
+}
+
+static const char *pack_basename(struct packed_git *p)
+{
+	const char *name = strrchr(p->pack_name, '/');
+
+	return name ? name + 1 : p->pack_name;
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
 
@@ -145,7 +233,9 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	struct string_list rollback = STRING_LIST_INIT_NODUP;
 	struct string_list existing_packs = STRING_LIST_INIT_DUP;
 	struct strbuf line = STRBUF_INIT;
+	struct pack_geometry geometry = { NULL };
 	int ext, ret, failed;
+	char *midx_name;
 	FILE *out;
 
 	/* variables to be filled by option parsing */
@@ -160,6 +250,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int no_update_server_info = 0;
 	int quiet = 0;
 	int local = 0;
+	int geometric_factor = 0;
 
 	struct option builtin_repack_options[] = {
 		OPT_BIT('a', NULL, &pack_everything,
@@ -180,6 +271,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('i', "delta-islands", &use_delta_islands,
+				N_("pass --delta-islands to git-pack-objects")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
@@ -194,6 +287,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("maximum size of each packfile")),
 		OPT_BOOL(0, "pack-kept-objects", &pack_kept_objects,
 				N_("repack objects in packs marked with .keep")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("find a geometric progression with factor <n>")),
 		OPT_END()
 	};
 
@@ -209,10 +304,35 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (geometric_factor) {
+		if (pack_everything)
+			die(_("--geometric is incompatible with -A and -a"));
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+
+		init_pack_geometry(&geometry);
+		split_pack_geometry(&geometry, geometric_factor);
+
+		/*
+		 * A bitmap can only be written for a pack that has all
+		 * objects, so if every pack is to be rolled up anyway,
+		 * repack everything into one pack the usual way, keeping
+		 * unreachable objects just like a roll-up would.
+		 * Otherwise the bitmap of the largest pack, which is left
+		 * alone, stays valid.
+		 */
+		if (geometry.split == geometry.pack_nr && write_bitmaps) {
+			pack_everything |= ALL_INTO_ONE;
+			keep_unreachable = 1;
+			geometric_factor = 0;
+		}
+	}
+
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
+	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE) &&
+	    !geometric_factor)
 		die(_(incremental_bitmap_conflict_error));
 
 	packdir = mkpathdup("%s/pack", get_object_directory());
@@ -225,9 +345,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (!pack_kept_objects)
 		argv_array_push(&cmd.args, "--honor-pack-keep");
 	argv_array_push(&cmd.args, "--non-empty");
-	argv_array_push(&cmd.args, "--all");
-	argv_array_push(&cmd.args, "--reflog");
-	argv_array_push(&cmd.args, "--indexed-objects");
+	if (!geometric_factor) {
+		argv_array_push(&cmd.args, "--all");
+		argv_array_push(&cmd.args, "--reflog");
+		argv_array_push(&cmd.args, "--indexed-objects");
+	}
 	if (window)
 		argv_array_pushf(&cmd.args, "--window=%s", window);
 	if (window_memory)
@@ -240,10 +362,29 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--no-reuse-delta");
 	if (no_reuse_object)
 		argv_array_pushf(&cmd.args, "--no-reuse-object");
-	if (write_bitmaps)
+	if (write_bitmaps && !geometric_factor)
 		argv_array_push(&cmd.args, "--write-bitmap-index");
-
-	if (pack_everything & ALL_INTO_ONE) {
+	if (use_delta_islands)
+		argv_array_push(&cmd.args, "--delta-islands");
+
+	if (geometric_factor) {
+		uint32_t i;
+
+		/*
+		 * The packs that are rolled up go away with -d; strip
+		 * them down to the "pack-<sha1>" that is expected below.
+		 */
+		for (i = 0; i < geometry.split; i++) {
+			const char *name = pack_basename(geometry.pack[i]);
+			size_t len;
+
+			if (strip_suffix(name, ".pack", &len))
+				string_list_append_nodup(&existing_packs,
+							 xmemdupz(name, len));
+		}
+		argv_array_push(&cmd.args, "--stdin-packs");
+		argv_array_push(&cmd.args, "--unpacked");
+	} else if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs);
 
 		if (existing_packs.nr && delete_redundant) {
@@ -278,12 +419,25 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 	cmd.git_cmd = 1;
 	cmd.out = -1;
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
 
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+		uint32_t i;
+
+		for (i = 0; i < geometry.pack_nr; i++)
+			fprintf(in, "%s%s\n", i < geometry.split ? "" : "^",
+				pack_basename(geometry.pack[i]));
+		fclose(in);
+	}
+
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline_lf(&line, out) != EOF) {
 		if (line.len != 40)
@@ -418,15 +572,28 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		}
 		if (!quiet && isatty(2))
 			opts |= PRUNE_PACKED_VERBOSE;
+		if (geometric_factor)
+			reprepare_packed_git();
 		prune_packed_objects(opts);
 	}
 
+	/*
+	 * Keep an existing multi-pack-index in sync with the packs we
+	 * just wrote and deleted; otherwise every lookup in the new
+	 * packs would miss it and fall back to a linear search.
+	 */
+	midx_name = get_midx_filename(get_object_directory());
+	if (file_exists(midx_name))
+		write_midx_file(get_object_directory());
+	free(midx_name);
+
 	if (!no_update_server_info)
 		update_server_info(0);
 	remove_temporary_files();
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
+	free(geometry.pack);
 	strbuf_release(&line);
 
 	return 0;
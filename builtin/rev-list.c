@@ -10,6 +10,7 @@
 #include "graph.h"
 #include "bisect.h"
 #include "progress.h"
+#include "tag.h"
 
 static const char rev_list_usage[] =
 "git rev-list [OPTION] <commit-id>... [ -- paths... ]\n"
@@ -113,7 +114,7 @@ static void show_commit(struct commit *commit, void *data)
 	else
 		putchar('\n');
 
-	if (revs->verbose_header && get_cached_commit_buffer(commit, NULL)) {
+	if (revs->verbose_header) {
 		struct strbuf buf = STRBUF_INIT;
 		struct pretty_print_context ctx = {0};
 		ctx.abbrev = revs->abbrev;
@@ -266,6 +267,49 @@ static int show_object_fast(
 	return 1;
 }
 
+/*
+ * "--count" of a plain set of commits can be answered from the stored
+ * reachability bitmaps when each positive and negative tip has one.
+ * Returns -1 when that is not possible, and the commits have to be
+ * walked.
+ */
+static int count_with_bitmaps(struct rev_info *revs)
+{
+	struct commit_list *wants = NULL, *haves = NULL;
+	int i, count = -1;
+
+	if (revs->prune || revs->left_right || revs->left_only ||
+	    revs->right_only || revs->cherry_mark || revs->cherry_pick ||
+	    revs->max_age != -1 || revs->min_age != -1 ||
+	    revs->min_parents || revs->max_parents != -1 ||
+	    revs->skip_count != -1 || revs->first_parent_only ||
+	    revs->grep_filter.pattern_list || revs->grep_filter.header_list ||
+	    revs->reflog_info || revs->no_walk || revs->boundary ||
+	    revs->ancestry_path || revs->simplify_by_decoration ||
+	    revs->unpacked || revs->bisect || revs->include_check)
+		return -1;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		int uninteresting = obj->flags & UNINTERESTING;
+
+		obj = deref_tag(obj, NULL, 0);
+		if (!obj || obj->type != OBJ_COMMIT)
+			goto out;
+		commit_list_insert((struct commit *)obj,
+				   uninteresting ? &haves : &wants);
+	}
+
+	count = bitmap_count_reachable_commits(wants, haves);
+	if (count >= 0 && revs->max_count >= 0 && revs->max_count < count)
+		count = revs->max_count;
+
+out:
+	free_commit_list(wants);
+	free_commit_list(haves);
+	return count;
+}
+
 int cmd_rev_list(int argc, const char **argv, const char *prefix)
 {
 	struct rev_info revs;
@@ -359,6 +403,14 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (bisect_list)
 		revs.limited = 1;
 
+	if (revs.count && !bisect_list) {
+		int commit_count = count_with_bitmaps(&revs);
+		if (commit_count >= 0) {
+			printf("%d\n", commit_count);
+			return 0;
+		}
+	}
+
 	if (show_progress)
 		progress = start_progress_delay(show_progress, 0, 0, 2);
 
@@ -201,6 +201,7 @@ struct cache_entry {
 #define CE_ADDED             (1 << 19)
 
 #define CE_HASHED            (1 << 20)
+#define CE_FSMONITOR_VALID   (1 << 21)
 #define CE_WT_REMOVE         (1 << 22) /* remove in work directory */
 #define CE_CONFLICTED        (1 << 23)
 
@@ -324,9 +325,11 @@ static inline unsigned int canon_mode(unsigned int mode)
 #define CACHE_TREE_CHANGED	(1 << 5)
 #define SPLIT_INDEX_ORDERED	(1 << 6)
 #define UNTRACKED_CHANGED	(1 << 7)
+#define FSMONITOR_CHANGED	(1 << 8)
 
 struct split_index;
 struct untracked_cache;
+struct ewah_bitmap;
 
 struct index_state {
 	struct cache_entry **cache;
@@ -337,11 +340,14 @@ struct index_state {
 	struct split_index *split_index;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_run_once : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	unsigned char sha1[20];
 	struct untracked_cache *untracked;
+	uint64_t fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
 };
 
 extern struct index_state the_index;
@@ -671,6 +677,8 @@ extern void *read_blob_data_from_index(const struct index_state *, const char *,
 #define CE_MATCH_IGNORE_MISSING		0x08
 /* enable stat refresh */
 #define CE_MATCH_REFRESH		0x10
+/* do stat comparison even if CE_FSMONITOR_VALID is true */
+#define CE_MATCH_IGNORE_FSMONITOR	0x20
 extern int ie_match_stat(const struct index_state *, const struct cache_entry *, struct stat *, unsigned int);
 extern int ie_modified(const struct index_state *, const struct cache_entry *, struct stat *, unsigned int);
 
@@ -735,6 +743,8 @@ extern int pack_compression_level;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern size_t shared_delta_base_cache_limit;
+extern const char *shared_delta_base_cache_file;
 extern unsigned long big_file_threshold;
 extern unsigned long pack_size_limit_cfg;
 
@@ -760,8 +770,14 @@ extern int check_replace_refs;
 extern char *git_replace_ref_base;
 
 extern int fsync_object_files;
+extern int fsync_ref_files;
+extern int batch_ref_updates;
+extern int core_reflog_index;
+extern int core_loose_object_cache;
 extern int core_preload_index;
+extern const char *core_fsmonitor;
 extern int core_apply_sparse_checkout;
+extern int core_sparse_checkout_cone;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -846,10 +862,12 @@ extern int grafts_replace_parents;
 #define GIT_REPO_VERSION 0
 #define GIT_REPO_VERSION_READ 1
 extern int repository_format_precious_objects;
+extern char *repository_format_ref_storage;
 
 struct repository_format {
 	int version;
 	int precious_objects;
+	char *ref_storage;
 	int is_bare;
 	char *work_tree;
 	struct string_list unknown_extensions;
@@ -1213,6 +1231,20 @@ static inline void *read_sha1_file(const unsigned char *sha1, enum object_type *
 	return read_sha1_file_extended(sha1, type, size, LOOKUP_REPLACE_OBJECT);
 }
 
+/*
+ * Once enable_obj_read_lock() has been called, read_sha1_file() and
+ * sha1_object_info_extended() may be called from several threads at
+ * once.  They serialize on a single (recursive) mutex, which they drop
+ * while inflating object data, so that the bulk of the work can still
+ * happen in parallel.  Any other access to the object database made
+ * while such readers are running must be wrapped in obj_read_lock()
+ * and obj_read_unlock().
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+
 /*
  * This internal function is only declared here for the benefit of
  * lookup_replace_object().  Please do not call it directly.
@@ -1552,6 +1584,12 @@ struct checkout {
 
 #define TEMPORARY_FILENAME_LENGTH 25
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
+/*
+ * Record the stat data "st" of the file just written for "ce" in the
+ * index, if "state" asks for the index to be refreshed.
+ */
+extern void update_ce_after_write(const struct checkout *state,
+				  struct cache_entry *ce, struct stat *st);
 
 struct cache_def {
 	struct strbuf path;
@@ -1579,6 +1617,9 @@ extern struct alternate_object_database {
 	struct strbuf scratch;
 	size_t base_len;
 
+	/* listing of the loose objects, see core.looseObjectCache */
+	struct loose_object_cache *loose_cache;
+
 	char path[FLEX_ARRAY];
 } *alt_odb_list;
 extern void prepare_alt_odb(void);
@@ -1637,8 +1678,10 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
+		 pack_keep_in_core:1,
 		 freshened:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1;
 	unsigned char sha1[20];
 	struct revindex_entry *revindex;
 	/* something like ".git/objects/pack/xxxxx.pack" */
@@ -1719,6 +1762,7 @@ extern void close_pack_index(struct packed_git *);
 
 extern unsigned char *use_pack(struct packed_git *, struct pack_window **, off_t, unsigned long *);
 extern void close_pack_windows(struct packed_git *);
+extern void close_pack(struct packed_git *);
 extern void close_all_packs(void);
 extern void unuse_pack(struct pack_window **);
 extern void clear_delta_base_cache(void);
@@ -1766,6 +1810,16 @@ extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsig
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Return the offset in the pack of the base of the delta at
+ * "delta_obj_offset", whose header has been parsed up to "*curpos",
+ * and advance "*curpos" past the base name or offset.  Return 0 if the
+ * base cannot be found.
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
@@ -1820,6 +1874,7 @@ typedef int each_packed_object_fn(const struct object_id *oid,
 				  void *data);
 extern int for_each_loose_object(each_loose_object_fn, void *, unsigned flags);
 extern int for_each_packed_object(each_packed_object_fn, void *, unsigned flags);
+extern int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn, void *data);
 
 struct object_info {
 	/* Request */
@@ -2042,6 +2097,12 @@ extern int git_config_get_maybe_bool(const char *key, int *dest);
 extern int git_config_get_pathname(const char *key, const char **dest);
 extern int git_config_get_untracked_cache(void);
 extern int git_config_get_split_index(void);
+extern int git_config_get_fsmonitor(void);
+/*
+ * Number of threads to load the index with; 0 means one per core,
+ * 1 disables threading.  Returns 1 if "index.threads" is not set.
+ */
+extern int git_config_get_index_threads(int *dest);
 extern int git_config_get_max_percent_split_change(void);
 
 /* This dies if the configured or default date is in the future */
@@ -2136,6 +2197,8 @@ extern void *alloc_tag_node(void);
 extern void *alloc_object_node(void);
 extern void alloc_report(void);
 extern unsigned int alloc_commit_index(void);
+struct commit;
+extern void init_commit_node(struct commit *c);
 
 /* pkt-line.c */
 void packet_trace_identity(const char *prog);
@@ -0,0 +1,982 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "pack.h"
+#include "refs.h"
+#include "commit.h"
+#include "object.h"
+#include "sha1-lookup.h"
+#include "commit-graph.h"
+#include "bloom.h"
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+
+#define GRAPH_DATA_WIDTH (GIT_SHA1_RAWSZ + 16)
+
+#define GRAPH_VERSION_1 0x1
+#define GRAPH_VERSION GRAPH_VERSION_1
+
+#define GRAPH_OID_VERSION_SHA1 1
+#define GRAPH_OID_LEN_SHA1 GIT_SHA1_RAWSZ
+#define GRAPH_OID_VERSION GRAPH_OID_VERSION_SHA1
+#define GRAPH_OID_LEN GRAPH_OID_LEN_SHA1
+
+#define GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_PARENT_NONE 0x70000000
+
+#define GRAPH_LAST_EDGE 0x80000000
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH + \
+			GRAPH_FANOUT_SIZE + GRAPH_OID_LEN)
+
+/* see object.h */
+#define REACHABLE (1u<<15)
+
+char *get_commit_graph_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graph", obj_dir);
+}
+
+void free_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	if (g->data)
+		munmap((void *)g->data, g->data_len);
+	free(g->bloom_filter_settings);
+	free(g);
+}
+
+static struct commit_graph *bad_graph(struct commit_graph *g,
+				      const char *graph_file,
+				      const char *reason)
+{
+	error("commit-graph file %s is corrupt: %s", graph_file, reason);
+	free_commit_graph(g);
+	return NULL;
+}
+
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	struct commit_graph *g;
+	const unsigned char *data, *chunk_lookup;
+	struct stat st;
+	size_t graph_size;
+	uint64_t last_chunk_offset = 0;
+	uint64_t bloom_indexes_size = 0;
+	uint32_t last_chunk_id = 0;
+	uint32_t i;
+	int fd;
+
+	fd = git_open(graph_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	graph_size = xsize_t(st.st_size);
+	if (graph_size < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("commit-graph file %s is too small", graph_file);
+		return NULL;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->data_len = graph_size;
+	g->data = xmmap(NULL, graph_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	data = g->data;
+	if (get_be32(data) != GRAPH_SIGNATURE)
+		return bad_graph(g, graph_file, "bad signature");
+	if (data[4] != GRAPH_VERSION)
+		return bad_graph(g, graph_file, "unsupported version");
+	if (data[5] != GRAPH_OID_VERSION)
+		return bad_graph(g, graph_file, "unsupported hash version");
+
+	g->hash_len = GRAPH_OID_LEN;
+	g->num_chunks = data[6];
+	if (GRAPH_HEADER_SIZE + (g->num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH +
+	    GRAPH_OID_LEN > graph_size)
+		return bad_graph(g, graph_file, "truncated chunk table");
+
+	chunk_lookup = data + GRAPH_HEADER_SIZE;
+	for (i = 0; i <= g->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset < last_chunk_offset ||
+		    chunk_offset > graph_size - GRAPH_OID_LEN)
+			return bad_graph(g, graph_file, "improper chunk offset");
+
+		switch (last_chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (chunk_offset - last_chunk_offset != GRAPH_FANOUT_SIZE)
+				return bad_graph(g, graph_file, "bad fanout size");
+			g->chunk_oid_fanout = (const uint32_t *)(data + last_chunk_offset);
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			g->chunk_oid_lookup = data + last_chunk_offset;
+			g->num_commits = (chunk_offset - last_chunk_offset) / g->hash_len;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			g->chunk_commit_data = data + last_chunk_offset;
+			if (chunk_offset - last_chunk_offset !=
+			    (uint64_t)g->num_commits * GRAPH_DATA_WIDTH)
+				return bad_graph(g, graph_file, "bad commit data size");
+			break;
+		case GRAPH_CHUNKID_LARGEEDGES:
+			g->chunk_large_edges = data + last_chunk_offset;
+			break;
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			g->chunk_bloom_indexes = data + last_chunk_offset;
+			bloom_indexes_size = chunk_offset - last_chunk_offset;
+			break;
+		case GRAPH_CHUNKID_BLOOMDATA:
+			g->chunk_bloom_data = data + last_chunk_offset;
+			g->bloom_data_len = chunk_offset - last_chunk_offset;
+			break;
+		}
+
+		last_chunk_id = chunk_id;
+		last_chunk_offset = chunk_offset;
+	}
+
+	if (!g->chunk_oid_fanout || !g->chunk_oid_lookup || !g->chunk_commit_data)
+		return bad_graph(g, graph_file, "missing required chunk");
+	if (ntohl(g->chunk_oid_fanout[255]) != g->num_commits)
+		return bad_graph(g, graph_file, "fanout does not match commit count");
+	for (i = 1; i < 256; i++)
+		if (ntohl(g->chunk_oid_fanout[i - 1]) > ntohl(g->chunk_oid_fanout[i]))
+			return bad_graph(g, graph_file, "fanout is not monotonic");
+
+	/*
+	 * The Bloom filter chunks are optional; ignore them unless both
+	 * are present and we understand them.
+	 */
+	if (g->chunk_bloom_indexes && g->chunk_bloom_data &&
+	    bloom_indexes_size == (uint64_t)g->num_commits * 4 &&
+	    g->bloom_data_len >= BLOOMDATA_CHUNK_HEADER_SIZE &&
+	    get_be32(g->chunk_bloom_data) == 1) {
+		g->bloom_filter_settings = xmalloc(sizeof(struct bloom_filter_settings));
+		g->bloom_filter_settings->hash_version = get_be32(g->chunk_bloom_data);
+		g->bloom_filter_settings->num_hashes = get_be32(g->chunk_bloom_data + 4);
+		g->bloom_filter_settings->bits_per_entry = get_be32(g->chunk_bloom_data + 8);
+	} else {
+		g->chunk_bloom_indexes = NULL;
+		g->chunk_bloom_data = NULL;
+	}
+
+	return g;
+}
+
+static struct commit_graph *commit_graph;
+static int commit_graph_prepared;
+
+/*
+ * The commit-graph records the parents as they appear in the commit
+ * objects; it must not be used when those are overridden by grafts,
+ * a shallow file or replace refs.
+ */
+static int commit_graph_compatible(void)
+{
+	return !commit_parents_overridden();
+}
+
+static int prepare_commit_graph_one(const char *obj_dir)
+{
+	char *graph_name = get_commit_graph_filename(obj_dir);
+
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+	return !!commit_graph;
+}
+
+int prepare_commit_graph(void)
+{
+	struct alternate_object_database *alt;
+	int config_value;
+
+	if (commit_graph_prepared)
+		return !!commit_graph;
+	commit_graph_prepared = 1;
+
+	if (!have_git_dir())
+		return 0;
+	if (!git_config_get_bool("core.commitgraph", &config_value) &&
+	    !config_value)
+		return 0;
+	if (!commit_graph_compatible())
+		return 0;
+
+	if (prepare_commit_graph_one(get_object_directory()))
+		return 1;
+	prepare_alt_odb();
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		if (prepare_commit_graph_one(alt->path))
+			return 1;
+	return 0;
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(g->chunk_oid_fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(g->chunk_oid_fanout[sha1[0]]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(g->chunk_oid_lookup + g->hash_len * mi, sha1);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	*pos = lo;
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32" in commit-graph", pos);
+
+	c = lookup_commit(g->chunk_oid_lookup + g->hash_len * pos);
+	if (!c)
+		die("could not find commit %s",
+		    sha1_to_hex(g->chunk_oid_lookup + g->hash_len * pos));
+	c->graph_pos = pos;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_graph_info(struct commit *item,
+				   struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+
+	item->graph_pos = pos;
+	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+static int fill_commit_in_graph(struct commit *item,
+				struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	const unsigned char *edges_end = g->data + g->data_len - g->hash_len;
+	const unsigned char *parent_data;
+	struct commit_list **pptr;
+	uint64_t date_high, date_low;
+	uint32_t edge_value;
+
+	item->object.parsed = 1;
+	fill_commit_graph_info(item, g, pos);
+
+	item->tree = lookup_tree(commit_data);
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	item->date = (timestamp_t)((date_high << 32) | date_low);
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + g->hash_len);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + g->hash_len + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(edge_value & GRAPH_OCTOPUS_EDGES_NEEDED)) {
+		insert_parent_or_die(g, edge_value, pptr);
+		return 1;
+	}
+
+	if (!g->chunk_large_edges)
+		die("commit-graph is missing the large edges chunk");
+	parent_data = g->chunk_large_edges + 4 * (edge_value & GRAPH_EDGE_LAST_MASK);
+	do {
+		if (parent_data + 4 > edges_end)
+			die("commit-graph large edge list is truncated");
+		edge_value = get_be32(parent_data);
+		pptr = insert_parent_or_die(g, edge_value & GRAPH_EDGE_LAST_MASK,
+					    pptr);
+		parent_data += 4;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return 1;
+}
+
+static int find_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t *pos)
+{
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH) {
+		*pos = item->graph_pos;
+		return 1;
+	}
+	return bsearch_graph(g, item->object.oid.hash, pos);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (item->object.parsed)
+		return 1;
+	if (!prepare_commit_graph())
+		return 0;
+	/* shallow entries may have been registered after we loaded the graph */
+	if (commit_grafts_in_use())
+		return 0;
+	if (!find_commit_in_graph(item, commit_graph, &pos))
+		return 0;
+	return fill_commit_in_graph(item, commit_graph, pos);
+}
+
+struct commit *lookup_commit_in_graph(const unsigned char *sha1)
+{
+	struct commit *commit;
+	uint32_t pos;
+
+	if (!prepare_commit_graph() || commit_grafts_in_use())
+		return NULL;
+	if (!bsearch_graph(commit_graph, sha1, &pos))
+		return NULL;
+	/* the graph may list commits that were pruned after it was written */
+	if (!has_sha1_file(sha1))
+		return NULL;
+	commit = lookup_commit(sha1);
+	if (commit && !commit->object.parsed)
+		fill_commit_in_graph(commit, commit_graph, pos);
+	return commit;
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!prepare_commit_graph())
+		return;
+	if (find_commit_in_graph(item, commit_graph, &pos))
+		fill_commit_graph_info(item, commit_graph, pos);
+}
+
+const struct bloom_filter_settings *get_bloom_filter_settings(void)
+{
+	if (!prepare_commit_graph())
+		return NULL;
+	return commit_graph->bloom_filter_settings;
+}
+
+static int load_bloom_filter_from_graph(struct commit_graph *g, uint32_t pos,
+					struct bloom_filter *filter)
+{
+	uint32_t start, end;
+
+	if (!g->bloom_filter_settings)
+		return 0;
+
+	start = pos ? get_be32(g->chunk_bloom_indexes + 4 * (pos - 1)) : 0;
+	end = get_be32(g->chunk_bloom_indexes + 4 * pos);
+	if (end < start ||
+	    end > g->bloom_data_len - BLOOMDATA_CHUNK_HEADER_SIZE) {
+		warning(_("ignoring out-of-range Bloom filter for commit %s"),
+			sha1_to_hex(g->chunk_oid_lookup + g->hash_len * pos));
+		return 0;
+	}
+
+	filter->data = (unsigned char *)g->chunk_bloom_data +
+		BLOOMDATA_CHUNK_HEADER_SIZE + start;
+	filter->len = end - start;
+	return 1;
+}
+
+int get_bloom_filter(struct commit *item, struct bloom_filter *filter)
+{
+	uint32_t pos;
+
+	if (!prepare_commit_graph() || !commit_graph->bloom_filter_settings)
+		return 0;
+	if (!find_commit_in_graph(item, commit_graph, &pos))
+		return 0;
+	return load_bloom_filter_from_graph(commit_graph, pos, filter);
+}
+
+struct packed_oid_list {
+	struct object_id *list;
+	int nr;
+	int alloc;
+};
+
+static void add_oid(struct packed_oid_list *oids, const struct object_id *oid)
+{
+	ALLOC_GROW(oids->list, oids->nr + 1, oids->alloc);
+	oidcpy(&oids->list[oids->nr++], oid);
+}
+
+static int add_packed_commits(const struct object_id *oid,
+			      struct packed_git *pack,
+			      uint32_t pos,
+			      void *data)
+{
+	struct packed_oid_list *oids = data;
+	enum object_type type;
+	off_t offset = nth_packed_object_offset(pack, pos);
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	oi.typep = &type;
+	if (packed_object_info(pack, offset, &oi) < 0)
+		return error(_("unable to get type of object %s"),
+			     oid_to_hex(oid));
+
+	if (type == OBJ_COMMIT)
+		add_oid(oids, oid);
+	return 0;
+}
+
+static int add_ref_to_list(const char *refname, const struct object_id *oid,
+			   int flags, void *cb_data)
+{
+	struct string_list *list = cb_data;
+
+	string_list_append(list, oid_to_hex(oid));
+	return 0;
+}
+
+static int commit_oid_cmp(const void *va, const void *vb)
+{
+	return oidcmp(va, vb);
+}
+
+static void sort_and_dedup_oids(struct packed_oid_list *oids)
+{
+	int i, nr;
+
+	QSORT(oids->list, oids->nr, commit_oid_cmp);
+	for (i = nr = 0; i < oids->nr; i++) {
+		if (nr && !oidcmp(&oids->list[nr - 1], &oids->list[i]))
+			continue;
+		oidcpy(&oids->list[nr++], &oids->list[i]);
+	}
+	oids->nr = nr;
+}
+
+static void close_reachable(struct packed_oid_list *oids)
+{
+	struct commit *commit;
+	int i;
+
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(oids->list[i].hash);
+		if (commit)
+			commit->object.flags |= REACHABLE;
+	}
+
+	/*
+	 * As this loop runs, oids->nr may grow, but not more than the
+	 * number of missing commits in the reachable closure.
+	 */
+	for (i = 0; i < oids->nr; i++) {
+		struct commit_list *parent;
+
+		commit = lookup_commit(oids->list[i].hash);
+		if (!commit || parse_commit(commit))
+			continue;
+		for (parent = commit->parents; parent; parent = parent->next) {
+			if (parent->item->object.flags & REACHABLE)
+				continue;
+			parent->item->object.flags |= REACHABLE;
+			add_oid(oids, &parent->item->object.oid);
+		}
+	}
+
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(oids->list[i].hash);
+		if (commit)
+			commit->object.flags &= ~REACHABLE;
+	}
+}
+
+static void compute_generation_numbers(struct commit **commits, int nr)
+{
+	struct commit_list *list = NULL;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (commits[i]->generation != GENERATION_NUMBER_INFINITY &&
+		    commits[i]->generation != GENERATION_NUMBER_ZERO)
+			continue;
+
+		commit_list_insert(commits[i], &list);
+		while (list) {
+			struct commit *current = list->item;
+			struct commit_list *parent;
+			int all_parents_computed = 1;
+			uint32_t max_generation = 0;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				uint32_t gen = parent->item->generation;
+
+				if (gen == GENERATION_NUMBER_INFINITY ||
+				    gen == GENERATION_NUMBER_ZERO) {
+					all_parents_computed = 0;
+					commit_list_insert(parent->item, &list);
+					break;
+				}
+				if (gen > max_generation)
+					max_generation = gen;
+			}
+
+			if (all_parents_computed) {
+				current->generation = max_generation + 1;
+				if (current->generation > GENERATION_NUMBER_MAX)
+					current->generation = GENERATION_NUMBER_MAX;
+				pop_commit(&list);
+			}
+		}
+	}
+}
+
+static const unsigned char *commit_to_sha1(size_t index, void *table)
+{
+	struct commit **commits = table;
+	return commits[index]->object.oid.hash;
+}
+
+static uint32_t graph_position(struct commit *c, struct commit **commits, int nr)
+{
+	int pos = sha1_pos(c->object.oid.hash, commits, nr, commit_to_sha1);
+
+	if (pos < 0)
+		die("BUG: parent %s is not in the commit-graph",
+		    oid_to_hex(&c->object.oid));
+	return pos;
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f,
+				     struct commit **commits, int nr)
+{
+	int i, count = 0;
+	struct commit **list = commits;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		while (count < nr) {
+			if ((*list)->object.oid.hash[0] != i)
+				break;
+			count++;
+			list++;
+		}
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f,
+				   struct commit **commits, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		sha1write(f, commits[i]->object.oid.hash, GRAPH_OID_LEN);
+}
+
+static void write_graph_chunk_data(struct sha1file *f,
+				   struct commit **commits, int nr)
+{
+	uint32_t num_extra_edges = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct commit *c = commits[i];
+		struct commit_list *parent = c->parents;
+		uint32_t packed_date[2];
+
+		sha1write(f, c->tree->object.oid.hash, GRAPH_OID_LEN);
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else {
+			sha1write_be32(f, graph_position(parent->item, commits, nr));
+			parent = parent->next;
+		}
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else if (parent->next) {
+			sha1write_be32(f, GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges);
+			for (; parent; parent = parent->next)
+				num_extra_edges++;
+		} else
+			sha1write_be32(f, graph_position(parent->item, commits, nr));
+
+		if (sizeof(c->date) > 4)
+			packed_date[0] = (c->date >> 32) & 0x3;
+		else
+			packed_date[0] = 0;
+		packed_date[0] |= c->generation << 2;
+		packed_date[1] = c->date;
+
+		sha1write_be32(f, packed_date[0]);
+		sha1write_be32(f, packed_date[1]);
+	}
+}
+
+static void write_graph_chunk_large_edges(struct sha1file *f,
+					  struct commit **commits, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct commit_list *parent = commits[i]->parents;
+
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t edge = graph_position(parent->item, commits, nr);
+
+			if (!parent->next)
+				edge |= GRAPH_LAST_EDGE;
+			sha1write_be32(f, edge);
+		}
+	}
+}
+
+static void write_graph_chunk_bloom_indexes(struct sha1file *f,
+					    struct bloom_filter *filters, int nr)
+{
+	uint32_t cur_pos = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		cur_pos += filters[i].len;
+		sha1write_be32(f, cur_pos);
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct sha1file *f,
+					 struct bloom_filter *filters, int nr,
+					 const struct bloom_filter_settings *settings)
+{
+	int i;
+
+	sha1write_be32(f, settings->hash_version);
+	sha1write_be32(f, settings->num_hashes);
+	sha1write_be32(f, settings->bits_per_entry);
+
+	for (i = 0; i < nr; i++)
+		sha1write(f, filters[i].data, filters[i].len);
+}
+
+/*
+ * Fill "filters" with the changed-path Bloom filters of "commits",
+ * reusing those of the existing commit-graph where possible.  Returns
+ * the total size of the filters, or -1 on error.
+ */
+static int64_t compute_bloom_filters(struct commit **commits, int nr,
+				     struct bloom_filter *filters,
+				     const struct bloom_filter_settings *settings)
+{
+	const struct bloom_filter_settings *existing = get_bloom_filter_settings();
+	int reuse = existing &&
+		existing->hash_version == settings->hash_version &&
+		existing->num_hashes == settings->num_hashes &&
+		existing->bits_per_entry == settings->bits_per_entry;
+	int64_t total = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct bloom_filter *filter = &filters[i];
+
+		if (reuse && get_bloom_filter(commits[i], filter))
+			filter->data = xmemdupz(filter->data, filter->len);
+		else if (compute_bloom_filter(commits[i], filter, settings))
+			return -1;
+		total += filter->len;
+	}
+	return total;
+}
+
+static void free_bloom_filters(struct bloom_filter *filters, int nr)
+{
+	int i;
+
+	if (!filters)
+		return;
+	for (i = 0; i < nr; i++)
+		free(filters[i].data);
+	free(filters);
+}
+
+static int add_pack_commits(const char *obj_dir,
+			    struct string_list *pack_indexes,
+			    struct packed_oid_list *oids)
+{
+	struct strbuf packname = STRBUF_INIT;
+	size_t dirlen;
+	int i, ret = 0;
+
+	strbuf_addf(&packname, "%s/pack/", obj_dir);
+	dirlen = packname.len;
+	for (i = 0; i < pack_indexes->nr; i++) {
+		struct packed_git *p;
+
+		strbuf_setlen(&packname, dirlen);
+		strbuf_addstr(&packname, pack_indexes->items[i].string);
+		p = add_packed_git(packname.buf, packname.len, 1);
+		if (!p) {
+			ret = error(_("error adding pack %s"), packname.buf);
+			break;
+		}
+		if (open_pack_index(p)) {
+			ret = error(_("error opening index for %s"), packname.buf);
+			free(p);
+			break;
+		}
+		if (for_each_object_in_pack(p, add_packed_commits, oids))
+			ret = -1;
+		close_pack(p);
+		free(p);
+		if (ret)
+			break;
+	}
+	strbuf_release(&packname);
+	return ret;
+}
+
+static void add_hex_commits(struct string_list *commit_hex,
+			    struct packed_oid_list *oids)
+{
+	int i;
+
+	for (i = 0; i < commit_hex->nr; i++) {
+		struct object_id oid;
+		const char *end;
+		struct commit *result;
+
+		if (parse_oid_hex(commit_hex->items[i].string, &oid, &end) || *end)
+			continue;
+
+		result = lookup_commit_reference_gently(oid.hash, 1);
+		if (result)
+			add_oid(oids, &result->object.oid);
+	}
+}
+
+int write_commit_graph(const char *obj_dir,
+		       struct string_list *pack_indexes,
+		       struct string_list *commit_hex,
+		       unsigned flags)
+{
+	struct packed_oid_list oids = { NULL, 0, 0 };
+	struct commit **commits;
+	struct sha1file *f;
+	struct strbuf tmp_file = STRBUF_INIT;
+	char *graph_name;
+	uint32_t chunk_ids[7];
+	uint64_t chunk_offsets[7];
+	uint32_t num_extra_edges = 0;
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct bloom_filter *bloom_filters = NULL;
+	int64_t bloom_data_size = 0;
+	int write_bloom_filters;
+	int num_chunks, i, nr, fd;
+
+	if (!commit_graph_compatible())
+		return 0;
+
+	if (flags & COMMIT_GRAPH_CHANGED_PATHS)
+		write_bloom_filters = 1;
+	else if (flags & COMMIT_GRAPH_NO_CHANGED_PATHS)
+		write_bloom_filters = 0;
+	else
+		write_bloom_filters = !!get_bloom_filter_settings();
+
+	if ((flags & COMMIT_GRAPH_APPEND) && prepare_commit_graph()) {
+		for (i = 0; i < commit_graph->num_commits; i++) {
+			struct object_id oid;
+
+			hashcpy(oid.hash, commit_graph->chunk_oid_lookup +
+				commit_graph->hash_len * i);
+			add_oid(&oids, &oid);
+		}
+	}
+
+	if (pack_indexes) {
+		if (add_pack_commits(obj_dir, pack_indexes, &oids)) {
+			free(oids.list);
+			return -1;
+		}
+	}
+
+	if (commit_hex)
+		add_hex_commits(commit_hex, &oids);
+
+	if (!pack_indexes && !commit_hex)
+		for_each_packed_object(add_packed_commits, &oids, 0);
+
+	close_reachable(&oids);
+	sort_and_dedup_oids(&oids);
+
+	if (oids.nr >= GRAPH_PARENT_NONE)
+		die(_("too many commits to write graph"));
+
+	nr = oids.nr;
+	ALLOC_ARRAY(commits, nr);
+	for (i = 0; i < nr; i++) {
+		struct commit_list *parent;
+
+		commits[i] = lookup_commit(oids.list[i].hash);
+		if (!commits[i] || parse_commit(commits[i]) || !commits[i]->tree) {
+			free(commits);
+			free(oids.list);
+			return error(_("unable to parse commit %s"),
+				     oid_to_hex(&oids.list[i]));
+		}
+
+		parent = commits[i]->parents;
+		if (parent && parent->next && parent->next->next)
+			num_extra_edges += commit_list_count(parent) - 1;
+	}
+	free(oids.list);
+
+	compute_generation_numbers(commits, nr);
+
+	if (write_bloom_filters) {
+		bloom_filters = xcalloc(nr, sizeof(*bloom_filters));
+		bloom_data_size = compute_bloom_filters(commits, nr, bloom_filters,
+							&bloom_settings);
+		if (bloom_data_size < 0) {
+			free_bloom_filters(bloom_filters, nr);
+			free(commits);
+			return -1;
+		}
+		if (bloom_data_size > 0xffffffff)
+			die(_("changed-path Bloom filters are too large"));
+	}
+
+	strbuf_addf(&tmp_file, "%s/info/tmp_graph_XXXXXX", obj_dir);
+	if (safe_create_leading_directories(tmp_file.buf))
+		die_errno(_("unable to create leading directories of %s"),
+			  tmp_file.buf);
+	fd = xmkstemp_mode(tmp_file.buf, 0444);
+	f = sha1fd(fd, tmp_file.buf);
+
+	num_chunks = 0;
+	chunk_ids[num_chunks++] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_ids[num_chunks++] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_ids[num_chunks++] = GRAPH_CHUNKID_DATA;
+	if (num_extra_edges)
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_LARGEEDGES;
+	if (write_bloom_filters) {
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_BLOOMINDEXES;
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_BLOOMDATA;
+	}
+	chunk_ids[num_chunks] = 0;
+
+	chunk_offsets[0] = GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	for (i = 0; i < num_chunks; i++) {
+		uint64_t size;
+
+		switch (chunk_ids[i]) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			size = GRAPH_FANOUT_SIZE;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			size = (uint64_t)GRAPH_OID_LEN * nr;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			size = (uint64_t)GRAPH_DATA_WIDTH * nr;
+			break;
+		case GRAPH_CHUNKID_LARGEEDGES:
+			size = 4 * (uint64_t)num_extra_edges;
+			break;
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			size = 4 * (uint64_t)nr;
+			break;
+		case GRAPH_CHUNKID_BLOOMDATA:
+			size = BLOOMDATA_CHUNK_HEADER_SIZE + bloom_data_size;
+			break;
+		default:
+			die("BUG: unknown commit-graph chunk %08x", chunk_ids[i]);
+		}
+		chunk_offsets[i + 1] = chunk_offsets[i] + size;
+	}
+
+	sha1write_be32(f, GRAPH_SIGNATURE);
+	sha1write_u8(f, GRAPH_VERSION);
+	sha1write_u8(f, GRAPH_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* unused padding byte */
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be32(f, chunk_offsets[i] >> 32);
+		sha1write_be32(f, chunk_offsets[i]);
+	}
+
+	write_graph_chunk_fanout(f, commits, nr);
+	write_graph_chunk_oids(f, commits, nr);
+	write_graph_chunk_data(f, commits, nr);
+	if (num_extra_edges)
+		write_graph_chunk_large_edges(f, commits, nr);
+	if (write_bloom_filters) {
+		write_graph_chunk_bloom_indexes(f, bloom_filters, nr);
+		write_graph_chunk_bloom_data(f, bloom_filters, nr,
+					     &bloom_settings);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	free(commits);
+	free_bloom_filters(bloom_filters, nr);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno(_("unable to make temporary graph file readable"));
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	if (rename(tmp_file.buf, graph_name))
+		die_errno(_("unable to rename temporary graph file to '%s'"),
+			  graph_name);
+
+	free(graph_name);
+	strbuf_release(&tmp_file);
+	return 0;
+}
+
+int write_commit_graph_reachable(const char *obj_dir, unsigned flags)
+{
+	struct string_list list = STRING_LIST_INIT_DUP;
+	int ret;
+
+	for_each_ref(add_ref_to_list, &list);
+	ret = write_commit_graph(obj_dir, NULL, &list, flags);
+	string_list_clear(&list, 0);
+	return ret;
+}
@@ -0,0 +1,119 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "git-compat-util.h"
+#include "string-list.h"
+
+struct commit;
+struct bloom_filter;
+struct bloom_filter_settings;
+
+/*
+ * The commit-graph file lives at "<objdir>/info/commit-graph" and
+ * records, for every commit it covers, the root tree, the parents,
+ * the commit date and the generation number in fixed-width records
+ * sorted by object name.  See
+ * Documentation/technical/commit-graph-format.txt for the layout.
+ */
+extern char *get_commit_graph_filename(const char *obj_dir);
+
+/*
+ * Given a commit struct, try to fill the commit struct info, including:
+ *  1. tree object
+ *  2. date
+ *  3. parents.
+ *
+ * Returns 1 if and only if the commit was found in the commit-graph
+ * (in which case it is now parsed).
+ *
+ * See parse_commit_buffer() for the fallback after this call.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * If "sha1" names a commit covered by the commit-graph that still
+ * exists, return that commit, parsed from the graph without reading
+ * the object itself.  Otherwise return NULL.
+ */
+extern struct commit *lookup_commit_in_graph(const unsigned char *sha1);
+
+/*
+ * It is possible that we loaded commit contents from the commit buffer,
+ * but we also want to know its position in the commit-graph and its
+ * generation number.  Fill the graph_pos and generation members of the
+ * given commit, if it is covered by the commit-graph.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/*
+ * Return 1 if a commit-graph is available for this repository (and
+ * has been loaded), 0 otherwise.
+ */
+extern int prepare_commit_graph(void);
+
+/*
+ * Return the settings of the changed-path Bloom filters of the
+ * commit-graph, or NULL if there is no commit-graph or it has no
+ * such filters.
+ */
+extern const struct bloom_filter_settings *get_bloom_filter_settings(void);
+
+/*
+ * Point "filter" at the changed-path Bloom filter of the given commit
+ * in the commit-graph.  Returns 1 on success, or 0 if the commit has
+ * no such filter.
+ */
+extern int get_bloom_filter(struct commit *item, struct bloom_filter *filter);
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_commits;
+
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t bloom_data_len;
+
+	struct bloom_filter_settings *bloom_filter_settings;
+};
+
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void free_commit_graph(struct commit_graph *g);
+
+#define COMMIT_GRAPH_APPEND		(1 << 0)
+#define COMMIT_GRAPH_CHANGED_PATHS	(1 << 1)
+#define COMMIT_GRAPH_NO_CHANGED_PATHS	(1 << 2)
+
+/*
+ * Write a commit-graph file to "<obj_dir>/info/commit-graph".
+ *
+ * The commits to be covered are collected from the packfiles named
+ * in "pack_indexes" (base names of .idx files inside "<obj_dir>/pack"),
+ * or from the hex object names in "commit_hex" (which are peeled to
+ * commits), or, when both are NULL, from every packed commit.  The
+ * set is then closed under reachability.  With COMMIT_GRAPH_APPEND,
+ * commits in an existing commit-graph are kept as well.
+ *
+ * Changed-path Bloom filters are written with COMMIT_GRAPH_CHANGED_PATHS,
+ * not written with COMMIT_GRAPH_NO_CHANGED_PATHS, and otherwise only
+ * if the existing commit-graph has them.
+ *
+ * Returns 0 on success (including when writing is skipped because
+ * grafts, replace refs or a shallow file are in use) and -1 on error.
+ */
+extern int write_commit_graph(const char *obj_dir,
+			      struct string_list *pack_indexes,
+			      struct string_list *commit_hex,
+			      unsigned flags);
+
+/* Write a commit-graph covering every commit reachable from a ref. */
+extern int write_commit_graph_reachable(const char *obj_dir, unsigned flags);
+
+#endif
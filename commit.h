@@ -13,6 +13,11 @@ struct commit_list {
 	struct commit_list *next;
 };
 
+#define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_ZERO 0
+
 struct commit {
 	struct object object;
 	void *util;
@@ -20,6 +25,8 @@ struct commit {
 	timestamp_t date;
 	struct commit_list *parents;
 	struct tree *tree;
+	uint32_t graph_pos;
+	uint32_t generation;
 };
 
 extern int save_commit_buffer;
@@ -251,6 +258,20 @@ struct commit_graft *read_graft_line(char *buf, int len);
 int register_commit_graft(struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(const unsigned char *sha1);
 
+/*
+ * Return true if grafts or shallow entries override the parents
+ * recorded in (some) commit objects.
+ */
+int commit_grafts_in_use(void);
+
+/*
+ * Like commit_grafts_in_use(), but also true if replace refs may
+ * override commit objects.  Data derived from the commit objects
+ * themselves (the commit-graph, reachability bitmaps) must not be used
+ * to answer questions about history then.
+ */
+int commit_parents_overridden(void);
+
 extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2);
 extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos);
 extern struct commit_list *get_octopus_merge_bases(struct commit_list *in);
@@ -393,6 +414,7 @@ extern int remove_signature(struct strbuf *buf);
 extern int check_commit_signature(const struct commit *commit, struct signature_check *sigc);
 
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
 LAST_ARG_MUST_BE_NULL
 extern int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
@@ -1120,6 +1120,15 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.shareddeltabasecachelimit")) {
+		shared_delta_base_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.shareddeltabasecachefile"))
+		return git_config_pathname(&shared_delta_base_cache_file,
+					   var, value);
+
 	if (!strcmp(var, "core.autocrlf")) {
 		if (value && !strcasecmp(value, "input")) {
 			auto_crlf = AUTO_CRLF_INPUT;
@@ -1189,6 +1198,26 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.fsyncreffiles")) {
+		fsync_ref_files = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.batchrefupdates")) {
+		batch_ref_updates = git_config_int(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.reflogindex")) {
+		core_reflog_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectcache")) {
+		core_loose_object_cache = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.preloadindex")) {
 		core_preload_index = git_config_bool(var, value);
 		return 0;
@@ -1209,6 +1238,11 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.sparsecheckoutcone")) {
+		core_sparse_checkout_cone = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.precomposeunicode")) {
 		precomposed_unicode = git_config_bool(var, value);
 		return 0;
@@ -2006,6 +2040,38 @@ int git_config_get_split_index(void)
 	return -1; /* default value */
 }
 
+int git_config_get_fsmonitor(void)
+{
+	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
+		core_fsmonitor = getenv("GIT_TEST_FSMONITOR");
+
+	if (core_fsmonitor && !*core_fsmonitor)
+		core_fsmonitor = NULL;
+
+	return core_fsmonitor ? 1 : 0;
+}
+
+int git_config_get_index_threads(int *dest)
+{
+	int is_bool, val;
+
+	val = git_env_ulong("GIT_TEST_INDEX_THREADS", 0);
+	if (val) {
+		*dest = val;
+		return 0;
+	}
+
+	if (!git_config_get_bool_or_int("index.threads", &is_bool, &val)) {
+		if (is_bool)
+			*dest = val ? 0 : 1;
+		else
+			*dest = val;
+		return 0;
+	}
+
+	return 1;
+}
+
 int git_config_get_max_percent_split_change(void)
 {
 	int val = -1;
@@ -0,0 +1,2 @@
+NO_GETTEXT=1
+NO_TCLTK=1
@@ -33,6 +33,36 @@ enum eol {
 };
 
 extern enum eol core_eol;
+
+enum crlf_action {
+	CRLF_UNDEFINED,
+	CRLF_BINARY,
+	CRLF_TEXT,
+	CRLF_TEXT_INPUT,
+	CRLF_TEXT_CRLF,
+	CRLF_AUTO,
+	CRLF_AUTO_INPUT,
+	CRLF_AUTO_CRLF
+};
+
+struct convert_driver;
+
+struct conv_attrs {
+	struct convert_driver *drv;
+	enum crlf_action attr_action; /* What attr says */
+	enum crlf_action crlf_action; /* When no attr is set, use core.autocrlf */
+	int ident;
+};
+
+/*
+ * Look up the conversion attributes of "path".  The result can be
+ * handed to convert_to_working_tree_ca() later, possibly in another
+ * process, as long as conv_attrs_need_driver() says it does not need
+ * an external filter driver.
+ */
+extern void convert_attrs(struct conv_attrs *ca, const char *path);
+extern int conv_attrs_need_driver(const struct conv_attrs *ca);
+
 extern const char *get_cached_convert_stats_ascii(const char *path);
 extern const char *get_wt_convert_stats_ascii(const char *path);
 extern const char *get_convert_attr_ascii(const char *path);
@@ -42,6 +72,9 @@ extern int convert_to_git(const char *path, const char *src, size_t len,
 			  struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src,
 				   size_t len, struct strbuf *dst);
+extern int convert_to_working_tree_ca(const struct conv_attrs *ca,
+				      const char *path, const char *src,
+				      size_t len, struct strbuf *dst);
 extern int renormalize_buffer(const char *path, const char *src, size_t len,
 			      struct strbuf *dst);
 static inline int would_convert_to_git(const char *path)
@@ -63,6 +96,8 @@ extern int would_convert_to_git_filter_fd(const char *path);
 struct stream_filter; /* opaque */
 
 extern struct stream_filter *get_stream_filter(const char *path, const unsigned char *);
+extern struct stream_filter *get_stream_filter_ca(const struct conv_attrs *ca,
+						  const unsigned char *);
 extern void free_stream_filter(struct stream_filter *);
 extern int is_null_stream_filter(struct stream_filter *);
 
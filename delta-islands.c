@@ -0,0 +1,352 @@
+#include "cache.h"
+#include "refs.h"
+#include "object.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "progress.h"
+#include "khash.h"
+#include "sha1-array.h"
+#include "string-list.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "delta-islands.h"
+
+/*
+ * The set of islands an object is in.  Objects usually share the set
+ * of the commit or tree they were reached from, so sets are reference
+ * counted and only copied when an object turns out to be in more
+ * islands than its parent.
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+/* size of the bitmaps, in 32-bit words */
+static uint32_t island_bitmap_size;
+
+/* object name -> struct island_bitmap */
+static khash_sha1 *island_marks;
+
+/* object name -> depth in the tree it was first found in */
+static khash_sha1_pos *tree_depths;
+
+static regex_t *island_regexes;
+static unsigned int island_regexes_alloc, island_regexes_nr;
+
+/* island name -> struct oid_array of the tips of its refs */
+static struct string_list islands = STRING_LIST_INIT_DUP;
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) +
+		      st_mult(island_bitmap_size, sizeof(uint32_t));
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b->bits, old->bits, island_bitmap_size * sizeof(uint32_t));
+	b->refcount = 1;
+	return b;
+}
+
+static void island_bitmap_or(struct island_bitmap *self,
+			     const struct island_bitmap *other)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		self->bits[i] |= other->bits[i];
+}
+
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static void island_bitmap_set(struct island_bitmap *self, uint32_t i)
+{
+	self->bits[i / 32] |= 1u << (i % 32);
+}
+
+int in_same_island(const unsigned char *trg, const unsigned char *src)
+{
+	khiter_t trg_pos, src_pos;
+
+	if (!island_marks)
+		return 1;
+
+	/*
+	 * An object that is in no island is not reachable from any of
+	 * the refs we care about, and can be stored against anything.
+	 */
+	trg_pos = kh_get_sha1(island_marks, trg);
+	if (trg_pos >= kh_end(island_marks))
+		return 1;
+
+	/* Nothing that is in an island may be based on such an object. */
+	src_pos = kh_get_sha1(island_marks, src);
+	if (src_pos >= kh_end(island_marks))
+		return 0;
+
+	return island_bitmap_is_subset(kh_value(island_marks, trg_pos),
+				       kh_value(island_marks, src_pos));
+}
+
+/* Add "obj" to all islands in "marks". */
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b;
+	khiter_t pos;
+	int hash_ret;
+
+	pos = kh_put_sha1(island_marks, obj->oid.hash, &hash_ret);
+	if (hash_ret) {
+		/* first time we see this object: share the set */
+		kh_value(island_marks, pos) = marks;
+		marks->refcount++;
+		return;
+	}
+
+	b = kh_value(island_marks, pos);
+	if (island_bitmap_is_subset(marks, b))
+		return;
+
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = kh_value(island_marks, pos) = island_bitmap_new(b);
+	}
+	island_bitmap_or(b, marks);
+}
+
+static void mark_island_tip(const struct object_id *oid,
+			    struct island_bitmap *marks)
+{
+	struct object *obj = parse_object(oid->hash);
+
+	while (obj) {
+		set_island_marks(obj, marks);
+		if (obj->type != OBJ_TAG)
+			break;
+		obj = ((struct tag *)obj)->tagged;
+		if (obj)
+			obj = parse_object(obj->oid.hash);
+	}
+}
+
+static int island_config_callback(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.island")) {
+		struct strbuf re = STRBUF_INIT;
+
+		if (!v)
+			return config_error_nonbool(k);
+
+		ALLOC_GROW(island_regexes, island_regexes_nr + 1,
+			   island_regexes_alloc);
+		if (*v != '^')
+			strbuf_addch(&re, '^');
+		strbuf_addstr(&re, v);
+		if (regcomp(&island_regexes[island_regexes_nr], re.buf,
+			    REG_EXTENDED))
+			die(_("failed to load island regex for '%s': %s"),
+			    k, re.buf);
+		strbuf_release(&re);
+		island_regexes_nr++;
+	}
+	return 0;
+}
+
+/*
+ * The name of the island of a ref is made of the groups captured by
+ * the last regex that matches it, so that "refs/virtual/([0-9]+)/"
+ * puts the refs of each fork in an island of their own.
+ */
+static int find_island_for_ref(const char *refname, const struct object_id *oid,
+			       int flags, void *data)
+{
+	regmatch_t matches[8];
+	struct strbuf island_name = STRBUF_INIT;
+	struct string_list_item *item;
+	int i, m;
+
+	for (i = island_regexes_nr - 1; i >= 0; i--)
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	if (i < 0)
+		return 0;
+
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+		if (island_name.len)
+			strbuf_addch(&island_name, '-');
+		strbuf_add(&island_name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	item = string_list_insert(&islands, island_name.buf);
+	if (!item->util)
+		item->util = xcalloc(1, sizeof(struct oid_array));
+	oid_array_append(item->util, oid);
+
+	strbuf_release(&island_name);
+	return 0;
+}
+
+void load_delta_islands(void)
+{
+	int i;
+
+	island_marks = kh_init_sha1();
+	tree_depths = kh_init_sha1_pos();
+
+	git_config(island_config_callback, NULL);
+	for_each_ref(find_island_for_ref, NULL);
+
+	island_bitmap_size = (islands.nr + 31) / 32;
+	for (i = 0; i < islands.nr; i++) {
+		struct oid_array *tips = islands.items[i].util;
+		struct island_bitmap *marks = island_bitmap_new(NULL);
+		int j;
+
+		island_bitmap_set(marks, i);
+		for (j = 0; j < tips->nr; j++)
+			mark_island_tip(&tips->oid[j], marks);
+		if (!--marks->refcount)
+			free(marks);
+	}
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *marks;
+	struct commit_list *p;
+	khiter_t pos;
+
+	if (!island_marks)
+		return;
+	pos = kh_get_sha1(island_marks, commit->object.oid.hash);
+	if (pos >= kh_end(island_marks))
+		return;
+
+	marks = kh_value(island_marks, pos);
+	if (parse_commit(commit) || !commit->tree)
+		return;
+	set_island_marks(&commit->tree->object, marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, marks);
+}
+
+void record_tree_depth(struct object *obj, const char *name)
+{
+	unsigned int depth = 0;
+	khiter_t pos;
+	int hash_ret;
+
+	if (!tree_depths)
+		return;
+	if (*name)
+		for (depth = 1; (name = strchr(name, '/')); name++)
+			depth++;
+
+	pos = kh_put_sha1_pos(tree_depths, obj->oid.hash, &hash_ret);
+	if (hash_ret)
+		kh_value(tree_depths, pos) = depth;
+}
+
+struct tree_islands_todo {
+	struct object_entry *entry;
+	unsigned int depth;
+};
+
+static int tree_depth_compare(const void *a, const void *b)
+{
+	const struct tree_islands_todo *todo_a = a;
+	const struct tree_islands_todo *todo_b = b;
+
+	if (todo_a->depth < todo_b->depth)
+		return -1;
+	return todo_a->depth > todo_b->depth;
+}
+
+void resolve_tree_islands(int progress, struct packing_data *to_pack)
+{
+	struct progress *progress_state = NULL;
+	struct tree_islands_todo *todo;
+	int nr = 0;
+	int i;
+
+	if (!island_marks)
+		return;
+
+	/*
+	 * Trees are handled from the root down, so that the marks of a
+	 * tree are complete before they are passed to its entries.
+	 */
+	ALLOC_ARRAY(todo, to_pack->nr_objects);
+	for (i = 0; i < to_pack->nr_objects; i++) {
+		struct object_entry *entry = &to_pack->objects[i];
+		khiter_t pos;
+
+		if (entry->type != OBJ_TREE)
+			continue;
+		todo[nr].entry = entry;
+		pos = kh_get_sha1_pos(tree_depths, entry->idx.sha1);
+		todo[nr].depth = pos < kh_end(tree_depths) ?
+			kh_value(tree_depths, pos) : 0;
+		nr++;
+	}
+	QSORT(todo, nr, tree_depth_compare);
+
+	if (progress)
+		progress_state = start_progress(_("Propagating island marks"), nr);
+
+	for (i = 0; i < nr; i++) {
+		struct object_entry *ent = todo[i].entry;
+		struct island_bitmap *marks;
+		struct tree_desc desc;
+		struct name_entry entry;
+		struct tree *tree;
+		khiter_t pos;
+
+		pos = kh_get_sha1(island_marks, ent->idx.sha1);
+		if (pos >= kh_end(island_marks))
+			continue;
+		marks = kh_value(island_marks, pos);
+
+		tree = lookup_tree(ent->idx.sha1);
+		if (!tree || parse_tree(tree) < 0)
+			die(_("bad tree object %s"), sha1_to_hex(ent->idx.sha1));
+
+		init_tree_desc(&desc, tree->buffer, tree->size);
+		while (tree_entry(&desc, &entry)) {
+			struct object *obj;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+			obj = lookup_object(entry.oid->hash);
+			if (!obj)
+				continue;
+			set_island_marks(obj, marks);
+		}
+		free_tree_buffer(tree);
+
+		display_progress(progress_state, i + 1);
+	}
+
+	stop_progress(&progress_state);
+	free(todo);
+}
@@ -0,0 +1,39 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+/*
+ * Delta islands restrict the delta bases that pack-objects may pick:
+ * each ref matching one of the "pack.island" regexes puts everything
+ * reachable from it in an island, and an object may only be stored as
+ * a delta against a base that is in every island the object is in.
+ * A pack served to a fork that only fetches one island can then reuse
+ * all of its deltas as they are.
+ */
+
+struct commit;
+struct object;
+struct packing_data;
+
+/*
+ * Read the "pack.island" configuration and mark the tips of the refs
+ * that match it.  This must be called before the traversal, which
+ * must be done in topological order.
+ */
+void load_delta_islands(void);
+
+/* Pass the island marks of "commit" down to its tree and its parents. */
+void propagate_island_marks(struct commit *commit);
+
+/* Remember how deep in its commit's tree "obj", a tree, was found. */
+void record_tree_depth(struct object *obj, const char *name);
+
+/*
+ * Once the traversal is done, pass the island marks of the trees in
+ * "to_pack" down to their entries.
+ */
+void resolve_tree_islands(int progress, struct packing_data *to_pack);
+
+/* Can "trg" be stored as a delta against "src"? */
+int in_same_island(const unsigned char *trg, const unsigned char *src);
+
+#endif /* DELTA_ISLANDS_H */
@@ -68,6 +68,20 @@ diff_delta(const void *src_buf, unsigned long src_bufsize,
 	return NULL;
 }
 
+/*
+ * delta_kernel_name: name the n-th set of match extension helpers this
+ * CPU supports, from the fastest one that is used by default to the
+ * plain C one, or return NULL when n is past the last one
+ *
+ * use_delta_kernel: make create_delta() use the named helpers; returns -1
+ * if they are unknown or not supported
+ *
+ * The deltas are the same whatever the helpers; these are for the benefit
+ * of the tests and benchmarks.
+ */
+extern const char *delta_kernel_name(int n);
+extern int use_delta_kernel(const char *name);
+
 /*
  * patch_delta: recreate target buffer given source buffer and delta data
  *
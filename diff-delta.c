@@ -14,6 +14,12 @@
 #include "git-compat-util.h"
 #include "delta.h"
 
+#if !defined(NO_DELTA_SIMD) && (defined(__x86_64__) || defined(__i386__)) && \
+	(GIT_GNUC_PREREQ(4, 9) || defined(__clang__))
+#define DELTA_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 /* maximum hash entry list for the same hash bucket */
 #define HASH_LIMIT 64
 
@@ -112,6 +118,158 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/*
+ * Matches are extended by one of the kernels below, the best the CPU
+ * supports.  They all compute exactly the same thing, so deltas do not
+ * depend on the one that is used.
+ */
+#ifdef DELTA_X86_KERNELS
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE inline
+#endif
+
+static int scalar_supported(void)
+{
+	return 1;
+}
+
+/* number of bytes "a" and "b" have in common, up to "len" */
+static KERNEL_INLINE unsigned int
+match_forward_scalar(const unsigned char *a, const unsigned char *b,
+		     unsigned int len)
+{
+	unsigned int i = 0;
+
+	while (i < len && a[i] == b[i])
+		i++;
+	return i;
+}
+
+/* same for the bytes that precede "a" and "b" */
+static KERNEL_INLINE unsigned int
+match_backward_scalar(const unsigned char *a, const unsigned char *b,
+		      unsigned int len)
+{
+	unsigned int i = 0;
+
+	while (i < len && a[-1 - (int)i] == b[-1 - (int)i])
+		i++;
+	return i;
+}
+
+/* hash of the RABIN_WINDOW bytes after each of "nr" blocks */
+static void hash_blocks(const unsigned char *data, unsigned int nr,
+			unsigned int *val)
+{
+	unsigned int n = 0, i;
+
+	/* four independent hashes at a time keep more lookups in flight */
+	for (; n + 4 <= nr; n += 4, data += 4 * RABIN_WINDOW) {
+		unsigned int v0 = 0, v1 = 0, v2 = 0, v3 = 0;
+		for (i = 1; i <= RABIN_WINDOW; i++) {
+			v0 = ((v0 << 8) | data[i]) ^ T[v0 >> RABIN_SHIFT];
+			v1 = ((v1 << 8) | data[i + RABIN_WINDOW]) ^ T[v1 >> RABIN_SHIFT];
+			v2 = ((v2 << 8) | data[i + 2 * RABIN_WINDOW]) ^ T[v2 >> RABIN_SHIFT];
+			v3 = ((v3 << 8) | data[i + 3 * RABIN_WINDOW]) ^ T[v3 >> RABIN_SHIFT];
+		}
+		val[n] = v0;
+		val[n + 1] = v1;
+		val[n + 2] = v2;
+		val[n + 3] = v3;
+	}
+	for (; n < nr; n++, data += RABIN_WINDOW) {
+		unsigned int v = 0;
+		for (i = 1; i <= RABIN_WINDOW; i++)
+			v = ((v << 8) | data[i]) ^ T[v >> RABIN_SHIFT];
+		val[n] = v;
+	}
+}
+
+#ifdef DELTA_X86_KERNELS
+
+__attribute__((target("sse2")))
+static KERNEL_INLINE unsigned int
+match_forward_sse2(const unsigned char *a, const unsigned char *b,
+		   unsigned int len)
+{
+	unsigned int i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		unsigned int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (diff)
+			return i + __builtin_ctz(diff);
+	}
+	return i + match_forward_scalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static KERNEL_INLINE unsigned int
+match_backward_sse2(const unsigned char *a, const unsigned char *b,
+		    unsigned int len)
+{
+	unsigned int i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a - i - 16));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b - i - 16));
+		unsigned int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (diff)
+			return i + __builtin_clz(diff) - 16;
+	}
+	return i + match_backward_scalar(a - i, b - i, len - i);
+}
+
+static int sse2_supported(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("avx2")))
+static KERNEL_INLINE unsigned int
+match_forward_avx2(const unsigned char *a, const unsigned char *b,
+		   unsigned int len)
+{
+	unsigned int i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		unsigned int diff =
+			~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (diff)
+			return i + __builtin_ctz(diff);
+	}
+	return i + match_forward_sse2(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static KERNEL_INLINE unsigned int
+match_backward_avx2(const unsigned char *a, const unsigned char *b,
+		    unsigned int len)
+{
+	unsigned int i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a - i - 32));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b - i - 32));
+		unsigned int diff =
+			~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (diff)
+			return i + __builtin_clz(diff);
+	}
+	return i + match_backward_sse2(a - i, b - i, len - i);
+}
+
+static int avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
 struct index_entry {
 	const unsigned char *ptr;
 	unsigned int val;
@@ -130,9 +288,13 @@ struct delta_index {
 	struct index_entry *hash[FLEX_ARRAY];
 };
 
+/* how many blocks to hash at once when indexing */
+#define HASH_BATCH 256
+
 struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 {
 	unsigned int i, hsize, hmask, entries, prev_val, *hash_count;
+	unsigned int block, batch, vals[HASH_BATCH];
 	const unsigned char *data, *buffer = buf;
 	struct delta_index *index;
 	struct unpacked_index_entry *entry, **hash;
@@ -180,12 +342,17 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 
 	/* then populate the index */
 	prev_val = ~0;
-	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
-	     data >= buffer;
-	     data -= RABIN_WINDOW) {
-		unsigned int val = 0;
-		for (i = 1; i <= RABIN_WINDOW; i++)
-			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
+	batch = entries;
+	for (block = entries; block; block--) {
+		unsigned int val;
+
+		if (block <= batch) {
+			batch = (block - 1) / HASH_BATCH * HASH_BATCH;
+			hash_blocks(buffer + batch * RABIN_WINDOW,
+				    block - batch, vals);
+		}
+		data = buffer + (block - 1) * RABIN_WINDOW;
+		val = vals[block - 1 - batch];
 		if (val == prev_val) {
 			/* keep the lowest of consecutive identical blocks */
 			entry[-1].entry.ptr = data + RABIN_WINDOW;
@@ -314,10 +481,14 @@ unsigned long sizeof_delta_index(struct delta_index *index)
  */
 #define MAX_OP_SIZE	(5 + 5 + 1 + RABIN_WINDOW + 7)
 
-void *
-create_delta(const struct delta_index *index,
-	     const void *trg_buf, unsigned long trg_size,
-	     unsigned long *delta_size, unsigned long max_size)
+typedef unsigned int (*match_fn)(const unsigned char *a,
+				 const unsigned char *b, unsigned int len);
+
+static KERNEL_INLINE void *
+create_delta_with(const struct delta_index *index,
+		  const void *trg_buf, unsigned long trg_size,
+		  unsigned long *delta_size, unsigned long max_size,
+		  match_fn match_forward, match_fn match_backward)
 {
 	unsigned int i, outpos, outsize, moff, msize, val;
 	int inscnt;
@@ -382,8 +553,7 @@ create_delta(const struct delta_index *index,
 					ref_size = top - src;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
+				ref += match_forward(ref, src, ref_size);
 				if (msize < ref - entry->ptr) {
 					/* this is our best match so far */
 					msize = ref - entry->ptr;
@@ -409,17 +579,17 @@ create_delta(const struct delta_index *index,
 			unsigned char *op;
 
 			if (inscnt) {
-				while (moff && ref_data[moff-1] == data[-1]) {
-					/* we can match one byte back */
-					msize++;
-					moff--;
-					data--;
-					outpos--;
-					if (--inscnt)
-						continue;
+				/* we can match some bytes back */
+				unsigned int back = moff < inscnt ? moff : inscnt;
+				back = match_backward(ref_data + moff, data, back);
+				msize += back;
+				moff -= back;
+				data -= back;
+				outpos -= back;
+				inscnt -= back;
+				if (!inscnt) {
 					outpos--;  /* remove count slot */
 					inscnt--;  /* make it -1 */
-					break;
 				}
 				out[outpos - inscnt - 1] = inscnt;
 				inscnt = 0;
@@ -487,3 +657,86 @@ create_delta(const struct delta_index *index,
 	*delta_size = outpos;
 	return out;
 }
+
+#define DEFINE_CREATE_DELTA(kernel) \
+static void *create_delta_##kernel(const struct delta_index *index, \
+				   const void *trg_buf, unsigned long trg_size, \
+				   unsigned long *delta_size, \
+				   unsigned long max_size) \
+{ \
+	return create_delta_with(index, trg_buf, trg_size, delta_size, \
+				 max_size, match_forward_##kernel, \
+				 match_backward_##kernel); \
+}
+
+DEFINE_CREATE_DELTA(scalar)
+#ifdef DELTA_X86_KERNELS
+__attribute__((target("sse2"))) DEFINE_CREATE_DELTA(sse2)
+__attribute__((target("avx2"))) DEFINE_CREATE_DELTA(avx2)
+#endif
+
+/*
+ * Each kernel gets its own copy of create_delta(), so that its helpers
+ * are inlined rather than called through a pointer for every candidate.
+ */
+struct delta_kernel {
+	const char *name;
+	int (*supported)(void);
+	void *(*create_delta)(const struct delta_index *index,
+			      const void *trg_buf, unsigned long trg_size,
+			      unsigned long *delta_size, unsigned long max_size);
+};
+
+static const struct delta_kernel delta_kernels[] = {
+#ifdef DELTA_X86_KERNELS
+	{ "avx2", avx2_supported, create_delta_avx2 },
+	{ "sse2", sse2_supported, create_delta_sse2 },
+#endif
+	{ "scalar", scalar_supported, create_delta_scalar },
+};
+
+static const struct delta_kernel *kernel;
+
+static const struct delta_kernel *get_delta_kernel(void)
+{
+	int i;
+
+	if (kernel)
+		return kernel;
+	for (i = 0; !delta_kernels[i].supported(); i++)
+		; /* the last one is always supported */
+	kernel = &delta_kernels[i];
+	return kernel;
+}
+
+void *
+create_delta(const struct delta_index *index,
+	     const void *trg_buf, unsigned long trg_size,
+	     unsigned long *delta_size, unsigned long max_size)
+{
+	return get_delta_kernel()->create_delta(index, trg_buf, trg_size,
+						delta_size, max_size);
+}
+
+const char *delta_kernel_name(int n)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(delta_kernels); i++)
+		if (delta_kernels[i].supported() && !n--)
+			return delta_kernels[i].name;
+	return NULL;
+}
+
+int use_delta_kernel(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(delta_kernels); i++)
+		if (!strcmp(delta_kernels[i].name, name) &&
+		    delta_kernels[i].supported()) {
+			kernel = &delta_kernels[i];
+			return 0;
+		}
+	return -1;
+}
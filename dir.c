@@ -16,6 +16,7 @@
 #include "utf8.h"
 #include "varint.h"
 #include "ewah/ewok.h"
+#include "fsmonitor.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -561,6 +562,213 @@ void parse_exclude_pattern(const char **pattern,
 	*patternlen = len;
 }
 
+static int pattern_entry_cmp(const void *a_, const void *b_,
+			     const void *unused_keydata)
+{
+	const struct pattern_entry *a = a_, *b = b_;
+	size_t len = a->patternlen > b->patternlen ?
+		a->patternlen : b->patternlen;
+
+	return ignore_case ?
+		strncasecmp(a->pattern, b->pattern, len) :
+		strncmp(a->pattern, b->pattern, len);
+}
+
+static void init_pattern_entry(struct pattern_entry *e,
+			       char *pattern, size_t patternlen)
+{
+	e->pattern = pattern;
+	e->patternlen = patternlen;
+	hashmap_entry_init(e, ignore_case ?
+			   memihash(pattern, patternlen) :
+			   memhash(pattern, patternlen));
+}
+
+static void free_pattern_hashmap(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_entry *e;
+
+	if (!map->cmpfn)
+		return;
+	hashmap_iter_init(map, &iter);
+	while ((e = hashmap_iter_next(&iter)))
+		free(e->pattern);
+	hashmap_free(map, 1);
+}
+
+/*
+ * Copy a cone pattern, dropping its escapes and, for a parent
+ * pattern, the trailing slash and asterisk.
+ */
+static char *dup_and_filter_pattern(const char *pattern, size_t *len)
+{
+	char *result = xstrdup(pattern);
+	char *set = result;
+	const char *read = pattern;
+
+	while (*read) {
+		/* skip escape characters (once) */
+		if (*read == '\\' && read[1])
+			read++;
+		*set++ = *read++;
+	}
+
+	if (set - result > 2 && set[-1] == '*' && set[-2] == '/')
+		set -= 2;
+	*set = '\0';
+	*len = set - result;
+	return result;
+}
+
+static int is_cone_pattern(const char *pattern, size_t patternlen)
+{
+	const char *prev, *cur, *next;
+
+	if (patternlen < 2 || *pattern == '*' || strstr(pattern, "**"))
+		return 0;
+
+	for (prev = pattern, cur = pattern + 1, next = pattern + 2;
+	     cur < pattern + patternlen;
+	     prev++, cur++, next++) {
+		/* Watch for glob characters '*', '\', '[', '?' */
+		if (!is_glob_special(*cur))
+			continue;
+		/* But only if they are not escaped */
+		if (*prev == '\\')
+			continue;
+		/* ... or escape another glob character */
+		if (*cur == '\\' && is_glob_special(*next))
+			continue;
+		/* A trailing asterisk after a slash is fine, too */
+		if (*prev == '/' && *cur == '*' &&
+		    next == pattern + patternlen)
+			continue;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Sort a pattern of a cone mode sparse-checkout file into the
+ * recursive or parent hashset of the exclude list, or give up on
+ * cone mode for this list if the pattern does not fit.  See "Cone
+ * pattern set" in Documentation/git-read-tree.txt:
+ *
+ *  - the patterns including everything at the root, and then
+ *    excluding all directories, only include the files at the root;
+ *  - "/A/B/" includes everything under A/B;
+ *  - a negative pattern excluding the directories inside A/B,
+ *    following "/A/B/", turns A/B into a parent directory, of which
+ *    only the files (and the subdirectories that are listed
+ *    themselves) are included.
+ */
+static void add_exclude_to_hashsets(struct exclude_list *el, struct exclude *x)
+{
+	struct pattern_entry *e;
+	struct pattern_entry *existing;
+	char *pattern;
+	size_t len;
+
+	if (!el->use_cone_patterns)
+		return;
+
+	if (!el->recursive_hashmap.cmpfn) {
+		hashmap_init(&el->recursive_hashmap, pattern_entry_cmp, 0);
+		hashmap_init(&el->parent_hashmap, pattern_entry_cmp, 0);
+	}
+
+	if ((x->flags & EXC_FLAG_NEGATIVE) &&
+	    (x->flags & EXC_FLAG_MUSTBEDIR) &&
+	    x->patternlen == 2 && !strncmp(x->pattern, "/*", 2)) {
+		el->full_cone = 0;
+		return;
+	}
+
+	if (!x->flags && x->patternlen == 2 && !strncmp(x->pattern, "/*", 2)) {
+		el->full_cone = 1;
+		return;
+	}
+
+	if (!is_cone_pattern(x->pattern, x->patternlen) ||
+	    *x->pattern != '/') {
+		warning(_("unrecognized pattern: '%s'"), x->pattern);
+		goto clear_hashmaps;
+	}
+
+	pattern = dup_and_filter_pattern(x->pattern, &len);
+	e = xmalloc(sizeof(*e));
+	init_pattern_entry(e, pattern, len);
+
+	if (x->patternlen > 2 &&
+	    !strcmp(x->pattern + x->patternlen - 2, "/*")) {
+		if (!(x->flags & EXC_FLAG_NEGATIVE)) {
+			warning(_("unrecognized pattern: '%s'"), x->pattern);
+			goto free_entry;
+		}
+
+		existing = hashmap_remove(&el->recursive_hashmap, e, NULL);
+		if (!existing) {
+			/* We did not see the "parent" included */
+			warning(_("unrecognized negative pattern: '%s'"),
+				x->pattern);
+			goto free_entry;
+		}
+		free(existing->pattern);
+		free(existing);
+		hashmap_add(&el->parent_hashmap, e);
+		return;
+	}
+
+	if (x->flags & EXC_FLAG_NEGATIVE) {
+		warning(_("unrecognized negative pattern: '%s'"), x->pattern);
+		goto free_entry;
+	}
+
+	if (hashmap_get(&el->parent_hashmap, e, NULL)) {
+		/* we already included this at the parent level */
+		warning(_("your sparse-checkout file may have issues: "
+			  "pattern '%s' is repeated"), x->pattern);
+		goto free_entry;
+	}
+	hashmap_add(&el->recursive_hashmap, e);
+	return;
+
+free_entry:
+	free(e->pattern);
+	free(e);
+clear_hashmaps:
+	warning(_("disabling cone pattern matching"));
+	free_pattern_hashmap(&el->parent_hashmap);
+	free_pattern_hashmap(&el->recursive_hashmap);
+	el->use_cone_patterns = 0;
+}
+
+static int hashmap_contains_path(struct hashmap *map,
+				 const char *path, size_t len)
+{
+	struct pattern_entry e;
+
+	init_pattern_entry(&e, (char *)path, len);
+	return !!hashmap_get(map, &e, NULL);
+}
+
+/*
+ * Is "path" (with a leading slash) in the recursive hashset, or
+ * is one of its leading directories?
+ */
+static int hashmap_contains_parent(struct hashmap *map,
+				   const char *path, size_t len)
+{
+	while (len) {
+		if (hashmap_contains_path(map, path, len))
+			return 1;
+		while (--len && path[len] != '/')
+			; /* nothing */
+	}
+	return 0;
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *el, int srcpos)
 {
@@ -585,6 +793,8 @@ void add_exclude(const char *string, const char *base,
 	ALLOC_GROW(el->excludes, el->nr + 1, el->alloc);
 	el->excludes[el->nr++] = x;
 	x->el = el;
+
+	add_exclude_to_hashsets(el, x);
 }
 
 static void *read_skip_worktree_file_from_index(const char *path, size_t *size,
@@ -626,6 +836,8 @@ void clear_exclude_list(struct exclude_list *el)
 		free(el->excludes[i]);
 	free(el->excludes);
 	free(el->filebuf);
+	free_pattern_hashmap(&el->recursive_hashmap);
+	free_pattern_hashmap(&el->parent_hashmap);
 
 	memset(el, 0, sizeof(*el));
 }
@@ -1002,17 +1214,65 @@ static struct exclude *last_exclude_matching_from_list(const char *pathname,
 
 /*
  * Scan the list and let the last match determine the fate.
- * Return 1 for exclude, 0 for include and -1 for undecided.
+ * Return MATCHED for exclude, NOT_MATCHED for include and UNDECIDED
+ * for undecided.
+ *
+ * With cone patterns, the decision is made by looking up the path
+ * and its leading directories in the hashsets instead, and is never
+ * UNDECIDED.  Directories that are included recursively are
+ * reported as MATCHED_RECURSIVE.
  */
-int is_excluded_from_list(const char *pathname,
-			  int pathlen, const char *basename, int *dtype,
-			  struct exclude_list *el)
+enum pattern_match_result is_excluded_from_list(const char *pathname,
+						int pathlen,
+						const char *basename,
+						int *dtype,
+						struct exclude_list *el)
 {
 	struct exclude *exclude;
-	exclude = last_exclude_matching_from_list(pathname, pathlen, basename, dtype, el);
-	if (exclude)
-		return exclude->flags & EXC_FLAG_NEGATIVE ? 0 : 1;
-	return -1; /* undecided */
+	struct strbuf path = STRBUF_INIT;
+	enum pattern_match_result result = NOT_MATCHED;
+	const char *slash;
+
+	if (!el->use_cone_patterns) {
+		exclude = last_exclude_matching_from_list(pathname, pathlen,
+							  basename, dtype, el);
+		if (exclude)
+			return exclude->flags & EXC_FLAG_NEGATIVE ?
+				NOT_MATCHED : MATCHED;
+		return UNDECIDED;
+	}
+
+	if (el->full_cone)
+		return MATCHED;
+
+	strbuf_addch(&path, '/');
+	strbuf_add(&path, pathname, pathlen);
+
+	if (hashmap_contains_path(&el->recursive_hashmap, path.buf, path.len)) {
+		result = MATCHED_RECURSIVE;
+		goto done;
+	}
+
+	slash = strrchr(path.buf, '/');
+	if (slash == path.buf) {
+		/* include every file in root */
+		result = MATCHED;
+		goto done;
+	}
+
+	if (hashmap_contains_path(&el->parent_hashmap,
+				  path.buf, slash - path.buf)) {
+		result = MATCHED;
+		goto done;
+	}
+
+	if (hashmap_contains_parent(&el->recursive_hashmap,
+				    path.buf, slash - path.buf))
+		result = MATCHED_RECURSIVE;
+
+done:
+	strbuf_release(&path);
+	return result;
 }
 
 static struct exclude *last_exclude_matching_from_lists(struct dir_struct *dir,
@@ -1652,17 +1912,24 @@ static int valid_cached_dir(struct dir_struct *dir,
 	if (!untracked)
 		return 0;
 
-	if (stat(path->len ? path->buf : ".", &st)) {
-		invalidate_directory(dir->untracked, untracked);
-		memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
-		return 0;
-	}
-	if (!untracked->valid ||
-	    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
-		if (untracked->valid)
+	/*
+	 * With fsmonitor, we can trust the untracked cache's valid field:
+	 * any change below this directory has already invalidated it.
+	 */
+	refresh_fsmonitor(&the_index);
+	if (!(dir->untracked->use_fsmonitor && untracked->valid)) {
+		if (stat(path->len ? path->buf : ".", &st)) {
 			invalidate_directory(dir->untracked, untracked);
-		fill_stat_data(&untracked->stat_data, &st);
-		return 0;
+			memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
+			return 0;
+		}
+		if (!untracked->valid ||
+		    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
+			if (untracked->valid)
+				invalidate_directory(dir->untracked, untracked);
+			fill_stat_data(&untracked->stat_data, &st);
+			return 0;
+		}
 	}
 
 	if (untracked->check_only != !!check_only) {
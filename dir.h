@@ -54,6 +54,38 @@ struct exclude_list {
 	const char *src;
 
 	struct exclude **excludes;
+
+	/*
+	 * While scanning the excludes, we attempt to match the patterns
+	 * with a more restricted set ("cone" patterns) that allows us to
+	 * use hashsets for matching logic, which is faster than the
+	 * linear lookup in the excludes array above.  The caller sets
+	 * use_cone_patterns before adding patterns; it is reset if a
+	 * pattern is not a cone pattern.
+	 */
+	unsigned use_cone_patterns;
+	unsigned full_cone;
+
+	/*
+	 * Stores paths where everything starting with those paths
+	 * is included.
+	 */
+	struct hashmap recursive_hashmap;
+
+	/*
+	 * Used to check single-level parents of blobs.
+	 */
+	struct hashmap parent_hashmap;
+};
+
+/*
+ * An entry of the cone pattern hashsets of an exclude_list: a
+ * directory, with a leading slash and without a trailing one.
+ */
+struct pattern_entry {
+	struct hashmap_entry ent;
+	char *pattern;
+	size_t patternlen;
 };
 
 /*
@@ -134,6 +166,11 @@ struct untracked_cache {
 	 */
 	unsigned dir_flags;
 	struct untracked_cache_dir *root;
+	/*
+	 * Set when an fsmonitor reports every change in the work tree,
+	 * so that a valid directory need not be stat()ed to be trusted.
+	 */
+	int use_fsmonitor;
 	/* Statistics */
 	int dir_created;
 	int gitignore_invalidated;
@@ -217,8 +254,22 @@ extern int within_depth(const char *name, int namelen, int depth, int max_depth)
 extern int fill_directory(struct dir_struct *dir, const struct pathspec *pathspec);
 extern int read_directory(struct dir_struct *, const char *path, int len, const struct pathspec *pathspec);
 
-extern int is_excluded_from_list(const char *pathname, int pathlen, const char *basename,
-				 int *dtype, struct exclude_list *el);
+enum pattern_match_result {
+	UNDECIDED = -1,
+	NOT_MATCHED = 0,
+	MATCHED = 1,
+	/*
+	 * With cone patterns, the path is a directory all of whose
+	 * contents match.
+	 */
+	MATCHED_RECURSIVE = 2
+};
+
+extern enum pattern_match_result is_excluded_from_list(const char *pathname,
+						       int pathlen,
+						       const char *basename,
+						       int *dtype,
+						       struct exclude_list *el);
 struct dir_entry *dir_add_ignored(struct dir_struct *dir, const char *pathname, int len);
 
 /*
@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "streaming.h"
 #include "submodule.h"
+#include "parallel-checkout.h"
 
 static void create_directories(const char *path, int path_len,
 			       const struct checkout *state)
@@ -216,14 +217,22 @@ static int write_entry(struct cache_entry *ce,
 
 finish:
 	if (state->refresh_cache) {
-		assert(state->istate);
 		if (!fstat_done)
 			lstat(ce->name, &st);
-		fill_stat_cache_info(ce, &st);
+		update_ce_after_write(state, ce, &st);
+	}
+	return 0;
+}
+
+void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+			   struct stat *st)
+{
+	if (state->refresh_cache) {
+		assert(state->istate);
+		fill_stat_cache_info(ce, st);
 		ce->ce_flags |= CE_UPDATE_IN_BASE;
 		state->istate->cache_changed |= CE_ENTRY_CHANGED;
 	}
-	return 0;
 }
 
 /*
@@ -319,5 +328,7 @@ int checkout_entry(struct cache_entry *ce,
 		return 0;
 
 	create_directories(path.buf, path.len, state);
+	if (!enqueue_checkout(ce, state))
+		return 0;
 	return write_entry(ce, path.buf, state, 0);
 }
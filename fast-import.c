@@ -166,6 +166,7 @@ Format of STDIN stream:
 #include "quote.h"
 #include "dir.h"
 #include "run-command.h"
+#include "thread-utils.h"
 
 #define PACK_ID_BITS 16
 #define MAX_PACK_ID ((1<<PACK_ID_BITS)-1)
@@ -200,6 +201,29 @@ struct mark_set {
 	unsigned int shift;
 };
 
+/*
+ * With --memory-limit, objects and marks are moved out of memory into
+ * sorted runs, which are files mapped back in and searched like pack
+ * indexes.  An object run is an array of "struct object_entry", sorted
+ * by object name and followed by a 256-entry fan-out table; a mark run
+ * is an array of "struct spilled_mark" sorted by mark.  The files only
+ * live as long as this process, so they are in its native layout.
+ */
+struct spilled_mark {
+	uintmax_t idnum;
+	struct object_entry e;
+};
+
+struct spill_run {
+	struct spill_run *next;
+	char *path;
+	void *map;
+	size_t len;
+	size_t nr;
+	void *records;
+	const uint32_t *fanout;
+};
+
 struct last_object {
 	struct strbuf data;
 	off_t offset;
@@ -284,6 +308,7 @@ static unsigned long max_depth = 10;
 static off_t max_packsize;
 static int unpack_limit = 100;
 static int force_update;
+static int num_threads = 1;
 
 /* Stats and misc. counters */
 static uintmax_t alloc_count;
@@ -324,6 +349,8 @@ static unsigned int object_entry_alloc = 5000;
 static struct object_entry_pool *blocks;
 static struct object_entry *object_table[1 << 16];
 static struct mark_set *marks;
+static uintmax_t entries_in_memory;
+static uintmax_t mark_sets_in_memory;
 static const char *export_marks_file;
 static const char *import_marks_file;
 static int import_marks_file_from_stream;
@@ -331,6 +358,12 @@ static int import_marks_file_ignore_missing;
 static int import_marks_file_done;
 static int relative_marks_paths;
 
+/* Objects and marks that were moved out of memory, newest run first */
+static unsigned long memory_limit;
+static unsigned long spill_count;
+static struct spill_run *object_runs;
+static struct spill_run *mark_runs;
+
 /* Our last blob */
 static struct last_object last_blob = { STRBUF_INIT, 0, 0, 0 };
 
@@ -403,7 +436,7 @@ static void write_branch_report(FILE *rpt, struct branch *b)
 	fputc('\n', rpt);
 }
 
-static void dump_marks_helper(FILE *, uintmax_t, struct mark_set *);
+static void write_marks(FILE *);
 
 static void write_crash_report(const char *err)
 {
@@ -483,7 +516,7 @@ static void write_crash_report(const char *err)
 	if (export_marks_file)
 		fprintf(rpt, "  exported to %s\n", export_marks_file);
 	else
-		dump_marks_helper(rpt, 0, marks);
+		write_marks(rpt);
 
 	fputc('\n', rpt);
 	fputs("-------------------\n", rpt);
@@ -493,8 +526,10 @@ static void write_crash_report(const char *err)
 }
 
 static void end_packfile(void);
+static int in_store_worker(void);
 static void unkeep_all_packs(void);
 static void dump_marks(void);
+static void drop_spill_runs(void);
 
 static NORETURN void die_nicely(const char *err, va_list params)
 {
@@ -506,12 +541,15 @@ static NORETURN void die_nicely(const char *err, va_list params)
 	fputs(message, stderr);
 	fputc('\n', stderr);
 
+	if (in_store_worker())
+		exit(128);
 	if (!zombie) {
 		zombie = 1;
 		write_crash_report(message);
 		end_packfile();
 		unkeep_all_packs();
 		dump_marks();
+		drop_spill_runs();
 	}
 	exit(128);
 }
@@ -563,10 +601,57 @@ static struct object_entry *new_object(unsigned char *sha1)
 		alloc_objects(object_entry_alloc);
 
 	e = blocks->next_free++;
+	entries_in_memory++;
 	hashcpy(e->idx.sha1, sha1);
 	return e;
 }
 
+static struct object_entry *find_spilled_object(const unsigned char *sha1)
+{
+	struct spill_run *r;
+
+	for (r = object_runs; r; r = r->next) {
+		struct object_entry *entries = r->records;
+		uint32_t lo = sha1[0] ? r->fanout[sha1[0] - 1] : 0;
+		uint32_t hi = r->fanout[sha1[0]];
+
+		while (lo < hi) {
+			uint32_t mi = lo + (hi - lo) / 2;
+			int cmp = hashcmp(sha1, entries[mi].idx.sha1);
+
+			if (!cmp)
+				return &entries[mi];
+			if (cmp < 0)
+				hi = mi;
+			else
+				lo = mi + 1;
+		}
+	}
+	return NULL;
+}
+
+static struct object_entry *find_spilled_mark(uintmax_t idnum)
+{
+	struct spill_run *r;
+
+	for (r = mark_runs; r; r = r->next) {
+		struct spilled_mark *m = r->records;
+		size_t lo = 0, hi = r->nr;
+
+		while (lo < hi) {
+			size_t mi = lo + (hi - lo) / 2;
+
+			if (m[mi].idnum == idnum)
+				return &m[mi].e;
+			if (idnum < m[mi].idnum)
+				hi = mi;
+			else
+				lo = mi + 1;
+		}
+	}
+	return NULL;
+}
+
 static struct object_entry *find_object(unsigned char *sha1)
 {
 	unsigned int h = sha1[0] << 8 | sha1[1];
@@ -574,7 +659,7 @@ static struct object_entry *find_object(unsigned char *sha1)
 	for (e = object_table[h]; e; e = e->next)
 		if (!hashcmp(sha1, e->idx.sha1))
 			return e;
-	return NULL;
+	return find_spilled_object(sha1);
 }
 
 static struct object_entry *insert_object(unsigned char *sha1)
@@ -587,6 +672,9 @@ static struct object_entry *insert_object(unsigned char *sha1)
 			return e;
 		e = e->next;
 	}
+	e = find_spilled_object(sha1);
+	if (e)
+		return e;
 
 	e = new_object(sha1);
 	e->next = object_table[h];
@@ -677,25 +765,31 @@ static char *pool_strdup(const char *s)
 	return r;
 }
 
+static struct mark_set *new_mark_set(unsigned int shift)
+{
+	struct mark_set *s = xcalloc(1, sizeof(struct mark_set));
+	s->shift = shift;
+	mark_sets_in_memory++;
+	return s;
+}
+
 static void insert_mark(uintmax_t idnum, struct object_entry *oe)
 {
+	uintmax_t orig_idnum = idnum;
 	struct mark_set *s = marks;
 	while ((idnum >> s->shift) >= 1024) {
-		s = pool_calloc(1, sizeof(struct mark_set));
-		s->shift = marks->shift + 10;
+		s = new_mark_set(marks->shift + 10);
 		s->data.sets[0] = marks;
 		marks = s;
 	}
 	while (s->shift) {
 		uintmax_t i = idnum >> s->shift;
 		idnum -= i << s->shift;
-		if (!s->data.sets[i]) {
-			s->data.sets[i] = pool_calloc(1, sizeof(struct mark_set));
-			s->data.sets[i]->shift = s->shift - 10;
-		}
+		if (!s->data.sets[i])
+			s->data.sets[i] = new_mark_set(s->shift - 10);
 		s = s->data.sets[i];
 	}
-	if (!s->data.marked[idnum])
+	if (!s->data.marked[idnum] && !find_spilled_mark(orig_idnum))
 		marks_set_count++;
 	s->data.marked[idnum] = oe;
 }
@@ -714,6 +808,8 @@ static struct object_entry *find_mark(uintmax_t idnum)
 		if (s)
 			oe = s->data.marked[idnum];
 	}
+	if (!oe)
+		oe = find_spilled_mark(orig_idnum);
 	if (!oe)
 		die("mark :%" PRIuMAX " not declared", orig_idnum);
 	return oe;
@@ -994,6 +1090,360 @@ static int loosen_small_pack(const struct packed_git *p)
 	return run_command(&unpack);
 }
 
+static void *deflate_object(const void *buf, unsigned long len,
+			    unsigned long *out_len)
+{
+	git_zstream s;
+	void *out;
+
+	git_deflate_init(&s, pack_compression_level);
+	s.next_in = (void *)buf;
+	s.avail_in = len;
+	s.avail_out = git_deflate_bound(&s, s.avail_in);
+	s.next_out = out = xmalloc(s.avail_out);
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	*out_len = s.total_out;
+	return out;
+}
+
+/*
+ * Append the deflated "out" to the pack as the data of "e".  If "delta"
+ * is set, it is a delta of "size" bytes against the object last stored
+ * through "last", otherwise the object itself, which is "size" bytes.
+ */
+static void write_object(struct object_entry *e, enum object_type type,
+			 unsigned long size, int delta,
+			 const void *out, unsigned long out_len,
+			 struct last_object *last)
+{
+	unsigned char hdr[96];
+	unsigned long hdrlen;
+
+	e->type = type;
+	e->pack_id = pack_id;
+	e->idx.offset = pack_size;
+	object_count++;
+	object_count_by_type[type]++;
+
+	crc32_begin(pack_file);
+
+	if (delta) {
+		off_t ofs = e->idx.offset - last->offset;
+		unsigned pos = sizeof(hdr) - 1;
+
+		delta_count_by_type[type]++;
+		e->depth = last->depth + 1;
+
+		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+						      OBJ_OFS_DELTA, size);
+		sha1write(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+
+		hdr[pos] = ofs & 127;
+		while (ofs >>= 7)
+			hdr[--pos] = 128 | (--ofs & 127);
+		sha1write(pack_file, hdr + pos, sizeof(hdr) - pos);
+		pack_size += sizeof(hdr) - pos;
+	} else {
+		e->depth = 0;
+		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+						      type, size);
+		sha1write(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+	}
+
+	sha1write(pack_file, out, out_len);
+	pack_size += out_len;
+
+	e->idx.crc32 = crc32_end(pack_file);
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * With --threads, blobs, commits and tags are deltified and deflated
+ * by worker threads while the main thread goes on parsing the stream.
+ * The main thread still hashes each object as soon as it is read, as
+ * marks, duplicates and trees need the object names right away, and it
+ * writes the objects to the pack in the order they were read, making
+ * the same decisions store_object() would, so that the pack is exactly
+ * the one a single thread would have written.
+ *
+ * Trees are stored by the main thread itself after the queue has been
+ * flushed, as are all objects when packs are limited in size, since
+ * where a pack ends depends on the size of every object before it.
+ */
+struct store_job {
+	struct object_entry *e;
+	enum object_type type;
+	struct last_object *last;
+	struct strbuf data;
+	struct strbuf base;
+	int try_delta;
+	int done;
+	void *delta;
+	unsigned long delta_len;
+	void *out;
+	unsigned long out_len;
+};
+
+#define STORE_QUEUE_JOBS_PER_THREAD 16
+#define STORE_QUEUE_BYTES (64 * 1024 * 1024)
+
+static struct store_job *store_queue;
+static unsigned int store_queue_alloc;
+/*
+ * Jobs are written out from "head", taken by a worker from "next" and
+ * added at "tail"; the counters only ever grow.
+ */
+static unsigned int store_queue_head;
+static unsigned int store_queue_next;
+static unsigned int store_queue_tail;
+static size_t store_queue_bytes;
+static int store_threads_exit;
+static int nr_store_threads;
+static pthread_t *store_threads;
+static pthread_t store_main_thread;
+static pthread_mutex_t store_mutex;
+static pthread_cond_t store_work_cond;
+static pthread_cond_t store_done_cond;
+
+static void *store_worker(void *unused)
+{
+	pthread_mutex_lock(&store_mutex);
+	for (;;) {
+		struct store_job *job;
+
+		while (store_queue_next == store_queue_tail && !store_threads_exit)
+			pthread_cond_wait(&store_work_cond, &store_mutex);
+		if (store_queue_next == store_queue_tail)
+			break;
+		job = &store_queue[store_queue_next++ % store_queue_alloc];
+		pthread_mutex_unlock(&store_mutex);
+
+		if (job->try_delta)
+			job->delta = diff_delta(job->base.buf, job->base.len,
+						job->data.buf, job->data.len,
+						&job->delta_len, job->data.len - 20);
+		if (job->delta)
+			job->out = deflate_object(job->delta, job->delta_len,
+						  &job->out_len);
+		else
+			job->out = deflate_object(job->data.buf, job->data.len,
+						  &job->out_len);
+
+		pthread_mutex_lock(&store_mutex);
+		job->done = 1;
+		pthread_cond_signal(&store_done_cond);
+	}
+	pthread_mutex_unlock(&store_mutex);
+	return NULL;
+}
+
+static int use_store_threads(void)
+{
+	int i;
+
+	if (store_threads)
+		return 1;
+	if (num_threads == 1 || max_packsize)
+		return 0;
+	if (!num_threads)
+		num_threads = online_cpus();
+	if (num_threads <= 1)
+		return 0;
+
+	/* the main thread is busy parsing and writing */
+	nr_store_threads = num_threads - 1;
+	store_queue_alloc = num_threads * STORE_QUEUE_JOBS_PER_THREAD;
+	store_queue = xcalloc(store_queue_alloc, sizeof(*store_queue));
+	for (i = 0; i < store_queue_alloc; i++) {
+		strbuf_init(&store_queue[i].data, 0);
+		strbuf_init(&store_queue[i].base, 0);
+	}
+
+	store_main_thread = pthread_self();
+	pthread_mutex_init(&store_mutex, NULL);
+	pthread_cond_init(&store_work_cond, NULL);
+	pthread_cond_init(&store_done_cond, NULL);
+	ALLOC_ARRAY(store_threads, nr_store_threads);
+	for (i = 0; i < nr_store_threads; i++) {
+		int err = pthread_create(&store_threads[i], NULL,
+					 store_worker, NULL);
+		if (err)
+			die("unable to create thread: %s", strerror(err));
+	}
+	return 1;
+}
+
+static int in_store_worker(void)
+{
+	return store_threads && !pthread_equal(pthread_self(), store_main_thread);
+}
+
+static int store_job_done(struct store_job *job)
+{
+	int done;
+
+	pthread_mutex_lock(&store_mutex);
+	done = job->done;
+	pthread_mutex_unlock(&store_mutex);
+	return done;
+}
+
+/* Write the oldest queued object to the pack, waiting for it if needed. */
+static void write_queued_object(void)
+{
+	struct store_job *job = &store_queue[store_queue_head % store_queue_alloc];
+	struct last_object *last = job->last;
+	int delta = 0;
+
+	pthread_mutex_lock(&store_mutex);
+	while (!job->done)
+		pthread_cond_wait(&store_done_cond, &store_mutex);
+	pthread_mutex_unlock(&store_mutex);
+	store_queue_head++;
+
+	if (job->try_delta && last->depth < max_depth) {
+		delta_count_attempts_by_type[job->type]++;
+		delta = !!job->delta;
+	} else if (job->delta) {
+		/* the chain got too deep while this job was waiting */
+		free(job->out);
+		job->out = deflate_object(job->data.buf, job->data.len,
+					  &job->out_len);
+	}
+
+	write_object(job->e, job->type,
+		     delta ? job->delta_len : job->data.len, delta,
+		     job->out, job->out_len, last);
+	if (last) {
+		last->offset = job->e->idx.offset;
+		last->depth = job->e->depth;
+	}
+
+	store_queue_bytes -= job->data.len + job->base.len;
+	strbuf_release(&job->data);
+	strbuf_release(&job->base);
+	free(job->delta);
+	job->delta = NULL;
+	free(job->out);
+	job->out = NULL;
+	job->done = 0;
+}
+
+static void flush_store_queue(void)
+{
+	if (!store_threads || in_store_worker())
+		return;
+	while (store_queue_head != store_queue_tail)
+		write_queued_object();
+}
+
+/*
+ * Queue "dat", whose entry "e" was just created, for writing.  Like
+ * store_object(), this takes over the contents of "dat".
+ */
+static void queue_object(enum object_type type, struct strbuf *dat,
+			 struct last_object *last, struct object_entry *e)
+{
+	struct store_job *job;
+
+	while (store_queue_head != store_queue_tail &&
+	       (store_queue_tail - store_queue_head == store_queue_alloc ||
+		store_queue_bytes > STORE_QUEUE_BYTES))
+		write_queued_object();
+
+	job = &store_queue[store_queue_tail % store_queue_alloc];
+	job->e = e;
+	job->type = type;
+	job->last = last;
+	job->try_delta = last && last->data.buf && dat->len > 20;
+	if (last) {
+		/*
+		 * "last" keeps the object for the next one to be deltified
+		 * against, and the job keeps the one before it.
+		 */
+		strbuf_swap(&last->data, dat);
+		strbuf_addbuf(&job->data, &last->data);
+		if (job->try_delta)
+			strbuf_swap(&job->base, dat);
+	} else {
+		strbuf_swap(&job->data, dat);
+	}
+	store_queue_bytes += job->data.len + job->base.len;
+
+	e->type = type;
+	e->pack_id = pack_id;
+	e->idx.offset = 1; /* just not zero, until it is written */
+
+	pthread_mutex_lock(&store_mutex);
+	store_queue_tail++;
+	pthread_cond_signal(&store_work_cond);
+	pthread_mutex_unlock(&store_mutex);
+
+	while (store_queue_head != store_queue_tail &&
+	       store_job_done(&store_queue[store_queue_head % store_queue_alloc]))
+		write_queued_object();
+}
+
+static void stop_store_threads(void)
+{
+	int i;
+
+	if (!store_threads)
+		return;
+	flush_store_queue();
+
+	pthread_mutex_lock(&store_mutex);
+	store_threads_exit = 1;
+	pthread_cond_broadcast(&store_work_cond);
+	pthread_mutex_unlock(&store_mutex);
+	for (i = 0; i < nr_store_threads; i++)
+		pthread_join(store_threads[i], NULL);
+	free(store_threads);
+	store_threads = NULL;
+
+	pthread_mutex_destroy(&store_mutex);
+	pthread_cond_destroy(&store_work_cond);
+	pthread_cond_destroy(&store_done_cond);
+	for (i = 0; i < store_queue_alloc; i++) {
+		strbuf_release(&store_queue[i].data);
+		strbuf_release(&store_queue[i].base);
+	}
+	free(store_queue);
+	store_queue = NULL;
+}
+
+#else
+
+static int use_store_threads(void)
+{
+	return 0;
+}
+
+static int in_store_worker(void)
+{
+	return 0;
+}
+
+static void flush_store_queue(void)
+{
+}
+
+static void queue_object(enum object_type type, struct strbuf *dat,
+			 struct last_object *last, struct object_entry *e)
+{
+}
+
+static void stop_store_threads(void)
+{
+}
+
+#endif
+
 static void end_packfile(void)
 {
 	static int running;
@@ -1001,6 +1451,8 @@ static void end_packfile(void)
 	if (running || !pack_data)
 		return;
 
+	flush_store_queue();
+
 	running = 1;
 	clear_delta_base_cache();
 	if (object_count) {
@@ -1075,6 +1527,271 @@ static void cycle_packfile(void)
 	start_packfile();
 }
 
+struct run_writer {
+	int fd;
+	struct strbuf path;
+	struct strbuf buf;
+	size_t nr;
+	uint32_t fanout[256];
+};
+
+static void start_run(struct run_writer *w)
+{
+	strbuf_init(&w->path, 0);
+	strbuf_init(&w->buf, 0);
+	w->fd = odb_mkstemp(&w->path, "pack/tmp_spill_XXXXXX");
+	w->nr = 0;
+	memset(w->fanout, 0, sizeof(w->fanout));
+}
+
+static void write_run_record(struct run_writer *w, const void *rec, size_t len)
+{
+	strbuf_add(&w->buf, rec, len);
+	w->nr++;
+	if (w->buf.len >= 64 * 1024) {
+		write_or_die(w->fd, w->buf.buf, w->buf.len);
+		strbuf_reset(&w->buf);
+	}
+}
+
+static void write_spilled_object(struct run_writer *w,
+				 const struct object_entry *e)
+{
+	struct object_entry copy = *e;
+
+	copy.next = NULL;
+	w->fanout[e->idx.sha1[0]]++;
+	write_run_record(w, &copy, sizeof(copy));
+}
+
+static struct spill_run *finish_run(struct run_writer *w, size_t rec_size,
+				    int with_fanout)
+{
+	struct spill_run *r = xcalloc(1, sizeof(*r));
+	int i;
+
+	if (with_fanout) {
+		for (i = 1; i < ARRAY_SIZE(w->fanout); i++)
+			w->fanout[i] += w->fanout[i - 1];
+		strbuf_add(&w->buf, w->fanout, sizeof(w->fanout));
+	}
+	write_or_die(w->fd, w->buf.buf, w->buf.len);
+	strbuf_release(&w->buf);
+
+	r->nr = w->nr;
+	r->len = st_mult(r->nr, rec_size) + (with_fanout ? sizeof(w->fanout) : 0);
+	r->map = xmmap(NULL, r->len, PROT_READ, MAP_PRIVATE, w->fd, 0);
+	close(w->fd);
+	r->path = strbuf_detach(&w->path, NULL);
+	r->records = r->map;
+	if (with_fanout)
+		r->fanout = (const uint32_t *)((char *)r->map + r->nr * rec_size);
+	return r;
+}
+
+static void drop_run(struct spill_run *r)
+{
+	munmap(r->map, r->len);
+	unlink_or_warn(r->path);
+	free(r->path);
+	free(r);
+}
+
+static void drop_spill_runs(void)
+{
+	while (object_runs) {
+		struct spill_run *next = object_runs->next;
+		drop_run(object_runs);
+		object_runs = next;
+	}
+	while (mark_runs) {
+		struct spill_run *next = mark_runs->next;
+		drop_run(mark_runs);
+		mark_runs = next;
+	}
+}
+
+/*
+ * Runs are merged as soon as the one before is not much bigger than
+ * the newest one, so that there are only logarithmically many of them
+ * to search.
+ */
+static void merge_object_runs(void)
+{
+	while (object_runs->next && object_runs->next->nr <= 2 * object_runs->nr) {
+		struct spill_run *newer = object_runs, *older = newer->next;
+		struct object_entry *a = newer->records, *b = older->records;
+		size_t i = 0, j = 0;
+		struct run_writer w;
+
+		start_run(&w);
+		while (i < newer->nr || j < older->nr) {
+			if (j == older->nr ||
+			    (i < newer->nr && hashcmp(a[i].idx.sha1, b[j].idx.sha1) < 0))
+				write_spilled_object(&w, &a[i++]);
+			else
+				write_spilled_object(&w, &b[j++]);
+		}
+		object_runs = finish_run(&w, sizeof(struct object_entry), 1);
+		object_runs->next = older->next;
+		drop_run(newer);
+		drop_run(older);
+	}
+}
+
+static void merge_mark_runs(void)
+{
+	while (mark_runs->next && mark_runs->next->nr <= 2 * mark_runs->nr) {
+		struct spill_run *newer = mark_runs, *older = newer->next;
+		struct spilled_mark *a = newer->records, *b = older->records;
+		size_t i = 0, j = 0;
+		struct run_writer w;
+
+		start_run(&w);
+		while (i < newer->nr || j < older->nr) {
+			if (j == older->nr ||
+			    (i < newer->nr && a[i].idnum <= b[j].idnum)) {
+				/* a mark set again overrides the older one */
+				if (j < older->nr && a[i].idnum == b[j].idnum)
+					j++;
+				write_run_record(&w, &a[i++], sizeof(*a));
+			} else {
+				write_run_record(&w, &b[j++], sizeof(*b));
+			}
+		}
+		mark_runs = finish_run(&w, sizeof(struct spilled_mark), 0);
+		mark_runs->next = older->next;
+		drop_run(newer);
+		drop_run(older);
+	}
+}
+
+static int entry_sha1_cmp(const void *a_, const void *b_)
+{
+	const struct object_entry *a = *(const struct object_entry **)a_;
+	const struct object_entry *b = *(const struct object_entry **)b_;
+	return hashcmp(a->idx.sha1, b->idx.sha1);
+}
+
+static void spill_objects(void)
+{
+	struct object_entry **sorted, *e;
+	struct spill_run *r;
+	struct run_writer w;
+	size_t nr = 0, i;
+	unsigned int h;
+
+	for (h = 0; h < ARRAY_SIZE(object_table); h++)
+		for (e = object_table[h]; e; e = e->next)
+			nr++;
+	if (!nr)
+		return;
+
+	ALLOC_ARRAY(sorted, nr);
+	i = 0;
+	for (h = 0; h < ARRAY_SIZE(object_table); h++)
+		for (e = object_table[h]; e; e = e->next)
+			sorted[i++] = e;
+	QSORT(sorted, nr, entry_sha1_cmp);
+
+	start_run(&w);
+	for (i = 0; i < nr; i++)
+		write_spilled_object(&w, sorted[i]);
+	free(sorted);
+	r = finish_run(&w, sizeof(struct object_entry), 1);
+	r->next = object_runs;
+	object_runs = r;
+	merge_object_runs();
+
+	while (blocks) {
+		struct object_entry_pool *next = blocks->next_pool;
+		free(blocks);
+		blocks = next;
+	}
+	memset(object_table, 0, sizeof(object_table));
+	entries_in_memory = 0;
+	alloc_objects(object_entry_alloc);
+}
+
+static void collect_marks(struct spilled_mark **list, size_t *nr, size_t *alloc,
+			  uintmax_t base, struct mark_set *m)
+{
+	uintmax_t k;
+
+	for (k = 0; k < 1024; k++) {
+		if (m->shift) {
+			if (m->data.sets[k])
+				collect_marks(list, nr, alloc, base + (k << m->shift),
+					      m->data.sets[k]);
+		} else if (m->data.marked[k]) {
+			ALLOC_GROW(*list, *nr + 1, *alloc);
+			(*list)[*nr].idnum = base + k;
+			(*list)[*nr].e = *m->data.marked[k];
+			(*nr)++;
+		}
+	}
+}
+
+static void free_mark_set(struct mark_set *m)
+{
+	uintmax_t k;
+
+	if (m->shift)
+		for (k = 0; k < 1024; k++)
+			if (m->data.sets[k])
+				free_mark_set(m->data.sets[k]);
+	free(m);
+}
+
+static void spill_marks(void)
+{
+	struct spilled_mark *list = NULL;
+	size_t nr = 0, alloc = 0, i;
+	unsigned int shift = marks->shift;
+	struct spill_run *r;
+	struct run_writer w;
+
+	collect_marks(&list, &nr, &alloc, 0, marks);
+	if (!nr)
+		return;
+
+	start_run(&w);
+	for (i = 0; i < nr; i++)
+		write_run_record(&w, &list[i], sizeof(*list));
+	free(list);
+	r = finish_run(&w, sizeof(struct spilled_mark), 0);
+	r->next = mark_runs;
+	mark_runs = r;
+	merge_mark_runs();
+
+	free_mark_set(marks);
+	mark_sets_in_memory = 0;
+	marks = new_mark_set(shift);
+}
+
+/*
+ * Move all objects and marks out of memory once they take more than
+ * --memory-limit.  This ends the current packfile first, as objects
+ * stay in memory until the index of their pack is written.  It must
+ * only be called between commands, when nobody holds on to an entry.
+ */
+static void check_memory_limit(void)
+{
+	if (!memory_limit ||
+	    entries_in_memory * sizeof(struct object_entry) +
+	    mark_sets_in_memory * sizeof(struct mark_set) <= memory_limit)
+		return;
+
+	/* queued objects are only counted once they are written */
+	flush_store_queue();
+	if (object_count)
+		cycle_packfile();
+	/* marks may point to entries, so they go first */
+	spill_marks();
+	spill_objects();
+	spill_count++;
+}
+
 static int store_object(
 	enum object_type type,
 	struct strbuf *dat,
@@ -1086,9 +1803,8 @@ static int store_object(
 	struct object_entry *e;
 	unsigned char hdr[96];
 	unsigned char sha1[20];
-	unsigned long hdrlen, deltalen;
+	unsigned long hdrlen, deltalen, outlen;
 	git_SHA_CTX c;
-	git_zstream s;
 
 	hdrlen = xsnprintf((char *)hdr, sizeof(hdr), "%s %lu",
 			   typename(type), (unsigned long)dat->len) + 1;
@@ -1113,6 +1829,12 @@ static int store_object(
 		return 1;
 	}
 
+	if ((!last || last == &last_blob) && use_store_threads()) {
+		queue_object(type, dat, last, e);
+		return 0;
+	}
+	flush_store_queue();
+
 	if (last && last->data.buf && last->depth < max_depth && dat->len > 20) {
 		delta_count_attempts_by_type[type]++;
 		delta = diff_delta(last->data.buf, last->data.len,
@@ -1121,23 +1843,14 @@ static int store_object(
 	} else
 		delta = NULL;
 
-	git_deflate_init(&s, pack_compression_level);
-	if (delta) {
-		s.next_in = delta;
-		s.avail_in = deltalen;
-	} else {
-		s.next_in = (void *)dat->buf;
-		s.avail_in = dat->len;
-	}
-	s.avail_out = git_deflate_bound(&s, s.avail_in);
-	s.next_out = out = xmalloc(s.avail_out);
-	while (git_deflate(&s, Z_FINISH) == Z_OK)
-		; /* nothing */
-	git_deflate_end(&s);
+	if (delta)
+		out = deflate_object(delta, deltalen, &outlen);
+	else
+		out = deflate_object(dat->buf, dat->len, &outlen);
 
 	/* Determine if we should auto-checkpoint. */
-	if ((max_packsize && (pack_size + 60 + s.total_out) > max_packsize)
-		|| (pack_size + 60 + s.total_out) < pack_size) {
+	if ((max_packsize && (pack_size + 60 + outlen) > max_packsize)
+		|| (pack_size + 60 + outlen) < pack_size) {
 
 		/* This new object needs to *not* have the current pack_id. */
 		e->pack_id = pack_id + 1;
@@ -1148,54 +1861,13 @@ static int store_object(
 			free(delta);
 			delta = NULL;
 
-			git_deflate_init(&s, pack_compression_level);
-			s.next_in = (void *)dat->buf;
-			s.avail_in = dat->len;
-			s.avail_out = git_deflate_bound(&s, s.avail_in);
-			s.next_out = out = xrealloc(out, s.avail_out);
-			while (git_deflate(&s, Z_FINISH) == Z_OK)
-				; /* nothing */
-			git_deflate_end(&s);
+			free(out);
+			out = deflate_object(dat->buf, dat->len, &outlen);
 		}
 	}
 
-	e->type = type;
-	e->pack_id = pack_id;
-	e->idx.offset = pack_size;
-	object_count++;
-	object_count_by_type[type]++;
-
-	crc32_begin(pack_file);
-
-	if (delta) {
-		off_t ofs = e->idx.offset - last->offset;
-		unsigned pos = sizeof(hdr) - 1;
-
-		delta_count_by_type[type]++;
-		e->depth = last->depth + 1;
-
-		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
-						      OBJ_OFS_DELTA, deltalen);
-		sha1write(pack_file, hdr, hdrlen);
-		pack_size += hdrlen;
-
-		hdr[pos] = ofs & 127;
-		while (ofs >>= 7)
-			hdr[--pos] = 128 | (--ofs & 127);
-		sha1write(pack_file, hdr + pos, sizeof(hdr) - pos);
-		pack_size += sizeof(hdr) - pos;
-	} else {
-		e->depth = 0;
-		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
-						      type, dat->len);
-		sha1write(pack_file, hdr, hdrlen);
-		pack_size += hdrlen;
-	}
-
-	sha1write(pack_file, out, s.total_out);
-	pack_size += s.total_out;
-
-	e->idx.crc32 = crc32_end(pack_file);
+	write_object(e, type, delta ? deltalen : dat->len, !!delta,
+		     out, outlen, last);
 
 	free(out);
 	free(delta);
@@ -1232,6 +1904,8 @@ static void stream_blob(uintmax_t len, unsigned char *sha1out, uintmax_t mark)
 	struct sha1file_checkpoint checkpoint;
 	int status = Z_OK;
 
+	flush_store_queue();
+
 	/* Determine if we should auto-checkpoint. */
 	if ((max_packsize && (pack_size + 60 + len) > max_packsize)
 		|| (pack_size + 60 + len) < pack_size)
@@ -1346,6 +2020,8 @@ static void *gfi_unpack_entry(
 {
 	enum object_type type;
 	struct packed_git *p = all_packs[oe->pack_id];
+
+	flush_store_queue();
 	if (p == pack_data && p->pack_size < (pack_size + 20)) {
 		/* The object is stored in the packfile we are writing to
 		 * and we have modified it since the last time we scanned
@@ -1849,6 +2525,59 @@ static void dump_marks_helper(FILE *f,
 	}
 }
 
+/*
+ * Write out the marks in memory and in the runs, in order, the newest
+ * version of each.
+ */
+static void write_marks(FILE *f)
+{
+	struct mark_source {
+		struct spilled_mark *m;
+		size_t nr, pos;
+	} *src;
+	struct spilled_mark *list = NULL;
+	size_t nr = 0, alloc = 0, nr_src = 1, i;
+	struct spill_run *r;
+	uintmax_t idnum;
+
+	if (!mark_runs) {
+		dump_marks_helper(f, 0, marks);
+		return;
+	}
+
+	collect_marks(&list, &nr, &alloc, 0, marks);
+	for (r = mark_runs; r; r = r->next)
+		nr_src++;
+	src = xcalloc(nr_src, sizeof(*src));
+	src[0].m = list;
+	src[0].nr = nr;
+	for (r = mark_runs, i = 1; r; r = r->next, i++) {
+		src[i].m = r->records;
+		src[i].nr = r->nr;
+	}
+
+	for (;;) {
+		struct spilled_mark *next = NULL;
+
+		/* on ties the first, i.e. newest, source wins */
+		for (i = 0; i < nr_src; i++)
+			if (src[i].pos < src[i].nr &&
+			    (!next || src[i].m[src[i].pos].idnum < next->idnum))
+				next = &src[i].m[src[i].pos];
+		if (!next)
+			break;
+		idnum = next->idnum;
+		fprintf(f, ":%" PRIuMAX " %s\n", idnum,
+			sha1_to_hex(next->e.idx.sha1));
+		for (i = 0; i < nr_src; i++)
+			if (src[i].pos < src[i].nr &&
+			    src[i].m[src[i].pos].idnum == idnum)
+				src[i].pos++;
+	}
+	free(src);
+	free(list);
+}
+
 static void dump_marks(void)
 {
 	static struct lock_file mark_lock;
@@ -1872,7 +2601,7 @@ static void dump_marks(void)
 		return;
 	}
 
-	dump_marks_helper(f, 0, marks);
+	write_marks(f);
 	if (commit_lock_file(&mark_lock)) {
 		failure |= error_errno("Unable to write file %s",
 				       export_marks_file);
@@ -1915,6 +2644,7 @@ static void read_marks(void)
 			e->idx.offset = 1; /* just not zero! */
 		}
 		insert_mark(mark, e);
+		check_memory_limit();
 	}
 	fclose(f);
 done:
@@ -2126,6 +2856,7 @@ static void parse_and_store_blob(
 	if (parse_data(&buf, big_file_threshold, &len))
 		store_object(OBJ_BLOB, &buf, last, sha1out, mark);
 	else {
+		flush_store_queue();
 		if (last) {
 			strbuf_release(&last->data);
 			last->offset = 0;
@@ -3176,6 +3907,7 @@ static void parse_ls(const char *p, struct branch *b)
 static void checkpoint(void)
 {
 	checkpoint_requested = 0;
+	flush_store_queue();
 	if (object_count) {
 		cycle_packfile();
 		dump_branches();
@@ -3251,6 +3983,16 @@ static void option_depth(const char *depth)
 		die("--depth cannot exceed %u", MAX_DEPTH);
 }
 
+static void option_threads(const char *threads)
+{
+	num_threads = ulong_arg("--threads", threads);
+#ifdef NO_PTHREADS
+	if (num_threads != 1)
+		warning("no threads support, ignoring --threads");
+	num_threads = 1;
+#endif
+}
+
 static void option_active_branches(const char *branches)
 {
 	max_active_branches = ulong_arg("--active-branches", branches);
@@ -3298,8 +4040,13 @@ static int parse_one_option(const char *option)
 		if (!git_parse_ulong(option, &v))
 			return 0;
 		big_file_threshold = v;
+	} else if (skip_prefix(option, "memory-limit=", &option)) {
+		if (!git_parse_ulong(option, &memory_limit))
+			return 0;
 	} else if (skip_prefix(option, "depth=", &option)) {
 		option_depth(option);
+	} else if (skip_prefix(option, "threads=", &option)) {
+		option_threads(option);
 	} else if (skip_prefix(option, "active-branches=", &option)) {
 		option_active_branches(option);
 	} else if (skip_prefix(option, "export-pack-edges=", &option)) {
@@ -3394,11 +4141,25 @@ static void git_pack_config(void)
 	else if (!git_config_get_int("transfer.unpacklimit", &limit))
 		unpack_limit = limit;
 
+	git_config_get_ulong("fastimport.memorylimit", &memory_limit);
+
+	if (!git_config_get_int("fastimport.threads", &num_threads)) {
+		if (num_threads < 0)
+			git_die_config("fastimport.threads",
+				       "invalid number of threads specified (%d)",
+				       num_threads);
+#ifdef NO_PTHREADS
+		if (num_threads != 1)
+			warning("no threads support, ignoring fastimport.threads");
+		num_threads = 1;
+#endif
+	}
+
 	git_config(git_default_config, NULL);
 }
 
 static const char fast_import_usage[] =
-"git fast-import [--date-format=<f>] [--max-pack-size=<n>] [--big-file-threshold=<n>] [--depth=<n>] [--active-branches=<n>] [--export-marks=<marks.file>]";
+"git fast-import [--date-format=<f>] [--max-pack-size=<n>] [--big-file-threshold=<n>] [--memory-limit=<n>] [--depth=<n>] [--threads=<n>] [--active-branches=<n>] [--export-marks=<marks.file>]";
 
 static void parse_argv(void)
 {
@@ -3450,7 +4211,7 @@ int cmd_main(int argc, const char **argv)
 	atom_table = xcalloc(atom_table_sz, sizeof(struct atom_str*));
 	branch_table = xcalloc(branch_table_sz, sizeof(struct branch*));
 	avail_tree_table = xcalloc(avail_tree_table_sz, sizeof(struct avail_tree_content*));
-	marks = pool_calloc(1, sizeof(struct mark_set));
+	marks = new_mark_set(0);
 
 	global_argc = argc;
 	global_argv = argv;
@@ -3493,6 +4254,7 @@ int cmd_main(int argc, const char **argv)
 
 		if (checkpoint_requested)
 			checkpoint();
+		check_memory_limit();
 	}
 
 	/* argv hasn't been parsed yet, do so */
@@ -3503,11 +4265,13 @@ int cmd_main(int argc, const char **argv)
 		die("stream ends early");
 
 	end_packfile();
+	stop_store_threads();
 
 	dump_branches();
 	dump_tags();
 	unkeep_all_packs();
 	dump_marks();
+	drop_spill_runs();
 
 	if (pack_edges)
 		fclose(pack_edges);
@@ -3530,6 +4294,8 @@ int cmd_main(int argc, const char **argv)
 		fprintf(stderr, "Total branches:  %10lu (%10lu loads     )\n", branch_count, branch_load_count);
 		fprintf(stderr, "      marks:     %10" PRIuMAX " (%10" PRIuMAX " unique    )\n", (((uintmax_t)1) << marks->shift) * 1024, marks_set_count);
 		fprintf(stderr, "      atoms:     %10u\n", atom_cnt);
+		if (memory_limit)
+			fprintf(stderr, "      spills:    %10lu\n", spill_count);
 		fprintf(stderr, "Memory total:    %10" PRIuMAX " KiB\n", (total_allocd + alloc_count*sizeof(struct object_entry))/1024);
 		fprintf(stderr, "       pools:    %10lu KiB\n", (unsigned long)(total_allocd/1024));
 		fprintf(stderr, "     objects:    %10" PRIuMAX " KiB\n", (alloc_count*sizeof(struct object_entry))/1024);
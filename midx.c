@@ -0,0 +1,769 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "sha1-lookup.h"
+#include "midx.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_BYTE_FILE_VERSION 4
+#define MIDX_BYTE_HASH_VERSION 5
+#define MIDX_BYTE_NUM_CHUNKS 6
+#define MIDX_BYTE_NUM_PACKS 8
+#define MIDX_HASH_VERSION 1
+#define MIDX_HASH_LEN GIT_SHA1_RAWSZ
+#define MIDX_HEADER_SIZE 12
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_HASH_LEN)
+
+#define MIDX_MAX_CHUNKS 5
+#define MIDX_CHUNK_ALIGNMENT 4
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKLOOKUP_WIDTH (sizeof(uint32_t) + sizeof(uint64_t))
+#define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
+#define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
+#define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+static struct multi_pack_index *bad_midx(struct multi_pack_index *m,
+					 const char *midx_name,
+					 const char *reason)
+{
+	error("multi-pack-index file %s is corrupt: %s", midx_name, reason);
+	close_midx(m);
+	return NULL;
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	char *midx_name = get_midx_filename(object_dir);
+	const unsigned char *chunk_lookup, *names, *names_end = NULL;
+	uint64_t last_chunk_offset = 0;
+	uint32_t last_chunk_id = 0;
+	struct stat st;
+	size_t midx_size;
+	uint32_t i;
+	int fd;
+
+	fd = git_open(midx_name);
+	if (fd < 0)
+		goto cleanup_fail;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto cleanup_fail;
+	}
+	midx_size = xsize_t(st.st_size);
+	if (midx_size < MIDX_MIN_SIZE) {
+		close(fd);
+		error("multi-pack-index file %s is too small", midx_name);
+		goto cleanup_fail;
+	}
+
+	FLEX_ALLOC_STR(m, object_dir, object_dir);
+	m->data_len = midx_size;
+	m->data = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(m->data) != MIDX_SIGNATURE) {
+		m = bad_midx(m, midx_name, "bad signature");
+		goto cleanup_fail;
+	}
+	if (m->data[MIDX_BYTE_FILE_VERSION] != MIDX_VERSION) {
+		m = bad_midx(m, midx_name, "unsupported version");
+		goto cleanup_fail;
+	}
+	if (m->data[MIDX_BYTE_HASH_VERSION] != MIDX_HASH_VERSION) {
+		m = bad_midx(m, midx_name, "unsupported hash version");
+		goto cleanup_fail;
+	}
+	m->hash_len = MIDX_HASH_LEN;
+	m->num_chunks = m->data[MIDX_BYTE_NUM_CHUNKS];
+	m->num_packs = get_be32(m->data + MIDX_BYTE_NUM_PACKS);
+
+	if (MIDX_HEADER_SIZE + (m->num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH +
+	    MIDX_HASH_LEN > midx_size) {
+		m = bad_midx(m, midx_name, "truncated chunk table");
+		goto cleanup_fail;
+	}
+
+	chunk_lookup = m->data + MIDX_HEADER_SIZE;
+	for (i = 0; i <= m->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		uint64_t chunk_size = chunk_offset - last_chunk_offset;
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset < last_chunk_offset ||
+		    chunk_offset > midx_size - MIDX_HASH_LEN) {
+			m = bad_midx(m, midx_name, "improper chunk offset");
+			goto cleanup_fail;
+		}
+
+		switch (last_chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = m->data + last_chunk_offset;
+			names_end = m->chunk_pack_names + chunk_size;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (chunk_size != MIDX_CHUNK_FANOUT_SIZE) {
+				m = bad_midx(m, midx_name, "bad fanout size");
+				goto cleanup_fail;
+			}
+			m->chunk_oid_fanout = (const uint32_t *)(m->data + last_chunk_offset);
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = m->data + last_chunk_offset;
+			m->num_objects = chunk_size / m->hash_len;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = m->data + last_chunk_offset;
+			if (chunk_size != (uint64_t)m->num_objects * MIDX_CHUNK_OFFSET_WIDTH) {
+				m = bad_midx(m, midx_name, "bad object offsets size");
+				goto cleanup_fail;
+			}
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = m->data + last_chunk_offset;
+			m->num_large_offsets = chunk_size / MIDX_CHUNK_LARGE_OFFSET_WIDTH;
+			break;
+		}
+
+		last_chunk_id = chunk_id;
+		last_chunk_offset = chunk_offset;
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		m = bad_midx(m, midx_name, "missing required chunk");
+		goto cleanup_fail;
+	}
+	if (ntohl(m->chunk_oid_fanout[255]) != m->num_objects) {
+		m = bad_midx(m, midx_name, "fanout does not match object count");
+		goto cleanup_fail;
+	}
+	for (i = 1; i < 256; i++) {
+		if (ntohl(m->chunk_oid_fanout[i - 1]) > ntohl(m->chunk_oid_fanout[i])) {
+			m = bad_midx(m, midx_name, "fanout is not monotonic");
+			goto cleanup_fail;
+		}
+	}
+
+	ALLOC_ARRAY(m->pack_names, m->num_packs);
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+
+	names = m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const unsigned char *end = memchr(names, '\0', names_end - names);
+
+		if (!end) {
+			m = bad_midx(m, midx_name, "truncated pack names");
+			goto cleanup_fail;
+		}
+		m->pack_names[i] = (const char *)names;
+		if (i && strcmp(m->pack_names[i - 1], m->pack_names[i]) >= 0) {
+			m = bad_midx(m, midx_name, "pack names out of order");
+			goto cleanup_fail;
+		}
+		names = end + 1;
+	}
+
+	free(midx_name);
+	return m;
+
+cleanup_fail:
+	free(midx_name);
+	return NULL;
+}
+
+int midx_pack_int_id(struct multi_pack_index *m, const char *idx_name)
+{
+	uint32_t first = 0, last = m->num_packs;
+
+	while (first < last) {
+		uint32_t mid = first + (last - first) / 2;
+		int cmp = strcmp(idx_name, m->pack_names[mid]);
+
+		if (!cmp)
+			return mid;
+		if (cmp > 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return -1;
+}
+
+static int bsearch_midx(struct multi_pack_index *m, const unsigned char *sha1,
+			uint32_t *result)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(m->chunk_oid_fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(m->chunk_oid_fanout[sha1[0]]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(m->chunk_oid_lookup + m->hash_len * mi, sha1);
+
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	*result = lo;
+	return 0;
+}
+
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+{
+	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
+}
+
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH;
+	offset32 = get_be32(offset_data + sizeof(uint32_t));
+
+	if (offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		offset32 ^= MIDX_LARGE_OFFSET_NEEDED;
+		if (offset32 >= m->num_large_offsets)
+			die(_("multi-pack-index large offset out of bounds"));
+		return get_be64(m->chunk_large_offsets +
+				MIDX_CHUNK_LARGE_OFFSET_WIDTH * offset32);
+	}
+
+	return offset32;
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e,
+		    struct multi_pack_index *m)
+{
+	struct packed_git *p;
+	uint32_t pos, pack_int_id;
+
+	if (!bsearch_midx(m, sha1, &pos))
+		return 0;
+
+	pack_int_id = nth_midxed_pack_int_id(m, pos);
+	if (pack_int_id >= m->num_packs)
+		return -1;
+	p = m->packs[pack_int_id];
+	if (!p)
+		return -1;
+
+	if (p->num_bad_objects) {
+		uint32_t i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(sha1, p->bad_object_sha1 + GIT_SHA1_RAWSZ * i))
+				return -1;
+	}
+
+	/*
+	 * As in fill_pack_entry(), make sure the packfile is still
+	 * here before telling the caller where to find the object.
+	 */
+	if (!is_pack_valid(p))
+		return -1;
+
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+struct pack_info {
+	char *idx_name;
+	struct packed_git *p;	/* only for packs not in the old midx */
+	uint32_t orig_pack_int_id;
+	time_t mtime;
+};
+
+#define PACK_NOT_IN_MIDX ((uint32_t)-1)
+
+struct pack_list {
+	struct pack_info *info;
+	uint32_t nr;
+	uint32_t alloc;
+	struct multi_pack_index *m;
+};
+
+struct midx_entry {
+	struct object_id oid;
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+static int pack_info_compare(const void *_a, const void *_b)
+{
+	const struct pack_info *a = _a, *b = _b;
+	return strcmp(a->idx_name, b->idx_name);
+}
+
+/*
+ * Sort by object name, preferring the copy from the most recently
+ * modified pack when an object appears more than once.
+ */
+static int midx_entry_compare(const void *_a, const void *_b)
+{
+	const struct midx_entry *a = _a, *b = _b;
+	int cmp = oidcmp(&a->oid, &b->oid);
+
+	if (cmp)
+		return cmp;
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	if (a->pack_mtime < b->pack_mtime)
+		return 1;
+	return a->pack_int_id < b->pack_int_id ? -1 : a->pack_int_id > b->pack_int_id;
+}
+
+static void add_pack_to_midx(const char *full_path, size_t full_path_len,
+			     const char *file_name, void *data)
+{
+	struct pack_list *packs = data;
+	struct pack_info *info;
+	struct strbuf pack_name = STRBUF_INIT;
+	struct stat st;
+	int orig_id = -1;
+
+	if (!ends_with(file_name, ".idx"))
+		return;
+
+	strbuf_add(&pack_name, full_path, full_path_len - strlen(".idx"));
+	strbuf_addstr(&pack_name, ".pack");
+	if (stat(pack_name.buf, &st)) {
+		strbuf_release(&pack_name);
+		return;
+	}
+	strbuf_release(&pack_name);
+
+	if (packs->m)
+		orig_id = midx_pack_int_id(packs->m, file_name);
+
+	ALLOC_GROW(packs->info, packs->nr + 1, packs->alloc);
+	info = &packs->info[packs->nr];
+	info->idx_name = xstrdup(file_name);
+	info->mtime = st.st_mtime;
+	info->p = NULL;
+
+	if (orig_id >= 0) {
+		info->orig_pack_int_id = orig_id;
+	} else {
+		info->orig_pack_int_id = PACK_NOT_IN_MIDX;
+		info->p = add_packed_git(full_path, full_path_len, 0);
+		if (!info->p) {
+			warning(_("failed to add packfile '%s'"), full_path);
+			free(info->idx_name);
+			return;
+		}
+		if (open_pack_index(info->p)) {
+			warning(_("failed to open pack-index '%s'"), full_path);
+			close_pack(info->p);
+			free(info->p);
+			free(info->idx_name);
+			return;
+		}
+	}
+	packs->nr++;
+}
+
+static void for_each_pack_index(const char *object_dir,
+				void (*fn)(const char *, size_t, const char *, void *),
+				void *data)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_addf(&path, "%s/pack", object_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		if (errno != ENOENT)
+			error_errno(_("unable to open object pack directory: %s"),
+				    path.buf);
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		fn(path.buf, path.len, de->d_name, data);
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+/*
+ * Collect the objects of the packs not covered by the old
+ * multi-pack-index, sorted and with duplicates removed.
+ */
+static struct midx_entry *get_new_pack_entries(struct pack_list *packs,
+					       uint32_t *nr_out)
+{
+	struct midx_entry *entries;
+	uint32_t i, j, nr = 0, total = 0;
+
+	for (i = 0; i < packs->nr; i++)
+		if (packs->info[i].p)
+			total += packs->info[i].p->num_objects;
+
+	ALLOC_ARRAY(entries, total);
+	for (i = 0; i < packs->nr; i++) {
+		struct packed_git *p = packs->info[i].p;
+
+		if (!p)
+			continue;
+		for (j = 0; j < p->num_objects; j++) {
+			struct midx_entry *e = &entries[nr++];
+
+			nth_packed_object_oid(&e->oid, p, j);
+			e->offset = nth_packed_object_offset(p, j);
+			e->pack_int_id = i;
+			e->pack_mtime = packs->info[i].mtime;
+		}
+	}
+
+	QSORT(entries, nr, midx_entry_compare);
+	for (i = j = 0; i < nr; i++) {
+		if (j && !oidcmp(&entries[j - 1].oid, &entries[i].oid))
+			continue;
+		entries[j++] = entries[i];
+	}
+	*nr_out = j;
+	return entries;
+}
+
+/*
+ * Merge the (sorted) entries of the old multi-pack-index with the new
+ * ones.  The old multi-pack-index must not cover any pack that has
+ * gone away; see write_midx_file().
+ */
+static struct midx_entry *merge_midx_entries(struct pack_list *packs,
+					     const uint32_t *old_to_new,
+					     struct midx_entry *new_entries,
+					     uint32_t nr_new,
+					     uint32_t *nr_out)
+{
+	struct multi_pack_index *m = packs->m;
+	uint32_t nr_old = m ? m->num_objects : 0;
+	struct midx_entry *result;
+	uint32_t i = 0, j = 0, nr = 0;
+
+	ALLOC_ARRAY(result, st_add(nr_old, nr_new));
+	while (i < nr_old || j < nr_new) {
+		struct midx_entry old;
+		int cmp;
+
+		if (i < nr_old) {
+			uint32_t id = old_to_new[nth_midxed_pack_int_id(m, i)];
+
+			if (id == PACK_NOT_IN_MIDX)
+				die("BUG: multi-pack-index entry for a pack that is gone");
+			hashcpy(old.oid.hash, m->chunk_oid_lookup + m->hash_len * i);
+			old.pack_int_id = id;
+			old.pack_mtime = packs->info[id].mtime;
+			old.offset = nth_midxed_offset(m, i);
+		}
+
+		if (i >= nr_old)
+			cmp = 1;
+		else if (j >= nr_new)
+			cmp = -1;
+		else
+			cmp = midx_entry_compare(&old, &new_entries[j]);
+
+		if (cmp < 0) {
+			if (!nr || oidcmp(&result[nr - 1].oid, &old.oid))
+				result[nr++] = old;
+			i++;
+		} else {
+			if (!nr || oidcmp(&result[nr - 1].oid, &new_entries[j].oid))
+				result[nr++] = new_entries[j];
+			j++;
+		}
+	}
+
+	*nr_out = nr;
+	return result;
+}
+
+static size_t write_midx_pack_names(struct sha1file *f, struct pack_list *packs)
+{
+	unsigned char padding[MIDX_CHUNK_ALIGNMENT];
+	size_t written = 0;
+	uint32_t i;
+
+	for (i = 0; i < packs->nr; i++) {
+		size_t len = strlen(packs->info[i].idx_name) + 1;
+
+		sha1write(f, packs->info[i].idx_name, len);
+		written += len;
+	}
+
+	/* add padding to be aligned */
+	i = MIDX_CHUNK_ALIGNMENT - (written % MIDX_CHUNK_ALIGNMENT);
+	if (i < MIDX_CHUNK_ALIGNMENT) {
+		memset(padding, 0, sizeof(padding));
+		sha1write(f, padding, i);
+		written += i;
+	}
+	return written;
+}
+
+static size_t pack_names_size(struct pack_list *packs)
+{
+	size_t len = 0;
+	uint32_t i;
+
+	for (i = 0; i < packs->nr; i++)
+		len += strlen(packs->info[i].idx_name) + 1;
+	if (len % MIDX_CHUNK_ALIGNMENT)
+		len += MIDX_CHUNK_ALIGNMENT - (len % MIDX_CHUNK_ALIGNMENT);
+	return len;
+}
+
+static void write_midx_oid_fanout(struct sha1file *f,
+				  struct midx_entry *objects, uint32_t nr)
+{
+	struct midx_entry *list = objects, *last = objects + nr;
+	uint32_t count = 0;
+	int i;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		while (list < last && list->oid.hash[0] == i) {
+			count++;
+			list++;
+		}
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_midx_oid_lookup(struct sha1file *f,
+				  struct midx_entry *objects, uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		sha1write(f, objects[i].oid.hash, MIDX_HASH_LEN);
+}
+
+static void write_midx_object_offsets(struct sha1file *f,
+				      struct midx_entry *objects, uint32_t nr)
+{
+	uint32_t i, nr_large_offset = 0;
+
+	for (i = 0; i < nr; i++) {
+		sha1write_be32(f, objects[i].pack_int_id);
+		if (objects[i].offset > 0x7fffffff)
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | nr_large_offset++);
+		else
+			sha1write_be32(f, (uint32_t)objects[i].offset);
+	}
+}
+
+static void write_midx_large_offsets(struct sha1file *f,
+				     struct midx_entry *objects, uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		uint64_t offset = objects[i].offset;
+
+		if (offset <= 0x7fffffff)
+			continue;
+		sha1write_be32(f, offset >> 32);
+		sha1write_be32(f, offset & 0xffffffff);
+	}
+}
+
+static void clear_pack_list(struct pack_list *packs)
+{
+	uint32_t i;
+
+	for (i = 0; i < packs->nr; i++) {
+		if (packs->info[i].p) {
+			close_pack(packs->info[i].p);
+			free(packs->info[i].p);
+		}
+		free(packs->info[i].idx_name);
+	}
+	free(packs->info);
+	packs->info = NULL;
+	packs->nr = packs->alloc = 0;
+}
+
+/* Has a pack the old multi-pack-index covers gone away? */
+static int midx_lost_pack(struct pack_list *packs)
+{
+	uint32_t i, nr = 0;
+
+	for (i = 0; i < packs->nr; i++)
+		if (packs->info[i].orig_pack_int_id != PACK_NOT_IN_MIDX)
+			nr++;
+	return nr < packs->m->num_packs;
+}
+
+int write_midx_file(const char *object_dir)
+{
+	struct pack_list packs = { NULL, 0, 0, NULL };
+	struct midx_entry *new_entries, *entries;
+	uint32_t nr_new, nr_entries, nr_large_offset = 0;
+	uint32_t *old_to_new = NULL;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct sha1file *f;
+	char *midx_name;
+	uint32_t i;
+	int num_chunks, fd;
+
+	packs.m = load_multi_pack_index(object_dir);
+	for_each_pack_index(object_dir, add_pack_to_midx, &packs);
+
+	/*
+	 * The objects of a pack that went away may still be in other
+	 * packs the old multi-pack-index covers, under entries it did
+	 * not keep as it only lists one copy of each object.  Rather
+	 * than hunting for them, index all of the packs from scratch.
+	 */
+	if (packs.m && midx_lost_pack(&packs)) {
+		clear_pack_list(&packs);
+		close_midx(packs.m);
+		packs.m = NULL;
+		for_each_pack_index(object_dir, add_pack_to_midx, &packs);
+	}
+
+	if (!packs.nr) {
+		close_midx(packs.m);
+		clear_midx_file(object_dir);
+		return 0;
+	}
+
+	QSORT(packs.info, packs.nr, pack_info_compare);
+
+	if (packs.m) {
+		ALLOC_ARRAY(old_to_new, packs.m->num_packs);
+		for (i = 0; i < packs.m->num_packs; i++)
+			old_to_new[i] = PACK_NOT_IN_MIDX;
+		for (i = 0; i < packs.nr; i++)
+			if (packs.info[i].orig_pack_int_id != PACK_NOT_IN_MIDX)
+				old_to_new[packs.info[i].orig_pack_int_id] = i;
+	}
+
+	new_entries = get_new_pack_entries(&packs, &nr_new);
+	entries = merge_midx_entries(&packs, old_to_new, new_entries, nr_new,
+				     &nr_entries);
+	free(new_entries);
+	free(old_to_new);
+
+	for (i = 0; i < nr_entries; i++)
+		if (entries[i].offset > 0x7fffffff)
+			nr_large_offset++;
+
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	num_chunks = 4;
+	if (nr_large_offset)
+		chunk_ids[num_chunks++] = MIDX_CHUNKID_LARGEOFFSETS;
+	chunk_ids[num_chunks] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_names_size(&packs);
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_CHUNK_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + (uint64_t)nr_entries * MIDX_HASH_LEN;
+	chunk_offsets[4] = chunk_offsets[3] + (uint64_t)nr_entries * MIDX_CHUNK_OFFSET_WIDTH;
+	if (nr_large_offset)
+		chunk_offsets[5] = chunk_offsets[4] +
+			(uint64_t)nr_large_offset * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
+
+	strbuf_addf(&tmp_file, "%s/pack/tmp_midx_XXXXXX", object_dir);
+	fd = xmkstemp_mode(tmp_file.buf, 0444);
+	f = sha1fd(fd, tmp_file.buf);
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_u8(f, MIDX_VERSION);
+	sha1write_u8(f, MIDX_HASH_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* number of base multi-pack-index files */
+	sha1write_be32(f, packs.nr);
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be32(f, chunk_offsets[i] >> 32);
+		sha1write_be32(f, chunk_offsets[i]);
+	}
+
+	write_midx_pack_names(f, &packs);
+	write_midx_oid_fanout(f, entries, nr_entries);
+	write_midx_oid_lookup(f, entries, nr_entries);
+	write_midx_object_offsets(f, entries, nr_entries);
+	if (nr_large_offset)
+		write_midx_large_offsets(f, entries, nr_entries);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno(_("unable to make temporary multi-pack-index readable"));
+
+	midx_name = get_midx_filename(object_dir);
+	if (rename(tmp_file.buf, midx_name))
+		die_errno(_("unable to rename temporary multi-pack-index to '%s'"),
+			  midx_name);
+
+	clear_pack_list(&packs);
+	free(entries);
+	free(midx_name);
+	strbuf_release(&tmp_file);
+	close_midx(packs.m);
+	return 0;
+}
+
+void clear_midx_file(const char *object_dir)
+{
+	char *midx_name = get_midx_filename(object_dir);
+
+	if (remove_path(midx_name))
+		die(_("failed to clear multi-pack-index at %s"), midx_name);
+
+	free(midx_name);
+}
@@ -0,0 +1,76 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+#include "git-compat-util.h"
+
+struct pack_entry;
+struct packed_git;
+
+/*
+ * A multi-pack-index ("<objdir>/pack/multi-pack-index") maps every
+ * object in a set of packfiles to the pack and offset holding it, so
+ * that a lookup costs a single binary search no matter how many packs
+ * there are.  See Documentation/technical/multi-pack-index-format.txt.
+ */
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	size_t num_large_offsets;
+
+	const char **pack_names;
+	struct packed_git **packs;
+	char object_dir[FLEX_ARRAY];
+};
+
+extern char *get_midx_filename(const char *object_dir);
+
+/*
+ * Read the multi-pack-index of "object_dir". Returns NULL if there is
+ * none, or if it is unusable (in which case an error is printed).
+ */
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir);
+extern void close_midx(struct multi_pack_index *m);
+
+/*
+ * Return the pack-int-id of the pack whose index is named "idx_name"
+ * (e.g. "pack-1234.idx"), or -1 if the multi-pack-index does not
+ * cover it.
+ */
+extern int midx_pack_int_id(struct multi_pack_index *m, const char *idx_name);
+
+/*
+ * Look up "sha1" in the multi-pack-index.  Returns 1 and fills "e" if
+ * the object is found in a usable pack, 0 if the multi-pack-index does
+ * not contain the object, and -1 if it does but the pack it points to
+ * cannot be used (e.g. it was deleted, or the object is marked bad);
+ * in the last case the caller must fall back to searching every pack.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e,
+			   struct multi_pack_index *m);
+
+extern uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
+extern off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+
+/*
+ * Write (or refresh) the multi-pack-index of "object_dir" so that it
+ * covers every pack in "<object_dir>/pack".  Entries of an existing
+ * multi-pack-index are reused for the packs it already covers, so only
+ * the .idx files of new packs are read.  Returns 0 on success.
+ */
+extern int write_midx_file(const char *object_dir);
+extern void clear_midx_file(const char *object_dir);
+
+#endif
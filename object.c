@@ -159,7 +159,7 @@ void *object_as_type(struct object *obj, enum object_type type, int quiet)
 		return obj;
 	else if (obj->type == OBJ_NONE) {
 		if (type == OBJ_COMMIT)
-			((struct commit *)obj)->index = alloc_commit_index();
+			init_commit_node((struct commit *)obj);
 		obj->type = type;
 		return obj;
 	}
@@ -33,6 +33,7 @@ struct object_array {
  * walker.c:        0-2
  * upload-pack.c:       4       11----------------19
  * builtin/blame.c:               12-13
+ * commit-graph.c:                       15
  * bisect.c:                               16
  * bundle.c:                               16
  * http-push.c:                            16-----19
@@ -33,13 +33,6 @@ static struct bitmap_index {
 	/* Packfile to which this bitmap index belongs to */
 	struct packed_git *pack;
 
-	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
-	 */
-	uint32_t reuse_objects;
-
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
 	size_t map_size; /* size of the mmaped buffer */
@@ -602,9 +595,6 @@ static void show_objects_for_type(
 	struct ewah_iterator it;
 	eword_t filter;
 
-	if (bitmap_git.reuse_objects == bitmap_git.pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
@@ -620,9 +610,6 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			if (pos + offset < bitmap_git.reuse_objects)
-				continue;
-
 			entry = &bitmap_git.pack->revindex[pos + offset];
 			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
 
@@ -742,64 +729,108 @@ int prepare_bitmap_walk(struct rev_info *revs)
 	return 0;
 }
 
+static void try_partial_reuse(size_t pos, struct bitmap *reuse,
+			      struct pack_window **w_curs)
+{
+	struct packed_git *pack = bitmap_git.pack;
+	struct revindex_entry *revidx;
+	off_t offset;
+	enum object_type type;
+	unsigned long size;
+
+	if (pos >= pack->num_objects)
+		return; /* not actually in the pack */
+
+	revidx = &pack->revindex[pos];
+	offset = revidx->offset;
+	type = unpack_object_header(pack, w_curs, &offset, &size);
+	if (type < 0)
+		return; /* broken packfile, punt */
+
+	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		int base_pos;
+
+		base_offset = get_delta_base(pack, w_curs, &offset, type,
+					     revidx->offset);
+		if (!base_offset)
+			return;
+		base_pos = find_revindex_position(pack, base_offset);
+
+		/*
+		 * Delta bases nearly always come before the delta in the
+		 * pack (OFS_DELTA cannot do anything else), which lets us
+		 * decide in a single pass.  A base that comes later, or
+		 * that we are not sending from this pack, would have to be
+		 * found among the other objects of the new pack; let the
+		 * regular code path deal with the object instead.
+		 */
+		if (base_pos < 0 || base_pos >= pos)
+			return;
+		if (!bitmap_get(reuse, base_pos))
+			return;
+	}
+
+	bitmap_set(reuse, pos);
+}
+
 int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 				       uint32_t *entries,
-				       off_t *up_to)
+				       struct bitmap **reuse_out)
 {
-	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
-	 */
-	static const double REUSE_PERCENT = 0.9;
-
 	struct bitmap *result = bitmap_git.result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	struct bitmap *reuse;
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
+	uint32_t offset;
 
 	assert(result);
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
-
-		reuse_objects += BITS_IN_EWORD;
+	/*
+	 * Whole words of wanted objects at the start of the pack can be
+	 * sent as they are, whatever their delta bases are: these all
+	 * come before them, and are sent too.
+	 */
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
+	if (i > bitmap_git.pack->num_objects / BITS_IN_EWORD)
+		i = bitmap_git.pack->num_objects / BITS_IN_EWORD;
+
+	reuse = bitmap_new();
+	if (i) {
+		/* setting the last bit makes sure the words are allocated */
+		bitmap_set(reuse, i * BITS_IN_EWORD - 1);
+		memset(reuse->words, 0xff, i * sizeof(eword_t));
 	}
 
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	for (; i < result->word_alloc; i++) {
+		eword_t word = result->words[i];
+		size_t pos = i * BITS_IN_EWORD;
 
-		entry = &bitmap_git.reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			if ((word >> offset) == 0)
+				break;
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", sha1_to_hex(sha1));
+			offset += ewah_bit_ctz64(word >> offset);
+			try_partial_reuse(pos + offset, reuse, &w_curs);
+		}
 	}
-#endif
+	unuse_pack(&w_curs);
 
-	if (!reuse_objects)
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
 		return -1;
-
-	if (reuse_objects >= bitmap_git.pack->num_objects) {
-		bitmap_git.reuse_objects = *entries = bitmap_git.pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git.pack;
-		return 0;
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git.result) * REUSE_PERCENT;
-
-	if (reuse_objects < reuse_threshold)
-		return -1;
-
-	bitmap_git.reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git.pack->revindex[reuse_objects].offset;
+	/*
+	 * The reused objects are written by the caller; drop them from
+	 * the result so that traverse_bitmap_commit_list() does not
+	 * show them.
+	 */
+	bitmap_and_not(result, reuse);
 	*packfile = bitmap_git.pack;
-
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -884,6 +915,132 @@ void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
 		*tags = count_object_type(bitmap_git.result, OBJ_TAG);
 }
 
+/*
+ * Reachability queries.
+ *
+ * The bitmap of a commit has a bit set for every object reachable from
+ * it, and the bitmapped pack holds the full closure of those objects.
+ * A query whose tips all have a stored bitmap can therefore be answered
+ * with a few bitmap operations instead of a commit walk.
+ */
+static int bitmap_reachability_ready(void)
+{
+	static int ready = -1;
+	int config;
+
+	if (ready >= 0)
+		return ready;
+
+	ready = 0;
+	if (!git_config_get_bool("pack.usebitmaps", &config) && !config)
+		return ready;
+	if (commit_parents_overridden())
+		return ready;
+	if (!bitmap_git.loaded) {
+		if (!bitmap_git.map && open_pack_bitmap() < 0)
+			return ready;
+		if (load_pack_bitmap() < 0)
+			return ready;
+	}
+	ready = 1;
+	return ready;
+}
+
+static struct ewah_bitmap *find_stored_bitmap(const struct object_id *oid)
+{
+	khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, oid->hash);
+
+	if (pos < kh_end(bitmap_git.bitmaps))
+		return lookup_stored_bitmap(kh_value(bitmap_git.bitmaps, pos));
+	return NULL;
+}
+
+/*
+ * Tips are often queried many times in a row (e.g. the commit given to
+ * "--merged"), so keep the last one inflated.
+ */
+static struct {
+	struct object_id tip;
+	struct bitmap *reachable;
+} last_tip;
+
+int bitmap_is_reachable_from(const struct object_id *tip,
+			     const struct object_id *oid)
+{
+	int pos;
+
+	if (!bitmap_reachability_ready())
+		return -1;
+
+	if (!last_tip.reachable || oidcmp(&last_tip.tip, tip)) {
+		struct ewah_bitmap *stored = find_stored_bitmap(tip);
+
+		if (!stored)
+			return -1;
+		bitmap_free(last_tip.reachable);
+		last_tip.reachable = ewah_to_bitmap(stored);
+		oidcpy(&last_tip.tip, tip);
+	}
+
+	/*
+	 * Everything reachable from the tip is in the bitmapped pack, so
+	 * an object outside of it is not.
+	 */
+	pos = bitmap_position_packfile(oid->hash);
+	if (pos < 0)
+		return 0;
+	return bitmap_get(last_tip.reachable, pos);
+}
+
+int bitmap_count_reachable_commits(const struct commit_list *wants,
+				   const struct commit_list *haves)
+{
+	struct ewah_bitmap *result, *tmp;
+	struct ewah_iterator it;
+	eword_t word;
+	uint32_t count = 0;
+
+	if (!wants || !bitmap_reachability_ready())
+		return -1;
+
+	result = ewah_pool_new();
+	tmp = ewah_pool_new();
+
+	for (; wants; wants = wants->next) {
+		struct ewah_bitmap *stored = find_stored_bitmap(&wants->item->object.oid);
+
+		if (!stored)
+			goto unavailable;
+		ewah_or(result, stored, tmp);
+		SWAP(result, tmp);
+		ewah_clear(tmp);
+	}
+
+	for (; haves; haves = haves->next) {
+		struct ewah_bitmap *stored = find_stored_bitmap(&haves->item->object.oid);
+
+		if (!stored)
+			goto unavailable;
+		ewah_and_not(result, stored, tmp);
+		SWAP(result, tmp);
+		ewah_clear(tmp);
+	}
+
+	ewah_and(result, bitmap_git.commits, tmp);
+	ewah_iterator_init(&it, tmp);
+	while (ewah_iterator_next(&word, &it))
+		count += ewah_bit_popcount64(word);
+
+	ewah_pool_free(result);
+	ewah_pool_free(tmp);
+	return count;
+
+unavailable:
+	ewah_pool_free(result);
+	ewah_pool_free(tmp);
+	return -1;
+}
+
 struct bitmap_test_data {
 	struct bitmap *base;
 	struct progress *prg;
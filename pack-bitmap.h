@@ -39,9 +39,35 @@ void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees, uint32_t *blob
 void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
 int prepare_bitmap_walk(struct rev_info *revs);
-int reuse_partial_packfile_from_bitmap(struct packed_git **packfile, uint32_t *entries, off_t *up_to);
+/*
+ * Find the objects of the bitmapped pack that can be sent as they are:
+ * those that are wanted and are either not deltas, or deltas against a
+ * base that is sent along with them.  They are marked in "reuse" (by
+ * their position in the pack) and removed from the objects that the
+ * next traverse_bitmap_commit_list() shows.
+ */
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse);
 int rebuild_existing_bitmaps(struct packing_data *mapping, khash_sha1 *reused_bitmaps, int show_progress);
 
+/*
+ * Reachability queries answered from the stored commit bitmaps alone,
+ * without a commit walk.  They return -1 when the bitmaps cannot give
+ * the answer (no usable bitmap index, "pack.useBitmaps" is off, or a
+ * tip has no bitmap of its own); the caller should then walk.
+ *
+ * bitmap_is_reachable_from() returns 1 if "oid" is reachable from the
+ * commit "tip", and 0 if it is not.
+ *
+ * bitmap_count_reachable_commits() returns the number of commits
+ * reachable from one of "wants" but from none of "haves".
+ */
+int bitmap_is_reachable_from(const struct object_id *tip,
+			     const struct object_id *oid);
+int bitmap_count_reachable_commits(const struct commit_list *wants,
+				   const struct commit_list *haves);
+
 void bitmap_writer_show_progress(int show);
 void bitmap_writer_set_checksum(unsigned char *sha1);
 void bitmap_writer_build_type_index(struct pack_idx_entry **index, uint32_t index_nr);
@@ -0,0 +1,340 @@
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "pkt-line.h"
+#include "progress.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "thread-utils.h"
+
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+static struct parallel_checkout {
+	enum {
+		PC_UNINITIALIZED = 0,
+		PC_ACCEPTING,
+		PC_RUNNING
+	} status;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+} parallel_checkout;
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+/* Upper bound on the number of items sent to a worker at once. */
+#define MAX_BATCH_SIZE 64
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	/* Let the test suite exercise the workers everywhere. */
+	const char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		if (strtol_i(env_workers, 10, num_workers) || *num_workers < 1)
+			die("invalid value for GIT_TEST_CHECKOUT_WORKERS: '%s'",
+			    env_workers);
+		*threshold = 0;
+		return;
+	}
+
+	if (git_config_get_int("checkout.workers", num_workers))
+		*num_workers = 1;
+	else if (*num_workers < 1)
+		*num_workers = online_cpus();
+
+	if (git_config_get_int("checkout.thresholdforparallelism", threshold))
+		*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		die("BUG: parallel checkout already initialized");
+	parallel_checkout.status = PC_ACCEPTING;
+}
+
+static void finish_parallel_checkout(void)
+{
+	free(parallel_checkout.items);
+	parallel_checkout.items = NULL;
+	parallel_checkout.nr = parallel_checkout.alloc = 0;
+	parallel_checkout.status = PC_UNINITIALIZED;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	struct parallel_checkout_item *pc_item;
+	struct conv_attrs ca;
+
+	if (parallel_checkout.status != PC_ACCEPTING ||
+	    state->base_dir_len || !S_ISREG(ce->ce_mode) ||
+	    sizeof(struct pc_item_fixed_portion) + ce_namelen(ce) > LARGE_PACKET_DATA_MAX)
+		return -1;
+
+	convert_attrs(&ca, ce->name);
+	if (conv_attrs_need_driver(&ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+	pc_item = &parallel_checkout.items[parallel_checkout.nr++];
+	pc_item->ce = ce;
+	pc_item->ca = ca;
+	pc_item->status = PC_ITEM_PENDING;
+	return 0;
+}
+
+size_t parallel_checkout_queue_size(void)
+{
+	return parallel_checkout.nr;
+}
+
+struct pc_worker {
+	struct child_process cp;
+	unsigned started:1,
+		 done:1;
+};
+
+static size_t next_to_send;
+static size_t batch_size;
+
+/*
+ * Send the next batch of items to "worker", or close its input if
+ * there is nothing left to do.
+ */
+static void send_batch(struct pc_worker *worker)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t end;
+
+	if (next_to_send >= parallel_checkout.nr) {
+		close(worker->cp.in);
+		worker->cp.in = -1;
+		return;
+	}
+
+	end = next_to_send + batch_size;
+	if (end > parallel_checkout.nr)
+		end = parallel_checkout.nr;
+
+	for (; next_to_send < end; next_to_send++) {
+		struct parallel_checkout_item *pc_item =
+			&parallel_checkout.items[next_to_send];
+		struct cache_entry *ce = pc_item->ce;
+		struct pc_item_fixed_portion fixed;
+		struct strbuf item = STRBUF_INIT;
+
+		memset(&fixed, 0, sizeof(fixed));
+		fixed.id = next_to_send;
+		fixed.ce_mode = ce->ce_mode;
+		fixed.crlf_action = pc_item->ca.crlf_action;
+		fixed.ident = pc_item->ca.ident;
+		hashcpy(fixed.sha1, ce->oid.hash);
+		fixed.name_len = ce_namelen(ce);
+
+		strbuf_add(&item, &fixed, sizeof(fixed));
+		strbuf_add(&item, ce->name, ce_namelen(ce));
+		packet_buf_write_len(&buf, item.buf, item.len);
+		strbuf_release(&item);
+	}
+	packet_buf_flush(&buf);
+
+	/*
+	 * If the worker went away, whatever we could not hand over stays
+	 * pending and is written by the main process at the end.
+	 */
+	if (write_in_full(worker->cp.in, buf.buf, buf.len) != buf.len) {
+		close(worker->cp.in);
+		worker->cp.in = -1;
+	}
+	strbuf_release(&buf);
+}
+
+static void record_result(const char *data, int len,
+			  struct progress *progress, unsigned int *progress_cnt)
+{
+	struct pc_item_result res;
+	struct parallel_checkout_item *pc_item;
+
+	if (len != sizeof(res))
+		die("BUG: unexpected result size from checkout worker: %d", len);
+	memcpy(&res, data, sizeof(res));
+	if (res.id >= parallel_checkout.nr)
+		die("BUG: checkout worker sent a result for unknown item %"PRIu32,
+		    res.id);
+
+	pc_item = &parallel_checkout.items[res.id];
+	if (pc_item->status != PC_ITEM_PENDING)
+		die("BUG: checkout worker sent two results for '%s'",
+		    pc_item->ce->name);
+
+	switch (res.status) {
+	case PC_ITEM_WRITTEN:
+		pc_item->st = res.st;
+		/* fallthrough */
+	case PC_ITEM_FAILED:
+		pc_item->status = res.status;
+		display_progress(progress, ++*progress_cnt);
+		break;
+	case PC_ITEM_COLLIDED:
+		/* counted when it is retried */
+		pc_item->status = res.status;
+		break;
+	default:
+		die("BUG: unknown status %"PRIu32" from checkout worker",
+		    res.status);
+	}
+}
+
+static int run_workers(int num_workers, struct progress *progress,
+		       unsigned int *progress_cnt)
+{
+	struct pc_worker *workers;
+	struct pollfd *pfd;
+	static char buf[LARGE_PACKET_MAX];
+	int i, active, ret = 0;
+
+	if (num_workers > parallel_checkout.nr)
+		num_workers = parallel_checkout.nr;
+
+	/*
+	 * Hand out work in small batches so that a worker that is done
+	 * early picks up more, instead of idling while a slower one is
+	 * still going through a fixed share of the entries.
+	 */
+	batch_size = parallel_checkout.nr / (num_workers * 4);
+	if (batch_size > MAX_BATCH_SIZE)
+		batch_size = MAX_BATCH_SIZE;
+	if (!batch_size)
+		batch_size = 1;
+	next_to_send = 0;
+
+	workers = xcalloc(num_workers, sizeof(*workers));
+	pfd = xcalloc(num_workers, sizeof(*pfd));
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	active = 0;
+	for (i = 0; i < num_workers; i++) {
+		struct child_process *cp = &workers[i].cp;
+
+		child_process_init(cp);
+		argv_array_push(&cp->args, "checkout--worker");
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		cp->clean_on_exit = 1;
+		if (start_command(cp)) {
+			/*
+			 * The remaining workers pick up the slack, and
+			 * run_parallel_checkout() writes whatever is left
+			 * if none could be started.
+			 */
+			workers[i].done = 1;
+			pfd[i].fd = -1;
+			continue;
+		}
+		workers[i].started = 1;
+		pfd[i].fd = cp->out;
+		pfd[i].events = POLLIN;
+		active++;
+		send_batch(&workers[i]);
+	}
+
+	while (active) {
+		if (poll(pfd, num_workers, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("poll failed");
+		}
+
+		for (i = 0; i < num_workers; i++) {
+			struct pc_worker *worker = &workers[i];
+			int len;
+
+			if (worker->done || !(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			len = packet_read(worker->cp.out, NULL, NULL,
+					  buf, sizeof(buf),
+					  PACKET_READ_GENTLE_ON_EOF);
+			if (len < 0) {
+				/* the worker exited */
+				worker->done = 1;
+				pfd[i].fd = -1;
+				active--;
+			} else if (!len) {
+				/* end of a batch */
+				if (worker->cp.in >= 0)
+					send_batch(worker);
+			} else {
+				record_result(buf, len, progress, progress_cnt);
+			}
+		}
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		struct child_process *cp = &workers[i].cp;
+
+		if (!workers[i].started)
+			continue;
+		if (cp->in >= 0)
+			close(cp->in);
+		close(cp->out);
+		if (finish_command(cp))
+			ret = error("checkout worker %d finished with error", i);
+	}
+
+	sigchain_pop(SIGPIPE);
+
+	free(pfd);
+	free(workers);
+	return ret;
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold, struct progress *progress,
+			  unsigned int *progress_cnt)
+{
+	int errs = 0;
+	size_t i;
+
+	if (parallel_checkout.status != PC_ACCEPTING)
+		die("BUG: parallel checkout is not accepting entries");
+	parallel_checkout.status = PC_RUNNING;
+
+	if (parallel_checkout.nr && num_workers > 1 &&
+	    parallel_checkout.nr >= threshold)
+		errs |= run_workers(num_workers, progress, progress_cnt);
+
+	/*
+	 * Collect the stat data in index order, and write whatever the
+	 * workers did not (or were not asked to) the usual way.  As the
+	 * status is no longer PC_ACCEPTING, checkout_entry() will not try
+	 * to queue these again.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			update_ce_after_write(state, pc_item->ce, &pc_item->st);
+			break;
+		case PC_ITEM_FAILED:
+			errs = 1;
+			break;
+		case PC_ITEM_PENDING:
+		case PC_ITEM_COLLIDED:
+			display_progress(progress, ++*progress_cnt);
+			errs |= checkout_entry(pc_item->ce, state, NULL);
+			break;
+		}
+	}
+
+	finish_parallel_checkout();
+	return errs;
+}
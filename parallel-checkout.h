@@ -0,0 +1,78 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+#include "cache.h"
+
+struct progress;
+
+/*
+ * Parallel checkout lets check_updates() hand the regular files it has
+ * to write over to a pool of "git checkout--worker" processes, which
+ * read, convert and write them concurrently.  Symlinks, gitlinks and
+ * files that need a smudge or process filter are still written by the
+ * main process, in the usual way.
+ */
+
+/* Read "checkout.workers" and "checkout.thresholdForParallelism". */
+extern void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/* Start accepting entries; see enqueue_checkout(). */
+extern void init_parallel_checkout(void);
+
+/*
+ * Queue "ce" to be written by the workers.  This is called from
+ * checkout_entry() once the way to the file has been cleared.  Returns
+ * 0 if the entry was queued, or -1 if the caller has to write it itself
+ * (parallel checkout is not active, or the entry is not eligible).
+ */
+extern int enqueue_checkout(struct cache_entry *ce, const struct checkout *state);
+
+/* Number of entries queued so far. */
+extern size_t parallel_checkout_queue_size(void);
+
+/*
+ * Write all queued entries and record their stat data in the index, in
+ * index order.  When fewer than "threshold" entries were queued they
+ * are simply written one by one.  Entries a worker could not create
+ * because a file already took their place (e.g. paths that differ only
+ * in case on a case-insensitive file system), or that were left behind
+ * by a worker that died, are written sequentially at the end.
+ * Returns 0 on success.
+ */
+extern int run_parallel_checkout(struct checkout *state, int num_workers,
+				 int threshold, struct progress *progress,
+				 unsigned int *progress_cnt);
+
+/*
+ * The main process sends each worker batches of items, each in its own
+ * pkt-line made of a "struct pc_item_fixed_portion" followed by the
+ * path, and a flush packet at the end of a batch.  The worker answers
+ * every item with a "struct pc_item_result" and a flush packet once it
+ * is done with the batch, after which it is sent the next batch.  When
+ * there is no more work the main process closes the worker's input.
+ */
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/* The worker could not write the entry and reported an error. */
+	PC_ITEM_FAILED,
+	/* The path already existed; it is retried by the main process. */
+	PC_ITEM_COLLIDED
+};
+
+struct pc_item_fixed_portion {
+	uint32_t id;
+	uint32_t ce_mode;
+	int32_t crlf_action;
+	int32_t ident;
+	unsigned char sha1[GIT_SHA1_RAWSZ];
+	uint32_t name_len;
+};
+
+struct pc_item_result {
+	uint32_t id;
+	uint32_t status;
+	struct stat st;
+};
+
+#endif
@@ -16,6 +16,9 @@
 #include "trailer.h"
 #include "wt-status.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -1519,7 +1522,8 @@ static int in_commit_list(const struct commit_list *want, struct commit *c)
  */
 static enum contains_result contains_test(struct commit *candidate,
 					  const struct commit_list *want,
-					  struct contains_cache *cache)
+					  struct contains_cache *cache,
+					  uint32_t cutoff)
 {
 	enum contains_result *cached = contains_cache_at(cache, candidate);
 
@@ -1535,6 +1539,17 @@ static enum contains_result contains_test(struct commit *candidate,
 
 	/* Otherwise, we don't know; prepare to recurse */
 	parse_commit_or_die(candidate);
+
+	/*
+	 * None of the wanted commits can be reached from a commit whose
+	 * generation number is smaller than all of theirs.  The cutoff
+	 * depends only on "want", so the answer can be cached.
+	 */
+	if (candidate->generation < cutoff) {
+		*cached = CONTAINS_NO;
+		return CONTAINS_NO;
+	}
+
 	return CONTAINS_UNKNOWN;
 }
 
@@ -1550,7 +1565,18 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 					      struct contains_cache *cache)
 {
 	struct contains_stack contains_stack = { 0, 0, NULL };
-	enum contains_result result = contains_test(candidate, want, cache);
+	enum contains_result result;
+	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+	const struct commit_list *p;
+
+	for (p = want; p; p = p->next) {
+		struct commit *c = p->item;
+		load_commit_graph_info(c);
+		if (c->generation < cutoff)
+			cutoff = c->generation;
+	}
+
+	result = contains_test(candidate, want, cache, cutoff);
 
 	if (result != CONTAINS_UNKNOWN)
 		return result;
@@ -1569,7 +1595,7 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		 * If we just popped the stack, parents->item has been marked,
 		 * therefore contains_test will return a meaningful yes/no.
 		 */
-		else switch (contains_test(parents->item, want, cache)) {
+		else switch (contains_test(parents->item, want, cache, cutoff)) {
 		case CONTAINS_YES:
 			*contains_cache_at(cache, commit) = CONTAINS_YES;
 			contains_stack.nr--;
@@ -1583,12 +1609,37 @@ static enum contains_result contains_tag_algo(struct commit *candidate,
 		}
 	}
 	free(contains_stack.contains_stack);
-	return contains_test(candidate, want, cache);
+	return contains_test(candidate, want, cache, cutoff);
+}
+
+/*
+ * Answer from the reachability bitmaps whether one of "list" is
+ * reachable from "commit"; -1 if they cannot tell.
+ */
+static int bitmap_contains(struct commit *commit, struct commit_list *list)
+{
+	int result = 0;
+
+	for (; list; list = list->next) {
+		switch (bitmap_is_reachable_from(&commit->object.oid,
+						 &list->item->object.oid)) {
+		case 1:
+			return 1;
+		case -1:
+			result = -1;
+			break;
+		}
+	}
+	return result;
 }
 
 static int commit_contains(struct ref_filter *filter, struct commit *commit,
 			   struct commit_list *list, struct contains_cache *cache)
 {
+	int ret = bitmap_contains(commit, list);
+
+	if (ret >= 0)
+		return ret;
 	if (filter->with_commit_tag_algo)
 		return contains_tag_algo(commit, list, cache) == CONTAINS_YES;
 	return is_descendant_of(commit, list);
@@ -1828,14 +1879,58 @@ void ref_array_clear(struct ref_array *array)
 	array->nr = array->alloc = 0;
 }
 
+/* Keep the refs that pass "--merged" or "--no-merged". */
+static void filter_merged_refs(struct ref_filter *filter,
+			       struct ref_array *array, const char *is_merged)
+{
+	int i, old_nr = array->nr;
+
+	array->nr = 0;
+	for (i = 0; i < old_nr; i++) {
+		struct ref_array_item *item = array->items[i];
+
+		if (is_merged[i] == (filter->merge == REF_FILTER_MERGED_INCLUDE))
+			array->items[array->nr++] = item;
+		else
+			free_array_item(item);
+	}
+}
+
+/*
+ * Mark the refs that are reachable from the "--merged" commit, using
+ * its reachability bitmap.  Returns -1 if there is none.
+ */
+static int merge_filter_with_bitmaps(struct ref_filter *filter,
+				     struct ref_array *array, char *is_merged)
+{
+	int i;
+
+	for (i = 0; i < array->nr; i++) {
+		int ret = bitmap_is_reachable_from(&filter->merge_commit->object.oid,
+						   &array->items[i]->commit->object.oid);
+		if (ret < 0)
+			return -1;
+		is_merged[i] = ret;
+	}
+	return 0;
+}
+
 static void do_merge_filter(struct ref_filter_cbdata *ref_cbdata)
 {
 	struct rev_info revs;
 	int i, old_nr;
 	struct ref_filter *filter = ref_cbdata->filter;
 	struct ref_array *array = ref_cbdata->array;
-	struct commit **to_clear = xcalloc(sizeof(struct commit *), array->nr);
+	struct commit **to_clear;
+	char *is_merged = xcalloc(array->nr, 1);
+
+	if (!merge_filter_with_bitmaps(filter, array, is_merged)) {
+		filter_merged_refs(filter, array, is_merged);
+		free(is_merged);
+		return;
+	}
 
+	to_clear = xcalloc(sizeof(struct commit *), array->nr);
 	init_revisions(&revs, NULL);
 
 	for (i = 0; i < array->nr; i++) {
@@ -1851,25 +1946,17 @@ static void do_merge_filter(struct ref_filter_cbdata *ref_cbdata)
 	if (prepare_revision_walk(&revs))
 		die(_("revision walk setup failed"));
 
-	old_nr = array->nr;
-	array->nr = 0;
-
-	for (i = 0; i < old_nr; i++) {
-		struct ref_array_item *item = array->items[i];
-		struct commit *commit = item->commit;
-
-		int is_merged = !!(commit->object.flags & UNINTERESTING);
+	for (i = 0; i < array->nr; i++)
+		is_merged[i] = !!(array->items[i]->commit->object.flags & UNINTERESTING);
 
-		if (is_merged == (filter->merge == REF_FILTER_MERGED_INCLUDE))
-			array->items[array->nr++] = array->items[i];
-		else
-			free_array_item(item);
-	}
+	old_nr = array->nr;
+	filter_merged_refs(filter, array, is_merged);
 
 	for (i = 0; i < old_nr; i++)
 		clear_commit_marks(to_clear[i], ALL_REV_FLAGS);
 	clear_commit_marks(filter->merge_commit, ALL_REV_FLAGS);
 	free(to_clear);
+	free(is_merged);
 }
 
 /*
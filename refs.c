@@ -716,6 +716,7 @@ struct read_ref_at_cb {
 	const char *refname;
 	timestamp_t at_time;
 	int cnt;
+	int skipped;
 	int reccnt;
 	unsigned char *sha1;
 	int found_it;
@@ -740,7 +741,9 @@ static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
 	cb->tz = tz;
 	cb->date = timestamp;
 
-	if (timestamp <= cb->at_time || cb->cnt == 0) {
+	/* Entries skipped by the backend count as seen: */
+	if (timestamp <= cb->at_time ||
+	    cb->cnt == cb->skipped + cb->reccnt - 1) {
 		if (cb->msg)
 			*cb->msg = xstrdup(message);
 		if (cb->cutoff_time)
@@ -748,7 +751,7 @@ static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
 		if (cb->cutoff_tz)
 			*cb->cutoff_tz = tz;
 		if (cb->cutoff_cnt)
-			*cb->cutoff_cnt = cb->reccnt - 1;
+			*cb->cutoff_cnt = cb->skipped + cb->reccnt - 1;
 		/*
 		 * we have not yet updated cb->[n|o]sha1 so they still
 		 * hold the values for the previous record.
@@ -772,8 +775,6 @@ static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
 	}
 	hashcpy(cb->osha1, ooid->hash);
 	hashcpy(cb->nsha1, noid->hash);
-	if (cb->cnt > 0)
-		cb->cnt--;
 	return 0;
 }
 
@@ -790,7 +791,7 @@ static int read_ref_at_ent_oldest(struct object_id *ooid, struct object_id *noid
 	if (cb->cutoff_tz)
 		*cb->cutoff_tz = tz;
 	if (cb->cutoff_cnt)
-		*cb->cutoff_cnt = cb->reccnt;
+		*cb->cutoff_cnt = cb->skipped + cb->reccnt;
 	hashcpy(cb->sha1, ooid->hash);
 	if (is_null_sha1(cb->sha1))
 		hashcpy(cb->sha1, noid->hash);
@@ -814,7 +815,9 @@ int read_ref_at(const char *refname, unsigned int flags, timestamp_t at_time, in
 	cb.cutoff_cnt = cutoff_cnt;
 	cb.sha1 = sha1;
 
-	for_each_reflog_ent_reverse(refname, read_ref_at_ent, &cb);
+	refs_for_each_reflog_ent_reverse_at(get_main_ref_store(), refname,
+					    at_time, cnt, read_ref_at_ent, &cb,
+					    &cb.skipped);
 
 	if (!cb.reccnt) {
 		if (flags & GET_SHA1_QUIETLY)
@@ -1541,12 +1544,39 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
 static struct ref_store *ref_store_init(const char *gitdir,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct ref_storage_be *be;
 	struct ref_store *refs;
+	struct repository_format format;
+	char *be_name = NULL;
+
+	/*
+	 * The ref storage of the main repository (and its worktrees)
+	 * is known from its extensions.refStorage; for submodules, we
+	 * need to read it from their config.
+	 */
+	if (flags & REF_STORE_MAIN) {
+		if (repository_format_ref_storage)
+			be_name = xstrdup(repository_format_ref_storage);
+	} else {
+		struct strbuf sb = STRBUF_INIT;
 
+		get_common_dir_noenv(&sb, gitdir);
+		strbuf_addstr(&sb, "/config");
+		if (read_repository_format(&format, sb.buf) >= 0)
+			be_name = format.ref_storage;
+		else
+			free(format.ref_storage);
+		string_list_clear(&format.unknown_extensions, 0);
+		free(format.work_tree);
+		strbuf_release(&sb);
+	}
+	if (!be_name)
+		be_name = xstrdup("files");
+
+	be = find_ref_storage_backend(be_name);
 	if (!be)
-		die("BUG: reference backend %s is unknown", be_name);
+		die("unknown ref storage '%s' in '%s'", be_name, gitdir);
+	free(be_name);
 
 	refs = be->init(gitdir, flags);
 	return refs;
@@ -1816,6 +1846,17 @@ int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn,
 						refname, fn, cb_data);
 }
 
+int refs_for_each_reflog_ent_reverse_at(struct ref_store *refs,
+					const char *refname,
+					timestamp_t at_time, int cnt,
+					each_reflog_ent_fn fn, void *cb_data,
+					int *skipped)
+{
+	return refs->be->for_each_reflog_ent_reverse_at(refs, refname,
+							at_time, cnt,
+							fn, cb_data, skipped);
+}
+
 int refs_for_each_reflog_ent(struct ref_store *refs, const char *refname,
 			     each_reflog_ent_fn fn, void *cb_data)
 {
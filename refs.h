@@ -369,6 +369,20 @@ int refs_for_each_reflog_ent_reverse(struct ref_store *refs,
 int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data);
 int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void *cb_data);
 
+/*
+ * Like refs_for_each_reflog_ent_reverse(), but the backend may skip
+ * the entries that are newer than the one just after the newest entry
+ * that has "cnt" newer entries (if "cnt" is not negative) or whose
+ * timestamp is at or before "at_time" (otherwise), if it can find that
+ * entry without reading them (see core.reflogIndex).  The number of
+ * entries skipped is stored in "*skipped" before "fn" is first called.
+ */
+int refs_for_each_reflog_ent_reverse_at(struct ref_store *refs,
+					const char *refname,
+					timestamp_t at_time, int cnt,
+					each_reflog_ent_fn fn, void *cb_data,
+					int *skipped);
+
 /*
  * Calls the specified function for each reflog file until it returns nonzero,
  * and returns the value. Reflog file order is unspecified.
@@ -2,6 +2,7 @@
 #include "../refs.h"
 #include "refs-internal.h"
 #include "ref-cache.h"
+#include "reflog-index.h"
 #include "../iterator.h"
 #include "../dir-iterator.h"
 #include "../lockfile.h"
@@ -32,9 +33,39 @@ static int ref_resolves_to_object(const char *refname,
 	return 1;
 }
 
+enum packed_peeled { PEELED_NONE, PEELED_TAGS, PEELED_FULLY };
+
 struct packed_ref_cache {
+	/*
+	 * The parsed entries of the packed-refs file.  For a file
+	 * with the "sorted" trait, this is only filled (and then
+	 * becomes authoritative) when somebody needs all of them, or
+	 * wants to modify them.
+	 */
 	struct ref_cache *cache;
 
+	/*
+	 * The contents of the packed-refs file, either mmapped or, if
+	 * it is small or mmap_packed_refs is off, read into memory.  It
+	 * is kept until the cache is freed, as iterators may be
+	 * scanning it.
+	 */
+	char *buf, *eof;
+	size_t mmapped_size;
+
+	/* Where the records start, after the header line: */
+	const char *records;
+
+	/*
+	 * Iff set, the records of "buf" are sorted and "cache" has
+	 * not been filled from them yet; references are then looked
+	 * up by bisecting "buf", and iterated over in place.
+	 */
+	int sorted;
+
+	/* What the header says about peeled values: */
+	enum packed_peeled peeled;
+
 	/*
 	 * Count of references to the data structure in this instance,
 	 * including the pointer from files_ref_store::packed if any.
@@ -91,6 +122,10 @@ static int release_packed_ref_cache(struct packed_ref_cache *packed_refs)
 {
 	if (!--packed_refs->referrers) {
 		free_ref_cache(packed_refs->cache);
+		if (packed_refs->mmapped_size)
+			munmap(packed_refs->buf, packed_refs->mmapped_size);
+		else
+			free(packed_refs->buf);
 		stat_validity_clear(&packed_refs->validity);
 		free(packed_refs);
 		return 1;
@@ -188,7 +223,24 @@ static struct files_ref_store *files_downcast(struct ref_store *ref_store,
  * traits will be added later.  The trailing space is required.
  */
 static const char PACKED_REFS_HEADER[] =
-	"# pack-refs with: peeled fully-peeled \n";
+	"# pack-refs with: peeled fully-peeled sorted \n";
+
+/*
+ * Files up to this size are read into memory rather than mmapped, as
+ * setting up a mapping costs more than reading a few pages.
+ */
+#define SMALL_PACKED_REFS_SIZE (32 * 1024)
+
+/*
+ * The packed-refs file is replaced by renaming a new one over it, which
+ * some systems refuse to do while anybody has it mapped; there, always
+ * read it into memory.
+ */
+#ifdef MMAP_PREVENTS_DELETE
+static const int mmap_packed_refs = 0;
+#else
+static const int mmap_packed_refs = 1;
+#endif
 
 /*
  * Parse one line from a packed-refs file.  Write the SHA1 to sha1.
@@ -227,7 +279,7 @@ static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
 }
 
 /*
- * Read f, which is a packed-refs file, into dir.
+ * Parse the packed-refs file contents from buf to eof into dir.
  *
  * A comment line of the form "# pack-refs with: " may contain zero or
  * more traits. We interpret the traits as follows:
@@ -252,18 +304,31 @@ static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are sorted by name, and each line ends with a
+ *      newline, so that a reference can be found by bisecting the
+ *      file, without parsing all of it.
  */
-static void read_packed_refs(FILE *f, struct ref_dir *dir)
+static void read_packed_refs(const char *buf, const char *eof,
+			     struct ref_dir *dir)
 {
 	struct ref_entry *last = NULL;
 	struct strbuf line = STRBUF_INIT;
-	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled = PEELED_NONE;
+	enum packed_peeled peeled = PEELED_NONE;
 
-	while (strbuf_getwholeline(&line, f, '\n') != EOF) {
+	while (buf < eof) {
+		const char *eol = memchr(buf, '\n', eof - buf);
 		unsigned char sha1[20];
 		const char *refname;
 		const char *traits;
 
+		eol = eol ? eol + 1 : eof;
+		strbuf_reset(&line);
+		strbuf_add(&line, buf, eol - buf);
+		buf = eol;
+
 		if (skip_prefix(line.buf, "# pack-refs with:", &traits)) {
 			if (strstr(traits, " fully-peeled "))
 				peeled = PEELED_FULLY;
@@ -340,6 +405,15 @@ static void files_reflog_path(struct files_ref_store *refs,
 	}
 }
 
+void files_store_reflog_path(struct ref_store *ref_store, struct strbuf *sb,
+			     const char *refname)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "reflog_path");
+
+	files_reflog_path(refs, sb, refname);
+}
+
 static void files_ref_path(struct files_ref_store *refs,
 			   struct strbuf *sb,
 			   const char *refname)
@@ -358,6 +432,64 @@ static void files_ref_path(struct files_ref_store *refs,
 	}
 }
 
+/*
+ * Read the packed-refs file at "path" into packed->buf, and parse its
+ * header.  The rest of it is only parsed right away if it is not
+ * sorted.
+ */
+static void load_packed_refs(struct packed_ref_cache *packed,
+			     const char *path)
+{
+	struct stat st;
+	const char *traits, *eol;
+	size_t size;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	stat_validity_update(&packed->validity, fd);
+	if (fstat(fd, &st) < 0)
+		die_errno("couldn't stat %s", path);
+	size = xsize_t(st.st_size);
+	if (!size) {
+		close(fd);
+		return;
+	}
+
+	if (!mmap_packed_refs || size <= SMALL_PACKED_REFS_SIZE) {
+		packed->buf = xmalloc(size);
+		if (read_in_full(fd, packed->buf, size) != size)
+			die_errno("couldn't read %s", path);
+	} else {
+		packed->buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		packed->mmapped_size = size;
+	}
+	close(fd);
+	packed->eof = packed->buf + size;
+	packed->records = packed->buf;
+
+	eol = memchr(packed->buf, '\n', size);
+	if (eol && skip_prefix(packed->buf, "# pack-refs with:", &traits)) {
+		char *p = xmemdupz(traits, eol + 1 - traits);
+
+		if (strstr(p, " fully-peeled "))
+			packed->peeled = PEELED_FULLY;
+		else if (strstr(p, " peeled "))
+			packed->peeled = PEELED_TAGS;
+		packed->sorted = !!strstr(p, " sorted ");
+		free(p);
+		packed->records = eol + 1;
+	}
+
+	/* A truncated last line means we cannot trust it to be sorted: */
+	if (packed->eof[-1] != '\n')
+		packed->sorted = 0;
+	if (!packed->sorted)
+		read_packed_refs(packed->buf, packed->eof,
+				 get_ref_dir(packed->cache->root));
+}
+
 /*
  * Get the packed_ref_cache for the specified files_ref_store,
  * creating it if necessary.
@@ -371,25 +503,29 @@ static struct packed_ref_cache *get_packed_ref_cache(struct files_ref_store *ref
 		clear_packed_ref_cache(refs);
 
 	if (!refs->packed) {
-		FILE *f;
-
 		refs->packed = xcalloc(1, sizeof(*refs->packed));
 		acquire_packed_ref_cache(refs->packed);
 		refs->packed->cache = create_ref_cache(&refs->base, NULL);
 		refs->packed->cache->root->flag &= ~REF_INCOMPLETE;
-		f = fopen(packed_refs_file, "r");
-		if (f) {
-			stat_validity_update(&refs->packed->validity, fileno(f));
-			read_packed_refs(f, get_ref_dir(refs->packed->cache->root));
-			fclose(f);
-		}
+		load_packed_refs(refs->packed, packed_refs_file);
 	}
 	return refs->packed;
 }
 
+/*
+ * Return the parsed entries of the packed refs, parsing them first
+ * if that has not been needed so far.
+ */
 static struct ref_dir *get_packed_ref_dir(struct packed_ref_cache *packed_ref_cache)
 {
-	return get_ref_dir(packed_ref_cache->cache->root);
+	struct ref_dir *dir = get_ref_dir(packed_ref_cache->cache->root);
+
+	if (packed_ref_cache->sorted) {
+		read_packed_refs(packed_ref_cache->buf, packed_ref_cache->eof,
+				 dir);
+		packed_ref_cache->sorted = 0;
+	}
+	return dir;
 }
 
 static struct ref_dir *get_packed_refs(struct files_ref_store *refs)
@@ -397,6 +533,152 @@ static struct ref_dir *get_packed_refs(struct files_ref_store *refs)
 	return get_packed_ref_dir(get_packed_ref_cache(refs));
 }
 
+/*
+ * A reference parsed from the buffer of a sorted packed-refs file.
+ */
+struct packed_record {
+	struct strbuf refname;
+	struct object_id oid;
+	struct object_id peeled;
+	unsigned int flag;
+};
+
+#define PACKED_RECORD_INIT { STRBUF_INIT }
+
+/*
+ * Return the start of the record (a reference line and the peeled
+ * lines after it) that contains "p".
+ */
+static const char *find_start_of_record(const char *buf, const char *p)
+{
+	while (p > buf && (p[-1] != '\n' || p[0] == '^'))
+		p--;
+	return p;
+}
+
+/* Return the start of the record after the one that starts at "p". */
+static const char *find_end_of_record(const char *p, const char *end)
+{
+	while (++p < end && (p[-1] != '\n' || p[0] == '^'))
+		;
+	return p;
+}
+
+/*
+ * Compare the name of the record at "rec" with "refname", without
+ * parsing it.  Return -1 if the reference line is malformed.
+ */
+static int cmp_packed_record(const char *rec, const char *eof,
+			     const char *refname, int *cmp)
+{
+	const char *eol = memchr(rec, '\n', eof - rec);
+	const unsigned char *name = (const unsigned char *)rec + 41;
+	const unsigned char *r = (const unsigned char *)refname;
+
+	if (eol - rec <= 41 || !isspace(rec[40]))
+		return -1;
+	for (; (const char *)name < eol && *r; name++, r++)
+		if (*name != *r)
+			break;
+	if ((const char *)name == eol)
+		*cmp = *r ? -1 : 0;
+	else if (!*r)
+		*cmp = 1;
+	else
+		*cmp = *name < *r ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Bisect the sorted packed-refs buffer for "refname", and set *rec to
+ * its record, or to where it would be.  Return 1 if the reference is
+ * there, 0 if it is not, and -1 if a malformed line got in the way;
+ * the caller should then fall back to get_packed_ref_dir(), which
+ * skips such lines.
+ */
+static int find_packed_record(struct packed_ref_cache *packed,
+			      const char *refname, const char **rec)
+{
+	const char *lo = packed->records, *hi = packed->eof;
+
+	while (lo < hi) {
+		const char *mid = find_start_of_record(packed->records,
+						       lo + (hi - lo) / 2);
+		int cmp;
+
+		if (cmp_packed_record(mid, packed->eof, refname, &cmp))
+			return -1;
+		if (cmp < 0)
+			lo = find_end_of_record(mid, hi);
+		else if (cmp > 0)
+			hi = mid;
+		else {
+			*rec = mid;
+			return 1;
+		}
+	}
+	*rec = lo;
+	return 0;
+}
+
+/*
+ * Parse the record at "rec" into "out" the way read_packed_refs()
+ * does, and return the start of the next record.  Return NULL if the
+ * reference line is malformed.
+ */
+static const char *parse_packed_record(struct packed_ref_cache *packed,
+				       const char *rec,
+				       struct packed_record *out)
+{
+	const char *eol = memchr(rec, '\n', packed->eof - rec);
+	const char *next = find_end_of_record(rec, packed->eof);
+	const char *p;
+
+	if (eol - rec <= 41 || get_oid_hex(rec, &out->oid) ||
+	    !isspace(rec[40]) || isspace(rec[41]))
+		return NULL;
+	strbuf_reset(&out->refname);
+	strbuf_add(&out->refname, rec + 41, eol - rec - 41);
+
+	out->flag = REF_ISPACKED;
+	if (check_refname_format(out->refname.buf, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(out->refname.buf))
+			die("packed refname is dangerous: %s", out->refname.buf);
+		oidclr(&out->oid);
+		out->flag |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+	if (packed->peeled == PEELED_FULLY ||
+	    (packed->peeled == PEELED_TAGS &&
+	     starts_with(out->refname.buf, "refs/tags/")))
+		out->flag |= REF_KNOWS_PEELED;
+
+	oidclr(&out->peeled);
+	for (p = eol + 1; p < next; p += PEELED_LINE_LENGTH) {
+		if (next - p < PEELED_LINE_LENGTH ||
+		    p[PEELED_LINE_LENGTH - 1] != '\n' ||
+		    get_oid_hex(p + 1, &out->peeled))
+			break;
+		out->flag |= REF_KNOWS_PEELED;
+	}
+	return next;
+}
+
+/*
+ * Look up "refname" in the buffer of a sorted packed-refs file.
+ * Return 1 and fill "out" if it is there, 0 if it is not, and -1 if
+ * the buffer cannot be used (see find_packed_record()).
+ */
+static int read_packed_record(struct packed_ref_cache *packed,
+			      const char *refname, struct packed_record *out)
+{
+	const char *rec;
+	int ret = find_packed_record(packed, refname, &rec);
+
+	if (ret == 1 && !parse_packed_record(packed, rec, out))
+		ret = -1;
+	return ret;
+}
+
 /*
  * Add a reference to the in-memory packed reference cache.  This may
  * only be called while the packed-refs file is locked (see
@@ -536,16 +818,6 @@ static struct ref_cache *get_loose_ref_cache(struct files_ref_store *refs)
 	return refs->loose;
 }
 
-/*
- * Return the ref_entry for the given refname from the packed
- * references.  If it does not exist, return NULL.
- */
-static struct ref_entry *get_packed_ref(struct files_ref_store *refs,
-					const char *refname)
-{
-	return find_ref_entry(get_packed_refs(refs), refname);
-}
-
 /*
  * A loose ref file doesn't exist; check for a packed ref.
  */
@@ -553,13 +825,26 @@ static int resolve_packed_ref(struct files_ref_store *refs,
 			      const char *refname,
 			      unsigned char *sha1, unsigned int *flags)
 {
+	struct packed_ref_cache *packed = get_packed_ref_cache(refs);
 	struct ref_entry *entry;
 
 	/*
 	 * The loose reference file does not exist; check for a packed
 	 * reference.
 	 */
-	entry = get_packed_ref(refs, refname);
+	if (packed->sorted) {
+		struct packed_record rec = PACKED_RECORD_INIT;
+		int ret = read_packed_record(packed, refname, &rec);
+
+		if (ret == 1) {
+			hashcpy(sha1, rec.oid.hash);
+			*flags |= REF_ISPACKED;
+		}
+		strbuf_release(&rec.refname);
+		if (ret >= 0)
+			return ret ? 0 : -1;
+	}
+	entry = find_ref_entry(get_packed_ref_dir(packed), refname);
 	if (entry) {
 		hashcpy(sha1, entry->u.value.oid.hash);
 		*flags |= REF_ISPACKED;
@@ -982,7 +1267,25 @@ static int files_peel_ref(struct ref_store *ref_store,
 	 * have REF_KNOWS_PEELED.
 	 */
 	if (flag & REF_ISPACKED) {
-		struct ref_entry *r = get_packed_ref(refs, refname);
+		struct packed_ref_cache *packed = get_packed_ref_cache(refs);
+		struct ref_entry *r;
+
+		if (packed->sorted) {
+			struct packed_record rec = PACKED_RECORD_INIT;
+			int ret = read_packed_record(packed, refname, &rec);
+
+			strbuf_release(&rec.refname);
+			if (ret == 1 && (rec.flag & REF_KNOWS_PEELED)) {
+				if (is_null_oid(&rec.peeled))
+					return -1;
+				hashcpy(sha1, rec.peeled.hash);
+				return 0;
+			}
+			if (ret >= 0)
+				return peel_object(base, sha1);
+		}
+
+		r = find_ref_entry(get_packed_ref_dir(packed), refname);
 		if (r) {
 			if (peel_entry(r, 0))
 				return -1;
@@ -994,6 +1297,113 @@ static int files_peel_ref(struct ref_store *ref_store,
 	return peel_object(base, sha1);
 }
 
+/*
+ * Iterate over the references of a sorted packed-refs buffer that
+ * start with "prefix", in place.
+ */
+struct packed_ref_iterator {
+	struct ref_iterator base;
+
+	struct packed_ref_cache *packed;
+	const char *pos;
+	char *prefix;
+	struct packed_record rec;
+};
+
+static int packed_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct packed_ref_iterator *iter =
+		(struct packed_ref_iterator *)ref_iterator;
+
+	while (iter->pos < iter->packed->eof) {
+		const char *next = parse_packed_record(iter->packed, iter->pos,
+						       &iter->rec);
+
+		if (!next) {
+			/* Skip malformed lines, like read_packed_refs() does: */
+			iter->pos = find_end_of_record(iter->pos,
+						       iter->packed->eof);
+			continue;
+		}
+		iter->pos = next;
+		if (!starts_with(iter->rec.refname.buf, iter->prefix)) {
+			if (strcmp(iter->rec.refname.buf, iter->prefix) > 0)
+				break;
+			continue;
+		}
+
+		iter->base.refname = iter->rec.refname.buf;
+		iter->base.oid = &iter->rec.oid;
+		iter->base.flags = iter->rec.flag;
+		return ITER_OK;
+	}
+
+	return ref_iterator_abort(ref_iterator);
+}
+
+static int packed_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				    struct object_id *peeled)
+{
+	struct packed_ref_iterator *iter =
+		(struct packed_ref_iterator *)ref_iterator;
+
+	if (iter->rec.flag & REF_KNOWS_PEELED) {
+		if (is_null_oid(&iter->rec.peeled))
+			return -1;
+		oidcpy(peeled, &iter->rec.peeled);
+		return 0;
+	}
+	if (iter->rec.flag & REF_ISBROKEN)
+		return -1;
+	return peel_object(iter->rec.oid.hash, peeled->hash) ? -1 : 0;
+}
+
+static int packed_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct packed_ref_iterator *iter =
+		(struct packed_ref_iterator *)ref_iterator;
+
+	release_packed_ref_cache(iter->packed);
+	strbuf_release(&iter->rec.refname);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable packed_ref_iterator_vtable = {
+	packed_ref_iterator_advance,
+	packed_ref_iterator_peel,
+	packed_ref_iterator_abort
+};
+
+/*
+ * Begin iterating over the packed references that start with
+ * "prefix": by scanning the buffer from where bisection finds the
+ * prefix if it is sorted, and over the parsed entries otherwise.
+ */
+static struct ref_iterator *packed_ref_iterator_begin(
+		struct packed_ref_cache *packed, const char *prefix)
+{
+	struct packed_ref_iterator *iter;
+	const char *pos;
+
+	if (!prefix)
+		prefix = "";
+	if (packed->sorted && find_packed_record(packed, prefix, &pos) < 0)
+		get_packed_ref_dir(packed); /* parse it all; clears "sorted" */
+	if (!packed->sorted)
+		return cache_ref_iterator_begin(packed->cache, prefix, 0);
+
+	iter = xcalloc(1, sizeof(*iter));
+	base_ref_iterator_init(&iter->base, &packed_ref_iterator_vtable);
+	iter->packed = packed;
+	acquire_packed_ref_cache(packed);
+	iter->pos = pos;
+	iter->prefix = xstrdup(prefix);
+	strbuf_init(&iter->rec.refname, 0);
+	return &iter->base;
+}
+
 struct files_ref_iterator {
 	struct ref_iterator base;
 
@@ -1105,8 +1515,7 @@ static struct ref_iterator *files_ref_iterator_begin(
 
 	iter->packed_ref_cache = get_packed_ref_cache(refs);
 	acquire_packed_ref_cache(iter->packed_ref_cache);
-	packed_iter = cache_ref_iterator_begin(iter->packed_ref_cache->cache,
-					       prefix, 0);
+	packed_iter = packed_ref_iterator_begin(iter->packed_ref_cache, prefix);
 
 	iter->iter0 = overlay_ref_iterator_begin(loose_iter, packed_iter);
 	iter->flags = flags;
@@ -1344,6 +1753,7 @@ static int commit_packed_refs(struct files_ref_store *refs)
 
 	fprintf_or_die(out, "%s", PACKED_REFS_HEADER);
 
+	get_packed_ref_dir(packed_ref_cache);
 	iter = cache_ref_iterator_begin(packed_ref_cache->cache, NULL, 0);
 	while ((ok = ref_iterator_advance(iter)) == ITER_OK) {
 		struct object_id peeled;
@@ -1356,12 +1766,19 @@ static int commit_packed_refs(struct files_ref_store *refs)
 	if (ok != ITER_DONE)
 		die("error while iterating over references");
 
-	if (commit_lock_file(packed_ref_cache->lock)) {
+	if (fsync_ref_files &&
+	    (fflush(out) || fsync(fileno(out)) < 0)) {
+		save_errno = errno;
+		error = -1;
+		rollback_lock_file(packed_ref_cache->lock);
+	} else if (commit_lock_file(packed_ref_cache->lock)) {
 		save_errno = errno;
 		error = -1;
 	}
 	packed_ref_cache->lock = NULL;
 	release_packed_ref_cache(packed_ref_cache);
+	if (error)
+		clear_packed_ref_cache(refs);
 	errno = save_errno;
 	return error;
 }
@@ -1570,7 +1987,10 @@ static int repack_without_refs(struct files_ref_store *refs,
 
 	/* Look for a packed ref */
 	for_each_string_list_item(refname, refnames) {
-		if (get_packed_ref(refs, refname->string)) {
+		unsigned char sha1[20];
+		unsigned int flags = 0;
+
+		if (!resolve_packed_ref(refs, refname->string, sha1, &flags)) {
 			needs_repacking = 1;
 			break;
 		}
@@ -1607,6 +2027,67 @@ static int repack_without_refs(struct files_ref_store *refs,
 	return ret;
 }
 
+/*
+ * Write the updates of transaction that are marked REF_NEEDS_PACKING
+ * to the packed-refs file, and remove the references listed in
+ * 'refnames' from it, all in a single rewrite of the file. The loose
+ * references of the updates must be locked by the caller. On error,
+ * leave packed-refs unchanged, write an error message to 'err', and
+ * return a nonzero value.
+ */
+static int write_packed_updates(struct files_ref_store *refs,
+				struct ref_transaction *transaction,
+				struct string_list *refnames,
+				struct strbuf *err)
+{
+	struct ref_dir *packed;
+	struct string_list_item *refname;
+	struct ref_update **added;
+	int i, nr_added = 0, ret;
+
+	files_assert_main_repository(refs, "write_packed_updates");
+
+	if (lock_packed_refs(refs, 0)) {
+		unable_to_lock_message(files_packed_refs_path(refs), errno, err);
+		return -1;
+	}
+	packed = get_packed_refs(refs);
+
+	/*
+	 * Overwrite the entries that exist before adding new ones, so
+	 * that looking them up does not have to sort the directories
+	 * again after every addition.
+	 */
+	ALLOC_ARRAY(added, transaction->nr);
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct ref_entry *entry;
+
+		if (!(update->flags & REF_NEEDS_PACKING))
+			continue;
+		entry = find_ref_entry(packed, update->refname);
+		if (entry) {
+			hashcpy(entry->u.value.oid.hash, update->new_sha1);
+			oidclr(&entry->u.value.peeled);
+			entry->flag = REF_ISPACKED;
+		} else {
+			added[nr_added++] = update;
+		}
+	}
+	for (i = 0; i < nr_added; i++)
+		add_packed_ref(refs, added[i]->refname, added[i]->new_sha1);
+	free(added);
+
+	for_each_string_list_item(refname, refnames)
+		remove_entry_from_dir(packed, refname->string);
+
+	ret = commit_packed_refs(refs);
+	if (ret)
+		strbuf_addf(err, "unable to overwrite old ref-pack file: %s",
+			    strerror(errno));
+	return ret;
+}
+
 static int files_delete_refs(struct ref_store *ref_store,
 			     struct string_list *refnames, unsigned int flags)
 {
@@ -1763,6 +2244,8 @@ static int files_rename_ref(struct ref_store *ref_store,
 			    oldrefname, strerror(errno));
 		goto out;
 	}
+	if (log)
+		reflog_index_remove(sb_oldref.buf);
 
 	if (refs_delete_ref(&refs->base, logmsg, oldrefname,
 			    orig_sha1, REF_NODEREF)) {
@@ -2012,12 +2495,99 @@ static int log_ref_write_fd(int fd, const unsigned char *old_sha1,
 	return 0;
 }
 
+/*
+ * Parse the reflog entry in sb, pointing *email_end at the '>' that
+ * ends the email and *message at the time zone that follows the
+ * timestamp. Return -1 if the entry is corrupt.
+ */
+static int parse_reflog_ent(struct strbuf *sb,
+			    struct object_id *ooid, struct object_id *noid,
+			    char **email_end, timestamp_t *timestamp,
+			    char **message)
+{
+	const char *p = sb->buf;
+
+	/* old SP new SP name <email> SP time TAB msg LF */
+	if (!sb->len || sb->buf[sb->len - 1] != '\n' ||
+	    parse_oid_hex(p, ooid, &p) || *p++ != ' ' ||
+	    parse_oid_hex(p, noid, &p) || *p++ != ' ' ||
+	    !(*email_end = strchr(p, '>')) ||
+	    (*email_end)[1] != ' ' ||
+	    !(*timestamp = parse_timestamp(*email_end + 2, message, 10)) ||
+	    !*message || (*message)[0] != ' ' ||
+	    ((*message)[1] != '+' && (*message)[1] != '-') ||
+	    !isdigit((*message)[2]) || !isdigit((*message)[3]) ||
+	    !isdigit((*message)[4]) || !isdigit((*message)[5]))
+		return -1;
+	return 0;
+}
+
+/*
+ * Write the index of the reflog at log_path from scratch.
+ */
+static int write_reflog_index(const char *log_path)
+{
+	struct reflog_index_entry *entries = NULL;
+	int nr = 0, alloc = 0, ret;
+	struct strbuf sb = STRBUF_INIT;
+	uint64_t offset = 0;
+	FILE *logfp;
+
+	logfp = fopen(log_path, "r");
+	if (!logfp)
+		return error_errno("unable to open '%s'", log_path);
+	while (!strbuf_getwholeline(&sb, logfp, '\n')) {
+		struct object_id ooid, noid;
+		char *email_end, *message;
+		timestamp_t timestamp;
+
+		if (!parse_reflog_ent(&sb, &ooid, &noid, &email_end,
+				      &timestamp, &message)) {
+			ALLOC_GROW(entries, nr + 1, alloc);
+			entries[nr].offset = offset;
+			entries[nr].timestamp = timestamp;
+			nr++;
+		}
+		offset += sb.len;
+	}
+	fclose(logfp);
+	strbuf_release(&sb);
+
+	ret = reflog_index_write(log_path, entries, nr, offset);
+	free(entries);
+	return ret;
+}
+
+/*
+ * Record in the index of the reflog of refname that the entry written
+ * by committer has been appended at offset, making the reflog log_size
+ * bytes long.
+ */
+static void update_reflog_index(struct files_ref_store *refs,
+				const char *refname, const char *committer,
+				uint64_t offset, uint64_t log_size)
+{
+	struct strbuf sb = STRBUF_INIT;
+	const char *email_end = strrchr(committer, '>');
+	timestamp_t timestamp = 0;
+
+	if (email_end)
+		timestamp = parse_timestamp(email_end + 1, NULL, 10);
+	files_reflog_path(refs, &sb, refname);
+	if (!timestamp ||
+	    reflog_index_append(sb.buf, offset, timestamp, log_size))
+		write_reflog_index(sb.buf);
+	strbuf_release(&sb);
+}
+
 static int files_log_ref_write(struct files_ref_store *refs,
 			       const char *refname, const unsigned char *old_sha1,
 			       const unsigned char *new_sha1, const char *msg,
 			       int flags, struct strbuf *err)
 {
 	int logfd, result;
+	const char *committer;
+	off_t offset = -1, log_size;
 
 	if (log_all_ref_updates == LOG_REFS_UNSET)
 		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
@@ -2031,8 +2601,11 @@ static int files_log_ref_write(struct files_ref_store *refs,
 
 	if (logfd < 0)
 		return 0;
+	committer = git_committer_info(0);
+	if (core_reflog_index)
+		offset = lseek(logfd, 0, SEEK_END);
 	result = log_ref_write_fd(logfd, old_sha1, new_sha1,
-				  git_committer_info(0), msg);
+				  committer, msg);
 	if (result) {
 		struct strbuf sb = STRBUF_INIT;
 		int save_errno = errno;
@@ -2044,6 +2617,8 @@ static int files_log_ref_write(struct files_ref_store *refs,
 		close(logfd);
 		return -1;
 	}
+	if (offset >= 0 && (log_size = lseek(logfd, 0, SEEK_CUR)) > offset)
+		update_reflog_index(refs, refname, committer, offset, log_size);
 	if (close(logfd)) {
 		struct strbuf sb = STRBUF_INIT;
 		int save_errno = errno;
@@ -2057,36 +2632,62 @@ static int files_log_ref_write(struct files_ref_store *refs,
 	return 0;
 }
 
+int files_store_log_ref_write(struct ref_store *ref_store,
+			      const char *refname, const unsigned char *old_sha1,
+			      const unsigned char *new_sha1, const char *msg,
+			      int flags, struct strbuf *err)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_WRITE, "log_ref_write");
+
+	return files_log_ref_write(refs, refname, old_sha1, new_sha1, msg,
+				   flags, err);
+}
+
 /*
  * Write sha1 into the open lockfile, then close the lockfile. On
  * errors, rollback the lockfile, fill in *err and
  * return -1.
  */
-static int write_ref_to_lockfile(struct ref_lock *lock,
-				 const unsigned char *sha1, struct strbuf *err)
+/*
+ * Check that sha1 names an object that refname may point at. On
+ * error, write a message to err and return a nonzero value.
+ */
+static int check_new_ref_value(const char *refname, const unsigned char *sha1,
+			       struct strbuf *err)
 {
-	static char term = '\n';
 	struct object *o;
-	int fd;
 
 	o = parse_object(sha1);
 	if (!o) {
 		strbuf_addf(err,
 			    "trying to write ref '%s' with nonexistent object %s",
-			    lock->ref_name, sha1_to_hex(sha1));
-		unlock_ref(lock);
+			    refname, sha1_to_hex(sha1));
 		return -1;
 	}
-	if (o->type != OBJ_COMMIT && is_branch(lock->ref_name)) {
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
 		strbuf_addf(err,
 			    "trying to write non-commit object %s to branch '%s'",
-			    sha1_to_hex(sha1), lock->ref_name);
+			    sha1_to_hex(sha1), refname);
+		return -1;
+	}
+	return 0;
+}
+
+static int write_ref_to_lockfile(struct ref_lock *lock,
+				 const unsigned char *sha1, struct strbuf *err)
+{
+	static char term = '\n';
+	int fd;
+
+	if (check_new_ref_value(lock->ref_name, sha1, err)) {
 		unlock_ref(lock);
 		return -1;
 	}
 	fd = get_lock_file_fd(lock->lk);
 	if (write_in_full(fd, sha1_to_hex(sha1), 40) != 40 ||
 	    write_in_full(fd, &term, 1) != 1 ||
+	    (fsync_ref_files && fsync(fd) < 0) ||
 	    close_ref(lock) < 0) {
 		strbuf_addf(err,
 			    "couldn't write '%s'", get_lock_file_path(lock->lk));
@@ -2264,6 +2865,7 @@ static int files_delete_reflog(struct ref_store *ref_store,
 	int ret;
 
 	files_reflog_path(refs, &sb, refname);
+	reflog_index_remove(sb.buf);
 	ret = remove_path(sb.buf);
 	strbuf_release(&sb);
 	return ret;
@@ -2275,27 +2877,19 @@ static int show_one_reflog_ent(struct strbuf *sb, each_reflog_ent_fn fn, void *c
 	char *email_end, *message;
 	timestamp_t timestamp;
 	int tz;
-	const char *p = sb->buf;
+	const char *committer;
 
-	/* old SP new SP name <email> SP time TAB msg LF */
-	if (!sb->len || sb->buf[sb->len - 1] != '\n' ||
-	    parse_oid_hex(p, &ooid, &p) || *p++ != ' ' ||
-	    parse_oid_hex(p, &noid, &p) || *p++ != ' ' ||
-	    !(email_end = strchr(p, '>')) ||
-	    email_end[1] != ' ' ||
-	    !(timestamp = parse_timestamp(email_end + 2, &message, 10)) ||
-	    !message || message[0] != ' ' ||
-	    (message[1] != '+' && message[1] != '-') ||
-	    !isdigit(message[2]) || !isdigit(message[3]) ||
-	    !isdigit(message[4]) || !isdigit(message[5]))
+	if (parse_reflog_ent(sb, &ooid, &noid, &email_end, &timestamp, &message))
 		return 0; /* corrupt? */
+	/* The committer follows "old SP new SP": */
+	committer = sb->buf + 2 * (GIT_SHA1_HEXSZ + 1);
 	email_end[1] = '\0';
 	tz = strtol(message + 1, NULL, 10);
 	if (message[6] != '\t')
 		message += 6;
 	else
 		message += 7;
-	return fn(&ooid, &noid, p, timestamp, tz, message, cb_data);
+	return fn(&ooid, &noid, committer, timestamp, tz, message, cb_data);
 }
 
 static char *find_beginning_of_line(char *bob, char *scan)
@@ -2309,30 +2903,34 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
-					     const char *refname,
-					     each_reflog_ent_fn fn,
-					     void *cb_data)
+/*
+ * Call fn for the entries of the reflog at log_path, newest first,
+ * starting with the entry that ends at offset "end", or with the last
+ * one if "end" is negative.
+ */
+static int for_each_reflog_ent_reverse_before(const char *log_path,
+					      const char *refname, long end,
+					      each_reflog_ent_fn fn,
+					      void *cb_data)
 {
-	struct files_ref_store *refs =
-		files_downcast(ref_store, REF_STORE_READ,
-			       "for_each_reflog_ent_reverse");
 	struct strbuf sb = STRBUF_INIT;
 	FILE *logfp;
 	long pos;
 	int ret = 0, at_tail = 1;
 
-	files_reflog_path(refs, &sb, refname);
-	logfp = fopen(sb.buf, "r");
-	strbuf_release(&sb);
+	logfp = fopen(log_path, "r");
 	if (!logfp)
 		return -1;
 
-	/* Jump to the end */
-	if (fseek(logfp, 0, SEEK_END) < 0)
-		ret = error("cannot seek back reflog for %s: %s",
-			    refname, strerror(errno));
-	pos = ftell(logfp);
+	if (end >= 0) {
+		pos = end;
+	} else {
+		/* Jump to the end */
+		if (fseek(logfp, 0, SEEK_END) < 0)
+			ret = error("cannot seek back reflog for %s: %s",
+				    refname, strerror(errno));
+		pos = ftell(logfp);
+	}
 	while (!ret && 0 < pos) {
 		int cnt;
 		size_t nread;
@@ -2423,6 +3021,51 @@ static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	return ret;
 }
 
+static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+					     const char *refname,
+					     each_reflog_ent_fn fn,
+					     void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse");
+	struct strbuf sb = STRBUF_INIT;
+	int ret;
+
+	files_reflog_path(refs, &sb, refname);
+	ret = for_each_reflog_ent_reverse_before(sb.buf, refname, -1,
+						 fn, cb_data);
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int files_for_each_reflog_ent_reverse_at(struct ref_store *ref_store,
+						const char *refname,
+						timestamp_t at_time, int cnt,
+						each_reflog_ent_fn fn,
+						void *cb_data, int *skipped)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse_at");
+	struct strbuf sb = STRBUF_INIT;
+	uint64_t end;
+	long start = -1;
+	int ret;
+
+	files_reflog_path(refs, &sb, refname);
+	*skipped = 0;
+	if (!reflog_index_lookup(sb.buf, at_time, cnt, &end, skipped) &&
+	    end <= maximum_signed_value_of_type(long))
+		start = end;
+	else
+		*skipped = 0;
+	ret = for_each_reflog_ent_reverse_before(sb.buf, refname, start,
+						 fn, cb_data);
+	strbuf_release(&sb);
+	return ret;
+}
+
 static int files_for_each_reflog_ent(struct ref_store *ref_store,
 				     const char *refname,
 				     each_reflog_ent_fn fn, void *cb_data)
@@ -2516,10 +3159,11 @@ static struct ref_iterator_vtable files_reflog_iterator_vtable = {
 	files_reflog_iterator_abort
 };
 
-static struct ref_iterator *files_reflog_iterator_begin(struct ref_store *ref_store)
+struct ref_iterator *files_store_reflog_iterator_begin(
+		struct ref_store *files_store, struct ref_store *ref_store)
 {
 	struct files_ref_store *refs =
-		files_downcast(ref_store, REF_STORE_READ,
+		files_downcast(files_store, REF_STORE_READ,
 			       "reflog_iterator_begin");
 	struct files_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
 	struct ref_iterator *ref_iterator = &iter->base;
@@ -2533,6 +3177,11 @@ static struct ref_iterator *files_reflog_iterator_begin(struct ref_store *ref_st
 	return ref_iterator;
 }
 
+static struct ref_iterator *files_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	return files_store_reflog_iterator_begin(ref_store, ref_store);
+}
+
 static int ref_update_reject_duplicates(struct string_list *refnames,
 					struct strbuf *err)
 {
@@ -2719,12 +3368,17 @@ static int check_old_oid(struct ref_update *update, struct object_id *oid,
  *   the referent to transaction.
  * - If it is an update of head_ref, add a corresponding REF_LOG_ONLY
  *   update of HEAD.
+ * - If batched is set and the reference is a shared one that is not
+ *   stored as a loose reference, mark it REF_NEEDS_PACKING instead
+ *   of writing the new value to the lockfile; the caller then writes
+ *   it to packed-refs while still holding the lock.
  */
 static int lock_ref_for_update(struct files_ref_store *refs,
 			       struct ref_update *update,
 			       struct ref_transaction *transaction,
 			       const char *head_ref,
 			       struct string_list *affected_refnames,
+			       int batched,
 			       struct strbuf *err)
 {
 	struct strbuf referent = STRBUF_INIT;
@@ -2822,6 +3476,20 @@ static int lock_ref_for_update(struct files_ref_store *refs,
 			 * The reference already has the desired
 			 * value, so we don't need to write it.
 			 */
+		} else if (batched && !(update->type & REF_ISSYMREF) &&
+			   ref_type(update->refname) == REF_TYPE_NORMAL &&
+			   ((update->type & REF_ISPACKED) ||
+			    is_null_oid(&lock->old_oid))) {
+			if (check_new_ref_value(update->refname,
+						update->new_sha1, err)) {
+				char *check_err = strbuf_detach(err, NULL);
+
+				strbuf_addf(err, "cannot update ref '%s': %s",
+					    update->refname, check_err);
+				free(check_err);
+				return TRANSACTION_GENERIC_ERROR;
+			}
+			update->flags |= REF_NEEDS_PACKING;
 		} else if (write_ref_to_lockfile(lock, update->new_sha1,
 						 err)) {
 			char *write_err = strbuf_detach(err, NULL);
@@ -2870,6 +3538,7 @@ static int files_transaction_commit(struct ref_store *ref_store,
 	int head_type;
 	struct object_id head_oid;
 	struct strbuf sb = STRBUF_INIT;
+	int batched, packed_updates = 0;
 
 	assert(err);
 
@@ -2881,6 +3550,16 @@ static int files_transaction_commit(struct ref_store *ref_store,
 		return 0;
 	}
 
+	/*
+	 * Large transactions write the new values of references that
+	 * are not loose straight into packed-refs, with a single
+	 * rename, instead of renaming one lockfile per reference into
+	 * place. The loose lockfiles are still taken, so that other
+	 * writers see the references as locked.
+	 */
+	batched = batch_ref_updates > 0 &&
+		transaction->nr >= batch_ref_updates;
+
 	/*
 	 * Fail if a refname appears more than once in the
 	 * transaction. (If we end up splitting up any updates using
@@ -2943,7 +3622,8 @@ static int files_transaction_commit(struct ref_store *ref_store,
 		struct ref_update *update = transaction->updates[i];
 
 		ret = lock_ref_for_update(refs, update, transaction,
-					  head_ref, &affected_refnames, err);
+					  head_ref, &affected_refnames,
+					  batched, err);
 		if (ret)
 			goto cleanup;
 	}
@@ -2953,7 +3633,10 @@ static int files_transaction_commit(struct ref_store *ref_store,
 		struct ref_update *update = transaction->updates[i];
 		struct ref_lock *lock = update->backend_data;
 
+		if (update->flags & REF_NEEDS_PACKING)
+			packed_updates = 1;
 		if (update->flags & REF_NEEDS_COMMIT ||
+		    update->flags & REF_NEEDS_PACKING ||
 		    update->flags & REF_LOG_ONLY) {
 			if (files_log_ref_write(refs,
 						lock->ref_name,
@@ -3008,7 +3691,13 @@ static int files_transaction_commit(struct ref_store *ref_store,
 		}
 	}
 
-	if (repack_without_refs(refs, &refs_to_delete, err)) {
+	if (packed_updates) {
+		if (write_packed_updates(refs, transaction,
+					 &refs_to_delete, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	} else if (repack_without_refs(refs, &refs_to_delete, err)) {
 		ret = TRANSACTION_GENERIC_ERROR;
 		goto cleanup;
 	}
@@ -3017,6 +3706,7 @@ static int files_transaction_commit(struct ref_store *ref_store,
 	for_each_string_list_item(ref_to_delete, &refs_to_delete) {
 		strbuf_reset(&sb);
 		files_reflog_path(refs, &sb, ref_to_delete->string);
+		reflog_index_remove(sb.buf);
 		if (!unlink_or_warn(sb.buf))
 			try_remove_empty_parents(refs, ref_to_delete->string,
 						 REMOVE_EMPTY_PARENTS_REFLOG);
@@ -3035,12 +3725,14 @@ static int files_transaction_commit(struct ref_store *ref_store,
 		if (lock)
 			unlock_ref(lock);
 
-		if (update->flags & REF_DELETED_LOOSE) {
+		if (update->flags & (REF_DELETED_LOOSE | REF_NEEDS_PACKING)) {
 			/*
-			 * The loose reference was deleted. Delete any
-			 * empty parent directories. (Note that this
-			 * can only work because we have already
-			 * removed the lockfile.)
+			 * The loose reference was deleted, or only its
+			 * lockfile was there because the reference went
+			 * to packed-refs instead. Delete any empty
+			 * parent directories. (Note that this can only
+			 * work because we have already removed the
+			 * lockfile.)
 			 */
 			try_remove_empty_parents(refs, update->refname,
 						 REMOVE_EMPTY_PARENTS_REF);
@@ -3151,6 +3843,10 @@ struct expire_reflog_cb {
 	void *policy_cb;
 	FILE *newlog;
 	struct object_id last_kept_oid;
+
+	/* The entries written to newlog, for its index: */
+	struct reflog_index_entry *index;
+	int index_nr, index_alloc;
 };
 
 static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
@@ -3171,6 +3867,13 @@ static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
 			printf("prune %s", message);
 	} else {
 		if (cb->newlog) {
+			if (core_reflog_index) {
+				ALLOC_GROW(cb->index, cb->index_nr + 1,
+					   cb->index_alloc);
+				cb->index[cb->index_nr].offset = ftell(cb->newlog);
+				cb->index[cb->index_nr].timestamp = timestamp;
+				cb->index_nr++;
+			}
 			fprintf(cb->newlog, "%s %s %s %"PRItime" %+05d\t%s",
 				oid_to_hex(ooid), oid_to_hex(noid),
 				email, timestamp, tz, message);
@@ -3264,6 +3967,7 @@ static int files_reflog_expire(struct ref_store *ref_store,
 		int update = (flags & EXPIRE_REFLOGS_UPDATE_REF) &&
 			!(type & REF_ISSYMREF) &&
 			!is_null_oid(&cb.last_kept_oid);
+		long log_size = ftell(cb.newlog);
 
 		if (close_lock_file(&reflog_lock)) {
 			status |= error("couldn't write %s: %s", log_file,
@@ -3279,16 +3983,24 @@ static int files_reflog_expire(struct ref_store *ref_store,
 		} else if (commit_lock_file(&reflog_lock)) {
 			status |= error("unable to write reflog '%s' (%s)",
 					log_file, strerror(errno));
-		} else if (update && commit_ref(lock)) {
-			status |= error("couldn't set %s", lock->ref_name);
+		} else {
+			if (!core_reflog_index || log_size < 0)
+				reflog_index_remove(log_file);
+			else
+				reflog_index_write(log_file, cb.index,
+						   cb.index_nr, log_size);
+			if (update && commit_ref(lock))
+				status |= error("couldn't set %s", lock->ref_name);
 		}
 	}
+	free(cb.index);
 	free(log_file);
 	unlock_ref(lock);
 	return status;
 
  failure:
 	rollback_lock_file(&reflog_lock);
+	free(cb.index);
 	free(log_file);
 	unlock_ref(lock);
 	return -1;
@@ -3315,7 +4027,7 @@ static int files_init_db(struct ref_store *ref_store, struct strbuf *err)
 }
 
 struct ref_storage_be refs_be_files = {
-	NULL,
+	&refs_be_reftable,
 	"files",
 	files_ref_store_create,
 	files_init_db,
@@ -3334,6 +4046,7 @@ struct ref_storage_be refs_be_files = {
 	files_reflog_iterator_begin,
 	files_for_each_reflog_ent,
 	files_for_each_reflog_ent_reverse,
+	files_for_each_reflog_ent_reverse_at,
 	files_reflog_exists,
 	files_create_reflog,
 	files_delete_reflog,
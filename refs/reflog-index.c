@@ -0,0 +1,292 @@
+#include "../cache.h"
+#include "../lockfile.h"
+#include "reflog-index.h"
+
+#define REFLOG_INDEX_SIGNATURE 0x52494458 /* "RIDX" */
+#define REFLOG_INDEX_VERSION 1
+#define REFLOG_INDEX_HEADER_SIZE 24
+#define REFLOG_INDEX_ENTRY_SIZE 16
+
+/* The timestamps of the entries never decrease: */
+#define REFLOG_INDEX_SORTED 0x1
+
+struct reflog_index {
+	const unsigned char *data;
+	uint32_t flags;
+	uint32_t nr;
+	uint64_t log_size;
+};
+
+static uint64_t entry_offset(const struct reflog_index *index, uint32_t i)
+{
+	return get_be64(index->data + REFLOG_INDEX_HEADER_SIZE +
+			i * REFLOG_INDEX_ENTRY_SIZE);
+}
+
+static timestamp_t entry_timestamp(const struct reflog_index *index, uint32_t i)
+{
+	return get_be64(index->data + REFLOG_INDEX_HEADER_SIZE +
+			i * REFLOG_INDEX_ENTRY_SIZE + 8);
+}
+
+static void write_header(unsigned char *header, uint32_t flags,
+			 uint32_t nr, uint64_t log_size)
+{
+	put_be32(header, REFLOG_INDEX_SIGNATURE);
+	put_be32(header + 4, REFLOG_INDEX_VERSION);
+	put_be32(header + 8, flags);
+	put_be32(header + 12, nr);
+	put_be64(header + 16, log_size);
+}
+
+static int parse_header(struct reflog_index *index,
+			const unsigned char *header, size_t size)
+{
+	if (size < REFLOG_INDEX_HEADER_SIZE ||
+	    get_be32(header) != REFLOG_INDEX_SIGNATURE ||
+	    get_be32(header + 4) != REFLOG_INDEX_VERSION)
+		return -1;
+	index->flags = get_be32(header + 8);
+	index->nr = get_be32(header + 12);
+	index->log_size = get_be64(header + 16);
+	if ((size - REFLOG_INDEX_HEADER_SIZE) / REFLOG_INDEX_ENTRY_SIZE < index->nr)
+		return -1;
+	return 0;
+}
+
+void reflog_index_path(struct strbuf *sb, const char *log_path)
+{
+	const char *base = strrchr(log_path, '/');
+
+	base = base ? base + 1 : log_path;
+	strbuf_add(sb, log_path, base - log_path);
+	strbuf_addf(sb, ".%s.idx", base);
+}
+
+int reflog_index_write(const char *log_path,
+		       const struct reflog_index_entry *entries, int nr,
+		       uint64_t log_size)
+{
+	static struct lock_file lock;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	unsigned char entry[REFLOG_INDEX_ENTRY_SIZE];
+	uint32_t flags = REFLOG_INDEX_SORTED;
+	int i, fd, ret = 0;
+
+	reflog_index_path(&path, log_path);
+	fd = hold_lock_file_for_update(&lock, path.buf, 0);
+	if (fd < 0) {
+		ret = error_errno("unable to lock reflog index '%s'", path.buf);
+		goto out;
+	}
+
+	strbuf_grow(&buf, REFLOG_INDEX_HEADER_SIZE +
+		    st_mult(nr, REFLOG_INDEX_ENTRY_SIZE));
+	strbuf_setlen(&buf, REFLOG_INDEX_HEADER_SIZE);
+	for (i = 0; i < nr; i++) {
+		if (i && entries[i].timestamp < entries[i - 1].timestamp)
+			flags &= ~REFLOG_INDEX_SORTED;
+		put_be64(entry, entries[i].offset);
+		put_be64(entry + 8, entries[i].timestamp);
+		strbuf_add(&buf, entry, sizeof(entry));
+	}
+	write_header((unsigned char *)buf.buf, flags, nr, log_size);
+
+	if (write_in_full(fd, buf.buf, buf.len) != buf.len ||
+	    commit_lock_file(&lock)) {
+		ret = error_errno("unable to write reflog index '%s'", path.buf);
+		rollback_lock_file(&lock);
+	}
+
+out:
+	strbuf_release(&buf);
+	strbuf_release(&path);
+	return ret;
+}
+
+int reflog_index_append(const char *log_path, uint64_t offset,
+			timestamp_t timestamp, uint64_t log_size)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct reflog_index index;
+	unsigned char header[REFLOG_INDEX_HEADER_SIZE];
+	unsigned char entry[REFLOG_INDEX_ENTRY_SIZE];
+	struct stat st;
+	off_t pos;
+	int fd, ret = -1;
+
+	reflog_index_path(&path, log_path);
+	fd = open(path.buf, O_RDWR);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st) ||
+	    read_in_full(fd, header, sizeof(header)) != sizeof(header) ||
+	    parse_header(&index, header, xsize_t(st.st_size)) ||
+	    index.log_size != offset)
+		goto out;
+
+	if (index.nr) {
+		pos = REFLOG_INDEX_HEADER_SIZE +
+			(off_t)(index.nr - 1) * REFLOG_INDEX_ENTRY_SIZE;
+		if (pread_in_full(fd, entry, sizeof(entry), pos) != sizeof(entry))
+			goto out;
+		if (timestamp < get_be64(entry + 8))
+			index.flags &= ~REFLOG_INDEX_SORTED;
+	}
+
+	/*
+	 * Write the entry before the header that counts it, so that an
+	 * interrupted update leaves an index that is merely out of
+	 * date.
+	 */
+	pos = REFLOG_INDEX_HEADER_SIZE +
+		(off_t)index.nr * REFLOG_INDEX_ENTRY_SIZE;
+	put_be64(entry, offset);
+	put_be64(entry + 8, timestamp);
+	write_header(header, index.flags, index.nr + 1, log_size);
+	if (lseek(fd, pos, SEEK_SET) != pos ||
+	    write_in_full(fd, entry, sizeof(entry)) != sizeof(entry) ||
+	    lseek(fd, 0, SEEK_SET) ||
+	    write_in_full(fd, header, sizeof(header)) != sizeof(header))
+		goto out;
+	ret = 0;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	strbuf_release(&path);
+	return ret;
+}
+
+void reflog_index_remove(const char *log_path)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	reflog_index_path(&path, log_path);
+	unlink_or_warn(path.buf);
+	strbuf_release(&path);
+}
+
+/*
+ * Check that the last entry of the index is the last entry of the
+ * reflog, to catch reflogs that have been rewritten to the size they
+ * had when the index was written.
+ */
+static int verify_last_entry(const struct reflog_index *index, int log_fd)
+{
+	char buf[1024];
+	uint64_t offset;
+	ssize_t len;
+	char *p, *end;
+	int after_lf;
+
+	offset = entry_offset(index, index->nr - 1);
+	if (offset >= index->log_size)
+		return -1;
+	/* Read the entry along with the LF that ends the previous one: */
+	after_lf = offset > 0;
+	len = pread_in_full(log_fd, buf, sizeof(buf) - 1, offset - after_lf);
+	if (len < 1)
+		return -1;
+	buf[len] = '\0';
+	p = buf;
+	if (after_lf && *p++ != '\n')
+		return -1;
+
+	/* old SP new SP name <email> SP time ... */
+	if (!(p = strchr(p, '>')) || p[1] != ' ' ||
+	    parse_timestamp(p + 2, &end, 10) != entry_timestamp(index, index->nr - 1) ||
+	    *end != ' ')
+		return -1;
+	return 0;
+}
+
+static int find_entry(const struct reflog_index *index,
+		      timestamp_t at_time, int cnt)
+{
+	int lo, hi;
+
+	if (cnt >= 0)
+		return (int)index->nr - 1 - cnt;
+
+	if (!(index->flags & REFLOG_INDEX_SORTED)) {
+		for (hi = index->nr - 1; hi >= 0; hi--)
+			if (entry_timestamp(index, hi) <= at_time)
+				break;
+		return hi;
+	}
+
+	/* The newest entry at or before at_time: */
+	lo = 0;
+	hi = index->nr;
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+
+		if (entry_timestamp(index, mi) <= at_time)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo - 1;
+}
+
+int reflog_index_lookup(const char *log_path,
+			timestamp_t at_time, int cnt,
+			uint64_t *end, int *skipped)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct reflog_index index;
+	struct stat st;
+	void *map = NULL;
+	size_t mapsz = 0;
+	int fd, log_fd = -1, ret = -1;
+	int pos;
+
+	reflog_index_path(&path, log_path);
+	fd = git_open(path.buf);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st))
+		goto out;
+	mapsz = xsize_t(st.st_size);
+	if (mapsz < REFLOG_INDEX_HEADER_SIZE)
+		goto out;
+	map = xmmap(NULL, mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+	index.data = map;
+	if (parse_header(&index, map, mapsz) || !index.nr)
+		goto out;
+
+	log_fd = git_open(log_path);
+	if (log_fd < 0 || fstat(log_fd, &st) ||
+	    (uint64_t)st.st_size != index.log_size ||
+	    verify_last_entry(&index, log_fd))
+		goto out;
+
+	/*
+	 * Start with the entry just after the one we are looking for,
+	 * which the caller needs to see, too.
+	 */
+	pos = find_entry(&index, at_time, cnt) + 1;
+	if (pos < 0)
+		pos = 0;
+	if (pos >= (int)index.nr) {
+		*skipped = 0;
+		*end = index.log_size;
+	} else {
+		*skipped = index.nr - 1 - pos;
+		*end = pos + 1 < (int)index.nr ?
+			entry_offset(&index, pos + 1) : index.log_size;
+	}
+	ret = 0;
+
+out:
+	if (map)
+		munmap(map, mapsz);
+	if (fd >= 0)
+		close(fd);
+	if (log_fd >= 0)
+		close(log_fd);
+	strbuf_release(&path);
+	return ret;
+}
@@ -0,0 +1,67 @@
+#ifndef REFS_REFLOG_INDEX_H
+#define REFS_REFLOG_INDEX_H
+
+/*
+ * A reflog index is a binary file next to a reflog that records the
+ * offset and the timestamp of each of its entries, so that "@{<n>}"
+ * and "@{<date>}" can find the entry they want without parsing the
+ * entries that are newer.  See Documentation/technical/reflog-index.txt
+ * for the file format.
+ *
+ * The index of "logs/refs/heads/master" is "logs/refs/heads/.master.idx";
+ * as no component of a reference name may begin with a dot, it cannot
+ * be mistaken for the reflog of another reference.
+ *
+ * An index is only used if it covers its reflog exactly; an index
+ * that is out of date (for example because the reflog was written to
+ * by a version of Git that does not know about indexes) is ignored.
+ */
+
+struct reflog_index_entry {
+	uint64_t offset;
+	timestamp_t timestamp;
+};
+
+/* Append the path of the index of the reflog at "log_path" to "sb". */
+void reflog_index_path(struct strbuf *sb, const char *log_path);
+
+/*
+ * Write the index of the reflog at "log_path", which is "log_size"
+ * bytes long and holds the "nr" given entries, oldest first.
+ */
+int reflog_index_write(const char *log_path,
+		       const struct reflog_index_entry *entries, int nr,
+		       uint64_t log_size);
+
+/*
+ * Record in the index of the reflog at "log_path" that an entry with
+ * "timestamp" has been appended to it at "offset", making it
+ * "log_size" bytes long.  Return -1 if there is no index, or if it
+ * does not cover the reflog up to "offset"; the caller should then
+ * write a new one.
+ */
+int reflog_index_append(const char *log_path, uint64_t offset,
+			timestamp_t timestamp, uint64_t log_size);
+
+/* Remove the index of the reflog at "log_path", if there is one. */
+void reflog_index_remove(const char *log_path);
+
+/*
+ * Look up, in the index of the reflog at "log_path", the newest entry
+ * that has "cnt" newer entries if "cnt" is not negative, or else the
+ * newest entry whose timestamp is at or before "at_time".  Store the
+ * number of entries that are newer than the entry just after it in
+ * "*skipped", and the offset at which that entry ends in "*end", so
+ * that reading the reflog backwards from "*end" yields the entry just
+ * after the one looked up, then the entry itself.  If there is no
+ * such entry, the oldest entry of the reflog takes the place of the
+ * entry just after it.
+ *
+ * Return 0 on success, or -1 if the reflog has no index that is up to
+ * date.
+ */
+int reflog_index_lookup(const char *log_path,
+			timestamp_t at_time, int cnt,
+			uint64_t *end, int *skipped);
+
+#endif /* REFS_REFLOG_INDEX_H */
@@ -61,6 +61,13 @@
  */
 #define REF_DELETED_LOOSE 0x200
 
+/*
+ * Used as a flag in ref_update::flags when the new value of the
+ * reference is to be written to packed-refs rather than to its loose
+ * lockfile.
+ */
+#define REF_NEEDS_PACKING 0x400
+
 /*
  * Return true iff refname is minimally safe. "Safe" here means that
  * deleting a loose reference by this name will not do any damage, for
@@ -540,6 +547,11 @@ typedef int for_each_reflog_ent_reverse_fn(struct ref_store *ref_store,
 					   const char *refname,
 					   each_reflog_ent_fn fn,
 					   void *cb_data);
+typedef int for_each_reflog_ent_reverse_at_fn(struct ref_store *ref_store,
+					      const char *refname,
+					      timestamp_t at_time, int cnt,
+					      each_reflog_ent_fn fn,
+					      void *cb_data, int *skipped);
 typedef int reflog_exists_fn(struct ref_store *ref_store, const char *refname);
 typedef int create_reflog_fn(struct ref_store *ref_store, const char *refname,
 			     int force_create, struct strbuf *err);
@@ -614,6 +626,7 @@ struct ref_storage_be {
 	reflog_iterator_begin_fn *reflog_iterator_begin;
 	for_each_reflog_ent_fn *for_each_reflog_ent;
 	for_each_reflog_ent_reverse_fn *for_each_reflog_ent_reverse;
+	for_each_reflog_ent_reverse_at_fn *for_each_reflog_ent_reverse_at;
 	reflog_exists_fn *reflog_exists;
 	create_reflog_fn *create_reflog;
 	delete_reflog_fn *delete_reflog;
@@ -621,6 +634,33 @@ struct ref_storage_be {
 };
 
 extern struct ref_storage_be refs_be_files;
+extern struct ref_storage_be refs_be_reftable;
+
+/*
+ * Backends other than "files" can keep their reflogs (and references
+ * that are not theirs to store, like the per-worktree ones) in a files
+ * ref_store of their own.  These give them access to its reflogs.
+ */
+
+/* Append the reflog path of "refname" (or of the logs directory) to "sb". */
+void files_store_reflog_path(struct ref_store *files_store, struct strbuf *sb,
+			     const char *refname);
+
+/*
+ * Append an entry to the reflog of "refname", creating it if
+ * core.logAllRefUpdates or REF_FORCE_CREATE_REFLOG in "flags" says so.
+ */
+int files_store_log_ref_write(struct ref_store *files_store,
+			      const char *refname, const unsigned char *old_sha1,
+			      const unsigned char *new_sha1, const char *msg,
+			      int flags, struct strbuf *err);
+
+/*
+ * Iterate over the reflogs in "files_store", resolving the references
+ * they belong to in "ref_store".
+ */
+struct ref_iterator *files_store_reflog_iterator_begin(
+		struct ref_store *files_store, struct ref_store *ref_store);
 
 /*
  * A representation of the reference store for the main repository or
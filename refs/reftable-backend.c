@@ -0,0 +1,1284 @@
+#include "../cache.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "../iterator.h"
+#include "../lockfile.h"
+#include "../object.h"
+#include "../string-list.h"
+#include "reftable.h"
+#include "reflog-index.h"
+
+/*
+ * The "reftable" backend stores the references of a repository in a
+ * stack of binary, block-indexed tables in $GIT_COMMON_DIR/reftable
+ * (see refs/reftable.h).  Looking up a reference or the references
+ * under a prefix costs O(log n) per table instead of a scan of the
+ * packed-refs file, and an update is an append of a small table
+ * instead of a rewrite of the whole file.
+ *
+ * Per-worktree references (like HEAD) and pseudorefs stay in files
+ * in $GIT_DIR, so that repository discovery and worktrees work as
+ * usual, and so do the reflogs; both are managed through a files
+ * ref_store embedded in this one.
+ */
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	/* Per-worktree references and the reflogs: */
+	struct ref_store *files;
+
+	struct reftable_stack stack;
+};
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+	refs->files = refs_be_files.init(gitdir, flags);
+
+	get_common_dir_noenv(&sb, gitdir);
+	strbuf_addstr(&sb, "/reftable");
+	reftable_stack_init(&refs->stack, sb.buf);
+	strbuf_release(&sb);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's
+ * store_flags to ensure the ref_store has all required capabilities.
+ * "caller" is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		die("BUG: ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		die("BUG: operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+/*
+ * References that are not stored in the tables, but in the files
+ * ref_store.
+ */
+static int is_files_ref(const char *refname)
+{
+	return ref_type(refname) != REF_TYPE_NORMAL;
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	int fd;
+
+	/*
+	 * The files ref_store creates refs/heads and refs/tags, which
+	 * keeps older versions of Git recognizing the directory as a
+	 * repository.
+	 */
+	if (refs->files->be->init_db(refs->files, err))
+		return -1;
+
+	safe_create_dir(refs->stack.dir, 1);
+	fd = open(refs->stack.list_path, O_WRONLY | O_CREAT, 0666);
+	if (fd < 0) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    refs->stack.list_path, strerror(errno));
+		return -1;
+	}
+	close(fd);
+	adjust_shared_perm(refs->stack.list_path);
+	return 0;
+}
+
+static int lock_tables_list(struct reftable_ref_store *refs,
+			    struct lock_file *lock, struct strbuf *err)
+{
+	static int timeout_configured = 0;
+	static int timeout_value = 1000;
+
+	if (!timeout_configured) {
+		git_config_get_int("core.packedrefstimeout", &timeout_value);
+		timeout_configured = 1;
+	}
+
+	if (hold_lock_file_for_update_timeout(lock, refs->stack.list_path,
+					      0, timeout_value) < 0) {
+		unable_to_lock_message(refs->stack.list_path, errno, err);
+		return -1;
+	}
+	if (reftable_stack_reload(&refs->stack)) {
+		strbuf_addf(err, "unable to read '%s'", refs->stack.list_path);
+		rollback_lock_file(lock);
+		return -1;
+	}
+	return 0;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, unsigned char *sha1,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	static struct strbuf target = STRBUF_INIT;
+	struct reftable_record rec;
+	int ret;
+
+	if (is_files_ref(refname))
+		return refs_read_raw_ref(refs->files, refname, sha1,
+					 referent, type);
+
+	*type = 0;
+	if (reftable_stack_reload(&refs->stack)) {
+		errno = EIO;
+		return -1;
+	}
+	ret = reftable_stack_read(&refs->stack, refname, &rec, &target);
+	if (ret) {
+		errno = ret < 0 ? EIO : ENOENT;
+		return -1;
+	}
+	if (rec.type == REFTABLE_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addstr(referent, rec.target);
+		*type |= REF_ISSYMREF;
+		return 0;
+	}
+	hashcpy(sha1, rec.oid.hash);
+	return 0;
+}
+
+static int ref_resolves_to_object(const char *refname,
+				  const struct object_id *oid,
+				  unsigned int flags)
+{
+	if (flags & REF_ISBROKEN)
+		return 0;
+	if (!has_sha1_file(oid->hash)) {
+		error("%s does not point to a valid object!", refname);
+		return 0;
+	}
+	return 1;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_merged_iterator merged;
+	char *prefix;
+	unsigned int flags;
+
+	struct strbuf refname;
+	struct object_id oid;
+	struct object_id peeled;
+	enum reftable_value_type type;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ret;
+
+	while ((ret = reftable_merged_iterator_next(&iter->merged)) > 0) {
+		const struct reftable_record *rec = &iter->merged.rec;
+		int flags = 0;
+
+		if (!starts_with(rec->refname, iter->prefix))
+			break;
+		if (is_files_ref(rec->refname))
+			continue;
+
+		strbuf_reset(&iter->refname);
+		strbuf_addstr(&iter->refname, rec->refname);
+		iter->type = rec->type;
+		if (rec->type == REFTABLE_SYMREF) {
+			if (!refs_resolve_ref_unsafe(&iter->refs->base,
+						     iter->refname.buf,
+						     RESOLVE_REF_READING,
+						     iter->oid.hash, &flags)) {
+				flags |= REF_ISBROKEN;
+				oidclr(&iter->oid);
+			}
+		} else {
+			oidcpy(&iter->oid, &rec->oid);
+			oidcpy(&iter->peeled, &rec->peeled);
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(iter->refname.buf, &iter->oid,
+					    flags))
+			continue;
+
+		iter->base.refname = iter->refname.buf;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ret < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	/*
+	 * References are peeled when they are written, so a reference
+	 * without a peeled value is not an annotated tag.
+	 */
+	switch (iter->type) {
+	case REFTABLE_OID_PEELED:
+		oidcpy(peeled, &iter->peeled);
+		return 0;
+	case REFTABLE_SYMREF:
+		return peel_object(iter->oid.hash, peeled->hash) ? -1 : 0;
+	default:
+		return -1;
+	}
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_merged_iterator_release(&iter->merged);
+	strbuf_release(&iter->refname);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct reftable_ref_iterator *iter;
+	struct ref_iterator *files_iter;
+
+	if (ref_paranoia < 0)
+		ref_paranoia = git_env_bool("GIT_REF_PARANOIA", 0);
+	if (ref_paranoia)
+		flags |= DO_FOR_EACH_INCLUDE_BROKEN;
+
+	refs = reftable_downcast(ref_store,
+				 REF_STORE_READ | (ref_paranoia ? 0 : REF_STORE_ODB),
+				 "ref_iterator_begin");
+
+	files_iter = refs->files->be->iterator_begin(refs->files, prefix,
+			flags | DO_FOR_EACH_PER_WORKTREE_ONLY);
+	if (flags & DO_FOR_EACH_PER_WORKTREE_ONLY)
+		return files_iter;
+	if (reftable_stack_reload(&refs->stack))
+		die("unable to read the references in '%s'", refs->stack.dir);
+
+	iter = xcalloc(1, sizeof(*iter));
+	base_ref_iterator_init(&iter->base, &reftable_ref_iterator_vtable);
+	iter->refs = refs;
+	iter->prefix = xstrdup(prefix);
+	iter->flags = flags;
+	strbuf_init(&iter->refname, 0);
+	reftable_merged_iterator_begin(&iter->merged, &refs->stack, prefix);
+
+	return overlay_ref_iterator_begin(files_iter, &iter->base);
+}
+
+static int reftable_peel_ref(struct ref_store *ref_store,
+			     const char *refname, unsigned char *sha1)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ | REF_STORE_ODB,
+				  "peel_ref");
+	struct strbuf target = STRBUF_INIT;
+	struct reftable_record rec;
+	unsigned char base[20];
+	int flag, ret;
+
+	if (current_ref_iter && current_ref_iter->refname == refname) {
+		struct object_id peeled;
+
+		if (ref_iterator_peel(current_ref_iter, &peeled))
+			return -1;
+		hashcpy(sha1, peeled.hash);
+		return 0;
+	}
+
+	if (refs_read_ref_full(ref_store, refname,
+			       RESOLVE_REF_READING, base, &flag))
+		return -1;
+
+	if (!is_files_ref(refname) && !(flag & REF_ISSYMREF) &&
+	    !reftable_stack_read(&refs->stack, refname, &rec, &target)) {
+		strbuf_release(&target);
+		if (rec.type != REFTABLE_OID_PEELED)
+			return -1;
+		hashcpy(sha1, rec.peeled.hash);
+		return 0;
+	}
+	strbuf_release(&target);
+
+	ret = peel_object(base, sha1);
+	return ret ? -1 : 0;
+}
+
+/* Fill in a record setting "refname" to "sha1", with its peeled value. */
+static void set_oid_record(struct reftable_record *rec, const char *refname,
+			   const unsigned char *sha1)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->refname = refname;
+	rec->type = REFTABLE_OID;
+	hashcpy(rec->oid.hash, sha1);
+	if (peel_object(sha1, rec->peeled.hash) == PEEL_PEELED)
+		rec->type = REFTABLE_OID_PEELED;
+}
+
+/* Check the new value of "refname" like write_ref_to_lockfile() does. */
+static int check_new_value(const char *refname, const unsigned char *sha1,
+			   struct strbuf *err)
+{
+	struct object *o = parse_object(sha1);
+
+	if (!o) {
+		strbuf_addf(err,
+			    "trying to write ref '%s' with nonexistent object %s",
+			    refname, sha1_to_hex(sha1));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
+		strbuf_addf(err,
+			    "trying to write non-commit object %s to branch '%s'",
+			    sha1_to_hex(sha1), refname);
+		return -1;
+	}
+	return 0;
+}
+
+static int record_cmp(const void *a_, const void *b_)
+{
+	const struct reftable_record *a = a_, *b = b_;
+
+	return strcmp(a->refname, b->refname);
+}
+
+/*
+ * Add "recs" to the stack as a new table, compact as needed, and
+ * commit "lock".  On failure, the lock is rolled back.
+ */
+static int write_records(struct reftable_ref_store *refs,
+			 struct reftable_record *recs, int nr,
+			 struct lock_file *lock, struct strbuf *err)
+{
+	QSORT(recs, nr, record_cmp);
+	if (reftable_stack_add(&refs->stack, recs, nr, err) ||
+	    reftable_stack_auto_compact(&refs->stack, err)) {
+		reftable_stack_rollback(&refs->stack, lock);
+		return -1;
+	}
+	return reftable_stack_commit(&refs->stack, lock, err);
+}
+
+/*
+ * The state of a ref_update of a reference in the tables, once any
+ * symbolic references on the way have been followed.
+ */
+struct table_update {
+	struct ref_update *update;
+	const char *refname;
+	struct object_id old_oid;
+	int exists;
+
+	/* Whether it is a symbolic ref, and whether its value stays: */
+	int symref, unchanged;
+
+	/* The symbolic references it has been updated through: */
+	struct string_list via;
+};
+
+/*
+ * Check the old value "oid" of "resolved", the reference that
+ * "update" ends up at (and which may not "exist" at all), with the
+ * same messages as the files backend.
+ */
+static int check_old_oid(struct ref_update *update, const char *resolved,
+			 int exists, struct object_id *oid, struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+	    !hashcmp(oid->hash, update->old_sha1))
+		return 0;
+
+	if (is_null_sha1(update->old_sha1))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    update->refname);
+	else if (!exists)
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "unable to resolve reference '%s'",
+			    update->refname, resolved);
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    update->refname,
+			    sha1_to_hex(update->old_sha1));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    update->refname,
+			    oid_to_hex(oid),
+			    sha1_to_hex(update->old_sha1));
+
+	return -1;
+}
+
+/*
+ * Follow the symbolic references from update->refname (unless
+ * REF_NODEREF), and record the reference that is actually updated in
+ * "tu", with its current value.  Return 1 if that reference lives in
+ * the files ref_store, 0 if it lives in the tables, and -1 on error.
+ */
+static int resolve_update(struct reftable_ref_store *refs,
+			  struct ref_update *update, struct table_update *tu,
+			  struct strbuf *err)
+{
+	struct strbuf refname = STRBUF_INIT;
+	struct strbuf referent = STRBUF_INIT;
+	int depth, ret = -1;
+
+	memset(tu, 0, sizeof(*tu));
+	string_list_init(&tu->via, 1);
+	tu->update = update;
+	strbuf_addstr(&refname, update->refname);
+
+	for (depth = 0; depth <= SYMREF_MAXDEPTH; depth++) {
+		if (is_files_ref(refname.buf)) {
+			unsigned char sha1[20];
+			unsigned int type;
+
+			if (depth) {
+				strbuf_addf(err, "cannot lock ref '%s': "
+					    "symbolic ref to '%s' is not supported",
+					    update->refname, refname.buf);
+				goto out;
+			}
+
+			/*
+			 * A symbolic reference from the files ref_store
+			 * into the tables, like HEAD usually is, is
+			 * followed by us; anything else is for the files
+			 * ref_store to update.
+			 */
+			if (update->flags & REF_NODEREF ||
+			    refs_read_raw_ref(refs->files, refname.buf, sha1,
+					      &referent, &type) ||
+			    !(type & REF_ISSYMREF) ||
+			    is_files_ref(referent.buf)) {
+				ret = 1;
+				goto out;
+			}
+		} else {
+			struct reftable_record rec;
+			int r = reftable_stack_read(&refs->stack, refname.buf,
+						    &rec, &referent);
+
+			if (r < 0) {
+				strbuf_addf(err, "cannot lock ref '%s': "
+					    "unable to read the tables",
+					    update->refname);
+				goto out;
+			}
+			if (r || rec.type != REFTABLE_SYMREF ||
+			    update->flags & REF_NODEREF) {
+				tu->exists = !r;
+				tu->symref = !r && rec.type == REFTABLE_SYMREF;
+				if (r)
+					; /* the old value is null */
+				else if (rec.type != REFTABLE_SYMREF)
+					oidcpy(&tu->old_oid, &rec.oid);
+				else if (!refs_resolve_ref_unsafe(&refs->base,
+						referent.buf, RESOLVE_REF_READING,
+						tu->old_oid.hash, NULL))
+					oidclr(&tu->old_oid);
+				tu->refname = strbuf_detach(&refname, NULL);
+				ret = 0;
+				goto out;
+			}
+		}
+		string_list_append(&tu->via, refname.buf);
+		strbuf_swap(&refname, &referent);
+	}
+
+	strbuf_addf(err, "cannot lock ref '%s': too many symbolic refs",
+		    update->refname);
+out:
+	strbuf_release(&refname);
+	strbuf_release(&referent);
+	return ret;
+}
+
+static void clear_table_updates(struct table_update *tus, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		free((char *)tus[i].refname);
+		string_list_clear(&tus[i].via, 0);
+	}
+	free(tus);
+}
+
+/* Is "refname" the branch that HEAD points at? */
+static int points_at_head(struct reftable_ref_store *refs, const char *refname)
+{
+	struct strbuf head_ref = STRBUF_INIT;
+	unsigned char sha1[20];
+	unsigned int type;
+	int ret;
+
+	ret = !refs_read_raw_ref(refs->files, "HEAD", sha1, &head_ref, &type) &&
+		(type & REF_ISSYMREF) && !strcmp(head_ref.buf, refname);
+	strbuf_release(&head_ref);
+	return ret;
+}
+
+/*
+ * Write the reflog entries for the table updates.  Like the files
+ * backend does, the deletion of the current branch is logged for HEAD.
+ */
+static int write_reflogs(struct reftable_ref_store *refs,
+			 struct table_update *tus, int nr, struct strbuf *err)
+{
+	int i, ret = 0;
+
+	for (i = 0; !ret && i < nr; i++) {
+		struct table_update *tu = &tus[i];
+		struct ref_update *update = tu->update;
+		int flags = update->flags & REF_FORCE_CREATE_REFLOG;
+		int j;
+
+		if (!(update->flags & REF_HAVE_NEW))
+			continue;
+
+		/*
+		 * The reflog of a deleted reference goes away with it,
+		 * and nothing is logged for one that does not change.
+		 */
+		if (!is_null_sha1(update->new_sha1) && !tu->unchanged)
+			ret = files_store_log_ref_write(refs->files,
+							tu->refname,
+							tu->old_oid.hash,
+							update->new_sha1,
+							update->msg, flags,
+							err);
+		for (j = 0; !ret && j < tu->via.nr; j++)
+			ret = files_store_log_ref_write(refs->files,
+							tu->via.items[j].string,
+							tu->old_oid.hash,
+							update->new_sha1,
+							update->msg, flags, err);
+
+		/* An update of the current branch is logged for HEAD, too: */
+		if (!ret && points_at_head(refs, tu->refname) &&
+		    !unsorted_string_list_has_string(&tu->via, "HEAD"))
+			ret = files_store_log_ref_write(refs->files, "HEAD",
+							tu->old_oid.hash,
+							update->new_sha1,
+							update->msg, 0, err);
+	}
+	return ret ? -1 : 0;
+}
+
+static int reftable_transaction_commit(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_commit");
+	static struct lock_file lock;
+	struct table_update *tus = NULL;
+	struct reftable_record *recs = NULL;
+	struct ref_transaction *files_transaction = NULL;
+	struct string_list affected = STRING_LIST_INIT_NODUP;
+	struct string_list deleted = STRING_LIST_INIT_NODUP;
+	int i, j, tus_nr = 0, recs_nr = 0, locked = 0;
+	int ret = TRANSACTION_GENERIC_ERROR;
+
+	assert(err);
+
+	if (transaction->state != REF_TRANSACTION_OPEN)
+		die("BUG: commit called for transaction that is not open");
+
+	if (!transaction->nr) {
+		transaction->state = REF_TRANSACTION_CLOSED;
+		return 0;
+	}
+
+	if (lock_tables_list(refs, &lock, err))
+		goto cleanup;
+	locked = 1;
+
+	/*
+	 * Sort out which updates are for the tables (following
+	 * symbolic references) and which are for the files ref_store,
+	 * and check the old values of the former.
+	 */
+	ALLOC_ARRAY(tus, transaction->nr);
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct table_update *tu = &tus[tus_nr];
+		struct string_list_item *item;
+		int r = resolve_update(refs, update, tu, err);
+
+		if (r) {
+			int flags = update->flags;
+
+			string_list_clear(&tu->via, 0);
+			if (r < 0)
+				goto cleanup;
+
+			/*
+			 * The files ref_store cannot see the target of a
+			 * symbolic reference into the tables, so we
+			 * check the old value ourselves.
+			 */
+			if (flags & REF_HAVE_OLD) {
+				struct object_id oid;
+
+				if (!refs_resolve_ref_unsafe(ref_store,
+						update->refname,
+						RESOLVE_REF_READING,
+						oid.hash, NULL))
+					oidclr(&oid);
+				if (check_old_oid(update, update->refname,
+						  !is_null_oid(&oid),
+						  &oid, err))
+					goto cleanup;
+				flags &= ~REF_HAVE_OLD;
+			}
+			string_list_append(&affected, update->refname);
+			if (!files_transaction) {
+				files_transaction =
+					ref_store_transaction_begin(refs->files,
+								    err);
+				if (!files_transaction)
+					goto cleanup;
+			}
+			ref_transaction_add_update(files_transaction,
+						   update->refname, flags,
+						   update->new_sha1,
+						   update->old_sha1,
+						   update->msg);
+			continue;
+		}
+		tus_nr++;
+		item = string_list_append(&affected, tu->refname);
+		if (tu->via.nr)
+			item->util = xstrfmt("'%s' (including one via symref '%s')",
+					     tu->refname, tu->via.items[0].string);
+		for (j = 0; j < tu->via.nr; j++)
+			string_list_append(&affected, tu->via.items[j].string);
+		if (!unsorted_string_list_has_string(&tu->via, "HEAD") &&
+		    points_at_head(refs, tu->refname))
+			string_list_append(&affected, "HEAD")->util =
+				xstrfmt("'HEAD' (including one via its referent '%s')",
+					tu->refname);
+		if ((update->flags & REF_HAVE_NEW) &&
+		    is_null_sha1(update->new_sha1))
+			string_list_append(&deleted, tu->refname);
+		if (check_old_oid(update, tu->refname, tu->exists,
+				  &tu->old_oid, err))
+			goto cleanup;
+	}
+
+	string_list_sort(&affected);
+	string_list_sort(&deleted);
+	for (i = 1; i < affected.nr; i++) {
+		struct string_list_item *a = &affected.items[i - 1];
+		struct string_list_item *b = &affected.items[i];
+
+		if (strcmp(a->string, b->string))
+			continue;
+		/* Word it like the files backend does: */
+		if (a->util || b->util)
+			strbuf_addf(err, "multiple updates for %s are not allowed",
+				    (const char *)(a->util ? a->util : b->util));
+		else
+			strbuf_addf(err, "multiple updates for ref '%s' not allowed.",
+				    a->string);
+		goto cleanup;
+	}
+
+	ALLOC_ARRAY(recs, tus_nr);
+	for (i = 0; i < tus_nr; i++) {
+		struct table_update *tu = &tus[i];
+		struct ref_update *update = tu->update;
+
+		if (!(update->flags & REF_HAVE_NEW))
+			continue;
+		if (is_null_sha1(update->new_sha1)) {
+			if (!tu->exists)
+				continue;
+			memset(&recs[recs_nr], 0, sizeof(*recs));
+			recs[recs_nr].refname = tu->refname;
+			recs[recs_nr++].type = REFTABLE_DELETION;
+			continue;
+		}
+		if (!tu->exists &&
+		    refs_verify_refname_available(&refs->base, tu->refname,
+						  &affected, &deleted, err)) {
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto cleanup;
+		}
+		if (tu->exists && !tu->symref &&
+		    !hashcmp(tu->old_oid.hash, update->new_sha1)) {
+			/*
+			 * The reference already has the desired value,
+			 * so we don't need to write it.
+			 */
+			tu->unchanged = 1;
+			continue;
+		}
+		if (check_new_value(tu->refname, update->new_sha1, err))
+			goto cleanup;
+		set_oid_record(&recs[recs_nr++], tu->refname, update->new_sha1);
+	}
+
+	if (!recs_nr) {
+		rollback_lock_file(&lock);
+		locked = 0;
+		if (write_reflogs(refs, tus, tus_nr, err))
+			goto cleanup;
+	} else {
+		/*
+		 * Like the files backend, write the reflogs before the
+		 * new values become visible.
+		 */
+		QSORT(recs, recs_nr, record_cmp);
+		if (reftable_stack_add(&refs->stack, recs, recs_nr, err) ||
+		    reftable_stack_auto_compact(&refs->stack, err) ||
+		    write_reflogs(refs, tus, tus_nr, err))
+			goto cleanup;
+		locked = 0;
+		if (reftable_stack_commit(&refs->stack, &lock, err))
+			goto cleanup;
+	}
+
+	for (i = 0; i < tus_nr; i++)
+		if (tus[i].exists && (tus[i].update->flags & REF_HAVE_NEW) &&
+		    is_null_sha1(tus[i].update->new_sha1))
+			refs_delete_reflog(refs->files, tus[i].refname);
+
+	/*
+	 * The per-worktree references are updated last, and this is
+	 * not atomic with the update of the tables above.
+	 */
+	if (files_transaction &&
+	    ref_transaction_commit(files_transaction, err))
+		goto cleanup;
+
+	ret = 0;
+
+cleanup:
+	if (locked)
+		reftable_stack_rollback(&refs->stack, &lock);
+	transaction->state = REF_TRANSACTION_CLOSED;
+	if (files_transaction)
+		ref_transaction_free(files_transaction);
+	clear_table_updates(tus, tus_nr);
+	free(recs);
+	string_list_clear(&affected, 1);
+	string_list_clear(&deleted, 0);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	static struct lock_file lock;
+	struct strbuf err = STRBUF_INIT;
+	unsigned char old_sha1[20], new_sha1[20];
+	int ret = 0;
+
+	if (!refs_resolve_ref_unsafe(ref_store, refname, RESOLVE_REF_READING,
+				     old_sha1, NULL))
+		hashclr(old_sha1);
+
+	if (is_files_ref(refname)) {
+		/*
+		 * The files ref_store cannot resolve a target in the
+		 * tables, so we write the reflog entry ourselves.
+		 */
+		if (refs->files->be->create_symref(refs->files, refname,
+						   target, NULL))
+			return -1;
+	} else {
+		struct reftable_record rec;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.refname = refname;
+		rec.type = REFTABLE_SYMREF;
+		rec.target = target;
+		if (lock_tables_list(refs, &lock, &err))
+			goto error;
+		if (refs_verify_refname_available(ref_store, refname,
+						  NULL, NULL, &err)) {
+			rollback_lock_file(&lock);
+			goto error;
+		}
+		if (write_records(refs, &rec, 1, &lock, &err))
+			goto error;
+	}
+
+	if (logmsg &&
+	    !refs_read_ref_full(ref_store, target, RESOLVE_REF_READING,
+				new_sha1, NULL) &&
+	    files_store_log_ref_write(refs->files, refname, old_sha1,
+				      new_sha1, logmsg, 0, &err))
+		goto error;
+	return ret;
+
+error:
+	ret = error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store,
+				struct string_list *refnames,
+				unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int i, result = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+	for (i = 0; i < refnames->nr; i++) {
+		const char *refname = refnames->items[i].string;
+
+		/*
+		 * A pseudoref is deleted as the file it is, without
+		 * following it, like the files backend does.
+		 */
+		if (ref_type(refname) == REF_TYPE_PSEUDOREF) {
+			if (refs_delete_ref(ref_store, NULL, refname, NULL,
+					    flags))
+				result |= error(_("could not remove reference %s"),
+						refname);
+			continue;
+		}
+		if (ref_transaction_delete(transaction, refname, NULL,
+					   flags, NULL, &err))
+			goto error;
+	}
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+	goto out;
+
+error:
+	if (refnames->nr == 1)
+		result = error(_("could not delete reference %s: %s"),
+			       refnames->items[0].string, err.buf);
+	else
+		result = error(_("could not delete references: %s"), err.buf);
+out:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return result;
+}
+
+/*
+ * Move the reflog at "from" to "to", removing whatever reflog was at
+ * "to", or an empty directory that would be in the way.
+ */
+static int move_reflog(const char *from, const char *to)
+{
+	if (safe_create_leading_directories_const(to) == SCLD_FAILED ||
+	    (rename(from, to) &&
+	     (errno != EISDIR || rmdir(to) || rename(from, to))))
+		return error_errno("unable to move logfile %s to %s",
+				   from, to);
+	reflog_index_remove(from);
+	return 0;
+}
+
+#define TMP_RENAMED_LOG  "refs/.tmp-renamed-log"
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	static struct lock_file lock;
+	struct strbuf oldlog = STRBUF_INIT, newlog = STRBUF_INIT;
+	struct strbuf tmplog = STRBUF_INIT, err = STRBUF_INIT;
+	struct reftable_record recs[2];
+	unsigned char orig_sha1[20];
+	struct stat loginfo;
+	int flag = 0, log, ret = -1;
+
+	if (is_files_ref(oldrefname) || is_files_ref(newrefname))
+		return error("renaming '%s' to '%s' is not supported",
+			     oldrefname, newrefname);
+
+	files_store_reflog_path(refs->files, &oldlog, oldrefname);
+	files_store_reflog_path(refs->files, &newlog, newrefname);
+	files_store_reflog_path(refs->files, &tmplog, TMP_RENAMED_LOG);
+
+	log = !lstat(oldlog.buf, &loginfo);
+	if (log && S_ISLNK(loginfo.st_mode)) {
+		error("reflog for %s is a symlink", oldrefname);
+		goto out;
+	}
+
+	if (!refs_resolve_ref_unsafe(ref_store, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     orig_sha1, &flag)) {
+		error("refname %s not found", oldrefname);
+		goto out;
+	}
+	if (flag & REF_ISSYMREF) {
+		error("refname %s is a symbolic ref, renaming it is not supported",
+		      oldrefname);
+		goto out;
+	}
+	if (!refs_rename_ref_available(ref_store, oldrefname, newrefname)) {
+		ret = 1;
+		goto out;
+	}
+
+	if (lock_tables_list(refs, &lock, &err)) {
+		error("%s", err.buf);
+		goto out;
+	}
+
+	/* The reflog is moved along before the rename becomes visible: */
+	if (log && (move_reflog(oldlog.buf, tmplog.buf) ||
+		    (refs_reflog_exists(refs->files, newrefname) &&
+		     refs_delete_reflog(refs->files, newrefname)) ||
+		    move_reflog(tmplog.buf, newlog.buf))) {
+		if (!lstat(tmplog.buf, &loginfo))
+			move_reflog(tmplog.buf, oldlog.buf);
+		rollback_lock_file(&lock);
+		goto out;
+	}
+
+	/*
+	 * Like the files backend, log the deletion of the old name for
+	 * HEAD if it is the current branch; create_symref() then logs
+	 * HEAD being pointed at the new name.
+	 */
+	memset(recs, 0, sizeof(recs));
+	recs[0].refname = oldrefname;
+	recs[0].type = REFTABLE_DELETION;
+	set_oid_record(&recs[1], newrefname, orig_sha1);
+	if ((points_at_head(refs, oldrefname) &&
+	     files_store_log_ref_write(refs->files, "HEAD", orig_sha1,
+				       null_sha1, logmsg, 0, &err)) ||
+	    files_store_log_ref_write(refs->files, newrefname, orig_sha1,
+				      orig_sha1, logmsg, 0, &err)) {
+		rollback_lock_file(&lock);
+		goto rollback;
+	}
+	if (!strcmp(oldrefname, newrefname) ?
+	    write_records(refs, &recs[1], 1, &lock, &err) :
+	    write_records(refs, recs, 2, &lock, &err))
+		goto rollback;
+	ret = 0;
+	goto out;
+
+rollback:
+	error("unable to rename '%s' to '%s': %s",
+	      oldrefname, newrefname, err.buf);
+	if (log)
+		move_reflog(newlog.buf, oldlog.buf);
+out:
+	strbuf_release(&oldlog);
+	strbuf_release(&newlog);
+	strbuf_release(&tmplog);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	static struct lock_file lock;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (lock_tables_list(refs, &lock, &err))
+		ret = error("%s", err.buf);
+	else if (reftable_stack_compact(&refs->stack, 0, &err)) {
+		reftable_stack_rollback(&refs->stack, &lock);
+		ret = error("%s", err.buf);
+	} else if (reftable_stack_commit(&refs->stack, &lock, &err))
+		ret = error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+
+	return files_store_reflog_iterator_begin(refs->files, ref_store);
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+
+	return refs_for_each_reflog_ent(refs->files, refname, fn, cb_data);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+
+	return refs_for_each_reflog_ent_reverse(refs->files, refname,
+						fn, cb_data);
+}
+
+static int reftable_for_each_reflog_ent_reverse_at(struct ref_store *ref_store,
+						   const char *refname,
+						   timestamp_t at_time, int cnt,
+						   each_reflog_ent_fn fn,
+						   void *cb_data, int *skipped)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse_at");
+
+	return refs_for_each_reflog_ent_reverse_at(refs->files, refname,
+						   at_time, cnt, fn, cb_data,
+						   skipped);
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+
+	return refs_reflog_exists(refs->files, refname);
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+
+	return refs_create_reflog(refs->files, refname, force_create, err);
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+
+	return refs_delete_reflog(refs->files, refname);
+}
+
+struct expire_reflog_cb {
+	unsigned int flags;
+	reflog_expiry_should_prune_fn *should_prune_fn;
+	void *policy_cb;
+	FILE *newlog;
+	struct object_id last_kept_oid;
+};
+
+static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
+			     const char *email, timestamp_t timestamp, int tz,
+			     const char *message, void *cb_data)
+{
+	struct expire_reflog_cb *cb = cb_data;
+
+	if (cb->flags & EXPIRE_REFLOGS_REWRITE)
+		ooid = &cb->last_kept_oid;
+
+	if ((*cb->should_prune_fn)(ooid->hash, noid->hash, email, timestamp, tz,
+				   message, cb->policy_cb)) {
+		if (!cb->newlog)
+			printf("would prune %s", message);
+		else if (cb->flags & EXPIRE_REFLOGS_VERBOSE)
+			printf("prune %s", message);
+	} else {
+		if (cb->newlog) {
+			fprintf(cb->newlog, "%s %s %s %"PRItime" %+05d\t%s",
+				oid_to_hex(ooid), oid_to_hex(noid),
+				email, timestamp, tz, message);
+			oidcpy(&cb->last_kept_oid, noid);
+		}
+		if (cb->flags & EXPIRE_REFLOGS_VERBOSE)
+			printf("keep %s", message);
+	}
+	return 0;
+}
+
+/*
+ * The files backend locks the reference while it rewrites its reflog;
+ * the reflog lock is all we have here.
+ */
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const unsigned char *sha1,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	static struct lock_file reflog_lock;
+	struct expire_reflog_cb cb;
+	struct strbuf log_file = STRBUF_INIT;
+	int status = 0, type = 0;
+	unsigned char unused[20];
+
+	if (!refs_reflog_exists(refs->files, refname))
+		return 0;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.flags = flags;
+	cb.policy_cb = policy_cb_data;
+	cb.should_prune_fn = should_prune_fn;
+
+	files_store_reflog_path(refs->files, &log_file, refname);
+	if (!(flags & EXPIRE_REFLOGS_DRY_RUN)) {
+		if (hold_lock_file_for_update(&reflog_lock, log_file.buf, 0) < 0) {
+			struct strbuf err = STRBUF_INIT;
+			unable_to_lock_message(log_file.buf, errno, &err);
+			error("%s", err.buf);
+			strbuf_release(&err);
+			strbuf_release(&log_file);
+			return -1;
+		}
+		cb.newlog = fdopen_lock_file(&reflog_lock, "w");
+		if (!cb.newlog) {
+			error("cannot fdopen %s (%s)",
+			      get_lock_file_path(&reflog_lock), strerror(errno));
+			rollback_lock_file(&reflog_lock);
+			strbuf_release(&log_file);
+			return -1;
+		}
+	}
+
+	(*prepare_fn)(refname, sha1, cb.policy_cb);
+	refs_for_each_reflog_ent(refs->files, refname, expire_reflog_ent, &cb);
+	(*cleanup_fn)(cb.policy_cb);
+
+	if (!(flags & EXPIRE_REFLOGS_DRY_RUN)) {
+		int update;
+
+		refs_resolve_ref_unsafe(ref_store, refname,
+					RESOLVE_REF_NO_RECURSE, unused, &type);
+		update = (flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+			!(type & REF_ISSYMREF) &&
+			!is_null_oid(&cb.last_kept_oid);
+
+		/*
+		 * Updating the reference appends to the old reflog,
+		 * which is then replaced by the new one.
+		 */
+		if (close_lock_file(&reflog_lock)) {
+			status |= error("couldn't write %s: %s", log_file.buf,
+					strerror(errno));
+		} else if (update &&
+			   refs_update_ref(ref_store, NULL, refname,
+					   cb.last_kept_oid.hash, NULL,
+					   REF_NODEREF, UPDATE_REFS_MSG_ON_ERR)) {
+			status |= error("couldn't set %s", refname);
+			rollback_lock_file(&reflog_lock);
+		} else if (commit_lock_file(&reflog_lock)) {
+			status |= error("unable to write reflog '%s' (%s)",
+					log_file.buf, strerror(errno));
+		}
+	}
+	strbuf_release(&log_file);
+	return status;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	NULL,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_commit,
+	reftable_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_peel_ref,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_for_each_reflog_ent_reverse_at,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
@@ -0,0 +1,870 @@
+#include "../cache.h"
+#include "../lockfile.h"
+#include "../string-list.h"
+#include "../varint.h"
+#include "reftable.h"
+
+static int corrupt_table(const struct reftable *table)
+{
+	return error("corrupt reftable '%s'", table->name);
+}
+
+struct reftable *reftable_open(const char *dir, const char *name)
+{
+	struct reftable *table;
+	struct strbuf path = STRBUF_INIT;
+	const unsigned char *footer;
+	struct stat st;
+	uint64_t index_offset;
+	void *data;
+	size_t size;
+	int fd;
+
+	strbuf_addf(&path, "%s/%s", dir, name);
+	fd = git_open(path.buf);
+	strbuf_release(&path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE) {
+		close(fd);
+		error("reftable '%s' is too small", name);
+		errno = 0;
+		return NULL;
+	}
+	data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	table = xcalloc(1, sizeof(*table));
+	table->name = xstrdup(name);
+	table->data = data;
+	table->size = size;
+	table->refcount = 1;
+
+	footer = table->data + size - REFTABLE_FOOTER_SIZE;
+	index_offset = get_be64(footer);
+	table->nr_blocks = get_be32(footer + 8);
+	if (get_be32(table->data) != REFTABLE_SIGNATURE ||
+	    table->data[4] != REFTABLE_VERSION ||
+	    get_be32(footer + 12) !=
+	    crc32(crc32(0, table->data, REFTABLE_HEADER_SIZE), footer, 12) ||
+	    index_offset < REFTABLE_HEADER_SIZE ||
+	    index_offset + (uint64_t)table->nr_blocks * 4 !=
+	    size - REFTABLE_FOOTER_SIZE) {
+		corrupt_table(table);
+		reftable_release(table);
+		errno = 0;
+		return NULL;
+	}
+	table->min_update_index = get_be64(table->data + 8);
+	table->max_update_index = get_be64(table->data + 16);
+	table->block_index = table->data + index_offset;
+	table->blocks_end = index_offset;
+	return table;
+}
+
+void reftable_release(struct reftable *table)
+{
+	if (!table || --table->refcount)
+		return;
+	munmap((void *)table->data, table->size);
+	free(table->name);
+	free(table);
+}
+
+/*
+ * Like decode_varint(), but for data we cannot trust: fail rather than
+ * read at or past "end", or when the value overflows.
+ */
+static int decode_varint_in(const unsigned char **bufp,
+			    const unsigned char *end, uintmax_t *valp)
+{
+	const unsigned char *buf = *bufp;
+	unsigned char c;
+	uintmax_t val;
+
+	if (buf >= end)
+		return -1;
+	c = *buf++;
+	val = c & 127;
+	while (c & 128) {
+		val += 1;
+		if (!val || MSB(val, 7) || buf >= end)
+			return -1;
+		c = *buf++;
+		val = (val << 7) + (c & 127);
+	}
+	*bufp = buf;
+	*valp = val;
+	return 0;
+}
+
+/*
+ * Compare the name of the record at "p", which must be a restart
+ * point (i.e., not prefix-compressed), to "refname".
+ */
+static int restart_name_cmp(const unsigned char *p, const unsigned char *end,
+			    const char *refname, int *corrupt)
+{
+	uintmax_t prefix_len, suffix_len;
+	size_t len = strlen(refname);
+	int cmp;
+
+	if (decode_varint_in(&p, end, &prefix_len) ||
+	    decode_varint_in(&p, end, &suffix_len) ||
+	    prefix_len || (suffix_len >> 2) > end - p) {
+		*corrupt = 1;
+		return 0;
+	}
+	suffix_len >>= 2;
+	cmp = memcmp(p, refname, suffix_len < len ? suffix_len : len);
+	if (!cmp)
+		cmp = suffix_len < len ? -1 : suffix_len > len;
+	return cmp;
+}
+
+/*
+ * Set up "it" to read block number "nr", and return its restart
+ * points in "restarts" and "restarts_nr".  Return 0 past the last
+ * block, 1 on success and -1 if the block is corrupt.
+ */
+static int load_block(struct reftable_iterator *it, uint32_t nr,
+		      const unsigned char **restarts, uint32_t *restarts_nr)
+{
+	const struct reftable *table = it->table;
+	size_t start, end;
+
+	it->block = nr;
+	it->pos = it->end = NULL;
+	it->peeked = 0;
+	strbuf_reset(&it->name);
+	if (nr >= table->nr_blocks)
+		return 0;
+
+	start = get_be32(table->block_index + 4 * nr);
+	end = nr + 1 < table->nr_blocks ?
+		get_be32(table->block_index + 4 * (nr + 1)) :
+		table->blocks_end;
+	if (start < REFTABLE_HEADER_SIZE || end > table->blocks_end ||
+	    end < start + 4)
+		return corrupt_table(table);
+	*restarts_nr = get_be32(table->data + end - 4);
+	if (!*restarts_nr || *restarts_nr > (end - start - 4) / 4)
+		return corrupt_table(table);
+	*restarts = table->data + end - 4 - 4 * *restarts_nr;
+	it->pos = table->data + start;
+	it->end = *restarts;
+	return 1;
+}
+
+static int decode_record(struct reftable_iterator *it)
+{
+	const unsigned char *p = it->pos;
+	uintmax_t prefix_len, suffix_type, suffix_len, target_len;
+	struct reftable_record *rec = &it->rec;
+
+	if (decode_varint_in(&p, it->end, &prefix_len) ||
+	    decode_varint_in(&p, it->end, &suffix_type))
+		return corrupt_table(it->table);
+	suffix_len = suffix_type >> 2;
+	if (prefix_len > it->name.len || suffix_len > it->end - p)
+		return corrupt_table(it->table);
+	strbuf_setlen(&it->name, prefix_len);
+	strbuf_add(&it->name, p, suffix_len);
+	p += suffix_len;
+
+	rec->refname = it->name.buf;
+	rec->type = suffix_type & 3;
+	rec->target = NULL;
+	switch (rec->type) {
+	case REFTABLE_DELETION:
+		break;
+	case REFTABLE_OID_PEELED:
+		if (it->end - p < 2 * GIT_SHA1_RAWSZ)
+			return corrupt_table(it->table);
+		hashcpy(rec->oid.hash, p);
+		hashcpy(rec->peeled.hash, p + GIT_SHA1_RAWSZ);
+		p += 2 * GIT_SHA1_RAWSZ;
+		break;
+	case REFTABLE_OID:
+		if (it->end - p < GIT_SHA1_RAWSZ)
+			return corrupt_table(it->table);
+		hashcpy(rec->oid.hash, p);
+		p += GIT_SHA1_RAWSZ;
+		break;
+	case REFTABLE_SYMREF:
+		if (decode_varint_in(&p, it->end, &target_len) ||
+		    target_len > it->end - p)
+			return corrupt_table(it->table);
+		strbuf_reset(&it->target);
+		strbuf_add(&it->target, p, target_len);
+		rec->target = it->target.buf;
+		p += target_len;
+		break;
+	}
+	it->pos = p;
+	return 1;
+}
+
+void reftable_iterator_seek(struct reftable_iterator *it,
+			    struct reftable *table, const char *refname)
+{
+	const unsigned char *restarts;
+	uint32_t restarts_nr, lo, hi;
+	int corrupt = 0;
+
+	it->table = table;
+	if (!table->nr_blocks) {
+		load_block(it, 0, &restarts, &restarts_nr);
+		return;
+	}
+
+	/* Find the last block whose first record is <= refname... */
+	lo = 0;
+	hi = table->nr_blocks;
+	while (hi - lo > 1) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		size_t start = get_be32(table->block_index + 4 * mi);
+
+		if (start >= table->blocks_end) {
+			corrupt = 1;
+			break;
+		}
+		if (restart_name_cmp(table->data + start,
+				     table->data + table->blocks_end,
+				     refname, &corrupt) <= 0)
+			lo = mi;
+		else
+			hi = mi;
+		if (corrupt)
+			break;
+	}
+	if (corrupt || load_block(it, lo, &restarts, &restarts_nr) < 0)
+		goto corrupt;
+
+	/* ...then the last restart point in it that is <= refname... */
+	lo = 0;
+	hi = restarts_nr;
+	while (hi - lo > 1) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = it->pos + get_be32(restarts + 4 * mi);
+
+		if (p >= it->end)
+			goto corrupt;
+		if (restart_name_cmp(p, it->end, refname, &corrupt) <= 0)
+			lo = mi;
+		else
+			hi = mi;
+		if (corrupt)
+			goto corrupt;
+	}
+	it->pos += get_be32(restarts + 4 * lo);
+	if (it->pos >= it->end)
+		goto corrupt;
+
+	/* ...and scan (at most one restart interval) from there. */
+	for (;;) {
+		int ret = reftable_iterator_next(it);
+
+		if (ret <= 0)
+			return;
+		if (strcmp(it->rec.refname, refname) >= 0) {
+			it->peeked = 1;
+			return;
+		}
+	}
+
+corrupt:
+	corrupt_table(table);
+	it->block = table->nr_blocks;
+	it->pos = it->end = NULL;
+	it->peeked = -1;
+}
+
+int reftable_iterator_next(struct reftable_iterator *it)
+{
+	int ret;
+
+	if (it->peeked < 0)
+		return -1;
+	if (it->peeked) {
+		it->peeked = 0;
+		return 1;
+	}
+	while (it->pos == it->end) {
+		const unsigned char *restarts;
+		uint32_t restarts_nr;
+
+		if (it->block >= it->table->nr_blocks)
+			return 0;
+		ret = load_block(it, it->block + 1, &restarts, &restarts_nr);
+		if (ret <= 0)
+			goto out;
+	}
+	ret = decode_record(it);
+out:
+	if (ret < 0)
+		it->peeked = -1;
+	return ret;
+}
+
+void reftable_iterator_release(struct reftable_iterator *it)
+{
+	strbuf_release(&it->name);
+	strbuf_release(&it->target);
+}
+
+void reftable_writer_init(struct reftable_writer *w, size_t block_size,
+			  uint64_t min_update_index,
+			  uint64_t max_update_index)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	strbuf_init(&w->buf, 0);
+	strbuf_init(&w->last_name, 0);
+	w->block_size = block_size;
+
+	put_be32(header, REFTABLE_SIGNATURE);
+	put_be32(header + 4, (REFTABLE_VERSION << 24) | block_size);
+	put_be64(header + 8, min_update_index);
+	put_be64(header + 16, max_update_index);
+	strbuf_add(&w->buf, header, sizeof(header));
+}
+
+static void encode_record(struct strbuf *out, const char *last_name,
+			  const struct reftable_record *rec)
+{
+	unsigned char varint[16];
+	size_t len = strlen(rec->refname), prefix_len = 0;
+
+	if (last_name)
+		while (last_name[prefix_len] &&
+		       last_name[prefix_len] == rec->refname[prefix_len])
+			prefix_len++;
+
+	strbuf_reset(out);
+	strbuf_add(out, varint, encode_varint(prefix_len, varint));
+	strbuf_add(out, varint,
+		   encode_varint(((len - prefix_len) << 2) | rec->type, varint));
+	strbuf_add(out, rec->refname + prefix_len, len - prefix_len);
+	switch (rec->type) {
+	case REFTABLE_DELETION:
+		break;
+	case REFTABLE_OID_PEELED:
+		strbuf_add(out, rec->oid.hash, GIT_SHA1_RAWSZ);
+		strbuf_add(out, rec->peeled.hash, GIT_SHA1_RAWSZ);
+		break;
+	case REFTABLE_OID:
+		strbuf_add(out, rec->oid.hash, GIT_SHA1_RAWSZ);
+		break;
+	case REFTABLE_SYMREF:
+		len = strlen(rec->target);
+		strbuf_add(out, varint, encode_varint(len, varint));
+		strbuf_add(out, rec->target, len);
+		break;
+	}
+}
+
+static void finish_block(struct reftable_writer *w)
+{
+	unsigned char be[4];
+	int i;
+
+	if (!w->block_records)
+		return;
+	for (i = 0; i < w->restarts_nr; i++) {
+		put_be32(be, w->restarts[i]);
+		strbuf_add(&w->buf, be, 4);
+	}
+	put_be32(be, w->restarts_nr);
+	strbuf_add(&w->buf, be, 4);
+	w->restarts_nr = 0;
+	w->block_records = 0;
+}
+
+void reftable_writer_add(struct reftable_writer *w,
+			 const struct reftable_record *rec)
+{
+	static struct strbuf encoded = STRBUF_INIT;
+	int restart = !(w->block_records % REFTABLE_RESTART_INTERVAL);
+
+	if (w->last_name.len && strcmp(w->last_name.buf, rec->refname) >= 0)
+		die("BUG: reftable records out of order: '%s' after '%s'",
+		    rec->refname, w->last_name.buf);
+
+	encode_record(&encoded, restart ? NULL : w->last_name.buf, rec);
+	if (w->block_records &&
+	    w->buf.len - w->block_start + encoded.len +
+	    4 * (w->restarts_nr + restart + 1) > w->block_size) {
+		finish_block(w);
+		restart = 1;
+		encode_record(&encoded, NULL, rec);
+	}
+
+	if (!w->block_records) {
+		if (w->buf.len > 0xffffffff)
+			die("reftable too large");
+		w->block_start = w->buf.len;
+		ALLOC_GROW(w->blocks, w->blocks_nr + 1, w->blocks_alloc);
+		w->blocks[w->blocks_nr++] = w->block_start;
+	}
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = w->buf.len - w->block_start;
+	}
+	strbuf_addbuf(&w->buf, &encoded);
+	w->block_records++;
+	strbuf_reset(&w->last_name);
+	strbuf_addstr(&w->last_name, rec->refname);
+}
+
+void reftable_writer_finish(struct reftable_writer *w)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	unsigned char be[4];
+	size_t index_offset;
+	int i;
+
+	finish_block(w);
+	index_offset = w->buf.len;
+	for (i = 0; i < w->blocks_nr; i++) {
+		put_be32(be, w->blocks[i]);
+		strbuf_add(&w->buf, be, 4);
+	}
+	put_be64(footer, index_offset);
+	put_be32(footer + 8, w->blocks_nr);
+	put_be32(footer + 12,
+		 crc32(crc32(0, (unsigned char *)w->buf.buf,
+			     REFTABLE_HEADER_SIZE), footer, 12));
+	strbuf_add(&w->buf, footer, sizeof(footer));
+}
+
+void reftable_writer_release(struct reftable_writer *w)
+{
+	strbuf_release(&w->buf);
+	strbuf_release(&w->last_name);
+	free(w->restarts);
+	free(w->blocks);
+}
+
+void reftable_stack_init(struct reftable_stack *st, const char *dir)
+{
+	memset(st, 0, sizeof(*st));
+	st->dir = xstrdup(dir);
+	st->list_path = xstrfmt("%s/tables.list", dir);
+	string_list_init(&st->written, 1);
+	string_list_init(&st->garbage, 1);
+}
+
+static void release_tables(struct reftable **tables, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		reftable_release(tables[i]);
+	free(tables);
+}
+
+void reftable_stack_release(struct reftable_stack *st)
+{
+	release_tables(st->tables, st->nr);
+	stat_validity_clear(&st->validity);
+	string_list_clear(&st->written, 0);
+	string_list_clear(&st->garbage, 0);
+	free(st->dir);
+	free(st->list_path);
+	memset(st, 0, sizeof(*st));
+}
+
+static struct reftable *find_table(struct reftable_stack *st,
+				   const char *name)
+{
+	int i;
+
+	for (i = 0; i < st->nr; i++)
+		if (!strcmp(st->tables[i]->name, name))
+			return st->tables[i];
+	return NULL;
+}
+
+int reftable_stack_reload(struct reftable_stack *st)
+{
+	struct strbuf list = STRBUF_INIT;
+	int tries;
+
+	if (stat_validity_check(&st->validity, st->list_path))
+		return 0;
+
+	/*
+	 * A table that is in the list can be removed by a concurrent
+	 * compaction before we get to open it.  In that case, the list
+	 * has been rewritten, so just read it again.
+	 */
+	for (tries = 0; tries < 5; tries++) {
+		struct reftable **tables = NULL;
+		int nr = 0, alloc = 0;
+		char *line, *next;
+		int fd = open(st->list_path, O_RDONLY);
+
+		if (fd < 0) {
+			if (errno != ENOENT)
+				return error_errno("unable to open '%s'",
+						   st->list_path);
+			stat_validity_clear(&st->validity);
+		} else {
+			strbuf_reset(&list);
+			if (strbuf_read(&list, fd, 0) < 0) {
+				error_errno("unable to read '%s'",
+					    st->list_path);
+				close(fd);
+				strbuf_release(&list);
+				return -1;
+			}
+			stat_validity_update(&st->validity, fd);
+			close(fd);
+		}
+
+		for (line = list.buf; fd >= 0 && *line; line = next) {
+			struct reftable *table;
+
+			next = strchrnul(line, '\n');
+			if (*next)
+				*next++ = '\0';
+			if (!*line)
+				continue;
+			table = find_table(st, line);
+			if (table)
+				table->refcount++;
+			else
+				table = reftable_open(st->dir, line);
+			if (!table)
+				break;
+			ALLOC_GROW(tables, nr + 1, alloc);
+			tables[nr++] = table;
+		}
+		if (fd >= 0 && *line) {
+			int err = errno;
+
+			release_tables(tables, nr);
+			stat_validity_clear(&st->validity);
+			if (err == ENOENT)
+				continue;
+			strbuf_release(&list);
+			if (err)
+				return error("unable to open reftable '%s': %s",
+					     line, strerror(err));
+			return -1;
+		}
+		release_tables(st->tables, st->nr);
+		st->tables = tables;
+		st->nr = nr;
+		st->alloc = alloc;
+		strbuf_release(&list);
+		return 0;
+	}
+	strbuf_release(&list);
+	return error("'%s' keeps changing", st->list_path);
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	if (!st->nr)
+		return 1;
+	return st->tables[st->nr - 1]->max_update_index + 1;
+}
+
+int reftable_stack_read(struct reftable_stack *st, const char *refname,
+			struct reftable_record *rec, struct strbuf *scratch)
+{
+	struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+	int i, ret = 1;
+
+	for (i = st->nr - 1; i >= 0; i--) {
+		reftable_iterator_seek(&it, st->tables[i], refname);
+		ret = reftable_iterator_next(&it);
+		if (ret < 0)
+			break;
+		if (!ret || strcmp(it.rec.refname, refname)) {
+			ret = 1;
+			continue;
+		}
+		if (it.rec.type == REFTABLE_DELETION) {
+			ret = 1;
+			break;
+		}
+		*rec = it.rec;
+		rec->refname = refname;
+		if (rec->type == REFTABLE_SYMREF) {
+			strbuf_reset(scratch);
+			strbuf_addstr(scratch, it.rec.target);
+			rec->target = scratch->buf;
+		}
+		ret = 0;
+		break;
+	}
+	reftable_iterator_release(&it);
+	return ret;
+}
+
+/*
+ * Write the table in "w" to the file "name" and push it onto the
+ * stack.
+ */
+static int add_table(struct reftable_stack *st, struct reftable_writer *w,
+		     uint64_t min_update_index, uint64_t max_update_index,
+		     struct strbuf *err)
+{
+	static struct lock_file lock;
+	struct reftable *table;
+	char *name, *path;
+
+	reftable_writer_finish(w);
+	name = xstrfmt("%012"PRIxMAX"-%012"PRIxMAX".ref",
+		       (uintmax_t)min_update_index,
+		       (uintmax_t)max_update_index);
+	path = xstrfmt("%s/%s", st->dir, name);
+
+	if (hold_lock_file_for_update(&lock, path, 0) < 0) {
+		unable_to_lock_message(path, errno, err);
+		goto fail;
+	}
+	if (write_in_full(get_lock_file_fd(&lock), w->buf.buf, w->buf.len) !=
+	    w->buf.len || commit_lock_file(&lock)) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    path, strerror(errno));
+		rollback_lock_file(&lock);
+		goto fail;
+	}
+	string_list_append(&st->written, name);
+
+	table = reftable_open(st->dir, name);
+	if (!table) {
+		strbuf_addf(err, "unable to read back '%s'", path);
+		goto fail;
+	}
+	ALLOC_GROW(st->tables, st->nr + 1, st->alloc);
+	st->tables[st->nr++] = table;
+	free(name);
+	free(path);
+	return 0;
+
+fail:
+	free(name);
+	free(path);
+	return -1;
+}
+
+int reftable_stack_add(struct reftable_stack *st,
+		       const struct reftable_record *recs, int nr,
+		       struct strbuf *err)
+{
+	struct reftable_writer w;
+	uint64_t update_index = reftable_stack_next_update_index(st);
+	int i, ret;
+
+	reftable_writer_init(&w, REFTABLE_DEFAULT_BLOCK_SIZE,
+			     update_index, update_index);
+	for (i = 0; i < nr; i++)
+		reftable_writer_add(&w, &recs[i]);
+	ret = add_table(st, &w, update_index, update_index, err);
+	reftable_writer_release(&w);
+	return ret;
+}
+
+static void merged_iterator_init(struct reftable_merged_iterator *mi,
+				 struct reftable **tables, int nr,
+				 const char *prefix, int keep_deletions)
+{
+	int i;
+
+	memset(mi, 0, sizeof(*mi));
+	mi->nr = nr;
+	mi->keep_deletions = keep_deletions;
+	ALLOC_ARRAY(mi->iters, nr);
+	ALLOC_ARRAY(mi->state, nr);
+	for (i = 0; i < nr; i++) {
+		struct reftable_iterator it = REFTABLE_ITERATOR_INIT;
+
+		mi->iters[i] = it;
+		tables[i]->refcount++;
+		reftable_iterator_seek(&mi->iters[i], tables[i], prefix);
+		mi->state[i] = 2;
+	}
+}
+
+void reftable_merged_iterator_begin(struct reftable_merged_iterator *mi,
+				    struct reftable_stack *st,
+				    const char *prefix)
+{
+	merged_iterator_init(mi, st->tables, st->nr, prefix, 0);
+}
+
+int reftable_merged_iterator_next(struct reftable_merged_iterator *mi)
+{
+	for (;;) {
+		const char *min = NULL;
+		int i, winner = -1;
+
+		for (i = 0; i < mi->nr; i++) {
+			if (mi->state[i] == 2) {
+				int ret = reftable_iterator_next(&mi->iters[i]);
+
+				if (ret < 0)
+					return -1;
+				mi->state[i] = ret;
+			}
+		}
+
+		/* The newest table wins among records of the same name: */
+		for (i = mi->nr - 1; i >= 0; i--) {
+			if (!mi->state[i])
+				continue;
+			if (!min || strcmp(mi->iters[i].rec.refname, min) < 0) {
+				min = mi->iters[i].rec.refname;
+				winner = i;
+			}
+		}
+		if (winner < 0)
+			return 0;
+
+		for (i = 0; i < mi->nr; i++)
+			if (mi->state[i] &&
+			    !strcmp(mi->iters[i].rec.refname, min))
+				mi->state[i] = 2;
+
+		if (mi->iters[winner].rec.type == REFTABLE_DELETION &&
+		    !mi->keep_deletions)
+			continue;
+		mi->rec = mi->iters[winner].rec;
+		return 1;
+	}
+}
+
+void reftable_merged_iterator_release(struct reftable_merged_iterator *mi)
+{
+	int i;
+
+	for (i = 0; i < mi->nr; i++) {
+		reftable_release(mi->iters[i].table);
+		reftable_iterator_release(&mi->iters[i]);
+	}
+	free(mi->iters);
+	free(mi->state);
+	memset(mi, 0, sizeof(*mi));
+}
+
+int reftable_stack_compact(struct reftable_stack *st, int first,
+			   struct strbuf *err)
+{
+	struct reftable_merged_iterator mi;
+	struct reftable_writer w;
+	uint64_t min_update_index, max_update_index;
+	int i, ret;
+
+	if (first < 0 || st->nr - first < 2)
+		return 0;
+
+	min_update_index = st->tables[first]->min_update_index;
+	max_update_index = st->tables[st->nr - 1]->max_update_index;
+	reftable_writer_init(&w, REFTABLE_DEFAULT_BLOCK_SIZE,
+			     min_update_index, max_update_index);
+	merged_iterator_init(&mi, st->tables + first, st->nr - first, "",
+			     first > 0);
+	while ((ret = reftable_merged_iterator_next(&mi)) > 0)
+		reftable_writer_add(&w, &mi.rec);
+	reftable_merged_iterator_release(&mi);
+	if (ret < 0) {
+		strbuf_addstr(err, "unable to read the tables to compact");
+		reftable_writer_release(&w);
+		return -1;
+	}
+
+	/* Replace the compacted tables by the new one: */
+	for (i = first; i < st->nr; i++) {
+		string_list_append(&st->garbage, st->tables[i]->name);
+		reftable_release(st->tables[i]);
+	}
+	st->nr = first;
+	ret = add_table(st, &w, min_update_index, max_update_index, err);
+	reftable_writer_release(&w);
+	return ret;
+}
+
+int reftable_stack_auto_compact(struct reftable_stack *st,
+				struct strbuf *err)
+{
+	int first = st->nr - 1;
+	size_t above;
+
+	if (first < 0)
+		return 0;
+	above = st->tables[first]->size;
+	while (first > 0 && st->tables[first - 1]->size < 2 * above) {
+		first--;
+		above += st->tables[first]->size;
+	}
+	return reftable_stack_compact(st, first, err);
+}
+
+static void remove_tables(struct reftable_stack *st, struct string_list *names)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, names) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", st->dir, item->string);
+		unlink_or_warn(path.buf);
+	}
+	string_list_clear(names, 0);
+	strbuf_release(&path);
+}
+
+int reftable_stack_commit(struct reftable_stack *st, struct lock_file *lock,
+			  struct strbuf *err)
+{
+	struct strbuf list = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < st->nr; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (write_in_full(get_lock_file_fd(lock), list.buf, list.len) !=
+	    list.len || commit_lock_file(lock)) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    st->list_path, strerror(errno));
+		strbuf_release(&list);
+		reftable_stack_rollback(st, lock);
+		return -1;
+	}
+	strbuf_release(&list);
+
+	/*
+	 * Tables that we wrote and then compacted away again were never
+	 * published, but are in the garbage list, too.
+	 */
+	string_list_clear(&st->written, 0);
+	remove_tables(st, &st->garbage);
+	stat_validity_clear(&st->validity);
+	return 0;
+}
+
+void reftable_stack_rollback(struct reftable_stack *st,
+			     struct lock_file *lock)
+{
+	rollback_lock_file(lock);
+	string_list_clear(&st->garbage, 0);
+	remove_tables(st, &st->written);
+
+	/* Drop what we added to the stack, and read it afresh: */
+	release_tables(st->tables, st->nr);
+	st->tables = NULL;
+	st->nr = st->alloc = 0;
+	stat_validity_clear(&st->validity);
+	if (reftable_stack_reload(st))
+		warning("unable to re-read '%s'", st->list_path);
+}
@@ -0,0 +1,240 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+/*
+ * Reading and writing of the binary, block-indexed reference tables
+ * used by the "reftable" ref storage backend.  See
+ * Documentation/technical/reftable.txt for the file format.
+ *
+ * A table is an immutable, sorted list of reference records.  The
+ * references of a repository are stored in a stack of tables, listed
+ * oldest first in "tables.list"; a record in a newer table shadows
+ * the records of the same name in older ones, and a deletion record
+ * hides the reference altogether.
+ */
+
+#define REFTABLE_SIGNATURE 0x52454654 /* "REFT" */
+#define REFTABLE_VERSION 1
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE 16
+
+#define REFTABLE_DEFAULT_BLOCK_SIZE 4096
+
+/* A restart point, with the full name of the record, every so often: */
+#define REFTABLE_RESTART_INTERVAL 16
+
+enum reftable_value_type {
+	REFTABLE_DELETION = 0,
+	REFTABLE_OID = 1,
+	REFTABLE_OID_PEELED = 2,
+	REFTABLE_SYMREF = 3
+};
+
+/*
+ * A reference record.  The strings of a record read from a table
+ * point into the table or into the iterator that produced it, and
+ * are only valid until the iterator is advanced.
+ */
+struct reftable_record {
+	const char *refname;
+	enum reftable_value_type type;
+	struct object_id oid;
+	struct object_id peeled;
+	const char *target;
+};
+
+/*
+ * An open, memory-mapped table.  Tables are reference counted, so
+ * that an iteration can keep using them after the stack has been
+ * reloaded from under it.
+ */
+struct reftable {
+	char *name;
+	const unsigned char *data;
+	size_t size;
+	int refcount;
+
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	/* The offsets of the ref blocks, and where the last one ends: */
+	const unsigned char *block_index;
+	uint32_t nr_blocks;
+	size_t blocks_end;
+};
+
+/*
+ * Open and map the table "name" in the directory "dir".  Return NULL
+ * (with errno set) if it cannot be read, and NULL (with an error
+ * message) if it is corrupt.
+ */
+struct reftable *reftable_open(const char *dir, const char *name);
+void reftable_release(struct reftable *table);
+
+/*
+ * Iterate over the records of a single table, in refname order.
+ */
+struct reftable_iterator {
+	struct reftable *table;
+	uint32_t block;
+	const unsigned char *pos, *end;
+	int peeked;
+	struct strbuf name;
+	struct strbuf target;
+	struct reftable_record rec;
+};
+
+#define REFTABLE_ITERATOR_INIT { NULL, 0, NULL, NULL, 0, STRBUF_INIT, STRBUF_INIT }
+
+/*
+ * Position "it" on "table" such that the next call to
+ * reftable_iterator_next() returns the first record whose name is
+ * greater than or equal to "refname".  Only O(log n) records are
+ * looked at to get there.
+ */
+void reftable_iterator_seek(struct reftable_iterator *it,
+			    struct reftable *table, const char *refname);
+
+/*
+ * Read the next record into it->rec.  Return 1 on success, 0 at the
+ * end of the table and -1 (with an error message) if the table is
+ * corrupt.
+ */
+int reftable_iterator_next(struct reftable_iterator *it);
+void reftable_iterator_release(struct reftable_iterator *it);
+
+/*
+ * Build a table in memory.  Records must be added in strictly
+ * increasing refname order.
+ */
+struct reftable_writer {
+	struct strbuf buf;
+	size_t block_size;
+	size_t block_start;
+	int block_records;
+	uint32_t *restarts;
+	int restarts_nr, restarts_alloc;
+	uint32_t *blocks;
+	int blocks_nr, blocks_alloc;
+	struct strbuf last_name;
+};
+
+void reftable_writer_init(struct reftable_writer *w, size_t block_size,
+			  uint64_t min_update_index,
+			  uint64_t max_update_index);
+void reftable_writer_add(struct reftable_writer *w,
+			 const struct reftable_record *rec);
+/* Finish the table; the complete file is then in w->buf. */
+void reftable_writer_finish(struct reftable_writer *w);
+void reftable_writer_release(struct reftable_writer *w);
+
+/*
+ * The stack of tables in a "reftable" directory.
+ *
+ * To modify the stack, take the lock on "tables.list", reload the
+ * stack, write and add new tables and/or compact existing ones, and
+ * then commit the list.  Until then, the changes are only visible
+ * through this reftable_stack.
+ */
+struct reftable_stack {
+	char *dir;
+	char *list_path;
+	struct reftable **tables;
+	int nr, alloc;
+	struct stat_validity validity;
+
+	/* Tables written, and tables dropped, since the list was read: */
+	struct string_list written;
+	struct string_list garbage;
+};
+
+void reftable_stack_init(struct reftable_stack *st, const char *dir);
+void reftable_stack_release(struct reftable_stack *st);
+
+/*
+ * Make sure that the stack matches what is on disk; this is cheap if
+ * "tables.list" has not changed since it was last read.  Return -1
+ * (with an error message) if the stack cannot be read.
+ */
+int reftable_stack_reload(struct reftable_stack *st);
+
+/*
+ * The update index that the next table added to the stack should
+ * use.
+ */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/*
+ * Look up "refname", searching the tables from the newest to the
+ * oldest.  Return 0 and fill "rec" if it exists (its symref target is
+ * copied into "scratch"), 1 if it does not and -1 on error.
+ */
+int reftable_stack_read(struct reftable_stack *st, const char *refname,
+			struct reftable_record *rec, struct strbuf *scratch);
+
+/*
+ * Write a new table with the given records, which must be sorted by
+ * refname and unique, and push it onto the stack.
+ */
+int reftable_stack_add(struct reftable_stack *st,
+		       const struct reftable_record *recs, int nr,
+		       struct strbuf *err);
+
+/*
+ * Merge the tables first..(st->nr - 1) into a single table.
+ * Deletion records are dropped if the bottom of the stack is
+ * compacted.
+ */
+int reftable_stack_compact(struct reftable_stack *st, int first,
+			   struct strbuf *err);
+
+/*
+ * Compact the smallest top part of the stack that leaves every table
+ * at least twice as big as all the tables above it together.  This
+ * keeps the stack O(log n) deep, while each record is only rewritten
+ * O(log n) times.
+ */
+int reftable_stack_auto_compact(struct reftable_stack *st,
+				struct strbuf *err);
+
+/*
+ * Write the names of the stack's tables to "lock", which must hold
+ * "tables.list", and commit it.  Tables that are not used anymore are
+ * then removed.
+ */
+int reftable_stack_commit(struct reftable_stack *st, struct lock_file *lock,
+			  struct strbuf *err);
+
+/*
+ * Roll back "lock", remove the tables that were written since, and
+ * re-read the stack.
+ */
+void reftable_stack_rollback(struct reftable_stack *st,
+			     struct lock_file *lock);
+
+/*
+ * Iterate over the merged view of the stack: the newest record of
+ * each name, skipping deletions.
+ */
+struct reftable_merged_iterator {
+	struct reftable_iterator *iters;
+	/* 0: exhausted, 1: has a record, 2: needs to be advanced */
+	int *state;
+	int nr;
+	int keep_deletions;
+	struct reftable_record rec;
+};
+
+/*
+ * Take a reference on the stack's current tables and seek them to
+ * "prefix".  reftable_merged_iterator_next() returns 1 and fills
+ * mi->rec, 0 at the end and -1 on error; the iteration does not stop
+ * at the end of "prefix".
+ */
+void reftable_merged_iterator_begin(struct reftable_merged_iterator *mi,
+				    struct reftable_stack *st,
+				    const char *prefix);
+int reftable_merged_iterator_next(struct reftable_merged_iterator *mi);
+void reftable_merged_iterator_release(struct reftable_merged_iterator *mi);
+
+#endif /* REFS_REFTABLE_H */
@@ -19,6 +19,8 @@
 #include "dir.h"
 #include "cache-tree.h"
 #include "bisect.h"
+#include "commit-graph.h"
+#include "bloom.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -193,7 +195,13 @@ static struct object *get_reference(struct rev_info *revs, const char *name,
 {
 	struct object *object;
 
-	object = parse_object(sha1);
+	/*
+	 * Tips covered by the commit-graph can be parsed without
+	 * inflating the commit object.
+	 */
+	object = (struct object *)lookup_commit_in_graph(sha1);
+	if (!object)
+		object = parse_object(sha1);
 	if (!object) {
 		if (revs->ignore_missing)
 			return object;
@@ -424,9 +432,116 @@ static void file_change(struct diff_options *options,
 	DIFF_OPT_SET(options, HAS_CHANGES);
 }
 
+static struct trace_key trace_bloom = TRACE_KEY_INIT(BLOOM);
+
+static struct {
+	int filter_not_present;
+	int maybe;
+	int definitely_not;
+	int false_positive;
+} bloom_count;
+
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	const struct pathspec_item *pi;
+	struct strbuf path = STRBUF_INIT;
+	const char *slash;
+	int nr;
+
+	if (!revs->prune || revs->pruning.pathspec.nr != 1)
+		return;
+	if (revs->pruning.pathspec.has_wildcard ||
+	    DIFF_OPT_TST(&revs->pruning, FOLLOW_RENAMES))
+		return;
+	pi = &revs->pruning.pathspec.items[0];
+	if (pi->magic & ~PATHSPEC_LITERAL)
+		return;
+
+	revs->bloom_filter_settings = get_bloom_filter_settings();
+	if (!revs->bloom_filter_settings)
+		return;
+
+	strbuf_add(&path, pi->match, pi->len);
+	while (path.len && path.buf[path.len - 1] == '/')
+		strbuf_setlen(&path, path.len - 1);
+	if (!path.len) {
+		strbuf_release(&path);
+		return;
+	}
+
+	/*
+	 * A commit that changed the path also changed each of its leading
+	 * directories, so all of them must "maybe" be in its filter.
+	 */
+	nr = 1;
+	for (slash = strchr(path.buf, '/'); slash; slash = strchr(slash + 1, '/'))
+		nr++;
+	ALLOC_ARRAY(revs->bloom_keys, nr);
+
+	fill_bloom_key(path.buf, path.len, &revs->bloom_keys[0],
+		       revs->bloom_filter_settings);
+	revs->bloom_keys_nr = 1;
+	for (slash = strchr(path.buf, '/'); slash; slash = strchr(slash + 1, '/'))
+		fill_bloom_key(path.buf, slash - path.buf,
+			       &revs->bloom_keys[revs->bloom_keys_nr++],
+			       revs->bloom_filter_settings);
+	strbuf_release(&path);
+}
+
+static void release_revisions_bloom_keys(struct rev_info *revs)
+{
+	int i;
+
+	if (!revs->bloom_keys_nr)
+		return;
+
+	trace_printf_key(&trace_bloom,
+			 "bloom filter statistics: not_present:%d maybe:%d "
+			 "definitely_not:%d false_positive:%d\n",
+			 bloom_count.filter_not_present, bloom_count.maybe,
+			 bloom_count.definitely_not, bloom_count.false_positive);
+
+	for (i = 0; i < revs->bloom_keys_nr; i++)
+		clear_bloom_key(&revs->bloom_keys[i]);
+	free(revs->bloom_keys);
+	revs->bloom_keys = NULL;
+	revs->bloom_keys_nr = 0;
+}
+
+/*
+ * Returns 0 if the commit certainly did not change the path we are
+ * limited to with respect to its first parent, -1 if it has no filter,
+ * and 1 if it may have.
+ */
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter filter;
+	int i;
+
+	if (!get_bloom_filter(commit, &filter)) {
+		bloom_count.filter_not_present++;
+		return -1;
+	}
+
+	for (i = 0; i < revs->bloom_keys_nr; i++) {
+		if (!bloom_filter_contains(&filter, &revs->bloom_keys[i],
+					   revs->bloom_filter_settings)) {
+			bloom_count.definitely_not++;
+			return 0;
+		}
+	}
+
+	bloom_count.maybe++;
+	return 1;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
+	int bloom_ret = -1;
+
 	struct tree *t1 = parent->tree;
 	struct tree *t2 = commit->tree;
 
@@ -453,11 +568,20 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	if (revs->bloom_keys_nr && !nth_parent) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+		if (!bloom_ret)
+			return REV_TREE_SAME;
+	}
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	if (diff_tree_sha1(t1->object.oid.hash, t2->object.oid.hash, "",
 			   &revs->pruning) < 0)
 		return REV_TREE_DIFFERENT;
+
+	if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+		bloom_count.false_positive++;
 	return tree_difference;
 }
 
@@ -655,7 +779,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    oid_to_hex(&commit->object.oid),
 			    oid_to_hex(&p->object.oid));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -2760,6 +2884,9 @@ int prepare_revision_walk(struct rev_info *revs)
 	    (revs->limited && limiting_can_increase_treesame(revs)))
 		revs->treesame.name = "treesame";
 
+	if (!revs->bloom_keys_nr)
+		prepare_to_use_bloom_filter(revs);
+
 	if (revs->no_walk != REVISION_WALK_NO_WALK_UNSORTED)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
@@ -3293,6 +3420,7 @@ struct commit *get_revision(struct rev_info *revs)
 		graph_update(revs->graph, c);
 	if (!c) {
 		free_saved_parents(revs);
+		release_revisions_bloom_keys(revs);
 		if (revs->previous_parents) {
 			free_commit_list(revs->previous_parents);
 			revs->previous_parents = NULL;
@@ -26,6 +26,8 @@
 #define DECORATE_FULL_REFS	2
 
 struct rev_info;
+struct bloom_key;
+struct bloom_filter_settings;
 struct log_info;
 struct string_list;
 struct saved_parents;
@@ -213,6 +215,15 @@ struct rev_info {
 
 	struct commit_list *previous_parents;
 	const char *break_bar;
+
+	/*
+	 * Keys of the single literal path we are limited to (and of its
+	 * leading directories), to be looked up in the changed-path
+	 * Bloom filters of the commit-graph.
+	 */
+	struct bloom_key *bloom_keys;
+	int bloom_keys_nr;
+	const struct bloom_filter_settings *bloom_filter_settings;
 };
 
 extern int ref_excluded(struct string_list *, const char *path);
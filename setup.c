@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "dir.h"
 #include "string-list.h"
+#include "refs.h"
 
 static int inside_git_dir = -1;
 static int inside_work_tree = -1;
@@ -396,6 +397,12 @@ static int check_repo_format(const char *var, const char *value, void *vdata)
 			;
 		else if (!strcmp(ext, "preciousobjects"))
 			data->precious_objects = git_config_bool(var, value);
+		else if (!strcmp(ext, "refstorage")) {
+			if (!value)
+				return config_error_nonbool(var);
+			free(data->ref_storage);
+			data->ref_storage = xstrdup(value);
+		}
 		else
 			string_list_append(&data->unknown_extensions, ext);
 	} else if (strcmp(var, "core.bare") == 0) {
@@ -439,6 +446,10 @@ static int check_repository_format_gently(const char *gitdir, int *nongit_ok)
 	}
 
 	repository_format_precious_objects = candidate.precious_objects;
+	if (candidate.ref_storage) {
+		free(repository_format_ref_storage);
+		repository_format_ref_storage = candidate.ref_storage;
+	}
 	string_list_clear(&candidate.unknown_extensions, 0);
 	if (!has_common) {
 		if (candidate.is_bare != -1) {
@@ -488,6 +499,13 @@ int verify_repository_format(const struct repository_format *format,
 		return -1;
 	}
 
+	if (format->ref_storage &&
+	    !ref_storage_backend_exists(format->ref_storage)) {
+		strbuf_addf(err, _("unknown ref storage '%s'"),
+			    format->ref_storage);
+		return -1;
+	}
+
 	return 0;
 }
 
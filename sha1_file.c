@@ -27,6 +27,10 @@
 #include "list.h"
 #include "mergesort.h"
 #include "quote.h"
+#include "midx.h"
+#include "thread-utils.h"
+#include "sha1-array.h"
+#include "shared-delta-cache.h"
 
 #define SZ_FMT PRIuMAX
 static inline uintmax_t sz_fmt(size_t s) { return s; }
@@ -40,6 +44,57 @@ const struct object_id empty_blob_oid = {
 	EMPTY_BLOB_SHA1_BIN_LITERAL
 };
 
+#ifndef NO_PTHREADS
+static int obj_read_use_lock;
+static pthread_mutex_t obj_read_mutex;
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		return;
+
+	obj_read_use_lock = 1;
+	init_recursive_mutex(&obj_read_mutex);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		return;
+
+	obj_read_use_lock = 0;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#else
+void enable_obj_read_lock(void)
+{
+}
+
+void disable_obj_read_lock(void)
+{
+}
+
+void obj_read_lock(void)
+{
+}
+
+void obj_read_unlock(void)
+{
+}
+#endif
+
 /*
  * This is meant to hold a *small* number of objects that you would
  * want read_sha1_file() to be able to return, but yet you do not want
@@ -647,6 +702,111 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+/*
+ * With core.looseObjectCache, the names of the loose objects in each
+ * object directory are read from its fanout directories the first time
+ * an object in them is looked up, so that looking up objects we do not
+ * have in that object directory does not cost a failing lstat() each.
+ * The listings are thrown away by reprepare_packed_git(), which is what
+ * callers already use to pick up objects written by other processes.
+ */
+struct loose_object_cache {
+	/* bitmap of the fanout directories that have been read */
+	uint32_t subdir_seen[8];
+	struct oid_array objects;
+};
+
+static struct loose_object_cache *local_loose_cache;
+
+static int for_each_file_in_obj_subdir(int subdir_nr,
+				       struct strbuf *path,
+				       each_loose_object_fn obj_cb,
+				       each_loose_cruft_fn cruft_cb,
+				       each_loose_subdir_fn subdir_cb,
+				       void *data);
+
+static int append_loose_object(const struct object_id *oid, const char *path,
+			       void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+/*
+ * Return 0 if the listing of the object directory "objdir" says that
+ * it does not have "sha1" as a loose object, and 1 if it may have it
+ * (including when the listings are not in use).
+ */
+static int loose_object_cache_may_have(struct loose_object_cache **cachep,
+				       const char *objdir,
+				       const unsigned char *sha1)
+{
+	struct loose_object_cache *cache;
+	struct object_id oid;
+	int subdir_nr = sha1[0];
+	int ret;
+
+	if (!core_loose_object_cache)
+		return 1;
+
+	obj_read_lock();
+	if (!*cachep)
+		*cachep = xcalloc(1, sizeof(**cachep));
+	cache = *cachep;
+	if (!(cache->subdir_seen[subdir_nr / 32] & (1u << (subdir_nr % 32)))) {
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_addf(&path, "%s/%02x", objdir, subdir_nr);
+		for_each_file_in_obj_subdir(subdir_nr, &path, append_loose_object,
+					    NULL, NULL, &cache->objects);
+		strbuf_release(&path);
+		cache->subdir_seen[subdir_nr / 32] |= 1u << (subdir_nr % 32);
+	}
+	hashcpy(oid.hash, sha1);
+	ret = oid_array_lookup(&cache->objects, &oid) >= 0;
+	obj_read_unlock();
+	return ret;
+}
+
+/*
+ * Record that this process has written the loose object at "filename",
+ * if it is in our object directory and its fanout directory has been
+ * read already.
+ */
+static void loose_object_cache_add(const char *filename)
+{
+	const char *objdir = get_object_directory();
+	const char *name;
+	size_t len = strlen(filename);
+	char hex[GIT_MAX_HEXSZ + 1];
+	struct object_id oid;
+	int subdir_nr;
+
+	if (!local_loose_cache ||
+	    len != strlen(objdir) + GIT_SHA1_HEXSZ + 2 ||
+	    !skip_prefix(filename, objdir, &name) ||
+	    name[0] != '/' || name[3] != '/')
+		return;
+	xsnprintf(hex, sizeof(hex), "%.2s%s", name + 1, name + 4);
+	if (get_oid_hex(hex, &oid))
+		return;
+
+	obj_read_lock();
+	subdir_nr = oid.hash[0];
+	if (local_loose_cache->subdir_seen[subdir_nr / 32] & (1u << (subdir_nr % 32)))
+		oid_array_append(&local_loose_cache->objects, &oid);
+	obj_read_unlock();
+}
+
+static void clear_loose_object_cache(struct loose_object_cache **cachep)
+{
+	if (!*cachep)
+		return;
+	oid_array_clear(&(*cachep)->objects);
+	free(*cachep);
+	*cachep = NULL;
+}
+
 /* Returns 1 if we have successfully freshened the file, 0 otherwise. */
 static int freshen_file(const char *fn)
 {
@@ -673,6 +833,9 @@ int check_and_freshen_file(const char *fn, int freshen)
 
 static int check_and_freshen_local(const unsigned char *sha1, int freshen)
 {
+	if (!loose_object_cache_may_have(&local_loose_cache,
+					 get_object_directory(), sha1))
+		return 0;
 	return check_and_freshen_file(sha1_file_name(sha1), freshen);
 }
 
@@ -681,7 +844,10 @@ static int check_and_freshen_nonlocal(const unsigned char *sha1, int freshen)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
-		const char *path = alt_sha1_path(alt, sha1);
+		const char *path;
+		if (!loose_object_cache_may_have(&alt->loose_cache, alt->path, sha1))
+			continue;
+		path = alt_sha1_path(alt, sha1);
 		if (check_and_freshen_file(path, freshen))
 			return 1;
 	}
@@ -977,7 +1143,7 @@ static int close_pack_fd(struct packed_git *p)
 	return 1;
 }
 
-static void close_pack(struct packed_git *p)
+void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
@@ -1139,7 +1305,11 @@ static int open_packed_git_1(struct packed_git *p)
 	unsigned char *idx_sha1;
 	long fd_flag;
 
-	if (!p->index_data && open_pack_index(p))
+	/*
+	 * Lookups in a pack the multi-pack-index covers go through the
+	 * multi-pack-index, so its .idx is only mapped on demand.
+	 */
+	if (!p->index_data && !p->multi_pack_index && open_pack_index(p))
 		return error("packfile %s index unavailable", p->pack_name);
 
 	if (!pack_max_fds) {
@@ -1188,6 +1358,9 @@ static int open_packed_git_1(struct packed_git *p)
 			" supported (try upgrading GIT to a newer version)",
 			p->pack_name, ntohl(hdr.hdr_version));
 
+	if (!p->index_data)
+		return 0;
+
 	/* Verify the pack matches its index. */
 	if (p->num_objects != ntohl(hdr.hdr_entries))
 		return error("packfile %s claims to have %"PRIu32" objects"
@@ -1430,6 +1603,28 @@ static void report_pack_garbage(struct string_list *list)
 	report_helper(list, seen_bits, first, list->nr);
 }
 
+static struct multi_pack_index *multi_pack_index;
+
+static struct multi_pack_index *prepare_multi_pack_index_one(const char *objdir)
+{
+	struct multi_pack_index *m;
+	int enabled;
+
+	for (m = multi_pack_index; m; m = m->next)
+		if (!strcmp(m->object_dir, objdir))
+			return m;
+
+	if (!git_config_get_bool("core.multipackindex", &enabled) && !enabled)
+		return NULL;
+
+	m = load_multi_pack_index(objdir);
+	if (m) {
+		m->next = multi_pack_index;
+		multi_pack_index = m;
+	}
+	return m;
+}
+
 static void prepare_packed_git_one(char *objdir, int local)
 {
 	struct strbuf path = STRBUF_INIT;
@@ -1437,6 +1632,7 @@ static void prepare_packed_git_one(char *objdir, int local)
 	DIR *dir;
 	struct dirent *de;
 	struct string_list garbage = STRING_LIST_INIT_DUP;
+	struct multi_pack_index *m;
 
 	strbuf_addstr(&path, objdir);
 	strbuf_addstr(&path, "/pack");
@@ -1450,6 +1646,7 @@ static void prepare_packed_git_one(char *objdir, int local)
 	}
 	strbuf_addch(&path, '/');
 	dirnamelen = path.len;
+	m = prepare_multi_pack_index_one(objdir);
 	while ((de = readdir(dir)) != NULL) {
 		struct packed_git *p;
 		size_t base_len;
@@ -1477,11 +1674,22 @@ static void prepare_packed_git_one(char *objdir, int local)
 			     */
 			    (p = add_packed_git(path.buf, path.len, local)) != NULL)
 				install_packed_git(p);
+
+			if (p && m) {
+				int pack_int_id = midx_pack_int_id(m, de->d_name);
+				if (pack_int_id >= 0) {
+					m->packs[pack_int_id] = p;
+					p->multi_pack_index = 1;
+				}
+			}
 		}
 
 		if (!report_garbage)
 			continue;
 
+		if (!strcmp(de->d_name, "multi-pack-index"))
+			continue;
+
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
@@ -1593,6 +1801,11 @@ void prepare_packed_git(void)
 
 void reprepare_packed_git(void)
 {
+	struct alternate_object_database *alt;
+
+	clear_loose_object_cache(&local_loose_cache);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		clear_loose_object_cache(&alt->loose_cache);
 	approximate_object_count_valid = 0;
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
@@ -1713,12 +1926,16 @@ static int stat_sha1_file(const unsigned char *sha1, struct stat *st,
 	struct alternate_object_database *alt;
 
 	*path = sha1_file_name(sha1);
-	if (!lstat(*path, st))
+	if (loose_object_cache_may_have(&local_loose_cache,
+					get_object_directory(), sha1) &&
+	    !lstat(*path, st))
 		return 0;
 
 	prepare_alt_odb();
 	errno = ENOENT;
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (!loose_object_cache_may_have(&alt->loose_cache, alt->path, sha1))
+			continue;
 		*path = alt_sha1_path(alt, sha1);
 		if (!lstat(*path, st))
 			return 0;
@@ -1738,13 +1955,20 @@ static int open_sha1_file(const unsigned char *sha1, const char **path)
 	int most_interesting_errno;
 
 	*path = sha1_file_name(sha1);
-	fd = git_open(*path);
-	if (fd >= 0)
-		return fd;
-	most_interesting_errno = errno;
+	if (loose_object_cache_may_have(&local_loose_cache,
+					get_object_directory(), sha1)) {
+		fd = git_open(*path);
+		if (fd >= 0)
+			return fd;
+		most_interesting_errno = errno;
+	} else {
+		most_interesting_errno = ENOENT;
+	}
 
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (!loose_object_cache_may_have(&alt->loose_cache, alt->path, sha1))
+			continue;
 		*path = alt_sha1_path(alt, sha1);
 		fd = git_open(*path);
 		if (fd >= 0)
@@ -1914,8 +2138,11 @@ static void *unpack_sha1_rest(git_zstream *stream, void *buffer, unsigned long s
 		 */
 		stream->next_out = buf + bytes;
 		stream->avail_out = size - bytes;
-		while (status == Z_OK)
+		while (status == Z_OK) {
+			obj_read_unlock();
 			status = git_inflate(stream, Z_FINISH);
+			obj_read_lock();
+		}
 	}
 	if (status == Z_STREAM_END && !stream->avail_in) {
 		git_inflate_end(stream);
@@ -2057,11 +2284,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -2274,6 +2501,10 @@ int packed_object_info(struct packed_git *p, off_t obj_offset,
 
 	if (oi->disk_sizep) {
 		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
+		if (!revidx) {
+			type = OBJ_BAD;
+			goto out;
+		}
 		*oi->disk_sizep = revidx[1].offset - obj_offset;
 	}
 
@@ -2326,7 +2557,13 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/*
+		 * The window we inflate from stays in use, and so mapped,
+		 * while other threads get to read objects.
+		 */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -2451,9 +2688,19 @@ void clear_delta_base_cache(void)
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
+	struct delta_base_cache_entry *ent;
 	struct list_head *lru, *tmp;
 
+	/*
+	 * Another thread may have cached the same base while we were
+	 * inflating it with the obj_read_lock() dropped.
+	 */
+	if (in_delta_base_cache(p, base_offset)) {
+		free(base);
+		return;
+	}
+
+	ent = xmalloc(sizeof(*ent));
 	delta_base_cached += base_size;
 
 	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
@@ -2508,6 +2755,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
+	/*
+	 * The shared cache outlives this process, so it must not hide
+	 * corruption from those checking the CRCs.
+	 */
+	int use_shared_cache = !do_check_packed_object_crc;
 
 	write_pack_access_log(p, obj_offset);
 
@@ -2527,6 +2779,21 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			break;
 		}
 
+		if (use_shared_cache) {
+			data = shared_delta_cache_get(p, curpos, &type, &size);
+			if (data) {
+				base_from_cache = 1;
+				break;
+			}
+		}
+
+		if (do_check_packed_object_crc && !p->index_data &&
+		    open_pack_index(p)) {
+			error("packfile %s index unavailable", p->pack_name);
+			unuse_pack(&w_curs);
+			return NULL;
+		}
+
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
 			off_t len = revidx[1].offset - obj_offset;
@@ -2603,13 +2870,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		void *base = data;
 		void *external_base = NULL;
 		unsigned long delta_size, base_size = size;
+		off_t base_obj_offset = obj_offset;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -2629,6 +2894,8 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 				mark_bad_packed_object(p, base_sha1);
 				base = read_object(base_sha1, &type, &base_size);
 				external_base = base;
+				/* what we build on it is not what the pack has */
+				use_shared_cache = 0;
 			}
 		}
 
@@ -2647,24 +2914,36 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
-			free(external_base);
-			continue;
-		}
+		} else {
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
+			/*
+			 * We could not apply the delta; warn the user, but
+			 * keep going. Our failure will be noticed either in
+			 * the next iteration of the loop, or if this is the
+			 * final delta, in the caller when we return NULL.
+			 * Those code paths will take care of making a more
+			 * explicit warning and retrying with another copy of
+			 * the object.
+			 */
+			if (!data)
+				error("failed to apply delta");
+		}
 
 		/*
-		 * We could not apply the delta; warn the user, but keep going.
-		 * Our failure will be noticed either in the next iteration of
-		 * the loop, or if this is the final delta, in the caller when
-		 * we return NULL. Those code paths will take care of making
-		 * a more explicit warning and retrying with another copy of
-		 * the object.
+		 * Only add the base to the cache once we are done with it:
+		 * unpack_compressed_entry() lets other threads read objects
+		 * while it inflates, and one of them could have evicted (and
+		 * freed) the base from the cache in the meantime.
 		 */
-		if (!data)
-			error("failed to apply delta");
+		if (!external_base) {
+			if (use_shared_cache)
+				shared_delta_cache_put(p, base_obj_offset, base,
+						       base_size, type);
+			add_delta_base_cache(p, base_obj_offset, base, base_size, type);
+		}
 
 		free(delta_data);
 		free(external_base);
@@ -2867,14 +3146,33 @@ static int fill_pack_entry(const unsigned char *sha1,
  */
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
+	struct multi_pack_index *m;
 	struct mru_entry *p;
+	int skip_midx_packs = 1;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
 
+	/*
+	 * A multi-pack-index answers for all of the packs it covers
+	 * with a single lookup, so only the packs it does not know
+	 * about need to be searched one by one.  If it points us at a
+	 * pack we cannot use, fall back to searching every pack.
+	 */
+	for (m = multi_pack_index; m; m = m->next) {
+		int ret = fill_midx_entry(sha1, e, m);
+		if (ret > 0)
+			return 1;
+		if (ret < 0)
+			skip_midx_packs = 0;
+	}
+
 	for (p = packed_git_mru->head; p; p = p->next) {
-		if (fill_pack_entry(sha1, e, p->item)) {
+		struct packed_git *pack = p->item;
+		if (skip_midx_packs && pack->multi_pack_index)
+			continue;
+		if (fill_pack_entry(sha1, e, pack)) {
 			mru_mark(packed_git_mru, p);
 			return 1;
 		}
@@ -2955,7 +3253,8 @@ static int sha1_loose_object_info(const unsigned char *sha1,
 	return (status < 0) ? status : 0;
 }
 
-int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+static int do_sha1_object_info_extended(const unsigned char *sha1,
+					struct object_info *oi, unsigned flags)
 {
 	struct cached_object *co;
 	struct pack_entry e;
@@ -2988,8 +3287,15 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 
 		/* Not a loose object; someone else may have just packed it. */
 		reprepare_packed_git();
-		if (!find_pack_entry(real, &e))
+		if (!find_pack_entry(real, &e)) {
+			/* ...or written it, if our listing of loose objects was stale. */
+			if (core_loose_object_cache &&
+			    !sha1_loose_object_info(real, oi, flags)) {
+				oi->whence = OI_LOOSE;
+				return 0;
+			}
 			return -1;
+		}
 	}
 
 	/*
@@ -3022,6 +3328,16 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	return 0;
 }
 
+int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+{
+	int ret;
+
+	obj_read_lock();
+	ret = do_sha1_object_info_extended(sha1, oi, flags);
+	obj_read_unlock();
+	return ret;
+}
+
 /* returns enum object_type or negative */
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
@@ -3101,7 +3417,16 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 		return buf;
 	}
 	reprepare_packed_git();
-	return read_packed_sha1(sha1, type, size);
+	buf = read_packed_sha1(sha1, type, size);
+	if (!buf && core_loose_object_cache) {
+		/* Our listing of the loose objects may have been stale, too. */
+		map = map_sha1_file(sha1, &mapsize);
+		if (map) {
+			buf = unpack_sha1_file(map, mapsize, type, size, sha1);
+			munmap(map, mapsize);
+		}
+	}
+	return buf;
 }
 
 /*
@@ -3118,12 +3443,16 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 	const struct packed_git *p;
 	const char *path;
 	struct stat st;
-	const unsigned char *repl = lookup_replace_object_extended(sha1, flag);
+	const unsigned char *repl;
 
+	obj_read_lock();
+	repl = lookup_replace_object_extended(sha1, flag);
 	errno = 0;
 	data = read_object(repl, type, size);
-	if (data)
+	if (data) {
+		obj_read_unlock();
 		return data;
+	}
 
 	if (errno && errno != ENOENT)
 		die_errno("failed to read object %s", sha1_to_hex(sha1));
@@ -3141,6 +3470,7 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 		die("packed object %s (stored in %s) is corrupt",
 		    sha1_to_hex(repl), p->pack_name);
 
+	obj_read_unlock();
 	return NULL;
 }
 
@@ -3248,6 +3578,7 @@ int finalize_object_file(const char *tmpfile, const char *filename)
 out:
 	if (adjust_shared_perm(filename))
 		return error("unable to set permission to '%s'", filename);
+	loose_object_cache_add(filename);
 	return 0;
 }
 
@@ -3490,7 +3821,8 @@ int has_sha1_file_with_flags(const unsigned char *sha1, int flags)
 	if (flags & HAS_SHA1_QUICK)
 		return 0;
 	reprepare_packed_git();
-	return find_pack_entry(sha1, &e);
+	return find_pack_entry(sha1, &e) ||
+	       (core_loose_object_cache && has_loose_object(sha1));
 }
 
 int has_object_file(const struct object_id *oid)
@@ -3868,7 +4200,7 @@ int for_each_loose_object(each_loose_object_fn cb, void *data, unsigned flags)
 	return foreach_alt_odb(loose_from_alt_odb, &alt);
 }
 
-static int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn cb, void *data)
+int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn cb, void *data)
 {
 	uint32_t i;
 	int r = 0;
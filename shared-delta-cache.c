@@ -0,0 +1,440 @@
+#include "cache.h"
+#include "shared-delta-cache.h"
+
+#if defined(NO_MMAP) || defined(GIT_WINDOWS_NATIVE)
+
+void *shared_delta_cache_get(struct packed_git *p, off_t offset,
+			     enum object_type *type, unsigned long *size)
+{
+	return NULL;
+}
+
+void shared_delta_cache_put(struct packed_git *p, off_t offset,
+			    const void *data, unsigned long size,
+			    enum object_type type)
+{
+}
+
+#else
+
+static struct trace_key trace_shared_cache = TRACE_KEY_INIT(SHARED_DELTA_CACHE);
+
+/*
+ * The cache file is made of a header, a hash table of slots, and a
+ * ring buffer holding the data.  Positions in the ring only ever grow:
+ * "head" is where the next object goes, and the data of a slot is
+ * still there as long as the ring did not wrap over it, i.e. as long
+ * as it is no more than "data_size" bytes behind "head".  An object
+ * that is used again when it is about to be overwritten is copied back
+ * to the head of the ring, and slots that are still valid are evicted
+ * least recently stored or copied back first.
+ *
+ * The whole file is only accessed with an fcntl() lock held on it: a
+ * read lock to look objects up, so that readers do not wait for each
+ * other, and a write lock to change anything.  Within one process,
+ * callers serialize access like they do for the per-process cache.
+ */
+#define SHARED_CACHE_SIGNATURE 0x44424331 /* "DBC1" */
+#define SHARED_CACHE_VERSION 1
+
+/* how many slots an object may be stored in */
+#define SHARED_CACHE_PROBES 8
+
+struct shared_cache_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t nr_slots;
+	uint32_t unused;
+	uint64_t data_size;
+	uint64_t head;
+	uint64_t clock;
+};
+
+struct shared_cache_slot {
+	unsigned char pack[20]; /* see pack_key() */
+	uint32_t type; /* 0 if the slot was never used */
+	uint64_t offset;
+	uint64_t pos;
+	uint64_t size;
+	uint64_t last_used;
+	uint32_t crc;
+	uint32_t unused;
+};
+
+/*
+ * Anyone who can write to the file can scribble over it, so the layout
+ * is remembered as it was when we mapped the file, and slots are
+ * checked before their data is touched.
+ */
+static struct shared_cache {
+	int fd;
+	struct shared_cache_header *header;
+	struct shared_cache_slot *slots;
+	unsigned char *data;
+	uint32_t nr_slots;
+	uint64_t data_size;
+} shared_cache = { -1 };
+
+static int shared_cache_lock(int type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	while (fcntl(shared_cache.fd, F_SETLKW, &fl) < 0)
+		if (errno != EINTR)
+			return -1;
+	return 0;
+}
+
+static size_t shared_cache_file_size(uint32_t nr_slots, uint64_t data_size)
+{
+	return st_add3(sizeof(struct shared_cache_header),
+		       st_mult(nr_slots, sizeof(struct shared_cache_slot)),
+		       data_size);
+}
+
+/*
+ * Set up a new (empty) cache file.  The layout is decided by whoever
+ * creates the file; later processes use it as it is.
+ */
+static int init_shared_cache_file(void)
+{
+	struct shared_cache_header header;
+	uint32_t nr_slots = 64;
+
+	/* assume 4k per delta base on average */
+	while (nr_slots < shared_delta_base_cache_limit / 4096 &&
+	       nr_slots < (1u << 30))
+		nr_slots <<= 1;
+
+	memset(&header, 0, sizeof(header));
+	header.signature = SHARED_CACHE_SIGNATURE;
+	header.version = SHARED_CACHE_VERSION;
+	header.nr_slots = nr_slots;
+	header.data_size = shared_delta_base_cache_limit;
+
+	if (ftruncate(shared_cache.fd,
+		      shared_cache_file_size(nr_slots, header.data_size)) < 0 ||
+	    write_in_full(shared_cache.fd, &header, sizeof(header)) < 0)
+		return -1;
+	return 0;
+}
+
+static int map_shared_cache(const char *path)
+{
+	struct shared_cache_header header;
+	struct stat st;
+	size_t size;
+	void *map;
+
+	if (fstat(shared_cache.fd, &st) < 0)
+		return error_errno("unable to stat '%s'", path);
+	if (!st.st_size && init_shared_cache_file() < 0)
+		return error_errno("unable to initialize '%s'", path);
+	if (xpread(shared_cache.fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    header.signature != SHARED_CACHE_SIGNATURE ||
+	    header.version != SHARED_CACHE_VERSION ||
+	    !header.nr_slots || (header.nr_slots & (header.nr_slots - 1)) ||
+	    !header.data_size)
+		return error("'%s' is not a delta base cache", path);
+	size = shared_cache_file_size(header.nr_slots, header.data_size);
+	if (fstat(shared_cache.fd, &st) < 0 || (size_t)st.st_size != size)
+		return error("delta base cache '%s' has the wrong size", path);
+
+	map = xmmap_gently(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   shared_cache.fd, 0);
+	if (map == MAP_FAILED)
+		return error_errno("unable to map '%s'", path);
+
+	shared_cache.header = map;
+	shared_cache.slots = (struct shared_cache_slot *)(shared_cache.header + 1);
+	shared_cache.data = (unsigned char *)(shared_cache.slots + header.nr_slots);
+	shared_cache.nr_slots = header.nr_slots;
+	shared_cache.data_size = header.data_size;
+	return 0;
+}
+
+static int prepare_shared_cache(void)
+{
+	static int initialized;
+	char *path;
+	int ret;
+
+	if (initialized)
+		return !!shared_cache.header;
+	initialized = 1;
+
+	if (!shared_delta_base_cache_limit)
+		return 0;
+
+	if (shared_delta_base_cache_file)
+		path = xstrdup(shared_delta_base_cache_file);
+	else
+		path = xstrfmt("%s/info/delta-base-cache", get_object_directory());
+
+	/*
+	 * Whoever can write to the file decides what the others read
+	 * back, so only give it the permissions core.sharedRepository
+	 * asks for.
+	 */
+	shared_cache.fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (shared_cache.fd >= 0)
+		adjust_shared_perm(path);
+	else if (errno == EEXIST)
+		shared_cache.fd = open(path, O_RDWR | O_CLOEXEC);
+	if (shared_cache.fd < 0) {
+		/* e.g. a read-only repository; just go without */
+		trace_printf_key(&trace_shared_cache, "unable to open %s: %s\n",
+				 path, strerror(errno));
+		free(path);
+		return 0;
+	}
+
+	if (shared_cache_lock(F_WRLCK) < 0) {
+		ret = error_errno("unable to lock '%s'", path);
+	} else {
+		ret = map_shared_cache(path);
+		shared_cache_lock(F_UNLCK);
+	}
+
+	if (ret < 0) {
+		close(shared_cache.fd);
+		shared_cache.fd = -1;
+		shared_cache.header = NULL;
+	}
+	free(path);
+	return !!shared_cache.header;
+}
+
+static int slot_valid(const struct shared_cache_slot *slot)
+{
+	uint64_t data_size = shared_cache.data_size;
+
+	return slot->type >= OBJ_COMMIT && slot->type <= OBJ_TAG &&
+	       slot->size && slot->size <= data_size / 4 &&
+	       slot->pos % data_size + slot->size <= data_size &&
+	       shared_cache.header->head - slot->pos <= data_size;
+}
+
+static uint32_t slot_crc(enum object_type type, unsigned long size,
+			 const void *data)
+{
+	unsigned char hdr[12];
+
+	put_be32(hdr, type);
+	put_be64(hdr + 4, size);
+	return crc32(crc32(0, hdr, sizeof(hdr)), data, size);
+}
+
+/*
+ * Identify packs by the checksum of their contents that their index
+ * records, rather than by their file name, which does not have to
+ * match it.  A pack that is damaged or rewritten in place keeps that
+ * checksum, though, so the identity of the .pack file (inode, size and
+ * times) goes into the key too: entries are only found again by
+ * processes that see the very same file.
+ */
+static struct pack_key {
+	struct packed_git *p;
+	unsigned char key[20];
+} *pack_keys;
+static int pack_keys_nr, pack_keys_alloc;
+
+static const unsigned char *pack_key(struct packed_git *p)
+{
+	struct pack_key *k;
+	struct stat st;
+	uint64_t id[7];
+	git_SHA_CTX ctx;
+	int i;
+
+	for (i = 0; i < pack_keys_nr; i++)
+		if (pack_keys[i].p == p)
+			return pack_keys[i].key;
+
+	if (!p->index_data && open_pack_index(p))
+		return NULL;
+	if (p->pack_fd >= 0 ? fstat(p->pack_fd, &st) : stat(p->pack_name, &st))
+		return NULL;
+	id[0] = st.st_dev;
+	id[1] = st.st_ino;
+	id[2] = st.st_size;
+	id[3] = st.st_mtime;
+	id[4] = ST_MTIME_NSEC(st);
+	id[5] = st.st_ctime;
+	id[6] = ST_CTIME_NSEC(st);
+
+	ALLOC_GROW(pack_keys, pack_keys_nr + 1, pack_keys_alloc);
+	k = &pack_keys[pack_keys_nr++];
+	k->p = p;
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, (const unsigned char *)p->index_data +
+			p->index_size - 40, 20);
+	git_SHA1_Update(&ctx, id, sizeof(id));
+	git_SHA1_Final(k->key, &ctx);
+	return k->key;
+}
+
+static int slot_matches(const struct shared_cache_slot *slot,
+			const unsigned char *pack, off_t offset)
+{
+	return slot->offset == offset && !hashcmp(slot->pack, pack);
+}
+
+/*
+ * Find the slot holding the object at "offset" in the pack with the
+ * key "pack".  If it is not there, "victim" is set to the slot it
+ * should go to: an unused one, or else the least recently used one of
+ * those it may go to.
+ */
+static struct shared_cache_slot *find_slot(const unsigned char *pack,
+					   off_t offset,
+					   struct shared_cache_slot **victim)
+{
+	uint32_t mask = shared_cache.nr_slots - 1;
+	uint32_t hash;
+	int i;
+
+	memcpy(&hash, pack, sizeof(hash));
+	hash ^= (uint32_t)offset * 2654435761u;
+	hash ^= (uint32_t)((uint64_t)offset >> 32);
+
+	*victim = NULL;
+	for (i = 0; i < SHARED_CACHE_PROBES; i++) {
+		struct shared_cache_slot *slot =
+			&shared_cache.slots[(hash + i) & mask];
+
+		if (!slot_valid(slot)) {
+			if (!*victim || slot_valid(*victim))
+				*victim = slot;
+			continue;
+		}
+		if (slot_matches(slot, pack, offset))
+			return slot;
+		if (!*victim ||
+		    (slot_valid(*victim) &&
+		     slot->last_used < (*victim)->last_used))
+			*victim = slot;
+	}
+	return NULL;
+}
+
+/* Copy the data of "slot" to the head of the ring. */
+static void store_slot(struct shared_cache_slot *slot, const void *data)
+{
+	struct shared_cache_header *header = shared_cache.header;
+	uint64_t data_size = shared_cache.data_size;
+	uint64_t pos = header->head;
+
+	/* an object is never split over the end of the ring */
+	if (pos % data_size + slot->size > data_size)
+		pos += data_size - pos % data_size;
+	header->head = pos + slot->size;
+
+	memcpy(shared_cache.data + pos % data_size, data, slot->size);
+	slot->pos = pos;
+}
+
+void *shared_delta_cache_get(struct packed_git *p, off_t offset,
+			     enum object_type *type, unsigned long *size)
+{
+	struct shared_cache_slot *slot, *victim;
+	const unsigned char *pack;
+	uint64_t pos;
+	uint32_t crc;
+	int refresh;
+	void *buf;
+
+	if (!prepare_shared_cache() || !(pack = pack_key(p)))
+		return NULL;
+	if (shared_cache_lock(F_RDLCK) < 0)
+		return NULL;
+
+	slot = find_slot(pack, offset, &victim);
+	if (!slot) {
+		shared_cache_lock(F_UNLCK);
+		return NULL;
+	}
+
+	buf = xmallocz(slot->size);
+	memcpy(buf, shared_cache.data + slot->pos % shared_cache.data_size,
+	       slot->size);
+	*type = slot->type;
+	*size = slot->size;
+	crc = slot->crc;
+	pos = slot->pos;
+	refresh = shared_cache.header->head - pos > shared_cache.data_size / 2;
+
+	shared_cache_lock(F_UNLCK);
+
+	if (slot_crc(*type, *size, buf) != crc) {
+		trace_printf_key(&trace_shared_cache, "bad %s %"PRIuMAX"\n",
+				 sha1_to_hex(pack), (uintmax_t)offset);
+		/* drop it, unless someone else already replaced it */
+		if (!shared_cache_lock(F_WRLCK)) {
+			if (slot->pos == pos && slot_matches(slot, pack, offset))
+				slot->type = 0;
+			shared_cache_lock(F_UNLCK);
+		}
+		free(buf);
+		return NULL;
+	}
+
+	/*
+	 * An object used again when it is about to be overwritten goes
+	 * back to the head of the ring, unless someone else moved or
+	 * replaced it in the meantime.
+	 */
+	if (refresh && !shared_cache_lock(F_WRLCK)) {
+		if (slot->pos == pos && slot->size == *size &&
+		    slot_matches(slot, pack, offset)) {
+			slot->last_used = ++shared_cache.header->clock;
+			store_slot(slot, buf);
+		}
+		shared_cache_lock(F_UNLCK);
+	}
+
+	trace_printf_key(&trace_shared_cache, "hit %s %"PRIuMAX"\n",
+			 sha1_to_hex(pack), (uintmax_t)offset);
+	return buf;
+}
+
+void shared_delta_cache_put(struct packed_git *p, off_t offset,
+			    const void *data, unsigned long size,
+			    enum object_type type)
+{
+	struct shared_cache_slot *slot, *victim;
+	const unsigned char *pack;
+	uint32_t crc;
+
+	if (!prepare_shared_cache() || !(pack = pack_key(p)))
+		return;
+	/* do not let one object flush most of the cache */
+	if (!size || size > shared_cache.data_size / 4)
+		return;
+
+	crc = slot_crc(type, size, data);
+	if (shared_cache_lock(F_WRLCK) < 0)
+		return;
+
+	slot = find_slot(pack, offset, &victim);
+	if (slot) {
+		slot->last_used = ++shared_cache.header->clock;
+	} else {
+		hashcpy(victim->pack, pack);
+		victim->offset = offset;
+		victim->size = size;
+		victim->type = type;
+		victim->crc = crc;
+		victim->last_used = ++shared_cache.header->clock;
+		store_slot(victim, data);
+		trace_printf_key(&trace_shared_cache, "add %s %"PRIuMAX"\n",
+				 sha1_to_hex(pack), (uintmax_t)offset);
+	}
+
+	shared_cache_lock(F_UNLCK);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef SHARED_DELTA_CACHE_H
+#define SHARED_DELTA_CACHE_H
+
+/*
+ * A cache of inflated delta bases that all processes working on a
+ * repository share, in a file they all map (see
+ * core.sharedDeltaBaseCacheLimit).  It sits behind the per-process
+ * delta base cache of unpack_entry(), so that concurrent pack-objects
+ * serving the same history do not each inflate the same hot bases.
+ *
+ * Entries are keyed by the checksum and file identity of the pack and
+ * the offset of the object in it.  Slots are checked to lie within the
+ * cache and a checksum of the type, size and data is verified on every
+ * hit, so that a damaged cache is only ever a miss.  All functions
+ * silently do nothing when the cache is disabled or cannot be used.
+ */
+
+/*
+ * Return a copy of the object at "offset" in "p" if it is in the
+ * cache, or NULL.  The copy is NUL-terminated and owned by the caller.
+ */
+void *shared_delta_cache_get(struct packed_git *p, off_t offset,
+			     enum object_type *type, unsigned long *size);
+
+/* Add the inflated object at "offset" in "p" to the cache. */
+void shared_delta_cache_put(struct packed_git *p, off_t offset,
+			    const void *data, unsigned long size,
+			    enum object_type type);
+
+#endif /* SHARED_DELTA_CACHE_H */
@@ -0,0 +1,98 @@
+/*
+ * test-delta-bench.c: time diff-delta.c with each set of helpers the CPU
+ * supports, and check that they all produce the same deltas
+ */
+
+#include "cache.h"
+#include "delta.h"
+
+static const char usage_str[] =
+	"test-delta-bench [--rounds=<n>] [--kernel=<name>] <from_file> <data_file>...";
+
+struct delta_result {
+	void *buf;
+	unsigned long size;
+};
+
+/* Delta every data file against "from", "rounds" times; return the time. */
+static uint64_t run(const struct strbuf *from, const struct strbuf *data,
+		    int nr, int rounds, struct delta_result *res)
+{
+	uint64_t start = getnanotime();
+	int r, i;
+
+	for (r = 0; r < rounds; r++) {
+		struct delta_index *index = create_delta_index(from->buf, from->len);
+
+		if (!index)
+			die("unable to index %lu bytes", (unsigned long)from->len);
+		for (i = 0; i < nr; i++) {
+			free(res[i].buf);
+			res[i].buf = create_delta(index, data[i].buf, data[i].len,
+						  &res[i].size, 0);
+		}
+		free_delta_index(index);
+	}
+	return getnanotime() - start;
+}
+
+int cmd_main(int argc, const char **argv)
+{
+	struct strbuf from = STRBUF_INIT, *data;
+	struct delta_result *expect = NULL, *actual;
+	const char *only = NULL, *name, *first = NULL;
+	int rounds = 10, nr, i, n, ret = 0;
+
+	for (argv++, argc--; argc && starts_with(*argv, "--"); argv++, argc--) {
+		if (skip_prefix(*argv, "--rounds=", &name))
+			rounds = atoi(name);
+		else if (skip_prefix(*argv, "--kernel=", &name))
+			only = name;
+		else
+			usage(usage_str);
+	}
+	if (argc < 2 || rounds < 1)
+		usage(usage_str);
+
+	if (strbuf_read_file(&from, argv[0], 0) < 0)
+		die_errno("unable to read '%s'", argv[0]);
+	nr = argc - 1;
+	data = xcalloc(nr, sizeof(*data));
+	for (i = 0; i < nr; i++) {
+		strbuf_init(&data[i], 0);
+		if (strbuf_read_file(&data[i], argv[i + 1], 0) < 0)
+			die_errno("unable to read '%s'", argv[i + 1]);
+	}
+
+	for (n = 0; (name = delta_kernel_name(n)); n++) {
+		uint64_t t;
+
+		if (only && strcmp(only, name))
+			continue;
+		if (use_delta_kernel(name))
+			die("unable to use '%s'", name);
+		actual = xcalloc(nr, sizeof(*actual));
+		t = run(&from, data, nr, rounds, actual);
+		printf("%-8s %10.3f ms/round\n", name, t / 1e6 / rounds);
+
+		if (!expect) {
+			expect = actual;
+			first = name;
+			continue;
+		}
+		for (i = 0; i < nr; i++) {
+			if (!expect[i].buf != !actual[i].buf ||
+			    (expect[i].buf &&
+			     (expect[i].size != actual[i].size ||
+			      memcmp(expect[i].buf, actual[i].buf, actual[i].size)))) {
+				ret = error("%s and %s differ for '%s'",
+					    first, name, argv[i + 1]);
+			}
+			free(actual[i].buf);
+		}
+		free(actual);
+	}
+	if (only && !first)
+		die("'%s' is not supported", only);
+	return ret;
+}
@@ -0,0 +1,36 @@
+#include "cache.h"
+#include "ewah/ewok.h"
+
+static void mark_dirty(size_t pos, void *data)
+{
+	char *valid = data;
+
+	if (pos < the_index.cache_nr)
+		valid[pos] = 0;
+}
+
+int cmd_main(int ac, const char **av)
+{
+	struct index_state *istate = &the_index;
+	char *valid;
+	int i;
+
+	setup_git_directory();
+	/* read the raw extension, without applying core.fsmonitor */
+	if (do_read_index(istate, get_index_file(), 0) < 0)
+		die("unable to read index file");
+	if (!istate->fsmonitor_last_update || !istate->fsmonitor_dirty) {
+		printf("no fsmonitor\n");
+		return 0;
+	}
+	printf("fsmonitor last update %"PRIuMAX"\n",
+	       (uintmax_t)istate->fsmonitor_last_update);
+
+	valid = xmalloc(istate->cache_nr + 1);
+	memset(valid, 1, istate->cache_nr + 1);
+	ewah_each_bit(istate->fsmonitor_dirty, mark_dirty, valid);
+	for (i = 0; i < istate->cache_nr; i++)
+		printf("%c %s\n", valid[i] ? '+' : '-', istate->cache[i]->name);
+	free(valid);
+	return 0;
+}
@@ -11,4 +11,19 @@ test_perf "read_cache/discard_cache $count times" "
 	test-read-cache $count
 "
 
+# With index.threads set, the index is written with an offset table so
+# that the entries can be parsed by several threads, while another one
+# parses the extensions.
+for threads in 2 4 8
+do
+	test_expect_success "write index for $threads threads" "
+		git config index.threads $threads &&
+		git read-tree HEAD
+	"
+
+	test_perf "read_cache/discard_cache $count times ($threads threads)" "
+		test-read-cache $count
+	"
+done
+
 test_done
@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# This test measures the cost of populating the work tree with
+# and without parallel checkout.  Unlike p0006, it is all about
+# inflating blobs and writing thousands of files, so the numbers
+# depend a lot on the file system and the number of CPUs.
+
+test_description="Tests performance of parallel checkout"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success "setup repo" '
+	empty_tree=$(git mktree </dev/null) &&
+	empty=$(git commit-tree -m empty $empty_tree) &&
+	git branch -f p0007-empty $empty &&
+	git checkout -q -f HEAD &&
+	nr_files=$(git ls-files | wc -l)
+'
+
+for workers in 1 2 4 8
+do
+	test_perf "checkout $nr_files files with $workers workers" "
+		git -c checkout.workers=$workers checkout -q -f p0007-empty &&
+		git -c checkout.workers=$workers checkout -q -f -
+	"
+done
+
+test_done
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+test_description='Tests the performance of transactions updating many refs'
+. ./perf-lib.sh
+
+test_expect_success 'setup' '
+	git init src &&
+	(
+		cd src &&
+		test_commit one &&
+		test_commit two &&
+		one=$(git rev-parse one) &&
+		two=$(git rev-parse two) &&
+		perl -le "print qq(create refs/mass/\$_ $one) for 1..10000" >create &&
+		perl -le "print qq(update refs/mass/\$_ $two $one) for 1..10000" >update &&
+		perl -le "print qq(delete refs/mass/\$_ $two) for 1..10000" >delete
+	)
+'
+
+# Each run creates, updates and deletes the same 10000 refs, so that it
+# leaves the repository as it found it.
+for batch in 0 1000
+do
+	for fsync in false true
+	do
+		test_perf "update-ref --stdin (batch=$batch, fsync=$fsync)" "
+			(
+				cd src &&
+				git config core.batchRefUpdates $batch &&
+				git config core.fsyncRefFiles $fsync &&
+				git update-ref --stdin <create &&
+				git update-ref --stdin <update &&
+				git update-ref --stdin <delete
+			)
+		"
+	done
+done
+
+test_expect_success 'create refs to push' '
+	git -C src update-ref --stdin <src/create
+'
+
+for batch in 0 1000
+do
+	test_perf "push 10000 new refs (batch=$batch)" "
+		rm -rf dst.git &&
+		git init -q --bare dst.git &&
+		git -C dst.git config core.batchRefUpdates $batch &&
+		git -C src push -q ../dst.git 'refs/mass/*:refs/heads/mass/*'
+	"
+done
+
+test_done
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+test_description='Tests the performance of path-limited log with changed-path Bloom filters'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# Pick a file and a directory pseudo-randomly.  The sort key is the
+# object name, so they are stable.
+test_expect_success 'select a file and a directory' '
+	git ls-tree -r HEAD | grep ^100644 |
+	sort -k 3 | head -1 | cut -f 2 >file &&
+	git ls-tree HEAD | grep ^040000 |
+	sort -k 3 | head -1 | cut -f 2 >dir
+'
+
+file=$(cat file)
+dir=$(cat dir)
+export file dir
+
+test_expect_success 'write commit-graph without changed paths' '
+	git commit-graph write --reachable --no-changed-paths
+'
+
+test_perf 'git log -- <file> (no filters)' '
+	git log --oneline -- "$file" >/dev/null
+'
+
+test_perf 'git log -- <dir> (no filters)' '
+	git log --oneline -- "$dir" >/dev/null
+'
+
+test_perf 'git commit-graph write --changed-paths' '
+	git commit-graph write --reachable --changed-paths
+'
+
+test_perf 'git log -- <file> (with filters)' '
+	git log --oneline -- "$file" >/dev/null
+'
+
+test_perf 'git log -- <dir> (with filters)' '
+	git log --oneline -- "$dir" >/dev/null
+'
+
+test_done
@@ -82,6 +82,16 @@ do
 		  --reflog --indexed-objects --delta-base-offset \
 		  --stdout </dev/null >/dev/null
 	'
+
+	# The same lookups again, this time answered by a single
+	# multi-pack-index instead of one pack index per pack.
+	test_expect_success "write multi-pack-index ($nr_packs)" '
+		git multi-pack-index write
+	'
+
+	test_perf "rev-list with multi-pack-index ($nr_packs)" '
+		git rev-list --objects --all >/dev/null
+	'
 done
 
 test_done
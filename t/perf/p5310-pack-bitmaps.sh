@@ -40,6 +40,22 @@ test_perf 'pack to file (bitmap)' '
 	git pack-objects --use-bitmap-index --all pack1b </dev/null >/dev/null
 '
 
+test_perf 'rev-list --count (walk)' '
+	git -c pack.useBitmaps=false rev-list --count --all >/dev/null
+'
+
+test_perf 'rev-list --count (bitmap)' '
+	git rev-list --count --all >/dev/null
+'
+
+test_perf 'tag --contains (walk)' '
+	git -c pack.useBitmaps=false tag --contains HEAD~100 >/dev/null
+'
+
+test_perf 'tag --contains (bitmap)' '
+	git tag --contains HEAD~100 >/dev/null
+'
+
 test_expect_success 'create partial bitmap state' '
 	# pick a commit to represent the repo tip in the past
 	cutoff=$(git rev-list HEAD~100 -1) &&
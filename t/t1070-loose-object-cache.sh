@@ -0,0 +1,57 @@
+#!/bin/sh
+
+test_description='looking up loose objects with core.looseObjectCache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init alt &&
+	test_commit -C alt base &&
+	git clone -s alt repo &&
+	test_commit -C repo local &&
+	test_commit -C repo local2 &&
+	{
+		git -C alt rev-list --objects --all &&
+		git -C repo rev-list --objects --all &&
+		echo 0000000000000000000000000000000000000001 &&
+		echo ffffffffffffffffffffffffffffffffffffffff &&
+		git -C repo rev-parse HEAD | sed "s/.$/0/" &&
+		git -C repo rev-parse HEAD | sed "s/.$/1/"
+	} | cut -d" " -f1 | sort -u >objects
+'
+
+test_expect_success 'lookups agree with and without the cache' '
+	git -C repo cat-file --batch-check <objects >expect &&
+	git -C repo -c core.looseObjectCache=true \
+		cat-file --batch-check <objects >actual &&
+	test_cmp expect actual &&
+	grep missing actual
+'
+
+test_expect_success 'objects written by the same process are found' '
+	echo changed >repo/local.t &&
+	git -C repo -c core.looseObjectCache=true commit -a -m changed &&
+	git -C repo -c core.looseObjectCache=true revert --no-edit HEAD &&
+	git -C repo diff --exit-code local2 &&
+	git -C repo fsck
+'
+
+test_expect_success PIPE 'objects written by another process are found' '
+	blob=$(echo new | git hash-object --stdin) &&
+	mkfifo in out &&
+	(git -C repo -c core.looseObjectCache=true \
+		cat-file --batch-check <in >out &) &&
+	exec 9>in &&
+	exec 8<out &&
+	test_when_finished "exec 9>&-" &&
+	test_when_finished "exec 8<&-" &&
+	echo >&9 $blob &&
+	read response <&8 &&
+	test "$response" = "$blob missing" &&
+	echo new | git -C repo hash-object -w --stdin &&
+	echo >&9 $blob &&
+	read response <&8 &&
+	test "$response" = "$blob blob 4"
+'
+
+test_done
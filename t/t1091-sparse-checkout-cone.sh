@@ -0,0 +1,153 @@
+#!/bin/sh
+
+test_description='sparse checkout with cone mode patterns'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p deep/deeper1/deepest deep/deeper2 folder1 folder2 &&
+	for f in a deep/a deep/deeper1/a deep/deeper1/deepest/a \
+		 deep/deeper2/a folder1/a folder2/a
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git config core.sparseCheckout true
+'
+
+# Check out HEAD according to the sparse-checkout file (read from stdin),
+# in cone mode or not, and record the entries that are checked out.
+sparse_checkout () {
+	cat >.git/info/sparse-checkout &&
+	git -c core.sparseCheckoutCone=$1 read-tree -mu HEAD 2>err &&
+	git ls-files -t | sed -n -e "s/^H //p" >actual.$1
+}
+
+# Check that cone mode and the full pattern set agree.
+check_both () {
+	cat >patterns &&
+	sparse_checkout false <patterns &&
+	test_cmp expect actual.false &&
+	sparse_checkout true <patterns &&
+	test_cmp expect actual.true &&
+	test_must_be_empty err
+}
+
+test_expect_success 'root files only' '
+	echo a >expect &&
+	check_both <<-\EOF &&
+	/*
+	!/*/
+	EOF
+	test_path_is_file a &&
+	test_path_is_missing deep &&
+	test_path_is_missing folder1
+'
+
+test_expect_success 'recursive pattern' '
+	cat >expect <<-\EOF &&
+	a
+	deep/a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	deep/deeper2/a
+	EOF
+	check_both <<-\EOF
+	/*
+	!/*/
+	/deep/
+	EOF
+'
+
+test_expect_success 'parent and recursive patterns' '
+	cat >expect <<-\EOF &&
+	a
+	deep/a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	folder2/a
+	EOF
+	check_both <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	!/deep/*/
+	/deep/deeper1/
+	/folder2/
+	EOF
+	test_path_is_missing deep/deeper2 &&
+	test_path_is_missing folder1
+'
+
+test_expect_success 'nested parent patterns' '
+	cat >expect <<-\EOF &&
+	a
+	deep/a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	EOF
+	check_both <<-\EOF
+	/*
+	!/*/
+	/deep/
+	!/deep/*/
+	/deep/deeper1/
+	!/deep/deeper1/*/
+	/deep/deeper1/deepest/
+	EOF
+'
+
+test_expect_success 'full cone' '
+	git ls-files >expect &&
+	check_both <<-\EOF
+	/*
+	EOF
+'
+
+test_expect_success 'escaped glob characters are literal' '
+	echo a >expect &&
+	check_both <<-\EOF
+	/*
+	!/*/
+	/fold\*/
+	EOF
+'
+
+test_expect_success 'non-cone patterns fall back to the full pattern set' '
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	*eeper1/
+	EOF
+	git -c core.sparseCheckoutCone=true read-tree -mu HEAD 2>err &&
+	test_i18ngrep "unrecognized pattern: .\*eeper1" err &&
+	test_i18ngrep "disabling cone pattern matching" err &&
+	cat >expect <<-\EOF &&
+	a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	EOF
+	git ls-files -t | sed -n -e "s/^H //p" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'negative pattern without its parent is not a cone pattern' '
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	!/deep/*/
+	EOF
+	git -c core.sparseCheckoutCone=true read-tree -mu HEAD 2>err &&
+	test_i18ngrep "unrecognized negative pattern" err
+'
+
+test_expect_success 'repopulate the whole working tree' '
+	echo "/*" >.git/info/sparse-checkout &&
+	git -c core.sparseCheckoutCone=true read-tree -mu HEAD &&
+	git ls-files >expect &&
+	git ls-files -t | sed -n -e "s/^H //p" >actual &&
+	test_cmp expect actual
+'
+
+test_done
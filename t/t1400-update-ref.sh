@@ -1277,6 +1277,86 @@ test_expect_success ULIMIT_FILE_DESCRIPTORS 'large transaction deleting branches
 )
 '
 
+test_expect_success 'batched transaction writes refs to packed-refs' '
+	test_config core.batchRefUpdates 10 &&
+	test_config core.logAllRefUpdates always &&
+	git update-ref refs/batch/loose $A &&
+	for i in $(test_seq 20)
+	do
+		echo "create refs/batch/$i $A" || return 1
+	done >input &&
+	echo "update refs/batch/loose $B $A" >>input &&
+	git update-ref --stdin <input &&
+	test_path_is_missing .git/refs/batch/1 &&
+	test_path_is_missing .git/refs/batch/20 &&
+	grep "^$A refs/batch/1\$" .git/packed-refs &&
+	test $A = $(git rev-parse refs/batch/20) &&
+	test $B = $(cat .git/refs/batch/loose) &&
+	git reflog exists refs/batch/20 &&
+	test $A = $(git rev-parse refs/batch/20@{0})
+'
+
+test_expect_success 'batched transaction checks old values' '
+	test_config core.batchRefUpdates 10 &&
+	for i in $(test_seq 20)
+	do
+		echo "update refs/batch/$i $B $A" || return 1
+	done >input &&
+	echo "update refs/batch/loose $C $A" >>input &&
+	test_must_fail git update-ref --stdin <input &&
+	test $A = $(git rev-parse refs/batch/1) &&
+	test $B = $(git rev-parse refs/batch/loose) &&
+	sed "\$d" input >input.ok &&
+	git update-ref --stdin <input.ok &&
+	test $B = $(git rev-parse refs/batch/1) &&
+	test $B = $(git rev-parse refs/batch/20)
+'
+
+test_expect_success 'batched transaction deletes refs from packed-refs' '
+	test_config core.batchRefUpdates 10 &&
+	for i in $(test_seq 10)
+	do
+		echo "delete refs/batch/$i $B" || return 1
+	done >input &&
+	echo "update refs/batch/11 $C $B" >>input &&
+	echo "delete refs/batch/loose $B" >>input &&
+	git update-ref --stdin <input &&
+	! grep "refs/batch/1\$" .git/packed-refs &&
+	! grep "refs/batch/10\$" .git/packed-refs &&
+	test_path_is_missing .git/refs/batch/loose &&
+	test_must_fail git rev-parse --verify -q refs/batch/loose &&
+	test $C = $(git rev-parse refs/batch/11) &&
+	git for-each-ref refs/batch/ >actual &&
+	test_line_count = 10 actual
+'
+
+test_expect_success 'batched transaction with core.fsyncRefFiles' '
+	test_config core.batchRefUpdates 10 &&
+	test_config core.fsyncRefFiles true &&
+	for i in $(test_seq 11 20)
+	do
+		echo "delete refs/batch/$i" || return 1
+	done >input &&
+	echo "create refs/batch/synced $A" >>input &&
+	git update-ref --stdin <input &&
+	git update-ref refs/batch/loose $A &&
+	git for-each-ref --format="%(refname)" refs/batch/ >actual &&
+	printf "refs/batch/%s\n" loose synced >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'batched transaction leaves no empty directories' '
+	test_config core.batchRefUpdates 10 &&
+	for i in $(test_seq 50)
+	do
+		echo "create refs/pull/$i/head $A" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	test $A = $(git rev-parse refs/pull/50/head) &&
+	find .git/refs/pull -mindepth 1 >actual &&
+	test_must_be_empty actual
+'
+
 test_expect_success 'handle per-worktree refs in refs/bisect' '
 	git commit --allow-empty -m "initial commit" &&
 	git worktree add -b branch worktree &&
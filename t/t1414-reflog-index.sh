@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='reflog indexes for @{<n>} and @{<date>} lookups'
+
+. ./test-lib.sh
+
+# Look up "<branch>@{<spec>}" with and without the index of the reflog
+# of the branch, and check that both give the same answer.
+check_lookup () {
+	idx=.git/logs/refs/heads/.$1.idx &&
+	test_path_is_file $idx &&
+	{
+		git rev-parse --verify -q "$1@{$2}" >with ||
+		echo missing >with
+	} &&
+	mv $idx idx.save &&
+	{
+		git rev-parse --verify -q "$1@{$2}" >without ||
+		echo missing >without
+	} &&
+	mv idx.save $idx &&
+	test_cmp without with
+}
+
+test_expect_success 'setup' '
+	git config core.reflogIndex true &&
+	for i in $(test_seq 50)
+	do
+		test_commit c$i || return 1
+	done &&
+	test_path_is_file .git/logs/refs/heads/.master.idx &&
+	test_path_is_file .git/logs/.HEAD.idx
+'
+
+test_expect_success '@{<n>} lookups' '
+	for n in 0 1 2 25 48 49 50 51 1000
+	do
+		check_lookup master $n || return 1
+	done &&
+	git rev-parse c26 >expect &&
+	git rev-parse master@{24} >actual &&
+	test_cmp expect actual &&
+	git rev-parse HEAD@{24} >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '@{<date>} lookups' '
+	first=$(git log -1 --format=%ct c1) &&
+	for t in 1 $first $(($first + 1)) $(($first + 60)) \
+		$(($first + 30 * 60 + 30)) $(($first + 49 * 60)) \
+		$(($first + 100000))
+	do
+		check_lookup master $t || return 1
+	done &&
+	git rev-parse c31 >expect &&
+	git rev-parse master@{$(($first + 30 * 60 + 30))} >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'an index that is out of date is ignored' '
+	git -c core.reflogIndex=false commit --allow-empty -m unindexed &&
+	for n in 0 1 10
+	do
+		check_lookup master $n || return 1
+	done &&
+	git commit --allow-empty -m indexed-again &&
+	check_lookup master 1 &&
+	git rev-parse HEAD^ >expect &&
+	git rev-parse master@{1} >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reflog expire rewrites the index' '
+	cutoff=$(git log -1 --format=%ct c20) &&
+	git reflog expire --expire=$cutoff master &&
+	test_path_is_file .git/logs/refs/heads/.master.idx &&
+	for n in 0 1 20 40 100
+	do
+		check_lookup master $n || return 1
+	done &&
+	check_lookup master $cutoff
+'
+
+test_expect_success 'timestamps that go backwards' '
+	for t in 5 3 9 1 7
+	do
+		GIT_COMMITTER_DATE="$((1000000000 + $t * 100)) +0000" \
+		git update-ref -m "at $t" refs/heads/skew c$t || return 1
+	done &&
+	for t in 50 150 250 350 450 550 650 750 850 950
+	do
+		check_lookup skew $((1000000000 + $t)) || return 1
+	done
+'
+
+test_expect_success 'deleting and renaming branches takes the index along' '
+	git branch dir/side c1 &&
+	git update-ref refs/heads/dir/side c2 &&
+	test_path_is_file .git/logs/refs/heads/dir/.side.idx &&
+	git branch -m dir/side renamed &&
+	test_path_is_missing .git/logs/refs/heads/dir &&
+	git rev-parse c1 >expect &&
+	git rev-parse renamed@{2} >actual &&
+	test_cmp expect actual &&
+	git update-ref refs/heads/renamed c3 &&
+	check_lookup renamed 2 &&
+	git branch -D renamed &&
+	test_path_is_missing .git/logs/refs/heads/renamed &&
+	test_path_is_missing .git/logs/refs/heads/.renamed.idx
+'
+
+test_expect_success 'indexes are not taken for reflogs' '
+	git reflog expire --all 2>err &&
+	test_must_be_empty err &&
+	git fsck 2>err &&
+	! grep idx err
+'
+
+test_done
@@ -0,0 +1,223 @@
+#!/bin/sh
+
+test_description='the reftable ref storage backend'
+
+. ./test-lib.sh
+
+test_expect_success 'init --ref-storage=reftable' '
+	git init --ref-storage=reftable repo &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	test 1 = "$(git -C repo config core.repositoryformatversion)" &&
+	test reftable = "$(git -C repo config extensions.refstorage)"
+'
+
+test_expect_success 'unknown ref storage is rejected' '
+	test_must_fail git init --ref-storage=bogus bogus &&
+	test_path_is_missing bogus/.git/config &&
+	git init bogus &&
+	git -C bogus config core.repositoryformatversion 1 &&
+	git -C bogus config extensions.refstorage bogus &&
+	test_must_fail git -C bogus rev-parse --git-dir
+'
+
+test_expect_success 'the ref storage of a repository cannot be changed' '
+	test_must_fail git init --ref-storage=files repo &&
+	git init --ref-storage=reftable repo &&
+	git init repo
+'
+
+test_expect_success 'refs are stored in the tables' '
+	(
+		cd repo &&
+		test_commit one &&
+		test_commit two &&
+		git branch side one &&
+		git tag -a -m annotated annotated one &&
+		git rev-parse one >expect &&
+		git rev-parse side >actual &&
+		test_cmp expect actual &&
+		git rev-parse annotated^{commit} >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing .git/refs/heads/master &&
+		test_path_is_missing .git/refs/heads/side &&
+		test_path_is_missing .git/packed-refs
+	)
+'
+
+test_expect_success 'for-each-ref and show-ref' '
+	(
+		cd repo &&
+		cat >expect <<-EOF &&
+		$(git rev-parse master) commit	refs/heads/master
+		$(git rev-parse side) commit	refs/heads/side
+		$(git rev-parse annotated) tag	refs/tags/annotated
+		$(git rev-parse one) commit	refs/tags/one
+		$(git rev-parse two) commit	refs/tags/two
+		EOF
+		git for-each-ref >actual &&
+		test_cmp expect actual &&
+		cat >expect <<-EOF &&
+		$(git rev-parse annotated) refs/tags/annotated
+		$(git rev-parse one) refs/tags/annotated^{}
+		EOF
+		git show-ref -d annotated >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'many refs span several blocks' '
+	(
+		cd repo &&
+		oid=$(git rev-parse two) &&
+		for i in $(test_seq 1000)
+		do
+			printf "create refs/many/%04d/ref-%04d $oid\n" $i $i ||
+			return 1
+		done >input &&
+		git update-ref --stdin <input &&
+		git for-each-ref refs/many/ >actual &&
+		test_line_count = 1000 actual &&
+		git for-each-ref refs/many/0500/ >actual &&
+		echo "$oid commit	refs/many/0500/ref-0500" >expect &&
+		test_cmp expect actual &&
+		git rev-parse refs/many/0001/ref-0001 refs/many/1000/ref-1000 >actual &&
+		printf "%s\n" $oid $oid >expect &&
+		test_cmp expect actual &&
+		test_must_fail git rev-parse --verify -q refs/many/1001/ref-1001
+	)
+'
+
+test_expect_success 'update-ref checks the old value' '
+	(
+		cd repo &&
+		one=$(git rev-parse one) &&
+		two=$(git rev-parse two) &&
+		test_must_fail git update-ref refs/heads/side $two $two &&
+		git update-ref refs/heads/side $two $one &&
+		test $two = "$(git rev-parse side)" &&
+		test_must_fail git update-ref -d refs/heads/side $one &&
+		git update-ref -d refs/heads/side $two &&
+		test_must_fail git rev-parse --verify -q side &&
+		git update-ref refs/heads/side $one "" &&
+		test_must_fail git update-ref refs/heads/side $one ""
+	)
+'
+
+test_expect_success 'ref names conflicting with existing ones are rejected' '
+	(
+		cd repo &&
+		test_must_fail git branch side/sub &&
+		test_must_fail git update-ref refs/heads/master/sub HEAD &&
+		git branch -d side &&
+		git branch side/sub &&
+		test_must_fail git branch side &&
+		git branch -d side/sub
+	)
+'
+
+test_expect_success 'symbolic refs in the tables' '
+	(
+		cd repo &&
+		git symbolic-ref refs/heads/sym refs/heads/master &&
+		test refs/heads/master = "$(git symbolic-ref refs/heads/sym)" &&
+		git update-ref refs/heads/sym one &&
+		git rev-parse one >expect &&
+		git rev-parse master >actual &&
+		test_cmp expect actual &&
+		git update-ref --no-deref -d refs/heads/sym &&
+		test_must_fail git symbolic-ref refs/heads/sym &&
+		git rev-parse master >actual &&
+		test_cmp expect actual &&
+		git reset --hard two
+	)
+'
+
+test_expect_success 'reflogs are kept' '
+	(
+		cd repo &&
+		git branch logged one &&
+		git update-ref -m "moved" refs/heads/logged two &&
+		git rev-parse one >expect &&
+		git rev-parse logged@{1} >actual &&
+		test_cmp expect actual &&
+		git rev-parse two >expect &&
+		git rev-parse master@{0} >actual &&
+		test_cmp expect actual &&
+		git checkout -b other &&
+		git checkout - &&
+		echo other >expect &&
+		git rev-parse --abbrev-ref @{-1} >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'branch -m moves the ref and its reflog' '
+	(
+		cd repo &&
+		git branch -m logged renamed &&
+		test_must_fail git rev-parse --verify -q logged &&
+		git rev-parse one >expect &&
+		git rev-parse renamed@{2} >actual &&
+		test_cmp expect actual &&
+		git branch -M renamed renamed &&
+		git branch -d renamed &&
+		test_must_fail git reflog exists refs/heads/renamed
+	)
+'
+
+test_expect_success 'the stack of tables is compacted' '
+	(
+		cd repo &&
+		for i in $(test_seq 32)
+		do
+			git update-ref refs/heads/counter-$i HEAD || return 1
+		done &&
+		test $(wc -l <.git/reftable/tables.list) -le 7 &&
+		git pack-refs --all &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		test $(ls .git/reftable/*.ref | wc -l) = 1 &&
+		git rev-parse HEAD >expect &&
+		git rev-parse counter-17 >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'records running past their block are rejected' '
+	cp -R repo damaged &&
+	(
+		cd damaged &&
+		git pack-refs --all &&
+		table=$(ls .git/reftable/*.ref) &&
+		perl -e '\''
+			open(my $fh, "+<", $ARGV[0]) or die;
+			binmode $fh;
+			local $/;
+			my $data = <$fh>;
+			my ($index) = unpack("Q>", substr($data, -16, 8));
+			my ($start, $end) = unpack("NN", substr($data, $index, 8));
+			my ($nr) = unpack("N", substr($data, $end - 4, 4));
+			my $len = $end - 4 - 4 * $nr - $start;
+			substr($data, $start, $len) = "\xff" x $len;
+			seek($fh, 0, 0);
+			print $fh $data;
+		'\'' "$table" &&
+		git for-each-ref 2>err &&
+		test_i18ngrep "corrupt reftable" err &&
+		test_must_fail git rev-parse --verify -q refs/heads/counter-1
+	)
+'
+
+test_expect_success 'per-worktree refs stay in files' '
+	(
+		cd repo &&
+		git worktree add -b wt-branch ../wt &&
+		git -C ../wt update-ref refs/bisect/wt HEAD &&
+		test_path_is_file .git/worktrees/wt/refs/bisect/wt &&
+		test_must_fail git rev-parse --verify -q refs/bisect/wt &&
+		git rev-parse wt-branch >expect &&
+		git -C ../wt rev-parse HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_done
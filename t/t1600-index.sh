@@ -73,4 +73,99 @@ test_expect_success 'GIT_INDEX_VERSION takes precedence over config' '
 	)
 '
 
+test_expect_success 'setup for threaded index loading' '
+	sane_unset GIT_INDEX_VERSION &&
+	sane_unset GIT_TEST_INDEX_THREADS &&
+	git config --unset-all index.version &&
+	rm -f .git/index &&
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	actual*
+	expect*
+	EOF
+	for i in $(test_seq 1 100)
+	do
+		mkdir -p dir$((i % 7)) &&
+		echo $i >dir$((i % 7))/file$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m many &&
+	echo intent >intent &&
+	git add -N intent &&
+	git update-index --untracked-cache &&
+	git status >/dev/null &&
+	git ls-files --stage --debug >expect.entries &&
+	test-dump-cache-tree >expect.tree
+'
+
+# Write the index in the given version, even if it is already in that
+# version, passing the remaining arguments as git options.
+rewrite_index () {
+	version=$1 &&
+	shift &&
+	if test $version = 4
+	then
+		other=2
+	else
+		other=4
+	fi &&
+	git "$@" update-index --index-version=$other &&
+	git "$@" update-index --index-version=$version
+}
+
+eoie_signature () {
+	# "EOIE", its length and its contents take 32 bytes before the
+	# trailing checksum
+	tail -c 52 .git/index | head -c 4
+}
+
+test_expect_success 'the EOIE extension is not written by default' '
+	rewrite_index 3 &&
+	test "$(eoie_signature)" != EOIE
+'
+
+for version in 2 3 4
+do
+	for threads in 2 3 8 true
+	do
+		test_expect_success "read index v$version with index.threads=$threads" '
+			rewrite_index $version -c index.threads=$threads &&
+			test "$(eoie_signature)" = EOIE &&
+			if test $threads != true
+			then
+				# too few entries for the automatic setting
+				grep IEOT .git/index >/dev/null
+			fi &&
+			git -c index.threads=$threads ls-files --stage --debug >actual &&
+			test_cmp expect.entries actual &&
+			git -c index.threads=$threads status --porcelain >actual &&
+			git -c index.threads=false status --porcelain >expect &&
+			test_cmp expect actual &&
+			test-dump-cache-tree >actual &&
+			test_cmp expect.tree actual
+		'
+	done
+done
+
+test_expect_success 'threaded index can be read without threads' '
+	rewrite_index 4 -c index.threads=4 &&
+	git -c index.threads=false ls-files --stage --debug >actual &&
+	test_cmp expect.entries actual
+'
+
+test_expect_success 'index.recordOffsetTable=false only writes the EOIE extension' '
+	rewrite_index 4 -c index.threads=4 -c index.recordOffsetTable=false &&
+	test "$(eoie_signature)" = EOIE &&
+	! grep IEOT .git/index &&
+	git -c index.threads=4 ls-files --stage --debug >actual &&
+	test_cmp expect.entries actual
+'
+
+test_expect_success 'index.recordEndOfIndexEntries=false writes no extensions for threading' '
+	rewrite_index 4 -c index.threads=4 -c index.recordEndOfIndexEntries=false &&
+	test "$(eoie_signature)" != EOIE &&
+	git -c index.threads=4 ls-files --stage --debug >actual &&
+	test_cmp expect.entries actual
+'
+
 test_done
@@ -6,6 +6,10 @@ test_description='split index mode tests'
 
 # We need total control of index splitting here
 sane_unset GIT_TEST_SPLIT_INDEX
+# ... and the fsmonitor extension would change the index checksums
+sane_unset GIT_TEST_FSMONITOR
+# ... as would the extensions written for threaded index loading
+sane_unset GIT_TEST_INDEX_THREADS
 
 test_expect_success 'enable split index' '
 	git config splitIndex.maxPercentChange 100 &&
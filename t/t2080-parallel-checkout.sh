@@ -0,0 +1,233 @@
+#!/bin/sh
+
+test_description='parallel checkout
+
+Check that writing the work tree with checkout.workers > 1 gives the
+same result, both in the work tree and in the index, as doing it
+sequentially.
+'
+
+. ./test-lib.sh
+
+# These tests pick the number of workers themselves.
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+# Run "git <args>" with the given number of workers and no threshold,
+# and check whether workers were used or not.
+#   parallel_git <workers> <expected-workers-used> <args>...
+parallel_git () {
+	workers=$1 &&
+	expect=$2 &&
+	shift 2 &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git \
+		-c checkout.workers=$workers \
+		-c checkout.thresholdForParallelism=0 \
+		"$@" &&
+	nr=$(grep "run_command: .*checkout--worker" trace | wc -l) &&
+	test $nr -eq $expect
+}
+
+list_file_types () {
+	(
+		cd "$1" &&
+		git ls-files |
+		while read path
+		do
+			if test -h "$path"
+			then
+				echo "symlink $path"
+			elif test -x "$path"
+			then
+				echo "executable $path"
+			else
+				echo "file $path"
+			fi
+		done
+	)
+}
+
+# Compare the work tree and the stat-clean index of two repositories.
+test_same_checkout () {
+	(cd "$1" && git ls-files -s && git diff-files --name-only) >expect &&
+	(cd "$2" && git ls-files -s && git diff-files --name-only) >actual &&
+	test_cmp expect actual &&
+	list_file_types "$1" >expect &&
+	list_file_types "$2" >actual &&
+	test_cmp expect actual &&
+	(cd "$1" && git ls-files -z | xargs -0 cat) >expect &&
+	(cd "$2" && git ls-files -z | xargs -0 cat) >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	git init src &&
+	(
+		cd src &&
+		for i in $(test_seq 1 40)
+		do
+			mkdir -p dir$((i % 5))/sub &&
+			echo "file $i" >file$i &&
+			echo "file $i" >dir$((i % 5))/file$i &&
+			echo "file $i" >dir$((i % 5))/sub/file$i || return 1
+		done &&
+		echo "#!$SHELL_PATH" >executable &&
+		chmod +x executable &&
+		git add . &&
+		git update-index --chmod=+x executable &&
+		git commit -m first &&
+		git tag first &&
+
+		for i in $(test_seq 1 40)
+		do
+			test $((i % 3)) = 0 || continue
+			echo "modified $i" >dir$((i % 5))/file$i || return 1
+		done &&
+		git rm -q -r -f dir4 &&
+		echo "now a file" >dir4 &&
+		git add . &&
+		git commit -m second
+	)
+'
+
+test_expect_success 'clone with parallel checkout' '
+	git clone -n src sequential &&
+	git -C sequential -c checkout.workers=1 checkout -q master &&
+	git clone -n src parallel &&
+	(
+		cd parallel &&
+		parallel_git 3 3 checkout -q master
+	) &&
+	test_same_checkout sequential parallel
+'
+
+test_expect_success 'switching branches with parallel checkout' '
+	git -C sequential -c checkout.workers=1 checkout -q first &&
+	(
+		cd parallel &&
+		parallel_git 3 3 checkout -q first
+	) &&
+	test_same_checkout sequential parallel &&
+	git -C sequential -c checkout.workers=1 checkout -q master &&
+	(
+		cd parallel &&
+		parallel_git 2 2 checkout -q master
+	) &&
+	test_same_checkout sequential parallel
+'
+
+test_expect_success 'index stat data is recorded for entries written by workers' '
+	(
+		cd parallel &&
+		rm -rf dir0 dir1 file1 &&
+		parallel_git 2 2 checkout -f master &&
+		git diff-files --quiet &&
+		git status --porcelain --untracked-files=no >actual &&
+		test_must_be_empty actual
+	)
+'
+
+test_expect_success 'no workers are used below the threshold' '
+	(
+		cd parallel &&
+		git checkout -q first &&
+		rm -f trace &&
+		GIT_TRACE="$(pwd)/trace" git -c checkout.workers=2 checkout -q master &&
+		! grep "checkout--worker" trace &&
+		git diff-files --quiet
+	)
+'
+
+test_expect_success 'no more workers than entries are started' '
+	(
+		cd parallel &&
+		rm -f file1 file2 &&
+		parallel_git 8 2 checkout -f master &&
+		test_path_is_file file1 &&
+		test_path_is_file file2
+	)
+'
+
+test_expect_success 'entries are written anyway if no worker starts' '
+	mkdir -p no-exec-path &&
+	(
+		cd parallel &&
+		git checkout -q --detach first &&
+		PATH=/nonexistent GIT_EXEC_PATH="$TRASH_DIRECTORY/no-exec-path" \
+			"$GIT_BUILD_DIR/git" -c checkout.workers=2 \
+			-c checkout.thresholdForParallelism=0 \
+			reset -q --hard master 2>err &&
+		test_i18ngrep "cannot run checkout--worker" err &&
+		git checkout -q master &&
+		git diff-files --quiet &&
+		git status --porcelain --untracked-files=no >actual &&
+		test_must_be_empty actual
+	) &&
+	git -C sequential checkout -q master &&
+	test_same_checkout sequential parallel
+'
+
+test_expect_success 'end-of-line and ident conversion in the workers' '
+	(
+		cd src &&
+		printf "a\nb\n" >crlf.txt &&
+		printf "\$Id\$\n" >ident.txt &&
+		printf "a\r\nb\n" >binary.dat &&
+		cat >.gitattributes <<-\EOF &&
+		*.txt text eol=crlf
+		ident.txt ident
+		*.dat binary
+		EOF
+		git add .gitattributes crlf.txt ident.txt binary.dat &&
+		git commit -m attributes
+	) &&
+	git -C sequential pull -q &&
+	git clone -n src parallel-attr &&
+	(
+		cd parallel-attr &&
+		parallel_git 2 2 checkout -q master &&
+		printf "a\r\nb\r\n" >expect &&
+		test_cmp expect crlf.txt &&
+		grep "\\\$Id: [0-9a-f]* \\\$" ident.txt
+	) &&
+	test_same_checkout sequential parallel-attr
+'
+
+test_expect_success 'entries with a smudge filter are written sequentially' '
+	(
+		cd src &&
+		echo "*.r13 filter=rot13" >>.gitattributes &&
+		echo hello >greeting.r13 &&
+		git add .gitattributes greeting.r13 &&
+		git commit -m filter
+	) &&
+	git clone -n src parallel-filter &&
+	(
+		cd parallel-filter &&
+		git config filter.rot13.smudge "tr a-zA-Z n-za-mN-ZA-M" &&
+		git config filter.rot13.clean "tr a-zA-Z n-za-mN-ZA-M" &&
+		parallel_git 2 2 checkout -q master &&
+		echo uryyb >expect &&
+		test_cmp expect greeting.r13 &&
+		git diff-files --quiet
+	)
+'
+
+test_expect_success SYMLINKS 'symlinks are written sequentially' '
+	(
+		cd src &&
+		ln -s dir0/file5 link &&
+		git add link &&
+		git commit -m link
+	) &&
+	git clone -n src parallel-link &&
+	(
+		cd parallel-link &&
+		parallel_git 2 2 checkout -q master &&
+		test -h link &&
+		test "$(readlink link)" = dir0/file5 &&
+		git diff-files --quiet
+	)
+'
+
+test_done
@@ -211,4 +211,98 @@ test_expect_success 'retry acquiring packed-refs.lock' '
 	git -c core.packedrefstimeout=3000 pack-refs --all --prune
 '
 
+test_expect_success 'packed-refs is written with the sorted trait' '
+	git pack-refs --all --prune &&
+	head -n 1 .git/packed-refs >actual &&
+	grep "^# pack-refs with:.* sorted $" actual
+'
+
+test_expect_success 'setup many packed refs' '
+	HEAD=$(git rev-parse HEAD) &&
+	git tag -a -m "annotated" many-annotated &&
+	for i in $(test_seq 1000)
+	do
+		printf "create refs/many/%04d $HEAD\n" $i || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	git pack-refs --all --prune &&
+	test $(wc -c <.git/packed-refs) -gt 32768
+'
+
+test_expect_success 'look up refs in a large sorted packed-refs' '
+	git rev-parse refs/many/0001 refs/many/0500 refs/many/1000 >actual &&
+	printf "%s\n" $HEAD $HEAD $HEAD >expect &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q refs/many/0500x &&
+	test_must_fail git rev-parse --verify -q refs/many/1001 &&
+	git rev-parse many-annotated^{} >actual &&
+	echo $HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'iterate over a prefix of a sorted packed-refs' '
+	git for-each-ref --format="%(refname)" "refs/many/05*" refs/many/1000 >actual &&
+	{
+		test_seq 500 599 | sed "s,^,refs/many/0," &&
+		echo refs/many/1000
+	} >expect &&
+	test_cmp expect actual &&
+	git show-ref -d many-annotated >actual &&
+	grep "^$HEAD refs/tags/many-annotated^{}$" actual
+'
+
+test_expect_success 'packed-refs without the sorted trait is still read' '
+	cp .git/packed-refs packed-refs.sorted &&
+	test_when_finished "mv packed-refs.sorted .git/packed-refs" &&
+	{
+		echo "# pack-refs with: peeled fully-peeled " &&
+		sed -e 1d packed-refs.sorted | sort -r
+	} >.git/packed-refs &&
+	git rev-parse refs/many/0500 >actual &&
+	echo $HEAD >expect &&
+	test_cmp expect actual &&
+	git for-each-ref refs/many/ >actual &&
+	test_line_count = 1000 actual
+'
+
+test_expect_success 'a malformed line in a sorted packed-refs is skipped' '
+	cp .git/packed-refs packed-refs.sorted &&
+	test_when_finished "mv packed-refs.sorted .git/packed-refs" &&
+	sed -e "s,^.* refs/many/0500$,garbage," packed-refs.sorted >.git/packed-refs &&
+	test_must_fail git rev-parse --verify -q refs/many/0500 &&
+	git rev-parse refs/many/0499 refs/many/0501 >actual &&
+	printf "%s\n" $HEAD $HEAD >expect &&
+	test_cmp expect actual &&
+	git for-each-ref refs/many/ >actual &&
+	test_line_count = 999 actual
+'
+
+test_expect_success 'a malformed line where bisection starts is skipped' '
+	git for-each-ref --format="%(refname)" >all &&
+	cp .git/packed-refs packed-refs.sorted &&
+	test_when_finished "mv packed-refs.sorted .git/packed-refs" &&
+	"$PERL_PATH" -e "
+		local \$/;
+		my \$buf = <STDIN>;
+		my \$records = index(\$buf, qq(\\n)) + 1;
+		my \$mid = \$records + int((length(\$buf) - \$records) / 2);
+		my \$start = rindex(\$buf, qq(\\n), \$mid - 1) + 1;
+		my \$end = index(\$buf, qq(\\n), \$start);
+		print STDERR substr(\$buf, \$start + 41, \$end - \$start - 41);
+		substr(\$buf, \$start, \$end - \$start) = qq(-) x (\$end - \$start);
+		print \$buf;
+	" <packed-refs.sorted >.git/packed-refs 2>bad &&
+	bad=$(cat bad) &&
+	test_must_fail git rev-parse --verify -q "$bad" &&
+	git rev-parse refs/many/0001 refs/many/1000 >actual &&
+	printf "%s\\n" $HEAD $HEAD >expect &&
+	test_cmp expect actual &&
+	git for-each-ref --format="%(refname)" refs/many/ >actual &&
+	test_line_count = 999 actual &&
+	! grep "^$bad$" actual &&
+	grep -v "^$bad$" all >expect &&
+	git for-each-ref --format="%(refname)" >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,124 @@
+#!/bin/sh
+
+test_description='git log with changed-path Bloom filters in the commit-graph'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git config core.commitGraph true &&
+	mkdir -p A/B/C D S &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 D/file4 &&
+	test_commit c5 file5 &&
+	git checkout -b side c2 &&
+	test_commit s1 S/side &&
+	test_commit s2 A/B/side &&
+	git checkout master &&
+	git merge -m merge side &&
+	git mv file5 D/file5 &&
+	git commit -m rename &&
+	git rm -r A/B/C &&
+	git commit -m "remove C" &&
+	git commit --allow-empty -m empty &&
+	test_commit c6 A/file1 &&
+	git commit-graph write --reachable --changed-paths
+'
+
+test_expect_success 'commit-graph lists the Bloom filter chunks' '
+	git commit-graph read >output &&
+	grep "^chunks:.* bloom_indexes bloom_data$" output
+'
+
+log_both () {
+	git -c core.commitGraph=false log "$@" >expect &&
+	git log "$@" >actual &&
+	test_cmp expect actual
+}
+
+for path in A A/ A/file1 A/B A/B/C A/B/C/file3 A/B/side D D/file5 S \
+	    file5 missing missing/path
+do
+	for opts in "" "--full-history" "--first-parent" "--simplify-merges" \
+		    "--topo-order" "--parents"
+	do
+		test_expect_success "log $opts -- $path" "
+			log_both $opts -- $path
+		"
+	done
+done
+
+test_expect_success 'log with a literal pathspec' '
+	log_both -- ":(literal)A/B"
+'
+
+test_expect_success 'filters rule out commits' '
+	GIT_TRACE_BLOOM="$(pwd)/trace" git log -- A/B/C/file3 >/dev/null &&
+	grep "definitely_not:[1-9]" trace
+'
+
+test_expect_success 'filters are not used for wildcard or multiple paths' '
+	rm -f trace &&
+	GIT_TRACE_BLOOM="$(pwd)/trace" git log -- "A/*" >/dev/null &&
+	GIT_TRACE_BLOOM="$(pwd)/trace" git log -- A D >/dev/null &&
+	GIT_TRACE_BLOOM="$(pwd)/trace" git log --follow -- D/file5 >/dev/null &&
+	test_path_is_missing trace &&
+	log_both -- "A/*" &&
+	log_both -- A D &&
+	log_both --follow -- D/file5
+'
+
+test_expect_success 'log from a subdirectory' '
+	(
+		cd A &&
+		git -c core.commitGraph=false log -- B >../expect &&
+		git log -- B >../actual
+	) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commits added after the graph have no filter' '
+	test_commit c7 A/B/file2 &&
+	GIT_TRACE_BLOOM="$(pwd)/trace" git log -- A/B >/dev/null &&
+	grep "not_present:1 " trace &&
+	log_both -- A/B
+'
+
+test_expect_success 'rewriting the graph keeps the filters by default' '
+	git commit-graph write --reachable &&
+	git commit-graph read >output &&
+	grep "bloom_indexes bloom_data" output &&
+	log_both -- A/B
+'
+
+test_expect_success 'appending to the graph reuses the filters' '
+	test_commit c8 D/file4 &&
+	git commit-graph write --reachable --append &&
+	git commit-graph read >output &&
+	grep "bloom_indexes bloom_data" output &&
+	log_both -- D/file4
+'
+
+test_expect_success '--no-changed-paths drops the filters' '
+	git commit-graph write --reachable --no-changed-paths &&
+	git commit-graph read >output &&
+	! grep bloom output &&
+	log_both -- A/B
+'
+
+test_expect_success 'commits with too many changes get a filter matching all' '
+	mkdir many &&
+	for i in $(test_seq 1 600)
+	do
+		echo $i >many/$i || return 1
+	done &&
+	git add many &&
+	git commit -m many &&
+	git commit-graph write --reachable --changed-paths &&
+	log_both -- many/17 &&
+	log_both -- A/file1 &&
+	log_both -- nothing/here
+'
+
+test_done
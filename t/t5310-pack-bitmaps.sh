@@ -49,31 +49,31 @@ rev_list_tests() {
 	state=$1
 
 	test_expect_success "counting commits via bitmap ($state)" '
-		git rev-list --count HEAD >expect &&
+		git -c pack.useBitmaps=false rev-list --count HEAD >expect &&
 		git rev-list --use-bitmap-index --count HEAD >actual &&
 		test_cmp expect actual
 	'
 
 	test_expect_success "counting partial commits via bitmap ($state)" '
-		git rev-list --count HEAD~5..HEAD >expect &&
+		git -c pack.useBitmaps=false rev-list --count HEAD~5..HEAD >expect &&
 		git rev-list --use-bitmap-index --count HEAD~5..HEAD >actual &&
 		test_cmp expect actual
 	'
 
 	test_expect_success "counting commits with limit ($state)" '
-		git rev-list --count -n 1 HEAD >expect &&
+		git -c pack.useBitmaps=false rev-list --count -n 1 HEAD >expect &&
 		git rev-list --use-bitmap-index --count -n 1 HEAD >actual &&
 		test_cmp expect actual
 	'
 
 	test_expect_success "counting non-linear history ($state)" '
-		git rev-list --count other...master >expect &&
+		git -c pack.useBitmaps=false rev-list --count other...master >expect &&
 		git rev-list --use-bitmap-index --count other...master >actual &&
 		test_cmp expect actual
 	'
 
 	test_expect_success "counting commits with limiting ($state)" '
-		git rev-list --count HEAD -- 1.t >expect &&
+		git -c pack.useBitmaps=false rev-list --count HEAD -- 1.t >expect &&
 		git rev-list --use-bitmap-index --count HEAD -- 1.t >actual &&
 		test_cmp expect actual
 	'
@@ -92,6 +92,48 @@ rev_list_tests() {
 		git rev-list --objects --use-bitmap-index HEAD tagged-blob >actual &&
 		grep $blob actual
 	'
+
+	test_expect_success "counting with reachability bitmaps ($state)" '
+		for range in "HEAD" "other" "master other" "other..master" \
+			     "master..other" "other...master" "^other master~2" \
+			     "-n 3 master" "$bitmaptip..HEAD" "--all" \
+			     "--no-merges HEAD" "--first-parent HEAD"
+		do
+			git -c pack.useBitmaps=false rev-list --count $range >expect &&
+			git rev-list --count $range >actual &&
+			test_cmp expect actual || return 1
+		done
+	'
+
+	test_expect_success "branch --merged with reachability bitmaps ($state)" '
+		git branch merged-5 HEAD~5 &&
+		git branch side-5 other~5 &&
+		for commit in master other HEAD~3 other~2 $bitmaptip
+		do
+			git -c pack.useBitmaps=false branch --merged $commit >expect &&
+			git branch --merged $commit >actual &&
+			test_cmp expect actual &&
+			git -c pack.useBitmaps=false branch --no-merged $commit >expect &&
+			git branch --no-merged $commit >actual &&
+			test_cmp expect actual || return 1
+		done &&
+		git branch -D merged-5 side-5
+	'
+
+	test_expect_success "tag --contains with reachability bitmaps ($state)" '
+		for commit in master~4 other~3 side-5 5 $bitmaptip
+		do
+			git -c pack.useBitmaps=false tag --contains $commit >expect &&
+			git tag --contains $commit >actual &&
+			test_cmp expect actual &&
+			git -c pack.useBitmaps=false tag --no-contains $commit >expect &&
+			git tag --no-contains $commit >actual &&
+			test_cmp expect actual &&
+			git -c pack.useBitmaps=false for-each-ref --contains $commit >expect &&
+			git for-each-ref --contains $commit >actual &&
+			test_cmp expect actual || return 1
+		done
+	'
 }
 
 rev_list_tests 'full bitmap'
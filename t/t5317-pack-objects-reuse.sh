@@ -0,0 +1,69 @@
+#!/bin/sh
+
+test_description='pack-objects sends objects of the bitmapped pack verbatim'
+. ./test-lib.sh
+
+# pack_and_check <rev-list-args>: pack what "rev-list <args>" wants
+# to "got.pack" with progress in "err", and check that it is complete
+pack_and_check () {
+	git rev-list --objects "$@" | cut -d" " -f1 | sort >expect &&
+	git rev-parse "$@" |
+	git pack-objects --stdout --revs --delta-base-offset \
+		--progress >got.pack 2>err &&
+	rm -f got.idx &&
+	git index-pack --strict -o got.idx got.pack &&
+	git show-index <got.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+}
+
+pack_reused () {
+	sed -n "s/.*pack-reused \([0-9]*\).*/\1/p" err
+}
+
+test_expect_success 'setup bitmapped pack with deltas' '
+	test-genrandom seed 16384 >file &&
+	git add file &&
+	test_commit base &&
+	for i in $(test_seq 1 40)
+	do
+		test-genrandom seed-$i 64 >>file &&
+		git add file &&
+		test_commit master-$i || return 1
+	done &&
+	git checkout -b other master-20 &&
+	for i in $(test_seq 1 40)
+	do
+		test-genrandom other-$i 64 >>file &&
+		git add file &&
+		test_commit other-$i || return 1
+	done &&
+	git checkout master &&
+	git repack -adb &&
+	git verify-pack -v .git/objects/pack/*.pack >verify &&
+	grep " [0-9]* [0-9]* [0-9]* 1 " verify
+'
+
+test_expect_success 'whole pack is reused' '
+	pack_and_check --all &&
+	test $(pack_reused) = $(wc -l <expect)
+'
+
+test_expect_success 'objects of one branch are reused' '
+	pack_and_check master &&
+	test $(pack_reused) -gt 0 &&
+	git verify-pack -v got.pack >verify &&
+	grep " [0-9]* [0-9]* [0-9]* 1 " verify
+'
+
+test_expect_success 'objects reused for a fetch with haves' '
+	pack_and_check other ^master-30 &&
+	test $(pack_reused) -gt 0
+'
+
+test_expect_success 'pack.allowPackReuse=false sends all objects afresh' '
+	test_config pack.allowPackReuse false &&
+	pack_and_check master &&
+	! grep pack-reused err
+'
+
+test_done
@@ -0,0 +1,229 @@
+#!/bin/sh
+
+test_description='multi-pack-indexes'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_read_expect () {
+	NUM_PACKS=$1
+	NUM_OBJECTS=$2
+	{
+		cat <<-EOF &&
+		header: 4d494458 1 1 4 0
+		num_packs: $NUM_PACKS
+		num_objects: $NUM_OBJECTS
+		chunks: pack_names oid_fanout oid_lookup object_offsets
+		packs:
+		EOF
+		ls $objdir/pack | grep "\.idx$" | sort
+	} >expect &&
+	git multi-pack-index read >actual &&
+	test_cmp expect actual
+}
+
+midx_git_two_modes () {
+	INPUT=${2:-/dev/null}
+	git -c core.multiPackIndex=false $1 <"$INPUT" >expect &&
+	git -c core.multiPackIndex=true $1 <"$INPUT" >actual &&
+	test_cmp expect actual
+}
+
+compare_results_with_midx () {
+	MSG=$1
+	test_expect_success "check normal git operations: $MSG" '
+		git rev-list --objects --all >obj-list &&
+		midx_git_two_modes "rev-list --objects --all" &&
+		midx_git_two_modes "log --raw" &&
+		midx_git_two_modes "cat-file --batch-check --buffer" obj-list &&
+		midx_git_two_modes "cat-file --batch --buffer" obj-list
+	'
+}
+
+test_expect_success 'write midx with no packs' '
+	git multi-pack-index write &&
+	test_path_is_missing $objdir/pack/multi-pack-index
+'
+
+generate_objects () {
+	i=$1
+	iii=$(printf '%03i' $i)
+	{
+		test-genrandom "bar" 200 &&
+		test-genrandom "baz $iii" 50
+	} >wide_delta_$iii &&
+	{
+		test-genrandom "foo"$i 100 &&
+		test-genrandom "foo"$(( $i + 1 )) 100 &&
+		test-genrandom "foo"$(( $i + 2 )) 100
+	} >deep_delta_$iii &&
+	echo $iii >file_$iii &&
+	test-genrandom "$iii" 8192 >>file_$iii &&
+	git update-index --add file_$iii deep_delta_$iii wide_delta_$iii &&
+	i=$(( $i + 1 ))
+}
+
+commit_and_list_objects () {
+	{
+		echo 101 &&
+		test-genrandom 100 8192;
+	} >file_101 &&
+	git update-index --add file_101 &&
+	tree=$(git write-tree) &&
+	commit=$(git commit-tree $tree -p HEAD</dev/null) &&
+	{
+		echo $tree &&
+		git ls-tree $tree | sed -e "s/.* \\([0-9a-f]*\\)	.*/\\1/"
+	} >obj-list &&
+	git reset --hard $commit
+}
+
+test_expect_success 'create objects' '
+	test_commit initial &&
+	for i in $(test_seq 1 5)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'write midx with one v1 pack' '
+	pack=$(git pack-objects --index-version=1 $objdir/pack/test <obj-list) &&
+	test_when_finished rm $objdir/pack/test-$pack.pack \
+		$objdir/pack/test-$pack.idx $objdir/pack/multi-pack-index &&
+	git multi-pack-index write &&
+	midx_read_expect 1 18
+'
+
+test_expect_success 'write midx with one v2 pack' '
+	git pack-objects --index-version=2,0x40 $objdir/pack/test <obj-list &&
+	git multi-pack-index write &&
+	midx_read_expect 1 18
+'
+
+compare_results_with_midx "one v2 pack"
+
+test_expect_success 'add more objects' '
+	for i in $(test_seq 6 10)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'write midx with two packs' '
+	git pack-objects --index-version=1 $objdir/pack/test-2 <obj-list &&
+	git multi-pack-index write &&
+	midx_read_expect 2 34
+'
+
+compare_results_with_midx "two packs"
+
+test_expect_success 'add more packs' '
+	for j in $(test_seq 11 20)
+	do
+		generate_objects $j &&
+		commit_and_list_objects &&
+		git pack-objects --index-version=2 $objdir/pack/test-pack <obj-list
+	done
+'
+
+compare_results_with_midx "mixed mode (two packs + extra)"
+
+test_expect_success 'write midx with twelve packs' '
+	git multi-pack-index write &&
+	midx_read_expect 12 74
+'
+
+compare_results_with_midx "twelve packs"
+
+test_expect_success 'rewriting the midx from scratch gives the same file' '
+	cp $objdir/pack/multi-pack-index midx-incremental &&
+	rm $objdir/pack/multi-pack-index &&
+	git multi-pack-index write &&
+	test_cmp midx-incremental $objdir/pack/multi-pack-index
+'
+
+test_expect_success 'midx does not count as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'lookups fall back when a pack in the midx is gone' '
+	git rev-parse HEAD:file_101 >blob &&
+	# the only copy of these objects is in the packs we remove
+	git pack-objects $objdir/pack/extra <blob >extra &&
+	git multi-pack-index write &&
+	git cat-file -p HEAD:file_101 >expect &&
+	test_when_finished "rm -f $objdir/pack/extra-*" &&
+	mv $objdir/pack/extra-$(cat extra).pack extra.pack &&
+	git cat-file -p HEAD:file_101 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt midx is ignored' '
+	cp $objdir/pack/multi-pack-index midx-backup &&
+	test_when_finished "mv -f midx-backup $objdir/pack/multi-pack-index" &&
+	chmod u+w $objdir/pack/multi-pack-index &&
+	printf "XXXX" | dd of=$objdir/pack/multi-pack-index bs=1 count=4 conv=notrunc &&
+	git rev-list --objects --all >actual 2>err &&
+	test_i18ngrep "multi-pack-index file .* is corrupt" err &&
+	git -c core.multiPackIndex=false rev-list --objects --all >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'covered packs are read without their .idx' '
+	git rev-list --objects --all >expect &&
+	rm -rf covered.git &&
+	cp -R .git covered.git &&
+	git --git-dir=covered.git multi-pack-index write &&
+	git --git-dir=covered.git prune-packed &&
+	for idx in covered.git/objects/pack/*.idx
+	do
+		rm -f $idx &&
+		echo garbage >$idx || return 1
+	done &&
+	git --git-dir=covered.git rev-list --objects --all >actual &&
+	test_cmp expect actual &&
+	git --git-dir=covered.git cat-file -p HEAD:file_101 >actual &&
+	test_cmp file_101 actual &&
+	test_must_fail git --git-dir=covered.git \
+		-c core.multiPackIndex=false cat-file -p HEAD:file_101
+'
+
+test_expect_success 'objects of a deleted pack stay reachable via other packs' '
+	rm -rf dup &&
+	git init dup &&
+	(
+		cd dup &&
+		test_commit one &&
+		git repack -ad &&
+		old=$(ls .git/objects/pack/*.pack) &&
+		>${old%.pack}.keep &&
+		test-chmtime =-60 $old &&
+		test_commit two &&
+		git rev-list --objects --all |
+		git pack-objects .git/objects/pack/pack &&
+		git multi-pack-index write &&
+		git repack -a -d &&
+		git cat-file -t HEAD &&
+		git -c core.multiPackIndex=false rev-list --objects --all >expect &&
+		git rev-list --objects --all >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'repack updates an existing midx' '
+	git repack -adf &&
+	midx_read_expect 1 $(git rev-list --objects --all | wc -l)
+'
+
+compare_results_with_midx "after repack"
+
+test_expect_success 'repack does not create a midx' '
+	rm $objdir/pack/multi-pack-index &&
+	git repack -ad &&
+	test_path_is_missing $objdir/pack/multi-pack-index
+'
+
+test_done
@@ -0,0 +1,100 @@
+#!/bin/sh
+
+test_description='exercise delta islands'
+. ./test-lib.sh
+
+# returns true iff $1 is a delta based on $2
+is_delta_base () {
+	delta_base=$(echo "$1" | git cat-file --batch-check='%(deltabase)') &&
+	echo >&2 "$1 has base $delta_base" &&
+	test "$2" = "$delta_base"
+}
+
+# generate a commit on branch $1 with a single file, "dir/file", whose
+# content is mostly based on the seed $2, but with a unique bit of
+# content $3 appended. This should allow us to see whether blobs of
+# different refs delta against each other.
+commit() {
+	blob=$({ test-genrandom "$2" 10240 && echo "$3"; } |
+	       git hash-object -w --stdin) &&
+	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+	tree=$(printf "040000 tree $tree\tdir\n" | git mktree) &&
+	commit=$(echo "$2-$3" | git commit-tree $tree ${4:+-p "$4"}) &&
+	git update-ref "refs/heads/$1" "$commit" &&
+	eval "$1"'=$(git rev-parse $1:dir/file)' &&
+	echo "$1: $commit ($blob)"
+}
+
+test_expect_success 'setup commits' '
+	commit one seed 1 &&
+	commit two seed 12
+'
+
+# Note: This is heavily dependent on the "prefer larger objects as base"
+# heuristic.
+test_expect_success 'vanilla repack deltas one against two' '
+	git repack -adf &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'island repack with no island definition is vanilla' '
+	git repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'island repack with no matches is vanilla' '
+	git -c "pack.island=refs/foo" repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'separate islands disallows delta' '
+	git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+	! is_delta_base $one $two &&
+	! is_delta_base $two $one
+'
+
+test_expect_success 'same island allows delta' '
+	git -c "pack.island=refs/heads" repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'coalesce same-named islands' '
+	git \
+		-c "pack.island=refs/(.*)/one" \
+		-c "pack.island=refs/(.*)/two" \
+		repack -adfi &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'island restrictions drop reused deltas' '
+	git repack -adfi &&
+	is_delta_base $one $two &&
+	git -c "pack.island=refs/heads/(.*)" repack -adi &&
+	! is_delta_base $one $two &&
+	! is_delta_base $two $one
+'
+
+test_expect_success 'islands can be disabled' '
+	git -c "pack.island=refs/heads/(.*)" repack -adf &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'repack.useDeltaIslands enables islands' '
+	git -c "pack.island=refs/heads/(.*)" -c repack.useDeltaIslands=true \
+		repack -adf &&
+	! is_delta_base $one $two &&
+	! is_delta_base $two $one
+'
+
+test_expect_success 'island repack keeps all objects' '
+	git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+	git fsck
+'
+
+test_expect_success 'bases may be reachable from more islands than targets' '
+	commit three seed "" refs/heads/one &&
+	git -c "pack.island=refs/heads/(.*)" repack -adfi &&
+	is_delta_base $three $one
+'
+
+test_done
@@ -0,0 +1,171 @@
+#!/bin/sh
+
+test_description='delta base cache shared between processes'
+. ./test-lib.sh
+
+cache=.git/objects/info/delta-base-cache
+
+modebits () {
+	ls -l "$1" | sed -e "s|^\(..........\).*|\1|"
+}
+
+# damage_slots <field>: make the given field of every used slot bogus
+damage_slots () {
+	"$PERL_PATH" -e '
+		my ($file, $field) = @ARGV;
+		open(my $fh, "+<", $file) or die;
+		binmode $fh;
+		local $/;
+		my $map = <$fh>;
+		my $nr = unpack("L", substr($map, 8, 4));
+		my ($ds, $head) = unpack("QQ", substr($map, 16, 16));
+		my $used = 0;
+		for my $i (0..$nr - 1) {
+			my $slot = 40 + 64 * $i;
+			next unless unpack("L", substr($map, $slot + 20, 4));
+			if ($field eq "type") {
+				substr($map, $slot + 20, 4) = pack("L", 7);
+			} elsif ($field eq "size") {
+				substr($map, $slot + 40, 8) = pack("Q", 1 << 40);
+			} else {
+				# last byte of the ring, within reach of "head"
+				my $pos = $head - $head % $ds - 1;
+				substr($map, $slot + 32, 8) = pack("Q", $pos);
+			}
+			$used++;
+		}
+		die "no used slots" unless $used;
+		seek($fh, 0, 0);
+		print $fh $map;
+	' $cache "$1"
+}
+
+test_expect_success 'setup packed deltas' '
+	test-genrandom seed 16384 >file &&
+	git add file &&
+	test_commit base &&
+	for i in $(test_seq 1 10)
+	do
+		test-genrandom seed-$i 256 >>file &&
+		git add file &&
+		test_commit delta-$i || return 1
+	done &&
+	git repack -ad &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch <objects >expect
+'
+
+test_expect_success 'cache is not used by default' '
+	git cat-file --batch <objects >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing $cache
+'
+
+test_expect_success 'first process fills the cache' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	GIT_TRACE_SHARED_DELTA_CACHE="$(pwd)/trace" \
+		git cat-file --batch <objects >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $cache &&
+	grep "^add " trace &&
+	! grep "^hit " trace
+'
+
+test_expect_success 'next process finds the bases in the cache' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	rm -f trace &&
+	GIT_TRACE_SHARED_DELTA_CACHE="$(pwd)/trace" \
+		git -c core.deltaBaseCacheLimit=0 cat-file --batch <objects >actual &&
+	test_cmp expect actual &&
+	grep "^hit " trace
+'
+
+test_expect_success 'damaged cache data is not used' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	test-genrandom garbage 1048576 >garbage &&
+	size=$(wc -c <$cache) &&
+	dd if=garbage of=$cache bs=1 seek=$(($size - 1048576)) \
+		conv=notrunc 2>/dev/null &&
+	rm -f trace &&
+	GIT_TRACE_SHARED_DELTA_CACHE="$(pwd)/trace" \
+		git -c core.deltaBaseCacheLimit=0 cat-file --batch <objects >actual &&
+	test_cmp expect actual &&
+	grep "^bad " trace &&
+	for field in type size pos
+	do
+		git -c core.deltaBaseCacheLimit=0 cat-file --batch <objects >actual &&
+		damage_slots $field &&
+		rm -f trace &&
+		GIT_TRACE_SHARED_DELTA_CACHE="$(pwd)/trace" \
+			git -c core.deltaBaseCacheLimit=0 cat-file --batch <objects >actual &&
+		test_cmp expect actual &&
+		# only what this process stored again may be hit
+		awk "/^add /  { added[\$2 \" \" \$3] = 1 }
+		     /^hit / && !added[\$2 \" \" \$3] { exit 1 }" trace ||
+		return 1
+	done
+'
+
+test_expect_success 'a pack changed in place is not served from the cache' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	git -c core.deltaBaseCacheLimit=0 cat-file --batch <objects >actual &&
+	pack=$(echo .git/objects/pack/pack-*.pack) &&
+	chmod +w $pack &&
+	test-chmtime +10 $pack &&
+	rm -f trace &&
+	GIT_TRACE_SHARED_DELTA_CACHE="$(pwd)/trace" \
+		git cat-file --batch <objects >actual &&
+	test_cmp expect actual &&
+	grep "^add " trace &&
+	! grep "^hit " trace
+'
+
+test_expect_success 'repacking locally does not copy data from the cache' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	base=$(git rev-parse HEAD:file) &&
+	idx=$(echo .git/objects/pack/pack-*.idx) &&
+	ofs=$(git show-index <$idx | sed -n "s/^\([0-9]*\) $base .*/\1/p") &&
+	rm -f trace &&
+	GIT_TRACE_SHARED_DELTA_CACHE="$(pwd)/trace" \
+		git -c core.deltaBaseCacheLimit=0 cat-file --batch <objects >actual &&
+	grep "^hit .* $ofs$" trace &&
+	rm -f trace &&
+	GIT_TRACE_SHARED_DELTA_CACHE="$(pwd)/trace" \
+		git -c core.deltaBaseCacheLimit=0 repack -adf &&
+	! grep " $ofs$" trace &&
+	git cat-file --batch <objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success POSIXPERM 'the cache gets the permissions of the repository' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	rm -f $cache &&
+	(umask 022 && git cat-file --batch <objects >actual) &&
+	test_cmp expect actual &&
+	test "$(modebits $cache)" = "-rw-------" &&
+	rm -f $cache &&
+	test_config core.sharedRepository group &&
+	(umask 022 && git cat-file --batch <objects >actual) &&
+	test "$(modebits $cache)" = "-rw-rw----"
+'
+
+test_expect_success 'core.sharedDeltaBaseCacheFile names the cache' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	test_config core.sharedDeltaBaseCacheFile "$(pwd)/other-cache" &&
+	git cat-file --batch <objects >actual &&
+	test_cmp expect actual &&
+	test_path_is_file other-cache
+'
+
+test_expect_success 'a file that is not a cache is left alone' '
+	test_config core.sharedDeltaBaseCacheLimit 1m &&
+	test_config core.sharedDeltaBaseCacheFile "$(pwd)/not-a-cache" &&
+	echo junk >not-a-cache &&
+	git cat-file --batch <objects >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "not a delta base cache" err &&
+	echo junk >expect.junk &&
+	test_cmp expect.junk not-a-cache
+'
+
+test_done
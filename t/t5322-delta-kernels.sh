@@ -0,0 +1,49 @@
+#!/bin/sh
+
+test_description='diff-delta gives the same deltas whatever helpers it uses'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6
+	do
+		test-genrandom piece-$i 3000 >piece$i || return 1
+	done &&
+	cat piece1 piece2 piece3 piece4 piece5 >base &&
+	cat piece2 piece1 piece3 piece5 piece4 >swapped &&
+	cat piece1 piece6 piece2 piece3 piece4 piece5 >inserted &&
+	cat piece1 piece3 piece5 >removed &&
+	"$PERL_PATH" -pe "s/\x41/\x42/g" <base >sprinkled &&
+	cat base base base >repeated &&
+	test_seq 1 3000 >text &&
+	sed -e "s/7/seven/" -e "/3$/d" <text >text2 &&
+	test-genrandom other 10000 >unrelated &&
+	printf "x" >tiny
+'
+
+test_expect_success 'all helpers give the same deltas' '
+	test-delta-bench --rounds=1 base \
+		swapped inserted removed sprinkled repeated unrelated tiny >out &&
+	test_line_count -gt 0 out &&
+	test-delta-bench --rounds=1 text text2 base &&
+	test-delta-bench --rounds=1 tiny base
+'
+
+test_expect_success 'deltas can be applied' '
+	for f in swapped inserted removed sprinkled repeated unrelated tiny
+	do
+		test-delta -d base $f delta &&
+		test-delta -p base delta actual &&
+		test_cmp $f actual || return 1
+	done &&
+	test-delta -d text text2 delta &&
+	test-delta -p text delta actual &&
+	test_cmp text2 actual
+'
+
+test_expect_success 'plain C helpers are always available' '
+	test-delta-bench --rounds=1 --kernel=scalar base inserted >out &&
+	grep "^scalar " out &&
+	test_must_fail test-delta-bench --kernel=none base inserted
+'
+
+test_done
@@ -1613,4 +1613,26 @@ test_expect_success 'updateInstead with push-to-checkout hook' '
 	)
 '
 
+test_expect_success 'batched push applies the refs that can be updated' '
+	mk_empty testrepo &&
+	git -C testrepo config core.batchRefUpdates 3 &&
+	git push testrepo master:refs/heads/df &&
+	git push testrepo refs/heads/master:refs/heads/b1 \
+		master:refs/heads/b2 master:refs/heads/b3 &&
+	test_path_is_missing testrepo/.git/refs/heads/b1 &&
+	test_must_fail git push testrepo master:refs/heads/b4 \
+		master:refs/heads/df/sub master:refs/heads/b5 \
+		:refs/heads/b1 2>err &&
+	grep "df/sub" err &&
+	git rev-parse master >expect &&
+	for ref in b2 b3 b4 b5 df
+	do
+		git -C testrepo rev-parse refs/heads/$ref || return 1
+	done >actual.all &&
+	test_line_count = 5 actual.all &&
+	test $(sort -u actual.all) = $(cat expect) &&
+	test_must_fail git -C testrepo rev-parse --verify -q refs/heads/b1 &&
+	test_must_fail git -C testrepo rev-parse --verify -q refs/heads/df/sub
+'
+
 test_done
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='upload-pack replays cached packs'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	write_script .git/hook <<-\EOF &&
+		echo >&2 "hook running"
+		exec "$@"
+	EOF
+	git config --global uploadpack.packObjectsHook ./hook &&
+	git config uploadpack.packCacheLimit 1m
+'
+
+cached_packs () {
+	ls .git/upload-pack-cache/*.pack 2>/dev/null | wc -l
+}
+
+test_expect_success 'first clone creates the pack and caches it' '
+	git clone --no-local --bare . first.git 2>stderr &&
+	grep "hook running" stderr &&
+	test $(cached_packs) = 1 &&
+	git -C first.git fsck
+'
+
+test_expect_success 'identical clone replays the cached pack' '
+	git clone --no-local --bare . second.git 2>stderr &&
+	! grep "hook running" stderr &&
+	test $(cached_packs) = 1 &&
+	git -C second.git fsck &&
+	git -C first.git for-each-ref >expect &&
+	git -C second.git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'ref update invalidates the cache' '
+	test_commit three &&
+	git clone --no-local --bare . third.git 2>stderr &&
+	grep "hook running" stderr &&
+	test $(cached_packs) = 2 &&
+	git -C third.git rev-parse --verify three
+'
+
+test_expect_success 'fetch with haves does not use the clone pack' '
+	git -C first.git fetch origin "+refs/heads/*:refs/heads/*" 2>stderr &&
+	grep "hook running" stderr &&
+	git -C first.git rev-parse --verify master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'packs over the limit are not cached' '
+	rm -rf .git/upload-pack-cache &&
+	git config uploadpack.packCacheLimit 100 &&
+	git clone --no-local --bare . fourth.git 2>stderr &&
+	grep "hook running" stderr &&
+	test $(cached_packs) = 0
+'
+
+test_expect_success 'least recently used packs are evicted' '
+	rm -rf .git/upload-pack-cache &&
+	git config uploadpack.packCacheLimit 1m &&
+	git clone --no-local --bare . fifth.git &&
+	old=$(ls .git/upload-pack-cache/*.pack) &&
+	size=$(wc -c <"$old") &&
+	test-chmtime -100 "$old" &&
+	git config uploadpack.packCacheLimit $((2 * $size + 10)) &&
+	test_commit four &&
+	git clone --no-local --bare . sixth.git &&
+	test $(cached_packs) = 1 &&
+	test_path_is_missing "$old"
+'
+
+test_done
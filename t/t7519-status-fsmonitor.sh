@@ -0,0 +1,256 @@
+#!/bin/sh
+
+test_description='git status with file system watcher'
+
+. ./test-lib.sh
+
+# Note, after "git reset --hard HEAD" no extensions exist other than 'TREE'
+# "git update-index --fsmonitor" can be used to get the extension written
+# before testing the results.
+
+clean_repo () {
+	git reset --hard HEAD &&
+	git clean -fd
+}
+
+dirty_repo () {
+	: >untracked &&
+	: >dir1/untracked &&
+	: >dir2/untracked &&
+	echo 1 >modified &&
+	echo 2 >dir1/modified &&
+	echo 3 >dir2/modified &&
+	echo 4 >new &&
+	echo 5 >dir1/new &&
+	echo 6 >dir2/new
+}
+
+# The fake monitor reports the paths listed, one per line, in
+# ".git/fsmonitor-changes" as NUL-terminated paths, and records the
+# arguments it was called with in ".git/fsmonitor-args".
+write_integration_script () {
+	write_script .git/hooks/fsmonitor-test <<-\EOF
+	if test "$#" -ne 2
+	then
+		echo "$0: exactly 2 arguments expected" >&2
+		exit 2
+	fi
+	if test "$1" != 1
+	then
+		echo "Unsupported core.fsmonitor hook version." >&2
+		exit 1
+	fi
+	echo "$*" >.git/fsmonitor-args
+	if test -f .git/fsmonitor-changes
+	then
+		tr "\n" "\0" <.git/fsmonitor-changes
+	fi
+	EOF
+}
+
+test_expect_success 'setup' '
+	mkdir -p .git/hooks &&
+	: >tracked &&
+	: >modified &&
+	mkdir dir1 &&
+	: >dir1/tracked &&
+	: >dir1/modified &&
+	mkdir dir2 &&
+	: >dir2/tracked &&
+	: >dir2/modified &&
+	git add . &&
+	git commit -m initial &&
+	write_integration_script &&
+	git config core.fsmonitor .git/hooks/fsmonitor-test &&
+	cat >.gitignore <<-\EOF
+	.gitignore
+	expect*
+	actual*
+	dump*
+	EOF
+'
+
+test_expect_success 'update-index --fsmonitor adds the fsmonitor extension' '
+	git update-index --fsmonitor &&
+	test-dump-fsmonitor >actual &&
+	grep "^fsmonitor last update" actual
+'
+
+test_expect_success 'update-index --no-fsmonitor removes the fsmonitor extension' '
+	git -c core.fsmonitor= update-index --no-fsmonitor &&
+	test-dump-fsmonitor >actual &&
+	echo "no fsmonitor" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'update-index --fsmonitor-valid sets the fsmonitor valid bit' '
+	cat >expect <<-\EOF &&
+	h dir1/modified
+	H dir1/tracked
+	h dir2/modified
+	H dir2/tracked
+	h modified
+	H tracked
+	EOF
+	git update-index --fsmonitor &&
+	git update-index --fsmonitor-valid dir1/modified dir2/modified modified &&
+	git ls-files -f >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'update-index --no-fsmonitor-valid clears the fsmonitor valid bit' '
+	cat >expect <<-\EOF &&
+	H dir1/modified
+	H dir1/tracked
+	H dir2/modified
+	H dir2/tracked
+	H modified
+	H tracked
+	EOF
+	git update-index --no-fsmonitor-valid dir1/modified dir2/modified modified &&
+	git ls-files -f >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the valid bits are stored in the index extension' '
+	git update-index --fsmonitor-valid modified &&
+	test-dump-fsmonitor >actual &&
+	grep "^+ modified$" actual &&
+	grep "^- tracked$" actual
+'
+
+test_expect_success 'the hook is called with the version and the last update' '
+	rm -f .git/fsmonitor-args &&
+	test-dump-fsmonitor >dump &&
+	last=$(sed -ne "s/^fsmonitor last update //p" dump) &&
+	git status >/dev/null &&
+	echo "1 $last" >expect &&
+	test_cmp expect .git/fsmonitor-args
+'
+
+test_expect_success 'refresh trusts entries the monitor did not report' '
+	clean_repo &&
+	git update-index --fsmonitor &&
+	git status >/dev/null &&
+	# change a file behind the back of the monitor
+	echo changed >modified &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'refresh checks the entries the monitor reported' '
+	test_when_finished "rm -f .git/fsmonitor-changes" &&
+	echo modified >.git/fsmonitor-changes &&
+	git status --porcelain --untracked-files=no >actual &&
+	echo " M modified" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a "/" from the monitor invalidates everything' '
+	test_when_finished "rm -f .git/fsmonitor-changes" &&
+	clean_repo &&
+	git update-index --fsmonitor &&
+	git status >/dev/null &&
+	echo changed >dir1/modified &&
+	echo / >.git/fsmonitor-changes &&
+	git status --porcelain --untracked-files=no >actual &&
+	echo " M dir1/modified" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a failing monitor invalidates everything' '
+	clean_repo &&
+	git update-index --fsmonitor &&
+	git status >/dev/null &&
+	echo changed >dir2/modified &&
+	git -c core.fsmonitor=false status --porcelain --untracked-files=no >actual &&
+	echo " M dir2/modified" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '--really-refresh ignores the fsmonitor valid bit' '
+	clean_repo &&
+	git update-index --fsmonitor &&
+	git status >/dev/null &&
+	echo changed >modified &&
+	test_must_fail git update-index --really-refresh >actual &&
+	grep "^modified: needs update" actual
+'
+
+# Make the same changes with and without the fake monitor reporting
+# them, and make sure the results agree.
+for preload_val in false true
+do
+	test_expect_success "setup preloadIndex to $preload_val" '
+		git config core.preloadIndex $preload_val &&
+		if test $preload_val = true
+		then
+			GIT_FORCE_PRELOAD_TEST=$preload_val; export GIT_FORCE_PRELOAD_TEST
+		else
+			sane_unset GIT_FORCE_PRELOAD_TEST
+		fi
+	'
+
+	for uc_val in false true
+	do
+		test_expect_success "setup untracked cache to $uc_val" '
+			git config core.untrackedcache $uc_val
+		'
+
+		test_expect_success "status detects reported modifications (preload $preload_val, uc $uc_val)" '
+			test_when_finished "rm -f .git/fsmonitor-changes" &&
+			clean_repo &&
+			git update-index --fsmonitor &&
+			git status >/dev/null &&
+			dirty_repo &&
+			cat >.git/fsmonitor-changes <<-\EOF &&
+			untracked
+			dir1/untracked
+			dir2/untracked
+			modified
+			dir1/modified
+			dir2/modified
+			new
+			dir1/new
+			dir2/new
+			EOF
+			git status --porcelain >actual &&
+			git -c core.fsmonitor= status --porcelain >expect &&
+			test_cmp expect actual
+		'
+
+		test_expect_success "status detects deleted files (preload $preload_val, uc $uc_val)" '
+			test_when_finished "rm -f .git/fsmonitor-changes" &&
+			clean_repo &&
+			git update-index --fsmonitor &&
+			git status >/dev/null &&
+			rm dir1/tracked &&
+			echo dir1/tracked >.git/fsmonitor-changes &&
+			git status --porcelain >actual &&
+			git -c core.fsmonitor= status --porcelain >expect &&
+			test_cmp expect actual
+		'
+	done
+done
+
+test_expect_success 'status is correct with the fsmonitor-all hook' '
+	clean_repo &&
+	dirty_repo &&
+	git config core.fsmonitor "$TEST_DIRECTORY/t7519/fsmonitor-all" &&
+	git update-index --fsmonitor &&
+	git status --porcelain >actual &&
+	git -c core.fsmonitor= status --porcelain >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unreported changes are missed with the fsmonitor-none hook' '
+	clean_repo &&
+	git config core.fsmonitor "$TEST_DIRECTORY/t7519/fsmonitor-none" &&
+	git update-index --fsmonitor &&
+	git status >/dev/null &&
+	echo changed >modified &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_must_be_empty actual
+'
+
+test_done
@@ -0,0 +1,142 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+# create_pack <tag> <n>: write a pack of <n> new blobs
+create_pack () {
+	for i in $(test_seq $2)
+	do
+		printf "blob\ndata <<EOF\n%s %s\nEOF\n" "$1" "$i" || return 1
+	done | git -c fastimport.unpackLimit=0 fast-import --quiet
+}
+
+# pack_sizes: print the number of objects in each pack, smallest first
+pack_sizes () {
+	for idx in $packdir/*.idx
+	do
+		git show-index <$idx | wc -l || return 1
+	done | sort -n | sed "s/ //g"
+}
+
+test_expect_success '--geometric with no packs' '
+	git init empty &&
+	(
+		cd empty &&
+		git repack --geometric=2 -d >out &&
+		test_i18ngrep "Nothing new" out
+	)
+'
+
+test_expect_success '--geometric leaves a progression alone' '
+	create_pack a 3 &&
+	create_pack b 6 &&
+	create_pack c 12 &&
+	ls $packdir >expect &&
+	git repack --geometric=2 -d &&
+	ls $packdir >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--geometric rolls up the small packs' '
+	rm -f $packdir/* &&
+	create_pack big 100 &&
+	big=$(ls $packdir/*.pack) &&
+	create_pack mid 10 &&
+	create_pack small1 3 &&
+	create_pack small2 3 &&
+	git repack --geometric=2 -d &&
+	test_path_is_file $big &&
+	printf "16\n100\n" >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	git cat-file --batch-all-objects --batch-check >objects &&
+	test_line_count = 116 objects
+'
+
+test_expect_success '--geometric packs loose objects' '
+	for i in $(test_seq 5)
+	do
+		echo loose $i | git hash-object -w --stdin || return 1
+	done &&
+	git repack --geometric=2 -d &&
+	git count-objects -v >count &&
+	grep "^count: 0" count &&
+	printf "5\n16\n100\n" >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	ls $packdir >before &&
+	git repack --geometric=2 -d &&
+	ls $packdir >after &&
+	test_cmp before after
+'
+
+test_expect_success '--geometric leaves kept packs alone' '
+	small=$(ls -S $packdir/*.pack | tail -n 1) &&
+	touch ${small%.pack}.keep &&
+	create_pack more 4 &&
+	git repack --geometric=2 -d &&
+	test_path_is_file $small &&
+	printf "4\n5\n16\n100\n" >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects --stdin-packs skips excluded objects' '
+	git init stdin-packs &&
+	(
+		cd stdin-packs &&
+		create_pack a 5 &&
+		a=$(basename $packdir/*.pack) &&
+		create_pack b 5 &&
+		echo "b 1" | git hash-object -w --stdin &&
+		git pack-objects --stdin-packs $packdir/pack 2>err <<-EOF &&
+		$(basename $(ls $packdir/*.pack | grep -v $a))
+		^$a
+		EOF
+		test_must_fail git pack-objects --stdin-packs \
+			$packdir/pack </dev/null 2>err --revs &&
+		test_i18ngrep "cannot be used" err
+	)
+'
+
+test_expect_success '--geometric keeps the bitmap of the largest pack' '
+	git init bitmaps &&
+	(
+		cd bitmaps &&
+		for i in $(test_seq 10)
+		do
+			test_commit c$i || return 1
+		done &&
+		git repack -adb &&
+		bitmap=$(ls $packdir/*.bitmap) &&
+		test_commit after &&
+		git repack --geometric=2 -db &&
+		test_path_is_file $bitmap &&
+		test $(ls $packdir/*.pack | wc -l) = 2 &&
+		git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+		git rev-list --objects --all --use-bitmap-index |
+			cut -d" " -f1 | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--geometric writes a bitmap when rolling up everything' '
+	(
+		cd bitmaps &&
+		echo unreachable | git hash-object -w --stdin >unreachable &&
+		git repack --geometric=1000 -db &&
+		test $(ls $packdir/*.pack | wc -l) = 1 &&
+		test $(ls $packdir/*.bitmap | wc -l) = 1 &&
+		git cat-file -e $(cat unreachable) &&
+		git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+		git rev-list --objects --all --use-bitmap-index |
+			cut -d" " -f1 | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_done
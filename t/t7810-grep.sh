@@ -1505,4 +1505,20 @@ test_expect_success 'grep does not report i-t-a and assume unchanged with -L' '
 	test_cmp expected actual
 '
 
+test_expect_success 'threaded grep of trees and the index reads deltas' '
+	git repack -a -d -f --depth=50 --window=250 &&
+	for n in 1 2 8
+	do
+		git grep --threads=$n -n -e vvv -e mmap HEAD >actual.$n.tree &&
+		git grep --threads=$n -n -e vvv -e mmap --cached >actual.$n.cached ||
+		return 1
+	done &&
+	test_line_count -gt 0 actual.1.tree &&
+	test_cmp actual.1.tree actual.2.tree &&
+	test_cmp actual.1.tree actual.8.tree &&
+	sed -e "s/^HEAD://" actual.1.tree >expected &&
+	test_cmp expected actual.1.cached &&
+	test_cmp actual.1.cached actual.8.cached
+'
+
 test_done
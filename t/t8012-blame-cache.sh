@@ -0,0 +1,140 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+. ./test-lib.sh
+
+cache_files () {
+	find .git/blame-cache -type f ! -name "tmp_*" 2>/dev/null | wc -l
+}
+
+num_commits () {
+	sed -n "s/^num commits: //p"
+}
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >file &&
+	git add file &&
+	test_tick && git commit -m one &&
+
+	git checkout -b side &&
+	sed -e "s/^2$/two/" file >tmp && mv tmp file &&
+	test_tick && git commit -a -m side &&
+
+	git checkout master &&
+	sed -e "s/^8$/eight/" file >tmp && mv tmp file &&
+	test_tick && git commit -a -m master &&
+	test_tick && git merge -m merge side &&
+
+	git mv file renamed &&
+	test_tick && git commit -m rename &&
+	echo 10 >>renamed &&
+	test_tick && git commit -a -m ten &&
+	sed -e "s/^5$/five/" renamed >tmp && mv tmp renamed &&
+	test_tick && git commit -a -m five &&
+
+	for rev in HEAD~2 HEAD~1 HEAD
+	do
+		git blame --porcelain $rev -- renamed >expect.$(git rev-parse $rev) ||
+		return 1
+	done &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'blame stores its result in the cache' '
+	git -c blame.cache=true blame --porcelain HEAD~2 -- renamed >actual &&
+	test_cmp expect.$(git rev-parse HEAD~2) actual &&
+	test $(cache_files) = 1
+'
+
+test_expect_success 'blaming the same commit again digs no history' '
+	git -c blame.cache=true blame --porcelain --show-stats HEAD~2 -- renamed >out &&
+	test $(num_commits <out) = 0 &&
+	sed "/^num /d" out >actual &&
+	test_cmp expect.$(git rev-parse HEAD~2) actual
+'
+
+test_expect_success 'blaming a descendant reuses the result for its parent' '
+	git -c blame.cache=true blame --porcelain --show-stats HEAD~1 -- renamed >out &&
+	test $(num_commits <out) = 1 &&
+	sed "/^num /d" out >actual &&
+	test_cmp expect.$(git rev-parse HEAD~1) actual &&
+	git -c blame.cache=true blame --porcelain --show-stats HEAD -- renamed >out &&
+	test $(num_commits <out) = 1 &&
+	sed "/^num /d" out >actual &&
+	test_cmp expect.$(git rev-parse HEAD) actual &&
+	test $(cache_files) = 3
+'
+
+test_expect_success 'line ranges and other formats use the cache' '
+	git blame -L 3,7 HEAD -- renamed >expect &&
+	git -c blame.cache=true blame -L 3,7 HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	git blame -n -f -e HEAD~1 -- renamed >expect &&
+	git -c blame.cache=true blame -n -f -e HEAD~1 -- renamed >actual &&
+	test_cmp expect actual &&
+	git blame --incremental HEAD -- renamed >out &&
+	sort out >expect &&
+	git -c blame.cache=true blame --incremental HEAD -- renamed >out &&
+	sort out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blaming the working tree uses the result for HEAD' '
+	test_when_finished "git checkout renamed" &&
+	echo 11 >>renamed &&
+	git blame --porcelain renamed >expect &&
+	git -c blame.cache=true blame --porcelain --show-stats renamed >out &&
+	test $(num_commits <out) = 1 &&
+	sed "/^num /d" out >actual &&
+	test_cmp expect actual &&
+	test $(cache_files) = 3
+'
+
+test_expect_success 'the cache is not used with -M or a range of commits' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame -M HEAD -- renamed >/dev/null &&
+	git -c blame.cache=true blame HEAD~2.. -- renamed >/dev/null &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'options affecting the result are part of the key' '
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	git blame -w --first-parent HEAD -- renamed >expect &&
+	git -c blame.cache=true blame -w --first-parent HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	test $(cache_files) = 2
+'
+
+test_expect_success 'a damaged cache file is ignored' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	f=$(find .git/blame-cache -type f) &&
+	chmod +w "$f" &&
+	test-genrandom garbage $(wc -c <"$f") >"$f" &&
+	git -c blame.cache=true blame --porcelain --show-stats HEAD -- renamed >out &&
+	test $(num_commits <out) -gt 0 &&
+	sed "/^num /d" out >actual &&
+	test_cmp expect.$(git rev-parse HEAD) actual
+'
+
+test_expect_success 'least recently used files are removed over blame.cacheLimit' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame HEAD~2 -- renamed >/dev/null &&
+	old=$(find .git/blame-cache -type f) &&
+	git -c blame.cache=true blame HEAD~1 -- renamed >/dev/null &&
+	parent=$(find .git/blame-cache -type f ! -path "$old") &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	tip=$(find .git/blame-cache -type f ! -path "$old" ! -path "$parent") &&
+	limit=$(cat "$parent" "$tip" | wc -c) &&
+	rm "$tip" &&
+	test-chmtime =-120 "$parent" &&
+	test-chmtime =-60 "$old" &&
+	git -c blame.cache=true -c blame.cacheLimit=$limit \
+		blame --porcelain HEAD -- renamed >actual &&
+	test_cmp expect.$(git rev-parse HEAD) actual &&
+	test_path_is_missing "$old" &&
+	test_path_is_file "$parent" &&
+	test_path_is_file "$tip"
+'
+
+test_done
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+test_description='git blame finding moved and copied lines with threads'
+. ./test-lib.sh
+
+test_expect_success setup '
+	for f in one two three four
+	do
+		for i in $(test_seq 1 40)
+		do
+			echo "$f line $i with some alphanumeric content" || return 1
+		done >$f || return 1
+	done &&
+	git add one two three four &&
+	test_tick &&
+	git commit -m initial &&
+
+	sed -n -e "10,19p" two >>one &&
+	sed -n -e "30,35p" three >>one &&
+	sed -e "20,29d" four >tmp && mv tmp four &&
+	sed -n -e "20,29p" four >>one &&
+	test_tick &&
+	git commit -a -m copies &&
+
+	cat four >five &&
+	sed -n -e "1,8p" one >>five &&
+	echo "new line in five" >>five &&
+	git add five &&
+	test_tick &&
+	git commit -m "new file"
+'
+
+for opts in -M -C "-C -C" "-C -C -C" "-C -C -C -w"
+do
+	test_expect_success "threads give the same result with $opts" '
+		for f in one five
+		do
+			git blame --threads=1 --porcelain $opts -- $f >expect &&
+			git blame --threads=4 --porcelain $opts -- $f >actual &&
+			test_cmp expect actual || return 1
+		done
+	'
+done
+
+test_expect_success 'lines are blamed across files' '
+	git blame --threads=4 -C -C -C -f five >actual &&
+	grep "^^*[0-9a-f]* one " actual &&
+	grep "^^*[0-9a-f]* four " actual
+'
+
+test_expect_success 'blame.threads is honored' '
+	git blame --threads=1 -C five >expect &&
+	git -c blame.threads=3 blame -C five >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -c blame.threads=-1 blame five
+'
+
+test_done
@@ -0,0 +1,102 @@
+#!/bin/sh
+
+test_description='git fast-import --threads'
+. ./test-lib.sh
+
+import () {
+	dir=$1 &&
+	shift &&
+	rm -rf "$dir" &&
+	git init -q "$dir" &&
+	git -C "$dir" fast-import --quiet "$@" <stream
+}
+
+test_expect_success 'setup' '
+	test_seq 1 2000 >file &&
+	for i in $(test_seq 1 30)
+	do
+		sed -e "$((i * 13))s/.*/change $i/" file >tmp &&
+		mv tmp file &&
+		cp file "copy$((i % 3))" &&
+		echo $i >>"copy$((i % 3))" &&
+		git add file copy* &&
+		test_tick &&
+		git commit -q -m "commit $i" &&
+		if test $((i % 10)) = 0
+		then
+			git tag -a -m "tag $i" "tag$i"
+		fi ||
+		return 1
+	done &&
+	git fast-export --all >stream
+'
+
+test_expect_success 'threaded import writes the same pack and marks' '
+	import serial --threads=1 --export-marks=../marks.serial &&
+	import threaded --threads=4 --export-marks=../marks.threaded &&
+	test_cmp marks.serial marks.threaded &&
+	test_cmp serial/.git/objects/pack/*.pack threaded/.git/objects/pack/*.pack &&
+	git -C threaded fsck --strict &&
+	git for-each-ref >expect &&
+	git -C threaded for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'delta chains are cut the same way' '
+	import serial --threads=1 --depth=2 &&
+	import threaded --threads=4 --depth=2 &&
+	test_cmp serial/.git/objects/pack/*.pack threaded/.git/objects/pack/*.pack
+'
+
+test_expect_success 'fastimport.threads is used' '
+	import serial &&
+	rm -rf threaded &&
+	git init -q threaded &&
+	git -C threaded -c fastimport.threads=3 fast-import --quiet <stream &&
+	test_cmp serial/.git/objects/pack/*.pack threaded/.git/objects/pack/*.pack &&
+	test_must_fail git -c fastimport.threads=-1 fast-import </dev/null
+'
+
+test_expect_success 'queued objects can be read back' '
+	test_tick &&
+	cat >input <<-INPUT_END &&
+	blob
+	mark :1
+	data 6
+	hello
+
+	commit refs/heads/read-back
+	mark :2
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+	data 4
+	one
+	M 100644 :1 hello
+
+	cat-blob :1
+	ls :2 hello
+	checkpoint
+	commit refs/heads/read-back
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+	data 4
+	two
+	from :2
+	M 100644 :1 again
+
+	INPUT_END
+	git fast-import --threads=4 <input >out &&
+	blob=$(echo hello | git hash-object --stdin) &&
+	printf "%s blob 6\nhello\n\n100644 blob %s\thello\n" $blob $blob >expect &&
+	test_cmp expect out &&
+	git fsck &&
+	git cat-file blob read-back:again >actual &&
+	echo hello >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'packs limited in size are written by one thread' '
+	import serial --threads=1 --max-pack-size=1m &&
+	import threaded --threads=4 --max-pack-size=1m &&
+	test_cmp serial/.git/objects/pack/*.pack threaded/.git/objects/pack/*.pack
+'
+
+test_done
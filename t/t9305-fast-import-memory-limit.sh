@@ -0,0 +1,129 @@
+#!/bin/sh
+
+test_description='git fast-import --memory-limit'
+. ./test-lib.sh
+
+import () {
+	dir=$1 &&
+	shift &&
+	rm -rf "$dir" &&
+	git init -q "$dir" &&
+	git -C "$dir" fast-import "$@" <stream 2>"$dir.stats"
+}
+
+spills () {
+	sed -n "s/^ *spills: *//p" "$1.stats"
+}
+
+test_expect_success 'setup' '
+	"$PERL_PATH" -e "
+		my \$c = 0;
+		for my \$i (1..6000) {
+			my \$d = \"blob \$i\n\";
+			print \"blob\nmark :\$i\ndata \", length(\$d), \"\n\$d\n\";
+			next if \$i % 200;
+			\$c++;
+			print \"commit refs/heads/master\nmark :\", 100000 + \$c, \"\n\";
+			print \"committer C O Mitter <c\@example.com> \", 1112912053 + \$c, \" -0700\n\";
+			print \"data <<EOM\ncommit \$c\nEOM\n\";
+			print \"from :\", 100000 + \$c - 1, \"\n\" if \$c > 1;
+			print \"M 100644 :\$i new\nM 100644 :1 first\nM 100644 :\", \$i - 100, \" old\n\n\";
+		}
+		print \"blob\nmark :1\ndata 6\nagain\n\n\";
+		print \"commit refs/heads/master\n\";
+		print \"committer C O Mitter <c\@example.com> 1112999999 -0700\n\";
+		print \"data <<EOM\nlast\nEOM\nfrom :\", 100000 + \$c, \"\n\";
+		print \"M 100644 :1 again\n\n\";
+	" >stream &&
+	cp stream generated &&
+	import unlimited --export-marks=../marks.unlimited
+'
+
+test_expect_success 'import within a memory limit' '
+	import limited --memory-limit=100k --export-marks=../marks.limited &&
+	test $(spills limited) -gt 1 &&
+	test_cmp marks.unlimited marks.limited &&
+	git -C unlimited rev-parse master >expect &&
+	git -C limited rev-parse master >actual &&
+	test_cmp expect actual &&
+	git -C limited fsck &&
+	echo again >expect &&
+	git -C limited cat-file blob master:again >actual &&
+	test_cmp expect actual &&
+	find limited/.git/objects/pack -name "tmp_spill_*" >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'spilled marks and objects can be used later' '
+	cat >stream <<-EOF &&
+	blob
+	mark :200000
+	data 4
+	abc
+
+	commit refs/heads/master
+	committer C O Mitter <c@example.com> 1113000000 -0700
+	data <<EOM
+	more
+	EOM
+	from refs/heads/master^0
+	M 100644 :7 seven
+	M 100644 :200000 abc
+
+	cat-blob :5999
+	EOF
+	git -C limited fast-import --memory-limit=100k \
+		--import-marks=../marks.limited --export-marks=../marks.more \
+		<stream >actual &&
+	grep "^blob 5999$" actual &&
+	echo "blob 7" >expect &&
+	git -C limited cat-file blob master:seven >actual &&
+	test_cmp expect actual &&
+	test $(wc -l <marks.more) = $(($(wc -l <marks.limited) + 1))
+'
+
+test_expect_success 'objects still queued for writing are spilled too' '
+	for f in 1 2 3 4
+	do
+		test-genrandom "big $f" 65536 >big$f || return 1
+	done &&
+	"$PERL_PATH" -e "
+		for my \$c (1..20) {
+			for my \$f (1..4) {
+				open(my \$fh, \"<\", \"big\$f\") or die;
+				binmode \$fh;
+				local \$/;
+				my \$d = <\$fh>;
+				substr(\$d, 0, 8) = sprintf(\"%08d\", \$c);
+				print \"blob\nmark :\$c\$f\ndata \", length(\$d), \"\n\$d\n\";
+			}
+			print \"commit refs/heads/master\n\";
+			print \"committer C O Mitter <c\@example.com> \", 1112912053 + \$c, \" -0700\n\";
+			print \"data <<EOM\ncommit \$c\nEOM\n\";
+			print \"M 100644 :\$c\$_ f\$_\n\" for 1..4;
+			print \"\n\";
+		}
+	" >stream &&
+	import serial --threads=1 &&
+	import threaded --threads=8 --memory-limit=1 &&
+	test $(spills threaded) -gt 1 &&
+	git -C serial rev-parse master >expect &&
+	git -C threaded rev-parse master >actual &&
+	test_cmp expect actual &&
+	git -C threaded fsck &&
+	find threaded/.git/objects/pack -name "tmp_*" >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'fastimport.memoryLimit is used' '
+	rm -rf config &&
+	git init -q config &&
+	git -C config -c fastimport.memoryLimit=100k fast-import \
+		<generated 2>config.stats &&
+	test $(spills config) -gt 0 &&
+	git -C unlimited rev-parse master >expect &&
+	git -C config rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -12,6 +12,7 @@
 #include "dir.h"
 #include "submodule.h"
 #include "submodule-config.h"
+#include "parallel-checkout.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -348,7 +349,7 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	state.force = 1;
 	state.quiet = 1;
@@ -357,6 +358,10 @@ static int check_updates(struct unpack_trees_options *o)
 
 	progress = get_progress(o);
 
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	if (!o->update || o->dry_run)
+		pc_workers = 1;
+
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKOUT, index);
 	for (i = 0; i < index->cache_nr; i++) {
@@ -374,20 +379,29 @@ static int check_updates(struct unpack_trees_options *o)
 	if (should_update_submodules() && o->update && !o->dry_run)
 		reload_gitmodules_file(index, &state);
 
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
 		if (ce->ce_flags & CE_UPDATE) {
+			size_t queued = parallel_checkout_queue_size();
+
 			if (ce->ce_flags & CE_WT_REMOVE)
 				die("BUG: both update and delete flags are set on %s",
 				    ce->name);
-			display_progress(progress, ++cnt);
 			ce->ce_flags &= ~CE_UPDATE;
 			if (o->update && !o->dry_run) {
 				errs |= checkout_entry(ce, &state, NULL);
 			}
+			/* queued entries are counted once they are written */
+			if (parallel_checkout_queue_size() == queued)
+				display_progress(progress, ++cnt);
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold,
+					      progress, &cnt);
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
@@ -1067,15 +1081,19 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 {
 	struct cache_entry **cache_end;
 	int dtype = DT_DIR;
-	int ret = is_excluded_from_list(prefix->buf, prefix->len,
-					basename, &dtype, el);
+	enum pattern_match_result orig_ret, ret;
 	int rc;
 
+	orig_ret = is_excluded_from_list(prefix->buf, prefix->len,
+					 basename, &dtype, el);
+
 	strbuf_addch(prefix, '/');
 
 	/* If undecided, use matching result of parent dir in defval */
-	if (ret < 0)
+	if (orig_ret == UNDECIDED)
 		ret = defval;
+	else
+		ret = orig_ret;
 
 	for (cache_end = cache; cache_end != cache + nr; cache_end++) {
 		struct cache_entry *ce = *cache_end;
@@ -1083,17 +1101,34 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 			break;
 	}
 
-	/*
-	 * TODO: check el, if there are no patterns that may conflict
-	 * with ret (iow, we know in advance the incl/excl
-	 * decision for the entire directory), clear flag here without
-	 * calling clear_ce_flags_1(). That function will call
-	 * the expensive is_excluded_from_list() on every entry.
-	 */
-	rc = clear_ce_flags_1(cache, cache_end - cache,
-			      prefix,
-			      select_mask, clear_mask,
-			      el, ret);
+	if (el->use_cone_patterns && orig_ret == MATCHED_RECURSIVE) {
+		/*
+		 * Cone patterns tell us that the whole directory is
+		 * included; clear the flag without looking at each
+		 * entry...
+		 */
+		struct cache_entry **ce;
+
+		for (ce = cache; ce != cache_end; ce++)
+			if (!select_mask || ((*ce)->ce_flags & select_mask))
+				(*ce)->ce_flags &= ~clear_mask;
+		rc = cache_end - cache;
+	} else if (el->use_cone_patterns && orig_ret == NOT_MATCHED) {
+		/* ... or that nothing in it is */
+		rc = cache_end - cache;
+	} else {
+		/*
+		 * TODO: check el, if there are no patterns that may conflict
+		 * with ret (iow, we know in advance the incl/excl
+		 * decision for the entire directory), clear flag here without
+		 * calling clear_ce_flags_1(). That function will call
+		 * the expensive is_excluded_from_list() on every entry.
+		 */
+		rc = clear_ce_flags_1(cache, cache_end - cache,
+				      prefix,
+				      select_mask, clear_mask,
+				      el, ret);
+	}
 	strbuf_setlen(prefix, prefix->len - 1);
 	return rc;
 }
@@ -1172,9 +1207,9 @@ static int clear_ce_flags_1(struct cache_entry **cache, int nr,
 		dtype = ce_to_dtype(ce);
 		ret = is_excluded_from_list(ce->name, ce_namelen(ce),
 					    name, &dtype, el);
-		if (ret < 0)
+		if (ret == UNDECIDED)
 			ret = defval;
-		if (ret > 0)
+		if (ret != NOT_MATCHED)
 			ce->ce_flags &= ~clear_mask;
 		cache++;
 	}
@@ -1251,6 +1286,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		o->skip_sparse_checkout = 1;
 	if (!o->skip_sparse_checkout) {
 		char *sparse = git_pathdup("info/sparse-checkout");
+		el.use_cone_patterns = core_sparse_checkout_cone;
 		if (add_excludes_from_file_to_list(sparse, "", 0, &el, 0) < 0)
 			o->skip_sparse_checkout = 1;
 		else
@@ -1264,6 +1300,8 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
 	o->result.version = o->src_index->version;
 	o->result.split_index = o->src_index->split_index;
+	o->result.fsmonitor_last_update = o->src_index->fsmonitor_last_update;
+	o->result.fsmonitor_has_run_once = o->src_index->fsmonitor_has_run_once;
 	if (o->result.split_index)
 		o->result.split_index->refcount++;
 	hashcpy(o->result.sha1, o->src_index->sha1);
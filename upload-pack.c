@@ -17,6 +17,9 @@
 #include "parse-options.h"
 #include "argv-array.h"
 #include "prio-queue.h"
+#include "sha1-array.h"
+#include "tempfile.h"
+#include "dir.h"
 
 static const char * const upload_pack_usage[] = {
 	N_("git upload-pack [<options>] <dir>"),
@@ -62,6 +65,7 @@ static int use_sideband;
 static int advertise_refs;
 static int stateless_rpc;
 static const char *pack_objects_hook;
+static unsigned long pack_cache_limit;
 
 static void reset_timeout(void)
 {
@@ -93,6 +97,194 @@ static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 	return 0;
 }
 
+/*
+ * The pack cache keeps the packs we sent, keyed by what the client
+ * asked for, so that identical requests (e.g. many clones of the same
+ * tips) are answered by replaying the pack instead of running
+ * pack-objects again.  The key covers the wants, the haves, the
+ * capabilities that change the pack, and all our refs, so that any
+ * ref update starts afresh.  Packs that have not been used recently
+ * are removed when the cache grows over uploadpack.packCacheLimit.
+ */
+static struct tempfile pack_cache_tempfile;
+static struct strbuf pack_cache_file = STRBUF_INIT;
+static off_t pack_cache_written;
+
+static int hash_pack_cache_oid(const struct object_id *oid, void *data)
+{
+	git_SHA1_Update(data, oid->hash, GIT_SHA1_RAWSZ);
+	return 0;
+}
+
+static int hash_pack_cache_ref(const char *refname,
+			       const struct object_id *oid,
+			       int flags, void *data)
+{
+	git_SHA1_Update(data, refname, strlen(refname) + 1);
+	git_SHA1_Update(data, oid->hash, GIT_SHA1_RAWSZ);
+	return 0;
+}
+
+static void pack_cache_key(unsigned char *sha1)
+{
+	struct oid_array wants = OID_ARRAY_INIT;
+	struct oid_array haves = OID_ARRAY_INIT;
+	struct strbuf caps = STRBUF_INIT;
+	git_SHA_CTX ctx;
+	int i;
+
+	for (i = 0; i < want_obj.nr; i++)
+		oid_array_append(&wants, &want_obj.objects[i].item->oid);
+	for (i = 0; i < have_obj.nr; i++)
+		oid_array_append(&haves, &have_obj.objects[i].item->oid);
+	strbuf_addf(&caps, "pack-cache 1 thin=%d ofs-delta=%d include-tag=%d",
+		    use_thin_pack, use_ofs_delta, use_include_tag);
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, caps.buf, caps.len + 1);
+	oid_array_for_each_unique(&wants, hash_pack_cache_oid, &ctx);
+	git_SHA1_Update(&ctx, "--not", 6);
+	oid_array_for_each_unique(&haves, hash_pack_cache_oid, &ctx);
+	git_SHA1_Update(&ctx, "refs", 5);
+	head_ref(hash_pack_cache_ref, &ctx);
+	for_each_ref(hash_pack_cache_ref, &ctx);
+	git_SHA1_Final(sha1, &ctx);
+
+	oid_array_clear(&wants);
+	oid_array_clear(&haves);
+	strbuf_release(&caps);
+}
+
+/*
+ * Send the cached pack for this request, if there is one.  Otherwise
+ * prepare to store the pack we are about to create, if we may.
+ */
+static int send_cached_pack(void)
+{
+	unsigned char key[20];
+	char data[8192];
+	ssize_t sz;
+	int fd;
+
+	if (!pack_cache_limit || shallow_nr || is_repository_shallow())
+		return 0;
+
+	pack_cache_key(key);
+	strbuf_reset(&pack_cache_file);
+	strbuf_git_common_path(&pack_cache_file, "upload-pack-cache/%s.pack",
+			       sha1_to_hex(key));
+
+	fd = open(pack_cache_file.buf, O_RDONLY);
+	if (fd < 0) {
+		struct strbuf tmp = STRBUF_INIT;
+
+		if (safe_create_leading_directories(pack_cache_file.buf) < 0)
+			return 0;
+		/* if we cannot write to the cache, just go without */
+		strbuf_git_common_path(&tmp, "upload-pack-cache/tmp_XXXXXX");
+		mks_tempfile_m(&pack_cache_tempfile, tmp.buf, 0444);
+		pack_cache_written = 0;
+		strbuf_release(&tmp);
+		return 0;
+	}
+
+	/* mark it as recently used */
+	utime(pack_cache_file.buf, NULL);
+
+	while ((sz = xread(fd, data, sizeof(data))) > 0)
+		send_client_data(1, data, sz);
+	if (sz < 0)
+		die_errno("unable to read '%s'", pack_cache_file.buf);
+	close(fd);
+
+	if (use_sideband)
+		packet_flush(1);
+	return 1;
+}
+
+static void write_pack_cache(const char *data, ssize_t sz)
+{
+	if (!is_tempfile_active(&pack_cache_tempfile))
+		return;
+
+	pack_cache_written += sz;
+	if (pack_cache_written > pack_cache_limit ||
+	    write_in_full(get_tempfile_fd(&pack_cache_tempfile), data, sz) < 0)
+		delete_tempfile(&pack_cache_tempfile);
+}
+
+struct pack_cache_entry {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int pack_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_cache_entry *a = va, *b = vb;
+
+	if (a->mtime < b->mtime)
+		return -1;
+	return a->mtime > b->mtime;
+}
+
+/* Remove the least recently used packs until the cache fits. */
+static void prune_pack_cache(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct pack_cache_entry *entries = NULL;
+	int nr = 0, alloc = 0, i;
+	off_t total = 0;
+	size_t baselen;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_git_common_path(&path, "upload-pack-cache/");
+	baselen = path.len;
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (stat(path.buf, &st) < 0)
+			continue;
+
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = xstrdup(path.buf);
+		entries[nr].mtime = st.st_mtime;
+		entries[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entries, nr, pack_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_cache_limit && !unlink(entries[i].path))
+			total -= entries[i].size;
+		free(entries[i].path);
+	}
+	free(entries);
+	strbuf_release(&path);
+}
+
+static void finish_pack_cache(void)
+{
+	if (!is_tempfile_active(&pack_cache_tempfile))
+		return;
+
+	if (!rename_tempfile(&pack_cache_tempfile, pack_cache_file.buf))
+		prune_pack_cache();
+}
+
 static void create_pack_file(void)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
@@ -104,6 +296,9 @@ static void create_pack_file(void)
 	int i;
 	FILE *pipe_fd;
 
+	if (send_cached_pack())
+		return;
+
 	if (!pack_objects_hook)
 		pack_objects.git_cmd = 1;
 	else {
@@ -233,7 +428,7 @@ static void create_pack_file(void)
 			sz = xread(pack_objects.out, cp,
 				  sizeof(data) - outsz);
 			if (0 < sz)
-				;
+				write_pack_cache(cp, sz);
 			else if (sz == 0) {
 				close(pack_objects.out);
 				pack_objects.out = -1;
@@ -279,6 +474,7 @@ static void create_pack_file(void)
 	}
 	if (use_sideband)
 		packet_flush(1);
+	finish_pack_cache();
 	return;
 
  fail:
@@ -1020,6 +1216,8 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 			allow_unadvertised_object_request |= ALLOW_ANY_SHA1;
 		else
 			allow_unadvertised_object_request &= ~ALLOW_ANY_SHA1;
+	} else if (!strcmp("uploadpack.packcachelimit", var)) {
+		pack_cache_limit = git_config_ulong(var, value);
 	} else if (!strcmp("uploadpack.keepalive", var)) {
 		keepalive = git_config_int(var, value);
 		if (!keepalive)